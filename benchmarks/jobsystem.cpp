@@ -0,0 +1,131 @@
+/*
+    Microbenchmarks for the svklib job system: spawn overhead, dependency chains
+    and parallel-for scaling over worker counts.
+
+    Usage: bench_jobsystem [max workers, default hardware threads up to 64]
+*/
+
+#include "jobsystem.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Best of `repeats` runs, in seconds
+static double measure(uint32_t repeats, const std::function<void()> &function) {
+    double best = 1e30;
+
+    for(uint32_t i = 0; i < repeats; i++) {
+        auto start = Clock::now();
+        function();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    return best;
+}
+
+// Enough floating point work per item that scaling is not bound by memory bandwidth
+static double work(uint32_t item) {
+    double value = item;
+    for(uint32_t i = 0; i < 256; i++) {
+        value = std::sqrt(value * 1.0001 + i);
+    }
+    return value;
+}
+
+static void benchmarkSpawn(JobSystem &jobs) {
+    constexpr uint32_t JOBS = 100'000;
+
+    double empty = measure(5, [&]() {
+        JobCounter counter;
+        for(uint32_t i = 0; i < JOBS; i++) {
+            jobs.run([]() {}, &counter);
+        }
+        jobs.wait(counter);
+    });
+
+    LOG_INFO("spawn/empty      {:>10.1f} ns per job ({} jobs)", empty * 1e9 / JOBS, JOBS);
+
+    // Every job starts the next one, measures continuation latency without parallelism
+    constexpr uint32_t CHAIN = 10'000;
+
+    double chain = measure(5, [&]() {
+        std::vector<JobCounter> counters(CHAIN);
+
+        jobs.run([]() {}, &counters[0]);
+        for(uint32_t i = 1; i < CHAIN; i++) {
+            jobs.runAfter(counters[i - 1], []() {}, &counters[i]);
+        }
+
+        for(auto &counter : counters) {
+            jobs.wait(counter);
+        }
+    });
+
+    LOG_INFO("spawn/chain      {:>10.1f} ns per dependency ({} jobs)", chain * 1e9 / CHAIN, CHAIN);
+}
+
+static void benchmarkParallelFor(uint32_t max_workers) {
+    constexpr uint32_t ITEMS = 1 << 18;
+    constexpr uint32_t BATCH = 1024;
+
+    std::vector<double> results(ITEMS);
+
+    double baseline = measure(3, [&]() {
+        for(uint32_t i = 0; i < ITEMS; i++) {
+            results[i] = work(i);
+        }
+    });
+
+    LOG_INFO("parallel_for/serial         {:>8.2f} ms", baseline * 1e3);
+
+    for(uint32_t workers = 1; workers <= max_workers; workers *= 2) {
+        JobSystem jobs(workers);
+
+        double time = measure(3, [&]() {
+            jobs.parallelFor(ITEMS, BATCH, [&](uint32_t begin, uint32_t end) {
+                for(uint32_t i = begin; i < end; i++) {
+                    results[i] = work(i);
+                }
+            });
+        });
+
+        auto stats = jobs.stats();
+
+        // The calling thread helps, so n workers run on n + 1 threads
+        LOG_INFO("parallel_for/{:<2} workers    {:>8.2f} ms  speedup {:>5.2f}x  efficiency {:>5.1f}%  stolen {:.1f}%",
+            workers,
+            time * 1e3,
+            baseline / time,
+            baseline / time / (workers + 1) * 100.0,
+            stats.executed > 0 ? 100.0 * stats.stolen / stats.executed : 0.0
+        );
+    }
+}
+
+int main(int argc, char **argv) {
+    logging::set_environmental_log_level(LOGLEVEL_INFO);
+
+    uint32_t max_workers = argc > 1 ?
+        static_cast<uint32_t>(std::atoi(argv[1])) :
+        std::clamp(std::thread::hardware_concurrency(), 1u, 64u);
+
+    {
+        JobSystem jobs;
+        LOG_INFO("Job system benchmarks, {} hardware threads", std::thread::hardware_concurrency());
+        benchmarkSpawn(jobs);
+    }
+
+    benchmarkParallelFor(std::max(max_workers, 1u));
+
+    logging::flush();
+}
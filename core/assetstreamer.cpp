@@ -0,0 +1,776 @@
+#include "assetstreamer.hpp"
+#include "barriers.hpp"
+#include "deletionqueue.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <filesystem>
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <vulkan/vulkan.hpp>
+
+// Reads in flight on the I/O thread
+static constexpr uint32_t IO_URING_ENTRIES = 64;
+// Largest single read, bigger files are read in several pieces
+static constexpr vk::DeviceSize MAX_READ_SIZE = 1 << 30;
+
+// Eviction priority of a Ready asset's memory, lower is evicted first
+static float residencyPriority(AssetPriority priority) {
+    switch(priority) {
+    case AssetPriority::High: return 0.75f;
+    case AssetPriority::Normal: return 0.5f;
+    case AssetPriority::Low: return 0.25f;
+    }
+
+    return 0.5f;
+}
+
+// Minimal io_uring submission and completion rings, just enough for reads.
+// Talks to the kernel directly so there is no liburing dependency.
+class IoUring {
+public:
+#ifdef __linux__
+    // nullptr when the kernel refuses io_uring, e.g. too old or filtered by seccomp
+    static std::unique_ptr<IoUring> create(uint32_t entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if(fd < 0) {
+            LOG_DEBUG("io_uring unavailable: {}.", std::strerror(errno));
+            return nullptr;
+        }
+
+        auto ring = std::unique_ptr<IoUring>(new IoUring());
+        ring->fd = fd;
+        ring->entries = params.sq_entries;
+
+        ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap) {
+            ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+        }
+
+        ring->sq_ptr = mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if(ring->sq_ptr == MAP_FAILED) {
+            ring->sq_ptr = nullptr;
+            return nullptr;
+        }
+
+        if(single_mmap) {
+            ring->cq_ptr = ring->sq_ptr;
+        } else {
+            ring->cq_ptr = mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if(ring->cq_ptr == MAP_FAILED) {
+                ring->cq_ptr = nullptr;
+                return nullptr;
+            }
+        }
+
+        ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(sqes == MAP_FAILED) {
+            return nullptr;
+        }
+        ring->sqes = static_cast<io_uring_sqe*>(sqes);
+
+        auto sq = static_cast<uint8_t*>(ring->sq_ptr);
+        ring->sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+        ring->sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        ring->sq_mask = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        ring->sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<uint8_t*>(ring->cq_ptr);
+        ring->cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        ring->cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        ring->cq_mask = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return ring;
+    }
+
+    ~IoUring() {
+        if(sqes) munmap(sqes, sqes_size);
+        if(cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        if(sq_ptr) munmap(sq_ptr, sq_size);
+        if(fd >= 0) close(fd);
+    }
+
+    // Queues a read, submitted with the next wait(). False when the ring is full.
+    bool read(int file, void *buffer, uint32_t size, uint64_t offset, uint64_t user_data) {
+        uint32_t tail = *sq_tail;
+        if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries) {
+            return false;
+        }
+
+        uint32_t index = tail & *sq_mask;
+
+        io_uring_sqe &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = file;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = size;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        unsubmitted++;
+        return true;
+    }
+
+    // Submits queued reads, blocks for at least one completion and hands every
+    // available completion to `complete` with the read's result or -errno
+    template<typename Complete>
+    void wait(Complete &&complete) {
+        while(syscall(__NR_io_uring_enter, fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+            if(errno != EINTR) {
+                THROW(runtime_error, "io_uring_enter failed: {}.", std::strerror(errno));
+            }
+        }
+        unsubmitted = 0;
+
+        uint32_t head = *cq_head;
+        while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe &cqe = cqes[head & *cq_mask];
+            uint64_t user_data = cqe.user_data;
+            int32_t result = cqe.res;
+
+            head++;
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+            complete(user_data, result);
+        }
+    }
+#else
+    static std::unique_ptr<IoUring> create(uint32_t) {
+        return nullptr;
+    }
+
+    bool read(int, void*, uint32_t, uint64_t, uint64_t) {
+        return false;
+    }
+
+    template<typename Complete>
+    void wait(Complete&&) {}
+#endif
+
+    uint32_t entries = 0;
+
+private:
+    IoUring() = default;
+
+#ifdef __linux__
+    int fd = -1;
+    uint32_t unsubmitted = 0;
+
+    void *sq_ptr = nullptr;
+    void *cq_ptr = nullptr;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    io_uring_cqe *cqes;
+#endif
+};
+
+// Blocking read of `size` bytes at `offset`, returns the bytes read or -1 with errno set
+#ifdef _WIN32
+static int64_t readAt(int, const std::string &path, uint8_t *data, size_t size, uint64_t offset) {
+    // No pread, so the file is opened per read. Reads are up to MAX_READ_SIZE,
+    // nearly every file takes a single one.
+    std::ifstream file(path, std::ios::binary);
+
+    if(!file.seekg(static_cast<std::streamoff>(offset))) {
+        errno = EIO;
+        return -1;
+    }
+
+    file.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+    if(file.bad()) {
+        errno = EIO;
+        return -1;
+    }
+
+    return static_cast<int64_t>(file.gcount());
+}
+#else
+static int64_t readAt(int fd, const std::string&, uint8_t *data, size_t size, uint64_t offset) {
+    return static_cast<int64_t>(pread(fd, data, size, static_cast<off_t>(offset)));
+}
+#endif
+
+AssetStreamer::AssetStreamer(Device &device, vk::DeviceSize staging_capacity, vk::DispatchLoaderDynamic &dispatcher)
+    : device(device), staging_capacity(staging_capacity), v_dispatcher(dispatcher)
+{
+    for(uint32_t i = 0; i < device.frames_in_flight + 1; i++) {
+        auto bufferInfo = vk::BufferCreateInfo()
+            .setSize(staging_capacity)
+            .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+            .setSharingMode(vk::SharingMode::eExclusive);
+
+        Buffer buffer(
+            device,
+            bufferInfo,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            dispatcher
+        );
+        // Mapped once for the lifetime of the streamer
+        MemoryMap mapping = buffer.mapMemory();
+
+        staging.push_back(StagingSlot {
+            .buffer = std::move(buffer),
+            .mapping = std::move(mapping),
+        });
+    }
+
+    io_uring = IoUring::create(IO_URING_ENTRIES);
+
+    if(io_uring) {
+        io_thread = std::thread([this]() {
+            ioLoop();
+        });
+    }
+
+    LOG_DEBUG("Created asset streamer with {} x {} bytes of staging, reading with {}.",
+        staging.size(), staging_capacity, io_uring ? "io_uring" : "pread on job workers"
+    );
+}
+
+AssetStreamer::~AssetStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+
+        for(auto &queue : read_queues) {
+            queue.clear();
+        }
+    }
+    io_wake.notify_all();
+
+    if(io_thread.joinable()) {
+        io_thread.join();
+    }
+
+    device.jobs->wait(job_counter);
+
+    for(auto &[handle, asset] : assets) {
+        dropBuffer(*asset);
+    }
+}
+
+std::shared_ptr<AssetStreamer::Asset> AssetStreamer::popHighest(AssetQueue (&queues)[3]) {
+    for(auto &queue : queues) {
+        if(!queue.empty()) {
+            auto asset = std::move(queue.front());
+            queue.pop_front();
+            return asset;
+        }
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<AssetStreamer::Asset> AssetStreamer::find(AssetHandle handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto asset = assets.find(handle);
+    if(asset == assets.end()) {
+        return nullptr;
+    }
+
+    return asset->second;
+}
+
+bool AssetStreamer::advance(Asset &asset, AssetState from, AssetState to) {
+    return asset.state.compare_exchange_strong(from, to, std::memory_order_acq_rel);
+}
+
+AssetHandle AssetStreamer::request(AssetRequest request) {
+    auto asset = std::make_shared<Asset>();
+    asset->request = std::move(request);
+
+    AssetHandle handle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        handle = next_handle++;
+        asset->handle = handle;
+
+        assets[handle] = asset;
+        read_queues[static_cast<size_t>(asset->request.priority)].push_back(asset);
+
+        streamer_stats.requested++;
+    }
+
+    if(io_uring) {
+        io_wake.notify_one();
+    } else {
+        // Any job takes the highest priority request, not necessarily this one
+        device.jobs->run([this]() {
+            readNextBlocking();
+        }, &job_counter);
+    }
+
+    return handle;
+}
+
+void AssetStreamer::cancel(AssetHandle handle) {
+    auto asset = find(handle);
+    if(!asset) return;
+
+    AssetState current = asset->state.load(std::memory_order_acquire);
+    while(current != AssetState::Ready && current != AssetState::Failed &&
+        current != AssetState::Cancelled && current != AssetState::Evicted) {
+        if(asset->state.compare_exchange_weak(current, AssetState::Cancelled, std::memory_order_acq_rel)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            streamer_stats.cancelled++;
+            break;
+        }
+    }
+
+    if(asset->state.load(std::memory_order_acquire) == AssetState::Cancelled) {
+        dropBuffer(*asset);
+    }
+}
+
+void AssetStreamer::release(AssetHandle handle) {
+    auto asset = find(handle);
+    if(!asset) return;
+
+    cancel(handle);
+    dropBuffer(*asset);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    assets.erase(handle);
+}
+
+AssetState AssetStreamer::state(AssetHandle handle) {
+    auto asset = find(handle);
+    if(!asset) {
+        THROW(runtime_error, "Unknown asset handle {}.", handle);
+    }
+
+    return asset->state.load(std::memory_order_acquire);
+}
+
+Buffer *AssetStreamer::get(AssetHandle handle) {
+    auto asset = find(handle);
+
+    if(!asset || asset->state.load(std::memory_order_acquire) != AssetState::Ready) {
+        return nullptr;
+    }
+
+    // The map keeps the asset alive until release()
+    return &asset->buffer;
+}
+
+void AssetStreamer::dropBuffer(Asset &asset) {
+    if(asset.residency != 0) {
+        device.memory->unregisterEvictable(asset.residency);
+        asset.residency = 0;
+    }
+
+    if(!asset.buffer.v_buffer) return;
+
+    device.resource_states->forgetBuffer(asset.buffer.v_buffer);
+    asset.buffer = Buffer();
+}
+
+void AssetStreamer::registerEvictable(const std::shared_ptr<Asset> &asset) {
+    std::weak_ptr<Asset> weak = asset;
+
+    // Runs from Device::nextFrame, on the render thread like the rest of the uploads
+    asset->residency = device.memory->registerEvictable(
+        asset->buffer.v_memory,
+        residencyPriority(asset->request.priority),
+        [this, weak]() {
+            auto evicted = weak.lock();
+            if(!evicted || !advance(*evicted, AssetState::Ready, AssetState::Evicted)) return;
+
+            // The tracker already dropped the registration
+            evicted->residency = 0;
+            dropBuffer(*evicted);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            streamer_stats.evicted++;
+        }
+    );
+}
+
+bool AssetStreamer::openAsset(Asset &asset) {
+#ifdef _WIN32
+    // Only the blocking path runs here, it reads by path and keeps no descriptor
+    std::error_code error;
+    auto size = std::filesystem::file_size(asset.request.path, error);
+    if(error) {
+        fail(asset, error.message());
+        return false;
+    }
+
+    asset.data.resize(static_cast<size_t>(size));
+#else
+    asset.fd = open(asset.request.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(asset.fd < 0) {
+        fail(asset, std::strerror(errno));
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(asset.fd, &info) != 0) {
+        fail(asset, std::strerror(errno));
+        closeAsset(asset);
+        return false;
+    }
+
+    asset.data.resize(static_cast<size_t>(info.st_size));
+#endif
+    asset.read_offset = 0;
+
+    return true;
+}
+
+void AssetStreamer::closeAsset(Asset &asset) {
+#ifndef _WIN32
+    if(asset.fd >= 0) {
+        close(asset.fd);
+        asset.fd = -1;
+    }
+#else
+    (void)asset;
+#endif
+}
+
+void AssetStreamer::fail(Asset &asset, const std::string &reason) {
+    AssetState current = asset.state.load(std::memory_order_acquire);
+    if(current == AssetState::Cancelled) return;
+
+    asset.state.store(AssetState::Failed, std::memory_order_release);
+    asset.data = std::vector<uint8_t>();
+
+    LOG_WARN("Failed to stream {}: {}", asset.request.path, reason);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    streamer_stats.failed++;
+}
+
+void AssetStreamer::readNextBlocking() {
+    std::shared_ptr<Asset> asset;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        asset = popHighest(read_queues);
+    }
+
+    if(!asset || !advance(*asset, AssetState::Queued, AssetState::Reading)) return;
+    if(!openAsset(*asset)) return;
+
+    while(asset->read_offset < asset->data.size()) {
+        if(asset->state.load(std::memory_order_acquire) == AssetState::Cancelled) {
+            closeAsset(*asset);
+            return;
+        }
+
+        size_t size = std::min<vk::DeviceSize>(asset->data.size() - asset->read_offset, MAX_READ_SIZE);
+        int64_t result = readAt(asset->fd, asset->request.path, asset->data.data() + asset->read_offset, size, asset->read_offset);
+
+        if(result < 0 && errno == EINTR) continue;
+
+        if(result <= 0) {
+            fail(*asset, result == 0 ? "file ended early" : std::strerror(errno));
+            closeAsset(*asset);
+            return;
+        }
+
+        asset->read_offset += static_cast<vk::DeviceSize>(result);
+    }
+
+    closeAsset(*asset);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        streamer_stats.bytes_read += asset->data.size();
+    }
+
+    // Already on a worker, no need to queue another job
+    decodeNow(*asset);
+}
+
+bool AssetStreamer::submitRead(Asset &asset) {
+    uint32_t size = static_cast<uint32_t>(std::min<vk::DeviceSize>(asset.data.size() - asset.read_offset, MAX_READ_SIZE));
+
+    return io_uring->read(asset.fd, asset.data.data() + asset.read_offset, size, asset.read_offset, asset.handle);
+}
+
+void AssetStreamer::ioLoop() {
+    SVK_THREAD_NAME("Asset I/O");
+
+    std::unordered_map<AssetHandle, std::shared_ptr<Asset>> reading;
+
+    while(true) {
+        std::vector<std::shared_ptr<Asset>> started;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            if(reading.empty()) {
+                io_wake.wait(lock, [this]() {
+                    return stopping || !read_queues[0].empty() || !read_queues[1].empty() || !read_queues[2].empty();
+                });
+            }
+
+            if(stopping && reading.empty()) break;
+
+            while(reading.size() + started.size() < io_uring->entries) {
+                auto asset = popHighest(read_queues);
+                if(!asset) break;
+
+                started.push_back(std::move(asset));
+            }
+        }
+
+        for(auto &asset : started) {
+            if(!advance(*asset, AssetState::Queued, AssetState::Reading)) continue;
+            if(!openAsset(*asset)) continue;
+
+            if(asset->data.empty()) {
+                closeAsset(*asset);
+                decode(asset);
+                continue;
+            }
+
+            submitRead(*asset);
+            reading[asset->handle] = asset;
+        }
+
+        if(reading.empty()) continue;
+
+        io_uring->wait([&](uint64_t handle, int32_t result) {
+            auto entry = reading.find(handle);
+            if(entry == reading.end()) return;
+
+            auto asset = entry->second;
+
+            // Kernels before 5.6 do not know IORING_OP_READ
+            if(result == -EINVAL) {
+                size_t size = std::min<vk::DeviceSize>(asset->data.size() - asset->read_offset, MAX_READ_SIZE);
+                result = static_cast<int32_t>(readAt(asset->fd, asset->request.path, asset->data.data() + asset->read_offset, size, asset->read_offset));
+                if(result < 0) result = -errno;
+            }
+
+            if(result == -EINTR || result == -EAGAIN) {
+                submitRead(*asset);
+                return;
+            }
+
+            if(result <= 0) {
+                fail(*asset, result == 0 ? "file ended early" : std::strerror(-result));
+                closeAsset(*asset);
+                reading.erase(entry);
+                return;
+            }
+
+            asset->read_offset += static_cast<vk::DeviceSize>(result);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                streamer_stats.bytes_read += static_cast<uint64_t>(result);
+            }
+
+            bool cancelled = asset->state.load(std::memory_order_acquire) == AssetState::Cancelled;
+
+            if(!cancelled && asset->read_offset < asset->data.size()) {
+                submitRead(*asset);
+                return;
+            }
+
+            closeAsset(*asset);
+            reading.erase(entry);
+
+            if(!cancelled) {
+                decode(std::move(asset));
+            }
+        });
+    }
+}
+
+void AssetStreamer::decode(std::shared_ptr<Asset> asset) {
+    device.jobs->run([this, asset]() {
+        decodeNow(*asset);
+    }, &job_counter);
+}
+
+void AssetStreamer::decodeNow(Asset &asset) {
+    SVK_ZONE("AssetStreamer::decode");
+
+    if(!advance(asset, AssetState::Reading, AssetState::Decoding)) return;
+
+    if(asset.request.decode) {
+        try {
+            asset.data = asset.request.decode(std::move(asset.data));
+        } catch(std::exception &error) {
+            fail(asset, error.what());
+            return;
+        }
+    }
+
+    if(asset.data.empty()) {
+        fail(asset, "nothing to upload");
+        return;
+    }
+
+    if(!advance(asset, AssetState::Decoding, AssetState::Uploading)) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto shared = assets.find(asset.handle);
+    if(shared != assets.end()) {
+        upload_queues[static_cast<size_t>(asset.request.priority)].push_back(shared->second);
+    }
+}
+
+void AssetStreamer::recordUploads(vk::CommandBuffer command_buffer) {
+    SVK_ZONE("AssetStreamer::recordUploads");
+
+    uint64_t completed = device.deletion_queue->completedValue();
+
+    // Visible only once every copy into the buffer finished
+    for(auto it = in_transfer.begin(); it != in_transfer.end();) {
+        Asset &asset = **it;
+
+        if(asset.state.load(std::memory_order_acquire) == AssetState::Cancelled) {
+            it = in_transfer.erase(it);
+            continue;
+        }
+
+        if(asset.retire_value > completed) {
+            ++it;
+            continue;
+        }
+
+        if(advance(asset, AssetState::Uploading, AssetState::Ready)) {
+            registerEvictable(*it);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            streamer_stats.ready++;
+        }
+        it = in_transfer.erase(it);
+    }
+
+    StagingSlot &slot = staging[device.frame_index % staging.size()];
+    auto mapped = static_cast<uint8_t*>(*slot.mapping);
+
+    struct Copy {
+        vk::Buffer destination;
+        vk::BufferCopy region;
+    };
+    std::vector<Copy> copies;
+
+    BarrierBatcher batcher(device, *device.resource_states);
+    vk::DeviceSize used = 0;
+
+    while(used < staging_capacity) {
+        std::shared_ptr<Asset> asset;
+        size_t priority = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for(; priority < 3; priority++) {
+                if(!upload_queues[priority].empty()) {
+                    asset = upload_queues[priority].front();
+                    break;
+                }
+            }
+        }
+
+        if(!asset) break;
+
+        if(asset->state.load(std::memory_order_acquire) == AssetState::Cancelled) {
+            std::lock_guard<std::mutex> lock(mutex);
+            upload_queues[priority].pop_front();
+            continue;
+        }
+
+        vk::DeviceSize size = asset->data.size();
+
+        if(!asset->buffer.v_buffer) {
+            auto bufferInfo = vk::BufferCreateInfo()
+                .setSize(size)
+                .setUsage(asset->request.usage | vk::BufferUsageFlagBits::eTransferDst)
+                .setSharingMode(vk::SharingMode::eExclusive);
+
+            asset->buffer = Buffer(device, bufferInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, v_dispatcher);
+            device.resource_states->trackBuffer(asset->buffer.v_buffer);
+        }
+
+        // Also orders the pieces of an asset spread over several frames
+        batcher.access(asset->buffer.v_buffer, ResourceUsage::TransferDst);
+
+        vk::DeviceSize chunk = std::min(size - asset->uploaded, staging_capacity - used);
+        std::memcpy(mapped + used, asset->data.data() + asset->uploaded, chunk);
+
+        copies.push_back(Copy {
+            .destination = asset->buffer.v_buffer,
+            .region = vk::BufferCopy(used, asset->uploaded, chunk),
+        });
+
+        used += chunk;
+        asset->uploaded += chunk;
+
+        if(asset->uploaded == size) {
+            asset->retire_value = device.deletion_queue->retireValue();
+            asset->data = std::vector<uint8_t>();
+            in_transfer.push_back(asset);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            upload_queues[priority].pop_front();
+        }
+    }
+
+    if(copies.empty()) return;
+
+    batcher.flush(command_buffer);
+
+    for(auto &copy : copies) {
+        command_buffer.copyBuffer(slot.buffer.v_buffer, copy.destination, copy.region, v_dispatcher);
+    }
+
+    SVK_COUNT(Uploads, copies.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    streamer_stats.bytes_uploaded += used;
+}
+
+AssetStreamerStats AssetStreamer::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return streamer_stats;
+}
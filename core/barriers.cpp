@@ -0,0 +1,497 @@
+#include "barriers.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <vulkan/vulkan.hpp>
+#ifndef __MACH__
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+#endif
+#include <vulkan/vulkan_to_string.hpp>
+
+using Stage2 = vk::PipelineStageFlagBits2;
+using Access2 = vk::AccessFlagBits2;
+using Layout = vk::ImageLayout;
+
+// Only stage and access bits that also exist in the original synchronization
+// API are used, so barriers can be lowered to vkCmdPipelineBarrier without synchronization2.
+ResourceState stateForUsage(ResourceUsage usage) {
+    switch(usage) {
+    case ResourceUsage::ColorAttachment:
+        return {Stage2::eColorAttachmentOutput, Access2::eColorAttachmentRead | Access2::eColorAttachmentWrite, Layout::eColorAttachmentOptimal};
+    case ResourceUsage::DepthStencilAttachment:
+        return {Stage2::eEarlyFragmentTests | Stage2::eLateFragmentTests,
+            Access2::eDepthStencilAttachmentRead | Access2::eDepthStencilAttachmentWrite, Layout::eDepthStencilAttachmentOptimal};
+    case ResourceUsage::DepthStencilRead:
+        return {Stage2::eEarlyFragmentTests | Stage2::eLateFragmentTests,
+            Access2::eDepthStencilAttachmentRead, Layout::eDepthStencilReadOnlyOptimal};
+    case ResourceUsage::SampledFragment:
+        return {Stage2::eFragmentShader, Access2::eShaderRead, Layout::eShaderReadOnlyOptimal};
+    case ResourceUsage::SampledCompute:
+        return {Stage2::eComputeShader, Access2::eShaderRead, Layout::eShaderReadOnlyOptimal};
+    case ResourceUsage::StorageRead:
+        return {Stage2::eComputeShader, Access2::eShaderRead, Layout::eGeneral};
+    case ResourceUsage::StorageWrite:
+        return {Stage2::eComputeShader, Access2::eShaderRead | Access2::eShaderWrite, Layout::eGeneral};
+    case ResourceUsage::TransferSrc:
+        return {Stage2::eTransfer, Access2::eTransferRead, Layout::eTransferSrcOptimal};
+    case ResourceUsage::TransferDst:
+        return {Stage2::eTransfer, Access2::eTransferWrite, Layout::eTransferDstOptimal};
+    case ResourceUsage::VertexBuffer:
+        return {Stage2::eVertexInput, Access2::eVertexAttributeRead};
+    case ResourceUsage::IndexBuffer:
+        return {Stage2::eVertexInput, Access2::eIndexRead};
+    case ResourceUsage::IndirectBuffer:
+        return {Stage2::eDrawIndirect, Access2::eIndirectCommandRead};
+    case ResourceUsage::UniformBuffer:
+        return {Stage2::eVertexShader | Stage2::eFragmentShader | Stage2::eComputeShader, Access2::eUniformRead};
+    case ResourceUsage::Present:
+        return {Stage2::eBottomOfPipe, vk::AccessFlags2(), Layout::ePresentSrcKHR};
+    }
+
+    THROW(runtime_error, "Unknown resource usage {}.", static_cast<int>(usage));
+}
+
+bool isWriteUsage(ResourceUsage usage) {
+    switch(usage) {
+    case ResourceUsage::ColorAttachment:
+    case ResourceUsage::DepthStencilAttachment:
+    case ResourceUsage::StorageWrite:
+    case ResourceUsage::TransferDst:
+        return true;
+    default:
+        return false;
+    }
+}
+
+vk::AccessFlags2 writeAccess(vk::AccessFlags2 access) {
+    return access & (
+        Access2::eColorAttachmentWrite |
+        Access2::eDepthStencilAttachmentWrite |
+        Access2::eShaderWrite |
+        Access2::eTransferWrite |
+        Access2::eHostWrite |
+        Access2::eMemoryWrite
+    );
+}
+
+void recordBarriers(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    const std::vector<vk::ImageMemoryBarrier2> &image_barriers,
+    const std::vector<vk::BufferMemoryBarrier2> &buffer_barriers
+) {
+    if(image_barriers.empty() && buffer_barriers.empty()) return;
+
+    SVK_COUNT(Barriers, image_barriers.size() + buffer_barriers.size());
+
+    if(device.capabilities.synchronization2) {
+        auto dependencyInfo = vk::DependencyInfo()
+            .setImageMemoryBarriers(image_barriers)
+            .setBufferMemoryBarriers(buffer_barriers);
+
+        command_buffer.pipelineBarrier2(dependencyInfo, device.v_dispatcher);
+        return;
+    }
+
+    // Without synchronization2 the whole batch shares one pair of stage masks
+    auto lowerStages = [](vk::PipelineStageFlags2 stages) {
+        return vk::PipelineStageFlags(static_cast<VkPipelineStageFlags>(static_cast<VkPipelineStageFlags2>(stages)));
+    };
+    auto lowerAccess = [](vk::AccessFlags2 access) {
+        return vk::AccessFlags(static_cast<VkAccessFlags>(static_cast<VkAccessFlags2>(access)));
+    };
+
+    vk::PipelineStageFlags srcStages;
+    vk::PipelineStageFlags dstStages;
+    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+    std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+
+    imageBarriers.reserve(image_barriers.size());
+    bufferBarriers.reserve(buffer_barriers.size());
+
+    for(auto &barrier : image_barriers) {
+        srcStages |= lowerStages(barrier.srcStageMask);
+        dstStages |= lowerStages(barrier.dstStageMask);
+
+        imageBarriers.push_back(vk::ImageMemoryBarrier()
+            .setSrcAccessMask(lowerAccess(barrier.srcAccessMask))
+            .setDstAccessMask(lowerAccess(barrier.dstAccessMask))
+            .setOldLayout(barrier.oldLayout)
+            .setNewLayout(barrier.newLayout)
+            .setSrcQueueFamilyIndex(barrier.srcQueueFamilyIndex)
+            .setDstQueueFamilyIndex(barrier.dstQueueFamilyIndex)
+            .setImage(barrier.image)
+            .setSubresourceRange(barrier.subresourceRange)
+        );
+    }
+
+    for(auto &barrier : buffer_barriers) {
+        srcStages |= lowerStages(barrier.srcStageMask);
+        dstStages |= lowerStages(barrier.dstStageMask);
+
+        bufferBarriers.push_back(vk::BufferMemoryBarrier()
+            .setSrcAccessMask(lowerAccess(barrier.srcAccessMask))
+            .setDstAccessMask(lowerAccess(barrier.dstAccessMask))
+            .setSrcQueueFamilyIndex(barrier.srcQueueFamilyIndex)
+            .setDstQueueFamilyIndex(barrier.dstQueueFamilyIndex)
+            .setBuffer(barrier.buffer)
+            .setOffset(barrier.offset)
+            .setSize(barrier.size)
+        );
+    }
+
+    if(!srcStages) srcStages = vk::PipelineStageFlagBits::eTopOfPipe;
+    if(!dstStages) dstStages = vk::PipelineStageFlagBits::eBottomOfPipe;
+
+    command_buffer.pipelineBarrier(
+        srcStages,
+        dstStages,
+        vk::DependencyFlags(),
+        nullptr,
+        bufferBarriers,
+        imageBarriers,
+        device.v_dispatcher
+    );
+}
+
+std::optional<StateTransition> SubresourceState::access(const ResourceState &dst, bool write, bool is_image) {
+    const bool layoutChange = is_image && layout != dst.layout;
+    const vk::ImageLayout dstLayout = is_image ? dst.layout : vk::ImageLayout::eUndefined;
+
+    if(layoutChange || write) {
+        // Writes and layout transitions wait for every access since the last write
+        vk::PipelineStageFlags2 pending = write_stages | read_stages;
+        std::optional<StateTransition> transition;
+
+        if(layoutChange || pending) {
+            transition = StateTransition {
+                .src = ResourceState { pending, write_access, layout },
+                .dst = ResourceState { dst.stages, dst.access, dstLayout },
+            };
+        }
+
+        layout = dstLayout;
+        write_stages = dst.stages;
+
+        if(write) {
+            write_access = writeAccess(dst.access);
+            read_stages = vk::PipelineStageFlags2();
+            read_access = vk::AccessFlags2();
+        } else {
+            // The layout transition is the last write; it is visible to the stages it waited for
+            write_access = vk::AccessFlags2();
+            read_stages = dst.stages;
+            read_access = dst.access;
+        }
+
+        return transition;
+    }
+
+    if(!write_stages || ((dst.stages & ~read_stages) == vk::PipelineStageFlags2() &&
+        (dst.access & ~read_access) == vk::AccessFlags2()))
+    {
+        read_stages |= dst.stages;
+        read_access |= dst.access;
+        return std::nullopt;
+    }
+
+    read_stages |= dst.stages;
+    read_access |= dst.access;
+
+    return StateTransition {
+        .src = ResourceState { write_stages, write_access, layout },
+        .dst = ResourceState { dst.stages, dst.access, dstLayout },
+    };
+}
+
+void ResourceStateTracker::trackImage(
+    vk::Image image,
+    uint32_t mip_levels,
+    uint32_t array_layers,
+    vk::ImageAspectFlags aspect,
+    ResourceState initial
+) {
+    images[static_cast<VkImage>(image)] = TrackedImage {
+        .mip_levels = mip_levels,
+        .array_layers = array_layers,
+        .aspect = aspect,
+        .subresources = std::vector<SubresourceState>(mip_levels * array_layers, SubresourceState(initial)),
+    };
+}
+
+void ResourceStateTracker::trackBuffer(vk::Buffer buffer, ResourceState initial) {
+    buffers[static_cast<VkBuffer>(buffer)] = SubresourceState(initial);
+}
+
+void ResourceStateTracker::forgetImage(vk::Image image) {
+    images.erase(static_cast<VkImage>(image));
+}
+
+void ResourceStateTracker::forgetBuffer(vk::Buffer buffer) {
+    buffers.erase(static_cast<VkBuffer>(buffer));
+}
+
+ResourceStateTracker::TrackedImage *ResourceStateTracker::image(vk::Image image) {
+    auto found = images.find(static_cast<VkImage>(image));
+    return found == images.end() ? nullptr : &found->second;
+}
+
+SubresourceState *ResourceStateTracker::buffer(vk::Buffer buffer) {
+    auto found = buffers.find(static_cast<VkBuffer>(buffer));
+    return found == buffers.end() ? nullptr : &found->second;
+}
+
+void ResourceStateTracker::setImageState(vk::Image image, ResourceState state) {
+    auto *tracked = this->image(image);
+
+    if(tracked == nullptr) {
+        THROW(runtime_error, "Image is not tracked.");
+    }
+
+    std::fill(tracked->subresources.begin(), tracked->subresources.end(), SubresourceState(state));
+}
+
+BarrierBatcher::BarrierBatcher(Device &device, ResourceStateTracker &tracker, bool debug)
+    : device(device), tracker(tracker), debug(debug) {}
+
+void BarrierBatcher::transition(
+    vk::Image image,
+    ResourceUsage usage,
+    std::optional<vk::ImageSubresourceRange> range
+) {
+    transition(image, stateForUsage(usage), isWriteUsage(usage), range);
+}
+
+void BarrierBatcher::transition(
+    vk::Image image,
+    ResourceState state,
+    bool write,
+    std::optional<vk::ImageSubresourceRange> range
+) {
+    auto *tracked = tracker.image(image);
+
+    if(tracked == nullptr) {
+        THROW(runtime_error, "Transitioning an image that is not tracked.");
+    }
+
+    uint32_t baseMip = range.has_value() ? range->baseMipLevel : 0;
+    uint32_t baseLayer = range.has_value() ? range->baseArrayLayer : 0;
+    uint32_t mipCount = range.has_value() && range->levelCount != VK_REMAINING_MIP_LEVELS ?
+        range->levelCount : tracked->mip_levels - baseMip;
+    uint32_t layerCount = range.has_value() && range->layerCount != VK_REMAINING_ARRAY_LAYERS ?
+        range->layerCount : tracked->array_layers - baseLayer;
+    vk::ImageAspectFlags aspect = range.has_value() ? range->aspectMask : tracked->aspect;
+
+    if(baseMip + mipCount > tracked->mip_levels || baseLayer + layerCount > tracked->array_layers) {
+        THROW(runtime_error, "Subresource range exceeds the tracked image.");
+    }
+
+    frame_stats.requested++;
+    bool needed = false;
+
+    for(uint32_t mip = baseMip; mip < baseMip + mipCount; mip++) {
+        for(uint32_t layer = baseLayer; layer < baseLayer + layerCount; layer++) {
+            auto &subresource = tracked->subresources[mip * tracked->array_layers + layer];
+            auto barrier = subresource.access(state, write, true);
+
+            if(!barrier.has_value()) continue;
+            needed = true;
+
+            auto pending = std::find_if(pending_images.begin(), pending_images.end(), [&](const PendingImage &p) {
+                return p.image == image && p.mip == mip && p.layer == layer;
+            });
+
+            if(pending != pending_images.end()) {
+                // Nothing ran in between, so the earlier barrier can go straight to the new state
+                pending->dst.stages |= barrier->dst.stages;
+                pending->dst.access |= barrier->dst.access;
+                pending->dst.layout = barrier->dst.layout;
+                frame_stats.merged++;
+                continue;
+            }
+
+            pending_images.push_back(PendingImage {
+                .image = image,
+                .aspect = aspect,
+                .mip = mip,
+                .layer = layer,
+                .src = barrier->src,
+                .dst = barrier->dst,
+            });
+        }
+    }
+
+    if(!needed) {
+        frame_stats.redundant++;
+
+        if(debug) {
+            LOG_DEBUG("Redundant image transition to layout {}.", vk::to_string(state.layout));
+        }
+    }
+}
+
+void BarrierBatcher::access(vk::Buffer buffer, ResourceUsage usage) {
+    access(buffer, stateForUsage(usage), isWriteUsage(usage));
+}
+
+void BarrierBatcher::access(vk::Buffer buffer, ResourceState state, bool write) {
+    auto *tracked = tracker.buffer(buffer);
+
+    if(tracked == nullptr) {
+        THROW(runtime_error, "Accessing a buffer that is not tracked.");
+    }
+
+    frame_stats.requested++;
+
+    auto barrier = tracked->access(state, write, false);
+
+    if(!barrier.has_value()) {
+        frame_stats.redundant++;
+
+        if(debug) {
+            LOG_DEBUG("Redundant buffer barrier for stages {}.", vk::to_string(state.stages));
+        }
+        return;
+    }
+
+    auto pending = std::find_if(pending_buffers.begin(), pending_buffers.end(), [&](const PendingBuffer &p) {
+        return p.buffer == buffer;
+    });
+
+    if(pending != pending_buffers.end()) {
+        pending->dst.stages |= barrier->dst.stages;
+        pending->dst.access |= barrier->dst.access;
+        frame_stats.merged++;
+        return;
+    }
+
+    pending_buffers.push_back(PendingBuffer {
+        .buffer = buffer,
+        .src = barrier->src,
+        .dst = barrier->dst,
+    });
+}
+
+void BarrierBatcher::flush(vk::CommandBuffer command_buffer) {
+    if(empty()) return;
+
+    // Sort so subresources of an image with identical transitions end up adjacent
+    std::sort(pending_images.begin(), pending_images.end(), [](const PendingImage &a, const PendingImage &b) {
+        if(a.image != b.image) return static_cast<VkImage>(a.image) < static_cast<VkImage>(b.image);
+        if(a.mip != b.mip) return a.mip < b.mip;
+        return a.layer < b.layer;
+    });
+
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+    std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+
+    auto sameTransition = [](const vk::ImageMemoryBarrier2 &barrier, const PendingImage &pending) {
+        return barrier.image == pending.image &&
+            barrier.subresourceRange.aspectMask == pending.aspect &&
+            barrier.srcStageMask == pending.src.stages &&
+            barrier.srcAccessMask == pending.src.access &&
+            barrier.dstStageMask == pending.dst.stages &&
+            barrier.dstAccessMask == pending.dst.access &&
+            barrier.oldLayout == pending.src.layout &&
+            barrier.newLayout == pending.dst.layout;
+    };
+
+    for(auto &pending : pending_images) {
+        if(!imageBarriers.empty()) {
+            auto &last = imageBarriers.back();
+            auto &range = last.subresourceRange;
+
+            // Extend the previous barrier over consecutive layers of the same mip...
+            if(sameTransition(last, pending) && range.levelCount == 1 &&
+                range.baseMipLevel == pending.mip && range.baseArrayLayer + range.layerCount == pending.layer)
+            {
+                range.layerCount++;
+                continue;
+            }
+        }
+
+        imageBarriers.push_back(vk::ImageMemoryBarrier2()
+            .setSrcStageMask(pending.src.stages)
+            .setSrcAccessMask(pending.src.access)
+            .setDstStageMask(pending.dst.stages)
+            .setDstAccessMask(pending.dst.access)
+            .setOldLayout(pending.src.layout)
+            .setNewLayout(pending.dst.layout)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setImage(pending.image)
+            .setSubresourceRange(vk::ImageSubresourceRange(pending.aspect, pending.mip, 1, pending.layer, 1))
+        );
+    }
+
+    // ...then merge consecutive mips covering the same layers
+    std::vector<vk::ImageMemoryBarrier2> mergedBarriers;
+    mergedBarriers.reserve(imageBarriers.size());
+
+    for(auto &barrier : imageBarriers) {
+        if(!mergedBarriers.empty()) {
+            auto &last = mergedBarriers.back();
+            auto &range = last.subresourceRange;
+            auto &next = barrier.subresourceRange;
+
+            if(last.image == barrier.image &&
+                last.srcStageMask == barrier.srcStageMask && last.srcAccessMask == barrier.srcAccessMask &&
+                last.dstStageMask == barrier.dstStageMask && last.dstAccessMask == barrier.dstAccessMask &&
+                last.oldLayout == barrier.oldLayout && last.newLayout == barrier.newLayout &&
+                range.aspectMask == next.aspectMask &&
+                range.baseArrayLayer == next.baseArrayLayer && range.layerCount == next.layerCount &&
+                range.baseMipLevel + range.levelCount == next.baseMipLevel)
+            {
+                range.levelCount += next.levelCount;
+                continue;
+            }
+        }
+
+        mergedBarriers.push_back(barrier);
+    }
+
+    for(auto &pending : pending_buffers) {
+        bufferBarriers.push_back(vk::BufferMemoryBarrier2()
+            .setSrcStageMask(pending.src.stages)
+            .setSrcAccessMask(pending.src.access)
+            .setDstStageMask(pending.dst.stages)
+            .setDstAccessMask(pending.dst.access)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setBuffer(pending.buffer)
+            .setOffset(0)
+            .setSize(VK_WHOLE_SIZE)
+        );
+    }
+
+    recordBarriers(device, command_buffer, mergedBarriers, bufferBarriers);
+
+    frame_stats.imageBarriers += static_cast<uint32_t>(mergedBarriers.size());
+    frame_stats.bufferBarriers += static_cast<uint32_t>(bufferBarriers.size());
+    frame_stats.batches++;
+
+    pending_images.clear();
+    pending_buffers.clear();
+}
+
+BarrierStats BarrierBatcher::nextFrame() {
+    BarrierStats stats = frame_stats;
+
+    if(debug) {
+        LOG_DEBUG("Barriers: {} requested, {} redundant, {} merged, {} image + {} buffer barriers in {} batches.",
+            stats.requested, stats.redundant, stats.merged,
+            stats.imageBarriers, stats.bufferBarriers, stats.batches
+        );
+    }
+
+    if(!empty()) {
+        LOG_WARN("Frame ended with {} unflushed barriers.", pending_images.size() + pending_buffers.size());
+    }
+
+    frame_stats = BarrierStats();
+    return stats;
+}
@@ -0,0 +1,322 @@
+#include "bufferheap.hpp"
+
+#include "deletionqueue.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+BufferHeap::BufferHeap(
+    Device &device,
+    vk::BufferUsageFlags usage,
+    vk::DeviceSize block_size,
+    vk::DispatchLoaderDynamic &dispatcher
+): device(device),
+   usage(usage | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst),
+   block_size(block_size),
+   v_dispatcher(dispatcher) {
+    if(block_size == 0) {
+        THROW(invalid_argument, "BufferHeap needs a non-zero block size.");
+    }
+}
+
+BufferHeap::~BufferHeap() {
+    for(auto &block : blocks) {
+        if(block) device.resource_states->forgetBuffer(block->buffer.v_buffer);
+    }
+}
+
+uint32_t BufferHeap::createBlock(vk::DeviceSize capacity) {
+    auto bufferInfo = vk::BufferCreateInfo()
+        .setSize(capacity)
+        .setUsage(usage)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    auto block = std::make_unique<Block>(Block {
+        .buffer = Buffer(device, bufferInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, v_dispatcher),
+        .ranges = RangeAllocator(capacity),
+    });
+    device.resource_states->trackBuffer(block->buffer.v_buffer);
+
+    auto slot = std::find(blocks.begin(), blocks.end(), nullptr);
+    if(slot == blocks.end()) {
+        slot = blocks.insert(blocks.end(), nullptr);
+    }
+    *slot = std::move(block);
+
+    uint32_t index = static_cast<uint32_t>(slot - blocks.begin());
+    LOG_DEBUG("Buffer heap block {} created, {} bytes", index, capacity);
+
+    return index;
+}
+
+void BufferHeap::retire(uint32_t block, vk::DeviceSize offset, vk::DeviceSize size) {
+    retired.push_back(RetiredRange {
+        .block = block,
+        .offset = offset,
+        .size = size,
+        .retire_value = device.deletion_queue->retireValue(),
+    });
+}
+
+vk::DeviceSize BufferHeap::reclaim(uint32_t &blocks_freed) {
+    uint64_t completed = device.deletion_queue->completedValue();
+
+    auto it = std::remove_if(retired.begin(), retired.end(), [&](const RetiredRange &range) {
+        if(range.retire_value > completed) return false;
+
+        blocks[range.block]->ranges.free(range.offset, range.size);
+        return true;
+    });
+    retired.erase(it, retired.end());
+
+    auto live = std::count_if(blocks.begin(), blocks.end(), [](const auto &block) { return block != nullptr; });
+
+    // Empty blocks are released, except the last one which is kept for the next allocations
+    vk::DeviceSize reclaimed = 0;
+    for(uint32_t i = 0; i < blocks.size(); i++) {
+        auto &block = blocks[i];
+        if(!block || block->ranges.used() > 0) continue;
+        if(live <= 1 && !block->draining) continue;
+
+        reclaimed += block->ranges.capacity();
+        blocks_freed++;
+        live--;
+
+        LOG_DEBUG("Buffer heap block {} released, {} bytes", i, block->ranges.capacity());
+
+        // The buffer goes through the deletion queue, nothing in flight uses it any more
+        device.resource_states->forgetBuffer(block->buffer.v_buffer);
+        block.reset();
+
+        if(source == i) source.reset();
+    }
+
+    total_bytes_reclaimed += reclaimed;
+    return reclaimed;
+}
+
+BufferHandle BufferHeap::allocate(vk::DeviceSize size, vk::DeviceSize alignment) {
+    if(size == 0) {
+        THROW(invalid_argument, "BufferHeap allocations need a non-zero size.");
+    }
+
+    uint32_t blocks_freed = 0;
+    reclaim(blocks_freed);
+
+    std::optional<uint32_t> found;
+    uint64_t offset = RangeAllocator::INVALID;
+
+    for(uint32_t i = 0; i < blocks.size(); i++) {
+        if(!blocks[i] || blocks[i]->draining) continue;
+
+        offset = blocks[i]->ranges.allocate(size, alignment);
+        if(offset != RangeAllocator::INVALID) {
+            found = i;
+            break;
+        }
+    }
+
+    if(!found.has_value()) {
+        found = createBlock(std::max(size, block_size));
+        offset = blocks[*found]->ranges.allocate(size, alignment);
+    }
+
+    blocks[*found]->allocations++;
+
+    BufferHandle handle = next_handle++;
+    allocations.emplace(handle, Allocation {
+        .block = *found,
+        .offset = offset,
+        .size = size,
+        .alignment = alignment,
+    });
+
+    return handle;
+}
+
+void BufferHeap::free(BufferHandle handle) {
+    auto it = allocations.find(handle);
+    if(it == allocations.end()) {
+        LOG_ERROR("Freed buffer heap handle {} does not exist, it was freed twice", handle);
+        return;
+    }
+
+    auto &allocation = it->second;
+    blocks[allocation.block]->allocations--;
+    retire(allocation.block, allocation.offset, allocation.size);
+
+    allocations.erase(it);
+}
+
+BufferRange BufferHeap::resolve(BufferHandle handle) const {
+    auto it = allocations.find(handle);
+    if(it == allocations.end()) {
+        THROW(invalid_argument, "Buffer heap handle {} does not exist.", handle);
+    }
+
+    auto &allocation = it->second;
+    return BufferRange {
+        .buffer = blocks[allocation.block]->buffer.v_buffer,
+        .offset = allocation.offset,
+        .size = allocation.size,
+    };
+}
+
+void BufferHeap::prepare(BarrierBatcher &batcher, ResourceUsage usage) {
+    for(auto &block : blocks) {
+        if(block && block->allocations > 0) batcher.access(block->buffer.v_buffer, usage);
+    }
+}
+
+std::optional<uint32_t> BufferHeap::pickSource() const {
+    std::optional<uint32_t> sparsest;
+    double sparsest_ratio = sparse_threshold;
+
+    for(uint32_t i = 0; i < blocks.size(); i++) {
+        auto &block = blocks[i];
+        if(!block || block->allocations == 0) continue;
+
+        double ratio = static_cast<double>(block->ranges.used()) / block->ranges.capacity();
+        if(ratio < sparsest_ratio) {
+            sparsest = i;
+            sparsest_ratio = ratio;
+        }
+    }
+
+    if(!sparsest.has_value()) return std::nullopt;
+
+    // Not worth starting when the other blocks cannot take its contents anyway
+    vk::DeviceSize room = 0;
+    for(uint32_t i = 0; i < blocks.size(); i++) {
+        if(i == *sparsest || !blocks[i] || blocks[i]->draining) continue;
+        room += blocks[i]->ranges.capacity() - blocks[i]->ranges.used();
+    }
+
+    if(room < blocks[*sparsest]->ranges.used()) return std::nullopt;
+
+    return sparsest;
+}
+
+DefragmentStats BufferHeap::defragment(vk::CommandBuffer command_buffer, vk::DeviceSize max_bytes) {
+    SVK_ZONE("BufferHeap::defragment");
+
+    auto start = std::chrono::steady_clock::now();
+
+    DefragmentStats result;
+    result.bytes_reclaimed = reclaim(result.blocks_freed);
+
+    if(!source.has_value()) {
+        source = pickSource();
+        if(source.has_value()) {
+            blocks[*source]->draining = true;
+            LOG_DEBUG("Buffer heap draining block {}, {} of {} bytes used",
+                *source, blocks[*source]->ranges.used(), blocks[*source]->ranges.capacity());
+        }
+    }
+
+    if(source.has_value() && blocks[*source]->allocations > 0) {
+        Block &from = *blocks[*source];
+
+        // Densest blocks first, so the sparse ones are the next to drain
+        std::vector<uint32_t> destinations;
+        for(uint32_t i = 0; i < blocks.size(); i++) {
+            if(blocks[i] && !blocks[i]->draining) destinations.push_back(i);
+        }
+        std::sort(destinations.begin(), destinations.end(), [&](uint32_t a, uint32_t b) {
+            return blocks[a]->ranges.used() > blocks[b]->ranges.used();
+        });
+
+        std::vector<std::pair<uint32_t, vk::BufferCopy>> copies;
+
+        for(auto &[handle, allocation] : allocations) {
+            if(result.bytes_moved >= max_bytes) break;
+            if(allocation.block != *source) continue;
+
+            std::optional<uint32_t> to;
+            uint64_t offset = RangeAllocator::INVALID;
+
+            for(uint32_t destination : destinations) {
+                offset = blocks[destination]->ranges.allocate(allocation.size, allocation.alignment);
+                if(offset != RangeAllocator::INVALID) {
+                    to = destination;
+                    break;
+                }
+            }
+
+            // The others filled up since the block was picked, try another one later
+            if(!to.has_value()) {
+                LOG_DEBUG("Buffer heap stopped draining block {}, no room left", *source);
+                from.draining = false;
+                source.reset();
+                break;
+            }
+
+            copies.emplace_back(*to, vk::BufferCopy(allocation.offset, offset, allocation.size));
+
+            retire(allocation.block, allocation.offset, allocation.size);
+            from.allocations--;
+            blocks[*to]->allocations++;
+
+            allocation.block = *to;
+            allocation.offset = offset;
+
+            result.moves++;
+            result.bytes_moved += allocation.size;
+        }
+
+        if(!copies.empty()) {
+            std::sort(copies.begin(), copies.end(), [](const auto &a, const auto &b) {
+                return a.first < b.first;
+            });
+
+            BarrierBatcher batcher(device, *device.resource_states);
+            batcher.access(from.buffer.v_buffer, ResourceUsage::TransferSrc);
+            for(auto &[to, copy] : copies) {
+                batcher.access(blocks[to]->buffer.v_buffer, ResourceUsage::TransferDst);
+            }
+            batcher.flush(command_buffer);
+
+            // One copy command per destination block
+            std::vector<vk::BufferCopy> regions;
+            for(size_t i = 0; i < copies.size(); i++) {
+                regions.push_back(copies[i].second);
+
+                if(i + 1 == copies.size() || copies[i + 1].first != copies[i].first) {
+                    command_buffer.copyBuffer(
+                        from.buffer.v_buffer,
+                        blocks[copies[i].first]->buffer.v_buffer,
+                        regions,
+                        v_dispatcher
+                    );
+                    regions.clear();
+                }
+            }
+        }
+    }
+
+    total_moves += result.moves;
+    total_bytes_moved += result.bytes_moved;
+
+    result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+BufferHeapStats BufferHeap::stats() const {
+    BufferHeapStats result;
+    result.allocations = static_cast<uint32_t>(allocations.size());
+    result.moves = total_moves;
+    result.bytes_moved = total_bytes_moved;
+    result.bytes_reclaimed = total_bytes_reclaimed;
+
+    for(auto &block : blocks) {
+        if(!block) continue;
+
+        result.blocks++;
+        result.capacity += block->ranges.capacity();
+        result.used += block->ranges.used();
+    }
+
+    return result;
+}
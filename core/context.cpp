@@ -0,0 +1,127 @@
+#include "context.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_core.h>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "log.hpp"
+#include "validation.hpp"
+
+Context::Context(
+    const std::string &application_name,
+    std::vector<const char*> requestedExtensions,
+    bool portability
+) {
+    createInstance(application_name, std::move(requestedExtensions), portability);
+}
+
+Context::~Context() {
+    destroy();
+}
+
+void Context::createInstance(
+    const std::string &application_name,
+    std::vector<const char*> requestedExtensions,
+    bool portability
+) {
+    if(vk_ready) {
+        THROW(runtime_error, "Vulkan instance was already created for this context.");
+    }
+
+    auto appinfo = vk::ApplicationInfo()
+        .setPApplicationName(application_name.c_str())
+        .setApplicationVersion(vk::makeApiVersion(0, 0, 1, 0))
+        .setApiVersion(vk::ApiVersion13)
+        .setEngineVersion(vk::makeApiVersion(0, 0, 1, 0))
+        .setPEngineName("svk");
+
+    if(Validation::enableValidationLayers) {
+        requestedExtensions.push_back(vk::EXTDebugUtilsExtensionName);
+    }
+
+    if(portability) {
+        requestedExtensions.push_back(vk::KHRPortabilityEnumerationExtensionName);
+    }
+
+    auto instanceInfo = vk::InstanceCreateInfo()
+        .setPApplicationInfo(&appinfo)
+        .setPEnabledExtensionNames(requestedExtensions);
+
+    if(Validation::enableValidationLayers) {
+        instanceInfo = instanceInfo.setPEnabledLayerNames(Validation::validationLayers);
+    } else {
+        instanceInfo = instanceInfo.setEnabledLayerCount(0);
+    }
+
+    if(portability) {
+        instanceInfo.setFlags(vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR);
+    }
+
+    v_dispatcher.init();
+
+    v_instance = vk::createInstance(instanceInfo, nullptr, v_dispatcher);
+    v_dispatcher.init(v_instance);
+
+    LOG_DEBUG("Initialized Vulkan instance.");
+
+    if(Validation::enableValidationLayers) {
+        auto messengerInfo = vk::DebugUtilsMessengerCreateInfoEXT()
+            .setMessageSeverity(
+                vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo |
+                vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose |
+                vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
+                vk::DebugUtilsMessageSeverityFlagBitsEXT::eError
+            ).setMessageType(
+                vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
+                vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance |
+                vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation
+            ).setPfnUserCallback(logging::debugCallback);
+
+        v_messenger = v_instance.createDebugUtilsMessengerEXT(messengerInfo, nullptr, v_dispatcher);
+        LOG_DEBUG("Initialized Vulkan debug messenger.");
+    }
+
+    vk_ready = true;
+}
+
+Device &Context::requestDevice(
+    const vk::PhysicalDeviceFeatures &requestedFeatures,
+    const std::vector<const char*> &requestedExtensions,
+    vk::SurfaceKHR surface
+) {
+    if(!vk_ready) {
+        THROW(runtime_error, "Requested a device before the Vulkan instance was created.");
+    }
+
+    v_device = std::make_unique<Device>(
+        v_instance,
+        surface,
+        requestedFeatures,
+        requestedExtensions,
+        v_dispatcher
+    );
+    return *v_device;
+}
+
+void Context::destroy() {
+    v_device.reset();
+
+    if(!vk_ready) return;
+
+    if(v_messenger) {
+        v_instance.destroyDebugUtilsMessengerEXT(v_messenger, nullptr, v_dispatcher);
+        v_messenger = nullptr;
+        LOG_DEBUG("Destroyed Vulkan debug messenger.");
+    }
+
+    v_instance.destroy(nullptr, v_dispatcher);
+    v_instance = nullptr;
+    LOG_DEBUG("Destroyed Vulkan instance.");
+
+    vk_ready = false;
+}
@@ -0,0 +1,144 @@
+#include "deletionqueue.hpp"
+#include "log.hpp"
+#include "memorytracker.hpp"
+
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_to_string.hpp>
+
+DeletionQueue::DeletionQueue(Device &device) : device(device) {}
+
+DeletionQueue::~DeletionQueue() {
+    flush();
+}
+
+void DeletionQueue::setTimeline(vk::Semaphore timeline, uint64_t pending_value) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(!entries.empty()) {
+        THROW(runtime_error, "Switching deletion queue to a timeline with {} handles pending.", entries.size());
+    }
+
+    v_timeline = timeline;
+    pending_timeline_value = pending_value;
+}
+
+void DeletionQueue::setPendingTimelineValue(uint64_t pending_value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_timeline_value = pending_value;
+}
+
+uint64_t DeletionQueue::retireValue() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return retireValueLocked();
+}
+
+uint64_t DeletionQueue::retireValueLocked() const {
+    if(v_timeline) {
+        return pending_timeline_value;
+    }
+
+    // nextFrame() runs right after the submit, before the fence of the frame that
+    // will reuse this slot was waited on. One more frame covers that wait.
+    return device.frame_index + device.frames_in_flight + 1;
+}
+
+uint64_t DeletionQueue::completedValue() const {
+    if(v_timeline) {
+        return device.v_device.getSemaphoreCounterValue(v_timeline, device.v_dispatcher);
+    }
+
+    return device.frame_index;
+}
+
+void DeletionQueue::collect() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(entries.empty()) return;
+
+    uint64_t completed = completedValue();
+
+    size_t destroyed = 0;
+    while(!entries.empty() && entries.front().retire_value <= completed) {
+        destroy(entries.front());
+        entries.pop_front();
+        destroyed++;
+    }
+
+    if(destroyed > 0) {
+        LOG_DEBUG("Deletion queue reclaimed {} handles, {} pending.", destroyed, entries.size());
+    }
+}
+
+void DeletionQueue::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for(auto &entry : entries) {
+        destroy(entry);
+    }
+    entries.clear();
+}
+
+size_t DeletionQueue::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void DeletionQueue::destroy(const Entry &entry) {
+    vk::Device v_device = device.v_device;
+    auto &d = device.v_dispatcher;
+
+    switch(entry.type) {
+    case vk::ObjectType::eBuffer:
+        v_device.destroyBuffer(vk::Buffer((VkBuffer)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eDeviceMemory:
+        device.memory->release(vk::DeviceMemory((VkDeviceMemory)entry.handle));
+        v_device.freeMemory(vk::DeviceMemory((VkDeviceMemory)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eImage:
+        v_device.destroyImage(vk::Image((VkImage)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eImageView:
+        v_device.destroyImageView(vk::ImageView((VkImageView)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::ePipeline:
+        v_device.destroyPipeline(vk::Pipeline((VkPipeline)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::ePipelineLayout:
+        v_device.destroyPipelineLayout(vk::PipelineLayout((VkPipelineLayout)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eShaderModule:
+        v_device.destroyShaderModule(vk::ShaderModule((VkShaderModule)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eRenderPass:
+        v_device.destroyRenderPass(vk::RenderPass((VkRenderPass)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eFramebuffer:
+        v_device.destroyFramebuffer(vk::Framebuffer((VkFramebuffer)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eFence:
+        v_device.destroyFence(vk::Fence((VkFence)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eSemaphore:
+        v_device.destroySemaphore(vk::Semaphore((VkSemaphore)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eCommandPool:
+        v_device.destroyCommandPool(vk::CommandPool((VkCommandPool)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eQueryPool:
+        v_device.destroyQueryPool(vk::QueryPool((VkQueryPool)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eSampler:
+        v_device.destroySampler(vk::Sampler((VkSampler)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eDescriptorPool:
+        v_device.destroyDescriptorPool(vk::DescriptorPool((VkDescriptorPool)entry.handle), nullptr, d);
+        break;
+    case vk::ObjectType::eDescriptorSetLayout:
+        v_device.destroyDescriptorSetLayout(vk::DescriptorSetLayout((VkDescriptorSetLayout)entry.handle), nullptr, d);
+        break;
+    default:
+        LOG_ERROR("Deletion queue cannot destroy objects of type {}.", vk::to_string(entry.type));
+        break;
+    }
+}
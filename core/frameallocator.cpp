@@ -0,0 +1,93 @@
+#include "frameallocator.hpp"
+
+#include "log.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_to_string.hpp>
+
+// Largest minimum offset alignment the spec allows, regions start at a multiple of it
+static constexpr vk::DeviceSize REGION_ALIGNMENT = 256;
+
+static vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+FrameAllocator::FrameAllocator(Device &device, vk::DeviceSize frame_capacity, vk::DispatchLoaderDynamic &dispatcher)
+: device(device), frame_capacity(frame_capacity), v_dispatcher(dispatcher),
+  uniform_alignment(device.properties.limits().minUniformBufferOffsetAlignment),
+  storage_alignment(device.properties.limits().minStorageBufferOffsetAlignment),
+  region_size(alignUp(frame_capacity, std::max({REGION_ALIGNMENT, uniform_alignment, storage_alignment}))),
+  buffer(createBuffer()),
+  mapping(buffer.mapMemory()) {
+    if(region_size * device.frames_in_flight > std::numeric_limits<uint32_t>::max()) {
+        THROW(invalid_argument, "Frame allocator of {} bytes per frame does not fit 32 bit dynamic offsets.",
+            frame_capacity
+        );
+    }
+}
+
+Buffer FrameAllocator::createBuffer() {
+    vk::BufferUsageFlags usage =
+        vk::BufferUsageFlagBits::eUniformBuffer |
+        vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eVertexBuffer |
+        vk::BufferUsageFlagBits::eIndexBuffer |
+        vk::BufferUsageFlagBits::eIndirectBuffer |
+        vk::BufferUsageFlagBits::eTransferSrc;
+    if(device.capabilities.bufferDeviceAddress) {
+        usage |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
+    }
+
+    auto bufferInfo = vk::BufferCreateInfo()
+        .setSize(region_size * device.frames_in_flight)
+        .setUsage(usage)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    return Buffer(
+        device,
+        bufferInfo,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        v_dispatcher
+    );
+}
+
+void FrameAllocator::begin(vk::Fence frame_fence) {
+    if(frame_fence) {
+        vk::Result waitResult = device.v_device.waitForFences(
+            frame_fence,
+            vk::True,
+            std::numeric_limits<uint64_t>::max(),
+            v_dispatcher
+        );
+        if(waitResult != vk::Result::eSuccess) {
+            THROW(runtime_error, "Failed to wait on the frame allocator's fence: {}.", vk::to_string(waitResult));
+        }
+    }
+
+    region = static_cast<uint32_t>(device.frame_index % device.frames_in_flight);
+    region_used = 0;
+}
+
+FrameAllocation FrameAllocator::allocate(vk::DeviceSize size, vk::DeviceSize alignment) {
+    vk::DeviceSize offset = alignUp(region_used, std::max<vk::DeviceSize>(alignment, 1));
+
+    if(offset + size > region_size) {
+        THROW(runtime_error, "Frame allocator is full, {} of {} bytes used and {} requested.",
+            region_used, region_size, size
+        );
+    }
+
+    region_used = offset + size;
+    peak_used = std::max(peak_used, region_used);
+
+    return FrameAllocation {
+        .buffer = buffer.v_buffer,
+        .offset = frameOffset() + offset,
+        .size = size,
+        .data = static_cast<uint8_t*>(*mapping) + frameOffset() + offset,
+        .address = device.capabilities.bufferDeviceAddress ? buffer.deviceAddress() + frameOffset() + offset : 0,
+    };
+}
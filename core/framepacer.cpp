@@ -0,0 +1,144 @@
+#include "framepacer.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_to_string.hpp>
+
+FramePacer::FramePacer(
+    Device &device,
+    Swapchain &swapchain,
+    FramePacerSettings settings,
+    vk::DispatchLoaderDynamic &dispatcher
+) : device(device),
+    swapchain(swapchain),
+    settings(settings),
+    v_dispatcher(dispatcher),
+    present_wait(device.capabilities.presentWait)
+{
+    setMaxFramesQueued(settings.max_frames_queued);
+
+    swapchain_generation = swapchain.generation;
+    frame_start = Clock::now();
+
+    if(present_wait) {
+        LOG_DEBUG("Frame pacer limits the display queue to {} frames.", this->settings.max_frames_queued);
+    } else {
+        LOG_DEBUG("Frame pacer without present wait, frames are only limited by {} frames in flight.",
+            device.frames_in_flight
+        );
+    }
+}
+
+void FramePacer::setMaxFramesQueued(uint32_t max_frames_queued) {
+    settings.max_frames_queued = std::max(max_frames_queued, 1u);
+}
+
+void FramePacer::restart() {
+    // Present ids belong to the old swapchain, which is already gone
+    queued.clear();
+    next_present_id = 1;
+    swapchain_generation = swapchain.generation;
+}
+
+bool FramePacer::waitForOldest(uint64_t timeout) {
+    QueuedFrame frame = queued.front();
+
+    vk::Result result;
+    try {
+        result = device.v_device.waitForPresentKHR(
+            swapchain.v_swapchain,
+            frame.present_id,
+            timeout,
+            v_dispatcher
+        );
+    } catch(vk::OutOfDateKHRError&) {
+        // The frame will never be shown, nothing to measure
+        queued.pop_front();
+        return true;
+    }
+
+    if(result == vk::Result::eTimeout) {
+        return false;
+    }
+
+    queued.pop_front();
+
+    double latency = std::chrono::duration<double, std::milli>(Clock::now() - frame.start).count();
+
+    latency_stats.frames++;
+    latency_stats.last_ms = latency;
+    latency_stats.max_ms = std::max(latency_stats.max_ms, latency);
+    latency_stats.average_ms += (latency - latency_stats.average_ms) / static_cast<double>(latency_stats.frames);
+
+    return true;
+}
+
+void FramePacer::beginFrame() {
+    SVK_ZONE("FramePacer::beginFrame");
+
+    if(swapchain.generation != swapchain_generation) {
+        restart();
+    }
+
+    if(present_wait) {
+        // Frames that reached the display meanwhile, measured without blocking
+        while(!queued.empty() && waitForOldest(0)) {}
+
+        if(queued.size() >= settings.max_frames_queued) {
+            latency_stats.stalls++;
+        }
+
+        while(queued.size() >= settings.max_frames_queued) {
+            if(!waitForOldest(settings.wait_timeout_ns)) {
+                queued.pop_front();
+                latency_stats.timeouts++;
+            }
+        }
+    }
+
+    frame_start = Clock::now();
+}
+
+vk::Result FramePacer::present(uint32_t image_index, vk::Semaphore wait_semaphore) {
+    SVK_ZONE("FramePacer::present");
+
+    if(swapchain.generation != swapchain_generation) {
+        restart();
+    }
+
+    uint64_t present_id = next_present_id;
+
+    auto presentIdInfo = vk::PresentIdKHR()
+        .setSwapchainCount(1)
+        .setPPresentIds(&present_id);
+
+    auto presentInfo = vk::PresentInfoKHR()
+        .setImageIndices(image_index)
+        .setSwapchains(swapchain.v_swapchain)
+        .setWaitSemaphores(wait_semaphore);
+
+    if(present_wait) {
+        presentInfo.setPNext(&presentIdInfo);
+    }
+
+    vk::Result result;
+    try {
+        result = device.v_present_queue.presentKHR(presentInfo, v_dispatcher);
+    } catch(vk::OutOfDateKHRError&) {
+        return vk::Result::eErrorOutOfDateKHR;
+    }
+
+    if(present_wait) {
+        queued.push_back(QueuedFrame {
+            .present_id = present_id,
+            .start = frame_start,
+        });
+        next_present_id++;
+    }
+
+    return result;
+}
@@ -0,0 +1,439 @@
+#include "gpuculling.hpp"
+
+#include "indirectdraw.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifndef SVK_SHADER_DIR
+#define SVK_SHADER_DIR "shaders"
+#endif
+
+static constexpr uint32_t CULL_FRUSTUM = 1;
+static constexpr uint32_t CULL_OCCLUSION = 2;
+static constexpr uint32_t CULL_COMPACT = 4;
+
+static constexpr uint32_t CULL_GROUP_SIZE = 64;
+static constexpr uint32_t HIZ_GROUP_SIZE = 8;
+
+struct HiZParams {
+    int32_t source_size[2];
+    int32_t destination_size[2];
+};
+
+// Gribb and Hartmann, planes point inwards. Near is z >= 0 for Vulkan clip space.
+static void extractPlanes(const Matrix4 &m, std::array<float, 4> (&planes)[6]) {
+    auto row = [&](int i) {
+        return std::array<float, 4> {m[i], m[4 + i], m[8 + i], m[12 + i]};
+    };
+
+    auto r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+    for(int i = 0; i < 4; i++) {
+        planes[0][i] = r3[i] + r0[i];
+        planes[1][i] = r3[i] - r0[i];
+        planes[2][i] = r3[i] + r1[i];
+        planes[3][i] = r3[i] - r1[i];
+        planes[4][i] = r2[i];
+        planes[5][i] = r3[i] - r2[i];
+    }
+
+    for(auto &plane : planes) {
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if(length == 0.0f) continue;
+
+        for(float &value : plane) {
+            value /= length;
+        }
+    }
+}
+
+GpuCuller::GpuCuller(Device &device, uint32_t max_instances, vk::DispatchLoaderDynamic &dispatcher)
+: device(device), max_instances(max_instances), v_dispatcher(dispatcher) {
+    if(!device.capabilities.drawIndirectFirstInstance) {
+        LOG_WARN("drawIndirectFirstInstance is not supported, culled draws all see instance index 0.");
+    }
+
+    auto storage = [](uint32_t binding) {
+        return vk::DescriptorSetLayoutBinding(binding, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute);
+    };
+
+    std::array<vk::DescriptorSetLayoutBinding, 5> cullBindings = {
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+        storage(1),
+        storage(2),
+        storage(3),
+        vk::DescriptorSetLayoutBinding(4, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute),
+    };
+    v_cull_set_layout = device->createDescriptorSetLayout(
+        vk::DescriptorSetLayoutCreateInfo().setBindings(cullBindings), nullptr, v_dispatcher
+    );
+
+    std::array<vk::DescriptorSetLayoutBinding, 2> hizBindings = {
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute),
+    };
+    v_hiz_set_layout = device->createDescriptorSetLayout(
+        vk::DescriptorSetLayoutCreateInfo().setBindings(hizBindings), nullptr, v_dispatcher
+    );
+
+    cull_shader = Shader(device, SVK_SHADER_DIR "/gpu_cull.comp.spv", vk::ShaderStageFlagBits::eCompute, v_dispatcher);
+    hiz_shader = Shader(device, SVK_SHADER_DIR "/hiz_downsample.comp.spv", vk::ShaderStageFlagBits::eCompute, v_dispatcher);
+
+    cull_pipeline = Pipeline(
+        device,
+        cull_shader,
+        vk::PipelineLayoutCreateInfo().setSetLayouts(v_cull_set_layout),
+        vk::ComputePipelineCreateInfo(),
+        v_dispatcher
+    );
+
+    auto hizPushRange = vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(HiZParams));
+
+    hiz_pipeline = Pipeline(
+        device,
+        hiz_shader,
+        vk::PipelineLayoutCreateInfo()
+            .setSetLayouts(v_hiz_set_layout)
+            .setPushConstantRanges(hizPushRange),
+        vk::ComputePipelineCreateInfo(),
+        v_dispatcher
+    );
+
+    // Nearest on purpose, filtering between depths would break the conservative test
+    auto samplerInfo = vk::SamplerCreateInfo()
+        .setMagFilter(vk::Filter::eNearest)
+        .setMinFilter(vk::Filter::eNearest)
+        .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+        .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+        .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+        .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+        .setMaxLod(VK_LOD_CLAMP_NONE);
+    v_sampler = device->createSampler(samplerInfo, nullptr, v_dispatcher);
+
+    auto commandsInfo = vk::BufferCreateInfo()
+        .setSize(std::max<vk::DeviceSize>(max_instances, 1) * sizeof(vk::DrawIndexedIndirectCommand))
+        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer)
+        .setSharingMode(vk::SharingMode::eExclusive);
+    commands = Buffer(device, commandsInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, v_dispatcher);
+
+    auto countInfo = vk::BufferCreateInfo()
+        .setSize(sizeof(uint32_t))
+        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eIndirectBuffer |
+            vk::BufferUsageFlagBits::eTransferDst)
+        .setSharingMode(vk::SharingMode::eExclusive);
+    count = Buffer(device, countInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, v_dispatcher);
+
+    device.resource_states->trackBuffer(commands.v_buffer);
+    device.resource_states->trackBuffer(count.v_buffer);
+
+    // Parameters are written by the CPU every frame, one set per frame in flight
+    uint32_t slots = device.frames_in_flight;
+
+    std::array<vk::DescriptorPoolSize, 3> poolSizes = {
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, slots),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, slots * 3),
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, slots),
+    };
+    v_pool = device->createDescriptorPool(
+        vk::DescriptorPoolCreateInfo().setMaxSets(slots).setPoolSizes(poolSizes), nullptr, v_dispatcher
+    );
+
+    std::vector<vk::DescriptorSetLayout> layouts(slots, v_cull_set_layout);
+    auto sets = device->allocateDescriptorSets(
+        vk::DescriptorSetAllocateInfo().setDescriptorPool(v_pool).setSetLayouts(layouts), v_dispatcher
+    );
+
+    auto paramsInfo = vk::BufferCreateInfo()
+        .setSize(sizeof(CullParams))
+        .setUsage(vk::BufferUsageFlagBits::eUniformBuffer)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    params.reserve(slots);
+    for(uint32_t i = 0; i < slots; i++) {
+        Buffer buffer(
+            device,
+            paramsInfo,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            v_dispatcher
+        );
+        MemoryMap mapping = buffer.mapMemory();
+
+        params.push_back(ParamSlot {
+            .buffer = std::move(buffer),
+            .mapping = std::move(mapping),
+            .v_set = sets[i],
+        });
+    }
+
+    // Placeholder pyramid so the descriptor is valid before the first buildHiZ
+    resizeHiZ(vk::Extent2D(1, 1));
+}
+
+GpuCuller::~GpuCuller() {
+    device.resource_states->forgetBuffer(commands.v_buffer);
+    device.resource_states->forgetBuffer(count.v_buffer);
+
+    for(auto view : v_hiz_levels) {
+        device.deletion_queue->push(view);
+    }
+    device.deletion_queue->push(v_hiz_pool);
+    device.deletion_queue->push(v_pool);
+    device.deletion_queue->push(v_sampler);
+    device.deletion_queue->push(v_cull_set_layout);
+    device.deletion_queue->push(v_hiz_set_layout);
+}
+
+void GpuCuller::resizeHiZ(vk::Extent2D extent) {
+    for(auto view : v_hiz_levels) {
+        device.deletion_queue->push(view);
+    }
+    v_hiz_levels.clear();
+
+    // Sets of the old pool may still be bound by frames in flight
+    if(v_hiz_pool) device.deletion_queue->push(v_hiz_pool);
+
+    uint32_t levels = static_cast<uint32_t>(std::floor(std::log2(std::max(extent.width, extent.height)))) + 1;
+
+    auto imageInfo = vk::ImageCreateInfo()
+        .setImageType(vk::ImageType::e2D)
+        .setFormat(vk::Format::eR32Sfloat)
+        .setExtent(vk::Extent3D(extent.width, extent.height, 1))
+        .setMipLevels(levels)
+        .setArrayLayers(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled)
+        .setSharingMode(vk::SharingMode::eExclusive)
+        .setInitialLayout(vk::ImageLayout::eUndefined);
+
+    hiz = Image(device, imageInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eColor, v_dispatcher);
+
+    for(uint32_t level = 0; level < levels; level++) {
+        auto viewInfo = vk::ImageViewCreateInfo()
+            .setImage(hiz.v_image)
+            .setViewType(vk::ImageViewType::e2D)
+            .setFormat(vk::Format::eR32Sfloat)
+            .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1));
+
+        v_hiz_levels.push_back(device->createImageView(viewInfo, nullptr, v_dispatcher));
+    }
+
+    // Level 0 reads the depth image, which may differ per frame in flight, so it
+    // gets one set per frame instead of one in total
+    uint32_t sets = levels - 1 + device.frames_in_flight;
+
+    std::array<vk::DescriptorPoolSize, 2> poolSizes = {
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, sets),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, sets),
+    };
+    v_hiz_pool = device->createDescriptorPool(
+        vk::DescriptorPoolCreateInfo().setMaxSets(sets).setPoolSizes(poolSizes), nullptr, v_dispatcher
+    );
+
+    std::vector<vk::DescriptorSetLayout> layouts(sets, v_hiz_set_layout);
+    auto allocated = device->allocateDescriptorSets(
+        vk::DescriptorSetAllocateInfo().setDescriptorPool(v_hiz_pool).setSetLayouts(layouts), v_dispatcher
+    );
+
+    v_depth_sets.assign(allocated.begin(), allocated.begin() + device.frames_in_flight);
+    v_depth_views.assign(device.frames_in_flight, nullptr);
+
+    // Index 0 stays null, level 0 binds the frame's depth set
+    v_hiz_sets.assign(1, nullptr);
+    v_hiz_sets.insert(v_hiz_sets.end(), allocated.begin() + device.frames_in_flight, allocated.end());
+
+    std::vector<vk::DescriptorImageInfo> imageInfos;
+    imageInfos.reserve(sets + levels);
+    std::vector<vk::WriteDescriptorSet> writes;
+
+    // The depth source of these is written in buildHiZ
+    for(auto set : v_depth_sets) {
+        imageInfos.push_back(vk::DescriptorImageInfo(nullptr, v_hiz_levels[0], vk::ImageLayout::eGeneral));
+        writes.push_back(vk::WriteDescriptorSet(set, 1, 0, vk::DescriptorType::eStorageImage, imageInfos.back()));
+    }
+
+    for(uint32_t level = 1; level < levels; level++) {
+        imageInfos.push_back(vk::DescriptorImageInfo(nullptr, v_hiz_levels[level], vk::ImageLayout::eGeneral));
+        writes.push_back(vk::WriteDescriptorSet(v_hiz_sets[level], 1, 0, vk::DescriptorType::eStorageImage, imageInfos.back()));
+
+        imageInfos.push_back(vk::DescriptorImageInfo(
+            v_sampler, v_hiz_levels[level - 1], vk::ImageLayout::eShaderReadOnlyOptimal
+        ));
+        writes.push_back(vk::WriteDescriptorSet(v_hiz_sets[level], 0, 0, vk::DescriptorType::eCombinedImageSampler, imageInfos.back()));
+    }
+
+    device->updateDescriptorSets(writes, nullptr, v_dispatcher);
+    SVK_COUNT(DescriptorUpdates, writes.size());
+
+    hiz_valid = false;
+
+    LOG_DEBUG("HiZ pyramid resized to {}x{} with {} levels.", extent.width, extent.height, levels);
+}
+
+void GpuCuller::buildHiZ(vk::CommandBuffer command_buffer, Image &depth, const Matrix4 &view_projection) {
+    SVK_ZONE("GpuCuller::buildHiZ");
+
+    vk::Extent2D extent(depth.v_extent.width, depth.v_extent.height);
+
+    if(extent.width != hiz.v_extent.width || extent.height != hiz.v_extent.height) {
+        resizeHiZ(extent);
+    }
+
+    // The frame that last used this set finished `frames_in_flight` frames ago
+    uint32_t slot = static_cast<uint32_t>(device.frame_index % v_depth_sets.size());
+
+    if(v_depth_views[slot] != depth.v_image_view) {
+        auto depthInfo = vk::DescriptorImageInfo(v_sampler, depth.v_image_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        device->updateDescriptorSets(
+            vk::WriteDescriptorSet(v_depth_sets[slot], 0, 0, vk::DescriptorType::eCombinedImageSampler, depthInfo),
+            nullptr,
+            v_dispatcher
+        );
+        SVK_COUNT(DescriptorUpdates, 1);
+
+        v_depth_views[slot] = depth.v_image_view;
+    }
+
+    BarrierBatcher batcher(device, *device.resource_states);
+    hiz_pipeline.bind(command_buffer);
+
+    vk::Extent2D source = extent;
+    vk::Extent2D destination = extent;
+
+    for(uint32_t level = 0; level < hiz.mip_levels; level++) {
+        if(level == 0) {
+            batcher.transition(depth.v_image, ResourceUsage::SampledCompute);
+        } else {
+            batcher.transition(hiz.v_image, ResourceUsage::SampledCompute,
+                vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level - 1, 1, 0, 1)
+            );
+        }
+        batcher.transition(hiz.v_image, ResourceUsage::StorageWrite,
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1)
+        );
+        batcher.flush(command_buffer);
+
+        HiZParams push = {
+            .source_size = {static_cast<int32_t>(source.width), static_cast<int32_t>(source.height)},
+            .destination_size = {static_cast<int32_t>(destination.width), static_cast<int32_t>(destination.height)},
+        };
+
+        command_buffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute,
+            hiz_pipeline.v_layout,
+            0,
+            level == 0 ? v_depth_sets[slot] : v_hiz_sets[level],
+            nullptr,
+            v_dispatcher
+        );
+        command_buffer.pushConstants(
+            hiz_pipeline.v_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push), &push, v_dispatcher
+        );
+        command_buffer.dispatch(
+            (destination.width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+            (destination.height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+            1,
+            v_dispatcher
+        );
+
+        source = destination;
+        destination = vk::Extent2D(std::max(destination.width / 2, 1u), std::max(destination.height / 2, 1u));
+    }
+
+    // Every other level was moved to sampling when the next one read it
+    batcher.transition(hiz.v_image, ResourceUsage::SampledCompute,
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, hiz.mip_levels - 1, 1, 0, 1)
+    );
+    batcher.flush(command_buffer);
+
+    hiz_valid = true;
+    hiz_view_projection = view_projection;
+}
+
+void GpuCuller::cull(
+    vk::CommandBuffer command_buffer,
+    Buffer &instances,
+    uint32_t instance_count,
+    const Matrix4 &view_projection,
+    CullSettings settings
+) {
+    SVK_ZONE("GpuCuller::cull");
+
+    if(instance_count > max_instances) {
+        THROW(invalid_argument, "Culling {} instances, the culler was created for {}.", instance_count, max_instances);
+    }
+
+    last_instance_count = instance_count;
+    if(instance_count == 0) return;
+
+    ParamSlot &slot = params[device.frame_index % params.size()];
+
+    CullParams values;
+    values.hiz_view_projection = hiz_view_projection;
+    extractPlanes(view_projection, values.planes);
+    values.hiz_size = {static_cast<float>(hiz.v_extent.width), static_cast<float>(hiz.v_extent.height)};
+    values.instance_count = instance_count;
+    values.flags = (settings.frustum ? CULL_FRUSTUM : 0) |
+        (settings.occlusion && hiz_valid ? CULL_OCCLUSION : 0) |
+        (compacts() ? CULL_COMPACT : 0);
+
+    std::memcpy(*slot.mapping, &values, sizeof(values));
+
+    // Rewritten every frame since the instance buffer and the pyramid may have changed
+    auto paramsInfo = vk::DescriptorBufferInfo(slot.buffer.v_buffer, 0, sizeof(CullParams));
+    auto instancesInfo = vk::DescriptorBufferInfo(instances.v_buffer, 0, VK_WHOLE_SIZE);
+    auto commandsInfo = vk::DescriptorBufferInfo(commands.v_buffer, 0, VK_WHOLE_SIZE);
+    auto countInfo = vk::DescriptorBufferInfo(count.v_buffer, 0, VK_WHOLE_SIZE);
+    auto hizInfo = vk::DescriptorImageInfo(v_sampler, hiz.v_image_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    std::array<vk::WriteDescriptorSet, 5> writes = {
+        vk::WriteDescriptorSet(slot.v_set, 0, 0, vk::DescriptorType::eUniformBuffer, nullptr, paramsInfo),
+        vk::WriteDescriptorSet(slot.v_set, 1, 0, vk::DescriptorType::eStorageBuffer, nullptr, instancesInfo),
+        vk::WriteDescriptorSet(slot.v_set, 2, 0, vk::DescriptorType::eStorageBuffer, nullptr, commandsInfo),
+        vk::WriteDescriptorSet(slot.v_set, 3, 0, vk::DescriptorType::eStorageBuffer, nullptr, countInfo),
+        vk::WriteDescriptorSet(slot.v_set, 4, 0, vk::DescriptorType::eCombinedImageSampler, hizInfo),
+    };
+    device->updateDescriptorSets(writes, nullptr, v_dispatcher);
+    SVK_COUNT(DescriptorUpdates, writes.size());
+
+    BarrierBatcher batcher(device, *device.resource_states);
+
+    if(compacts()) {
+        batcher.access(count.v_buffer, ResourceUsage::TransferDst);
+        batcher.flush(command_buffer);
+
+        command_buffer.fillBuffer(count.v_buffer, 0, sizeof(uint32_t), 0, v_dispatcher);
+    }
+
+    batcher.access(instances.v_buffer, ResourceUsage::StorageRead);
+    batcher.access(commands.v_buffer, ResourceUsage::StorageWrite);
+    batcher.access(count.v_buffer, ResourceUsage::StorageWrite);
+    batcher.transition(hiz.v_image, ResourceUsage::SampledCompute);
+    batcher.flush(command_buffer);
+
+    cull_pipeline.bind(command_buffer);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, cull_pipeline.v_layout, 0, slot.v_set, nullptr, v_dispatcher
+    );
+    command_buffer.dispatch((instance_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1, v_dispatcher);
+}
+
+void GpuCuller::prepareDraw(BarrierBatcher &batcher) {
+    batcher.access(commands.v_buffer, ResourceUsage::IndirectBuffer);
+    batcher.access(count.v_buffer, ResourceUsage::IndirectBuffer);
+}
+
+void GpuCuller::draw(vk::CommandBuffer command_buffer) {
+    if(last_instance_count == 0) return;
+
+    if(compacts()) {
+        drawIndexedIndirectCount(device, command_buffer, commands, 0, count, 0, last_instance_count);
+    } else {
+        drawIndexedIndirect(device, command_buffer, commands, last_instance_count);
+    }
+}
@@ -0,0 +1,212 @@
+#include "gpuprofiler.hpp"
+#include "deletionqueue.hpp"
+#include "jsonutil.hpp"
+#include "log.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <vulkan/vulkan.hpp>
+
+GpuProfiler::GpuProfiler(Device &device, uint32_t max_scopes_per_frame, uint32_t history_size)
+    : device(device), max_scopes(max_scopes_per_frame), history_size(history_size)
+{
+    timestamp_period = device.properties.limits().timestampPeriod;
+    valid_bits = device.properties.queue_families[device.queue_family_indices.graphics].timestampValidBits;
+    timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+    if(!supported()) {
+        LOG_WARN("Graphics queue does not support timestamps, GPU profiling is disabled.");
+        return;
+    }
+
+    slots.resize(device.frames_in_flight + 1);
+
+    for(auto &slot : slots) {
+        auto poolInfo = vk::QueryPoolCreateInfo()
+            .setQueryType(vk::QueryType::eTimestamp)
+            .setQueryCount(max_scopes * 2);
+
+        slot.v_pool = device.v_device.createQueryPool(poolInfo, nullptr, device.v_dispatcher);
+    }
+
+    LOG_DEBUG("Created GPU profiler with {} timestamp pools ({} valid bits, {} ns per tick).",
+        slots.size(), valid_bits, timestamp_period
+    );
+}
+
+GpuProfiler::~GpuProfiler() {
+    for(auto &slot : slots) {
+        device.deletion_queue->push(slot.v_pool);
+    }
+}
+
+void GpuProfiler::beginFrame(vk::CommandBuffer command_buffer) {
+    if(!supported()) return;
+
+    current_slot = static_cast<uint32_t>(frame % slots.size());
+    auto &slot = slots[current_slot];
+
+    if(slot.recorded) {
+        resolve(slot);
+    }
+
+    command_buffer.resetQueryPool(slot.v_pool, 0, max_scopes * 2, device.v_dispatcher);
+
+    slot.scopes.clear();
+    slot.used_queries = 0;
+    slot.frame = frame;
+    slot.recorded = true;
+
+    current_depth = 0;
+    frame++;
+}
+
+uint32_t GpuProfiler::beginScope(vk::CommandBuffer command_buffer, const std::string &name) {
+    if(!supported()) return UINT32_MAX;
+
+    auto &slot = slots[current_slot];
+
+    if(!slot.recorded || slot.used_queries + 2 > max_scopes * 2) {
+        return UINT32_MAX;
+    }
+
+    uint32_t query = slot.used_queries;
+    slot.used_queries += 2;
+
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.v_pool, query, device.v_dispatcher);
+
+    slot.scopes.push_back(Scope {
+        .name = name,
+        .depth = current_depth++,
+        .query = query,
+    });
+
+    return static_cast<uint32_t>(slot.scopes.size() - 1);
+}
+
+void GpuProfiler::endScope(vk::CommandBuffer command_buffer, uint32_t scope) {
+    if(scope == UINT32_MAX) return;
+
+    auto &slot = slots[current_slot];
+
+    command_buffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eBottomOfPipe,
+        slot.v_pool,
+        slot.scopes[scope].query + 1,
+        device.v_dispatcher
+    );
+
+    current_depth--;
+}
+
+void GpuProfiler::resolve(FrameSlot &slot) {
+    if(slot.used_queries == 0) return;
+
+    // Value and availability pairs
+    auto result = device.v_device.getQueryPoolResults<uint64_t>(
+        slot.v_pool,
+        0,
+        slot.used_queries,
+        slot.used_queries * 2 * sizeof(uint64_t),
+        2 * sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability,
+        device.v_dispatcher
+    );
+
+    if(result.result == vk::Result::eNotReady) {
+        // The frame has not finished even after cycling all pools; never wait on it
+        dropped_frames++;
+        LOG_DEBUG("GPU profiler dropped frame {} ({} dropped so far).", slot.frame, dropped_frames);
+        return;
+    }
+
+    auto &data = result.value;
+
+    GpuFrameTimings timings;
+    timings.frame = slot.frame;
+    timings.scopes.reserve(slot.scopes.size());
+
+    for(auto &scope : slot.scopes) {
+        uint32_t begin = scope.query * 2;
+        uint32_t end = (scope.query + 1) * 2;
+
+        if(data[begin + 1] == 0 || data[end + 1] == 0) continue;
+
+        uint64_t beginTicks = data[begin] & timestamp_mask;
+        uint64_t endTicks = data[end] & timestamp_mask;
+
+        if(!has_base_timestamp) {
+            base_timestamp = beginTicks;
+            has_base_timestamp = true;
+        }
+
+        // Masked subtraction keeps durations right across a counter wrap
+        uint64_t elapsed = (endTicks - beginTicks) & timestamp_mask;
+        uint64_t sinceBase = (beginTicks - base_timestamp) & timestamp_mask;
+
+        timings.scopes.push_back(GpuScopeTiming {
+            .name = scope.name,
+            .depth = scope.depth,
+            .start_us = static_cast<double>(sinceBase) * timestamp_period / 1e3,
+            .duration_ms = static_cast<double>(elapsed) * timestamp_period / 1e6,
+        });
+    }
+
+    resolved.push_back(std::move(timings));
+
+    while(resolved.size() > history_size) {
+        resolved.pop_front();
+    }
+}
+
+const GpuFrameTimings *GpuProfiler::lastFrame() const {
+    if(resolved.empty()) return nullptr;
+
+    return &resolved.back();
+}
+
+double GpuProfiler::duration(const std::string &name) const {
+    const GpuFrameTimings *last = lastFrame();
+
+    if(last == nullptr) return 0.0;
+
+    double total = 0.0;
+    for(auto &scope : last->scopes) {
+        if(scope.name == name) total += scope.duration_ms;
+    }
+
+    return total;
+}
+
+void GpuProfiler::writeChromeTrace(const std::string &path) const {
+    std::ofstream file(path);
+
+    if(!file.is_open()) {
+        THROW(runtime_error, "Failed to open {} for writing the GPU trace.", path);
+    }
+
+    file << "{\"traceEvents\":[\n";
+
+    bool first = true;
+    for(auto &timings : resolved) {
+        for(auto &scope : timings.scopes) {
+            file << fmt::format(
+                "{}{{\"name\":\"{}\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":{},"
+                "\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"frame\":{}}}}}",
+                first ? "" : ",\n",
+                utils::escapeJson(scope.name),
+                scope.depth,
+                scope.start_us,
+                scope.duration_ms * 1e3,
+                timings.frame
+            );
+            first = false;
+        }
+    }
+
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    LOG_DEBUG("Wrote GPU trace of {} frames to {}.", resolved.size(), path);
+}
@@ -0,0 +1,77 @@
+#include "indirectdraw.hpp"
+
+#include "instrument.hpp"
+#include "log.hpp"
+
+void drawIndirect(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    Buffer &commands,
+    uint32_t draw_count,
+    vk::DeviceSize offset
+) {
+    if(draw_count == 0) return;
+
+    constexpr uint32_t stride = sizeof(vk::DrawIndirectCommand);
+
+    if(device.capabilities.multiDrawIndirect || draw_count == 1) {
+        command_buffer.drawIndirect(commands.v_buffer, offset, draw_count, stride, device.v_dispatcher);
+        SVK_COUNT(Draws, 1);
+        return;
+    }
+
+    for(uint32_t i = 0; i < draw_count; i++) {
+        command_buffer.drawIndirect(commands.v_buffer, offset + i * stride, 1, stride, device.v_dispatcher);
+    }
+    SVK_COUNT(Draws, draw_count);
+}
+
+void drawIndexedIndirect(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    Buffer &commands,
+    uint32_t draw_count,
+    vk::DeviceSize offset
+) {
+    if(draw_count == 0) return;
+
+    constexpr uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+    if(device.capabilities.multiDrawIndirect || draw_count == 1) {
+        command_buffer.drawIndexedIndirect(commands.v_buffer, offset, draw_count, stride, device.v_dispatcher);
+        SVK_COUNT(Draws, 1);
+        return;
+    }
+
+    for(uint32_t i = 0; i < draw_count; i++) {
+        command_buffer.drawIndexedIndirect(commands.v_buffer, offset + i * stride, 1, stride, device.v_dispatcher);
+    }
+    SVK_COUNT(Draws, draw_count);
+}
+
+void drawIndexedIndirectCount(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    Buffer &commands,
+    vk::DeviceSize offset,
+    Buffer &count,
+    vk::DeviceSize count_offset,
+    uint32_t max_draw_count
+) {
+    if(!device.capabilities.drawIndirectCount) {
+        THROW(runtime_error, "drawIndexedIndirectCount needs the drawIndirectCount device feature.");
+    }
+
+    if(max_draw_count == 0) return;
+
+    command_buffer.drawIndexedIndirectCount(
+        commands.v_buffer,
+        offset,
+        count.v_buffer,
+        count_offset,
+        max_draw_count,
+        sizeof(vk::DrawIndexedIndirectCommand),
+        device.v_dispatcher
+    );
+    SVK_COUNT(Draws, 1);
+}
@@ -0,0 +1,266 @@
+#include "instrument.hpp"
+#include "jsonutil.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace {
+    // Power of two so the head can wrap with a mask
+    constexpr uint64_t RING_CAPACITY = 1 << 14;
+    constexpr size_t FRAME_HISTORY = 1024;
+
+    struct ZoneEvent {
+        const char *name;
+        uint64_t begin_ns;
+        uint64_t end_ns;
+    };
+
+    // Fields are relaxed atomics, a dump may read a slot while its thread overwrites it
+    struct ZoneSlot {
+        std::atomic<const char*> name {nullptr};
+        std::atomic<uint64_t> begin_ns {0};
+        std::atomic<uint64_t> end_ns {0};
+    };
+
+    // Written by its thread only, older events are overwritten once the ring is full.
+    // `claimed` is raised before a slot is written and `head` after, so a dump can
+    // tell which of the slots it copied were being overwritten meanwhile.
+    struct ThreadRing {
+        uint32_t index;
+        std::string name;
+        std::atomic<uint64_t> head {0};
+        std::atomic<uint64_t> claimed {0};
+        std::unique_ptr<ZoneSlot[]> slots;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        // Kept after their threads exit so their zones still make it into the dump
+        std::vector<std::unique_ptr<ThreadRing>> rings;
+
+        std::array<std::atomic<uint64_t>, instrument::COUNTER_COUNT> counters {};
+
+        uint64_t frame = 0;
+        std::deque<instrument::FrameCounters> frames;
+    };
+
+    Registry &registry() {
+        static Registry instance;
+        return instance;
+    }
+
+    ThreadRing &threadRing() {
+        thread_local ThreadRing *ring = [] {
+            auto &reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+
+            auto created = std::make_unique<ThreadRing>();
+            created->index = static_cast<uint32_t>(reg.rings.size());
+            created->name = fmt::format("Thread {}", created->index);
+            created->slots = std::make_unique<ZoneSlot[]>(RING_CAPACITY);
+
+            reg.rings.push_back(std::move(created));
+            return reg.rings.back().get();
+        }();
+
+        return *ring;
+    }
+
+    // Copies the events still in the ring, dropping any the thread started
+    // overwriting during the copy
+    std::vector<ZoneEvent> snapshot(const ThreadRing &ring) {
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        uint64_t begin = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+
+        std::vector<ZoneEvent> events;
+        events.reserve(head - begin);
+
+        for(uint64_t i = begin; i < head; i++) {
+            auto &slot = ring.slots[i & (RING_CAPACITY - 1)];
+            events.push_back(ZoneEvent {
+                slot.name.load(std::memory_order_relaxed),
+                slot.begin_ns.load(std::memory_order_relaxed),
+                slot.end_ns.load(std::memory_order_relaxed),
+            });
+        }
+
+        // Pairs with the release fence in recordZone. Event i shares its slot with
+        // i + RING_CAPACITY, whose claim makes `claimed` exceed i + RING_CAPACITY.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = ring.claimed.load(std::memory_order_relaxed);
+        uint64_t valid = claimed > RING_CAPACITY ? claimed - RING_CAPACITY : 0;
+
+        if(valid > begin) {
+            events.erase(events.begin(), events.begin() + std::min<uint64_t>(valid - begin, events.size()));
+        }
+
+        return events;
+    }
+}
+
+const char *instrument::counterName(Counter counter) {
+    switch(counter) {
+    case Counter::Submits: return "Submits";
+    case Counter::Draws: return "Draws";
+    case Counter::Barriers: return "Barriers";
+    case Counter::Allocations: return "Allocations";
+    case Counter::DescriptorUpdates: return "Descriptor updates";
+    case Counter::Uploads: return "Uploads";
+    default: return "Unknown";
+    }
+}
+
+uint64_t instrument::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count());
+}
+
+void instrument::recordZone(const char *name, uint64_t begin_ns, uint64_t end_ns) {
+    auto &ring = threadRing();
+
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+    ring.claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto &slot = ring.slots[head & (RING_CAPACITY - 1)];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.begin_ns.store(begin_ns, std::memory_order_relaxed);
+    slot.end_ns.store(end_ns, std::memory_order_relaxed);
+
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void instrument::count(Counter counter, uint64_t amount) {
+    registry().counters[static_cast<size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void instrument::frameMark() {
+    auto &reg = registry();
+
+    FrameCounters frame;
+    frame.end_ns = now();
+
+    for(size_t i = 0; i < COUNTER_COUNT; i++) {
+        frame.values[i] = reg.counters[i].exchange(0, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    frame.frame = reg.frame++;
+    reg.frames.push_back(frame);
+
+    while(reg.frames.size() > FRAME_HISTORY) {
+        reg.frames.pop_front();
+    }
+}
+
+instrument::FrameCounters instrument::lastFrame() {
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    if(reg.frames.empty()) return FrameCounters();
+
+    return reg.frames.back();
+}
+
+void instrument::setThreadName(const std::string &name) {
+    auto &ring = threadRing();
+
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    ring.name = name;
+}
+
+void instrument::writeChromeTrace(const std::string &path) {
+    std::ofstream file(path);
+
+    if(!file.is_open()) {
+        THROW(runtime_error, "Failed to open {} for writing the CPU trace.", path);
+    }
+
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    std::vector<std::vector<ZoneEvent>> events;
+    events.reserve(reg.rings.size());
+    for(auto &ring : reg.rings) {
+        events.push_back(snapshot(*ring));
+    }
+
+    // Timestamps are made relative to the oldest event to keep them readable
+    uint64_t base = UINT64_MAX;
+    for(auto &ringEvents : events) {
+        for(auto &event : ringEvents) {
+            base = std::min(base, event.begin_ns);
+        }
+    }
+    for(auto &frame : reg.frames) {
+        base = std::min(base, frame.end_ns);
+    }
+    if(base == UINT64_MAX) base = 0;
+
+    auto micros = [base](uint64_t ns) {
+        return static_cast<double>(ns - std::min(ns, base)) / 1e3;
+    };
+
+    file << "{\"traceEvents\":[\n";
+
+    bool first = true;
+    auto separator = [&first]() {
+        const char *result = first ? "" : ",\n";
+        first = false;
+        return result;
+    };
+
+    for(size_t r = 0; r < reg.rings.size(); r++) {
+        auto &ring = reg.rings[r];
+
+        file << fmt::format(
+            "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+            separator(), ring->index, utils::escapeJson(ring->name)
+        );
+
+        for(auto &event : events[r]) {
+
+            file << fmt::format(
+                "{}{{\"name\":\"{}\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                separator(),
+                utils::escapeJson(event.name),
+                ring->index,
+                micros(event.begin_ns),
+                static_cast<double>(event.end_ns - event.begin_ns) / 1e3
+            );
+        }
+    }
+
+    for(auto &frame : reg.frames) {
+        std::string args;
+        for(size_t i = 0; i < COUNTER_COUNT; i++) {
+            args += fmt::format("{}\"{}\":{}", i == 0 ? "" : ",", counterName(static_cast<Counter>(i)), frame.values[i]);
+        }
+
+        file << fmt::format(
+            "{}{{\"name\":\"Frame counters\",\"ph\":\"C\",\"pid\":0,\"ts\":{:.3f},\"args\":{{{}}}}}",
+            separator(), micros(frame.end_ns), args
+        );
+        file << fmt::format(
+            "{}{{\"name\":\"Frame {}\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":{:.3f}}}",
+            separator(), frame.frame, micros(frame.end_ns)
+        );
+    }
+
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    LOG_DEBUG("Wrote CPU trace of {} frames to {}.", reg.frames.size(), path);
+}
@@ -0,0 +1,268 @@
+#include "jobsystem.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+// Idle rounds a worker yields through before going to sleep
+static constexpr uint32_t SPIN_ROUNDS = 64;
+
+namespace {
+    thread_local const JobSystem *current_system = nullptr;
+    thread_local uint32_t current_worker = 0;
+}
+
+JobSystem::JobSystem(uint32_t worker_count) {
+    if(worker_count == 0) {
+        uint32_t hardware = std::thread::hardware_concurrency();
+        worker_count = std::max(hardware, 2u) - 1;
+    }
+
+    for(uint32_t i = 0; i < worker_count + 1; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    for(uint32_t i = 0; i < worker_count; i++) {
+        threads.emplace_back([this, i]() {
+            workerLoop(i);
+        });
+    }
+
+    LOG_DEBUG("Started job system with {} workers.", worker_count);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping.store(true, std::memory_order_release);
+    }
+    wake.notify_all();
+
+    for(auto &thread : threads) {
+        thread.join();
+    }
+
+    if(queued.load(std::memory_order_acquire) > 0) {
+        LOG_WARN("Job system destroyed with {} jobs that never ran.", queued.load());
+    }
+}
+
+uint32_t JobSystem::currentWorker() const {
+    if(current_system == this) {
+        return current_worker;
+    }
+
+    return static_cast<uint32_t>(threads.size());
+}
+
+void JobSystem::run(std::function<void()> job, JobCounter *counter) {
+    if(counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    submit(Job {
+        .function = std::move(job),
+        .counter = counter,
+    });
+}
+
+void JobSystem::runAfter(JobCounter &dependency, std::function<void()> job, JobCounter *counter) {
+    if(counter) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+        // finish() decrements under the same lock, so either it sees the
+        // continuation or the check here sees the zero
+        std::lock_guard<std::mutex> lock(dependency.mutex);
+
+        if(!dependency.done()) {
+            dependency.continuations.push_back(JobCounter::Continuation {
+                .function = std::move(job),
+                .counter = counter,
+            });
+            return;
+        }
+    }
+
+    submit(Job {
+        .function = std::move(job),
+        .counter = counter,
+    });
+}
+
+void JobSystem::submit(Job job) {
+    Worker &worker = *workers[currentWorker()];
+
+    // Counted before the push so the count never drops below the jobs in the deques
+    queued.fetch_add(1, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        if(sleeping == 0) return;
+    }
+    wake.notify_one();
+}
+
+bool JobSystem::popOwn(uint32_t worker, Job &job) {
+    Worker &own = *workers[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+
+    if(own.jobs.empty()) return false;
+
+    // Newest first, its data is most likely still in cache
+    job = std::move(own.jobs.back());
+    own.jobs.pop_back();
+
+    return true;
+}
+
+bool JobSystem::steal(uint32_t worker, Job &job) {
+    size_t count = workers.size();
+
+    for(size_t offset = 1; offset < count; offset++) {
+        Worker &victim = *workers[(worker + offset) % count];
+
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if(!lock.owns_lock() || victim.jobs.empty()) continue;
+
+        // Oldest first, usually the biggest remaining chunk of work
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+
+        workers[worker]->stolen.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    return false;
+}
+
+bool JobSystem::executeOne(uint32_t worker) {
+    if(queued.load(std::memory_order_acquire) == 0) return false;
+
+    Job job;
+    if(!popOwn(worker, job) && !steal(worker, job)) {
+        return false;
+    }
+
+    execute(job, worker);
+    return true;
+}
+
+void JobSystem::execute(Job &job, uint32_t worker) {
+    queued.fetch_sub(1, std::memory_order_acq_rel);
+
+    job.function();
+
+    workers[worker]->executed.fetch_add(1, std::memory_order_relaxed);
+
+    if(job.counter) {
+        finish(*job.counter);
+    }
+}
+
+void JobSystem::finish(JobCounter &counter) {
+    std::vector<JobCounter::Continuation> continuations;
+    {
+        // Decremented under the lock, wait() takes it once more before returning so
+        // the counter is never touched here after its owner moved on
+        std::lock_guard<std::mutex> lock(counter.mutex);
+
+        if(counter.pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+        continuations = std::move(counter.continuations);
+        counter.continuations.clear();
+    }
+
+    for(auto &continuation : continuations) {
+        submit(Job {
+            .function = std::move(continuation.function),
+            .counter = continuation.counter,
+        });
+    }
+}
+
+void JobSystem::wait(JobCounter &counter) {
+    SVK_ZONE("JobSystem::wait");
+
+    uint32_t worker = currentWorker();
+
+    while(!counter.done()) {
+        if(!executeOne(worker)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // The last finish() may still hold the lock, the counter has to outlive it
+    std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+void JobSystem::parallelFor(
+    uint32_t count,
+    uint32_t batch,
+    const std::function<void(uint32_t begin, uint32_t end)> &function
+) {
+    if(count == 0) return;
+
+    batch = std::max(batch, 1u);
+
+    JobCounter counter;
+
+    for(uint32_t begin = 0; begin < count; begin += batch) {
+        uint32_t end = std::min(count, begin + batch);
+
+        run([&function, begin, end]() {
+            function(begin, end);
+        }, &counter);
+    }
+
+    wait(counter);
+}
+
+JobSystemStats JobSystem::stats() const {
+    JobSystemStats result;
+
+    for(auto &worker : workers) {
+        result.executed += worker->executed.load(std::memory_order_relaxed);
+        result.stolen += worker->stolen.load(std::memory_order_relaxed);
+    }
+
+    return result;
+}
+
+void JobSystem::workerLoop(uint32_t worker) {
+    current_system = this;
+    current_worker = worker;
+
+    SVK_THREAD_NAME("Job worker " + std::to_string(worker));
+
+    uint32_t idle = 0;
+
+    while(!stopping.load(std::memory_order_acquire)) {
+        if(executeOne(worker)) {
+            idle = 0;
+            continue;
+        }
+
+        if(++idle < SPIN_ROUNDS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleeping++;
+        wake.wait(lock, [this]() {
+            return stopping.load(std::memory_order_acquire) || queued.load(std::memory_order_acquire) > 0;
+        });
+        sleeping--;
+
+        idle = 0;
+    }
+}
@@ -1,14 +1,267 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
-#include <fmt/base.h>
+#include <fmt/format.h>
 #include <log.hpp>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan_enums.hpp>
 
 int logging::Logging::LOG_LEVEL = 0;
 
+namespace {
+    // Power of two so positions can wrap with a mask
+    constexpr uint64_t RING_CAPACITY = 1 << 10;
+    constexpr auto IDLE_INTERVAL = std::chrono::milliseconds(10);
+
+    // Written by its thread only, drained by the logging thread.
+    // Positions grow forever, a slot is free again once tail passed it.
+    struct ThreadRing {
+        std::atomic<uint64_t> head {0};
+        std::atomic<uint64_t> tail {0};
+        std::unique_ptr<logging::detail::Record[]> records;
+    };
+
+    struct Backend {
+        // Guards the list of rings, a thread takes it only when logging for the first time
+        std::mutex rings_mutex;
+        std::vector<std::unique_ptr<ThreadRing>> rings;
+
+        // Held while draining so flush() and the logging thread never consume the same ring together
+        std::mutex drain_mutex;
+
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+
+        std::atomic<bool> running {false};
+        std::atomic<bool> stopping {false};
+        std::thread thread;
+    };
+
+    // Never destroyed, threads may still log while statics are torn down
+    Backend &backend() {
+        static Backend *instance = new Backend();
+        return *instance;
+    }
+
+    const char *prefix(int level) {
+        switch(level) {
+        case LOGLEVEL_DEBUG: return "\x1b[38;5;229m>\tDEBUG:\t\x1b[0m";
+        case LOGLEVEL_INFO: return "\x1b[38;5;111m>>\tINFO:\t\x1b[0m";
+        case LOGLEVEL_WARN: return "\x1b[38;5;208m>>>\tWARN:\t\x1b[0m";
+        default: return "\x1b[38;5;196m>>>>\tERROR:\t\x1b[0m";
+        }
+    }
+
+    uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count());
+    }
+
+    void wakeLoggingThread() {
+        backend().wake.notify_one();
+    }
+
+    // Formats everything published so far into a single write, oldest first across threads
+    void drain() {
+        auto &state = backend();
+        std::lock_guard<std::mutex> drainLock(state.drain_mutex);
+
+        struct Pending {
+            ThreadRing *ring;
+            uint64_t position;
+        };
+        std::vector<Pending> pending;
+
+        {
+            std::lock_guard<std::mutex> lock(state.rings_mutex);
+
+            for(auto &ring : state.rings) {
+                uint64_t head = ring->head.load(std::memory_order_acquire);
+                uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+                for(uint64_t i = tail; i < head; i++) {
+                    pending.push_back(Pending { ring.get(), i });
+                }
+            }
+        }
+
+        if(pending.empty()) return;
+
+        auto record = [](const Pending &entry) -> logging::detail::Record& {
+            return entry.ring->records[entry.position & (RING_CAPACITY - 1)];
+        };
+
+        std::stable_sort(pending.begin(), pending.end(), [&](const Pending &a, const Pending &b) {
+            return record(a).timestamp_ns < record(b).timestamp_ns;
+        });
+
+        fmt::memory_buffer out;
+        for(auto &entry : pending) {
+            auto &message = record(entry);
+
+            const char *levelPrefix = prefix(message.level);
+            out.append(levelPrefix, levelPrefix + std::char_traits<char>::length(levelPrefix));
+            message.format_to(message, out);
+            out.push_back('\n');
+
+            message.destroy(message);
+        }
+
+        // Slots are handed back only after their arguments were destroyed
+        for(auto &entry : pending) {
+            entry.ring->tail.store(entry.position + 1, std::memory_order_release);
+        }
+
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+    }
+
+    void loggingThread() {
+        auto &state = backend();
+
+        while(!state.stopping.load(std::memory_order_acquire)) {
+            {
+                std::unique_lock<std::mutex> lock(state.wake_mutex);
+                state.wake.wait_for(lock, IDLE_INTERVAL);
+            }
+
+            drain();
+        }
+    }
+
+    // Started with the first message and joined when the program exits,
+    // later messages are written on the calling thread
+    struct LoggingThreadGuard {
+        LoggingThreadGuard() {
+            auto &state = backend();
+
+            state.thread = std::thread(loggingThread);
+            state.running.store(true, std::memory_order_release);
+        }
+
+        ~LoggingThreadGuard() {
+            auto &state = backend();
+
+            state.running.store(false, std::memory_order_release);
+            state.stopping.store(true, std::memory_order_release);
+            wakeLoggingThread();
+            state.thread.join();
+
+            drain();
+        }
+    };
+
+    ThreadRing &threadRing() {
+        static LoggingThreadGuard guard;
+
+        thread_local ThreadRing *ring = [] {
+            auto &state = backend();
+
+            auto created = std::make_unique<ThreadRing>();
+            created->records = std::make_unique<logging::detail::Record[]>(RING_CAPACITY);
+
+            std::lock_guard<std::mutex> lock(state.rings_mutex);
+            state.rings.push_back(std::move(created));
+            return state.rings.back().get();
+        }();
+
+        return *ring;
+    }
+
+    // Validation messages keyed by their id, claimed with a CAS so the
+    // callback never locks. Counts are approximate when threads race on a window.
+    struct ValidationEntry {
+        std::atomic<uint64_t> key {0};
+        std::atomic<uint64_t> window {0};
+        std::atomic<uint32_t> count {0};
+        std::atomic<uint32_t> suppressed {0};
+    };
+
+    constexpr size_t VALIDATION_TABLE_SIZE = 1024;
+    std::array<ValidationEntry, VALIDATION_TABLE_SIZE> validation_table;
+
+    ValidationEntry *validationEntry(int32_t id) {
+        // The high bit keeps id 0 apart from empty slots
+        uint64_t key = static_cast<uint32_t>(id) | (1ull << 32);
+        size_t start = static_cast<uint32_t>(id) * 2654435761u % VALIDATION_TABLE_SIZE;
+
+        for(size_t i = 0; i < VALIDATION_TABLE_SIZE; i++) {
+            auto &entry = validation_table[(start + i) % VALIDATION_TABLE_SIZE];
+
+            uint64_t current = entry.key.load(std::memory_order_acquire);
+            if(current == key) return &entry;
+
+            if(current == 0 && entry.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                return &entry;
+            }
+            if(current == key) return &entry;
+        }
+
+        return nullptr;
+    }
+}
+
+logging::detail::Record *logging::detail::acquire() {
+    auto &ring = threadRing();
+    auto &state = backend();
+
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+    while(head - ring.tail.load(std::memory_order_acquire) >= RING_CAPACITY) {
+        if(!state.running.load(std::memory_order_acquire)) return nullptr;
+
+        // Full ring, the logging thread frees slots with every drain
+        wakeLoggingThread();
+        std::this_thread::yield();
+    }
+
+    if(!state.running.load(std::memory_order_acquire)) return nullptr;
+
+    auto &record = ring.records[head & (RING_CAPACITY - 1)];
+    record.timestamp_ns = now();
+
+    return &record;
+}
+
+void logging::detail::publish(Record *record) {
+    auto &ring = threadRing();
+
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+
+    // Warnings and errors are written promptly, everything else waits for the next drain
+    if(record->level <= LOGLEVEL_WARN || head + 1 - ring.tail.load(std::memory_order_relaxed) > RING_CAPACITY / 2) {
+        wakeLoggingThread();
+    }
+}
+
+void logging::detail::writeNow(int level, const std::string &message) {
+    // Keeps the order with anything still queued
+    drain();
+
+    auto &state = backend();
+    std::lock_guard<std::mutex> lock(state.drain_mutex);
+
+    fmt::print(stdout, "{}{}\n", prefix(level), message);
+    std::fflush(stdout);
+}
+
+void logging::flush() {
+    drain();
+}
+
 void logging::set_log_level(int log_level) noexcept {
     Logging::LOG_LEVEL = log_level;
 }
@@ -31,3 +284,45 @@ void logging::set_environmental_log_level(int _default) noexcept {
     if(loglevel == -1) set_log_level(_default);
     else set_log_level(loglevel);
 }
+
+VKAPI_ATTR VkBool32 VKAPI_CALL logging::debugCallback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+    VkDebugUtilsMessageTypeFlagsEXT messageType,
+    const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+    void* pUserData
+) {
+    int level = LOGLEVEL_DEBUG;
+    if(messageSeverity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+        level = LOGLEVEL_WARN;
+    } else if(messageSeverity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+        level = LOGLEVEL_ERROR;
+    }
+
+    // Dropped before any work when the level is filtered out
+    if(Logging::LOG_LEVEL < level) return vk::False;
+
+    const char *name = pCallbackData->pMessageIdName != nullptr ? pCallbackData->pMessageIdName : "";
+
+    if(ValidationEntry *entry = validationEntry(pCallbackData->messageIdNumber)) {
+        uint64_t second = now() / 1000000000ull;
+        uint64_t window = entry->window.load(std::memory_order_relaxed);
+
+        if(window != second && entry->window.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+            entry->count.store(0, std::memory_order_relaxed);
+
+            uint32_t suppressed = entry->suppressed.exchange(0, std::memory_order_relaxed);
+            if(suppressed > 0) {
+                write(level, "Validation layer: suppressed {} repeats of {}", suppressed, name);
+            }
+        }
+
+        if(entry->count.fetch_add(1, std::memory_order_relaxed) >= VALIDATION_REPEAT_LIMIT) {
+            entry->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return vk::False;
+        }
+    }
+
+    write(level, "Validation layer: {}", pCallbackData->pMessage);
+
+    return vk::False;
+}
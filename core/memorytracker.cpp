@@ -0,0 +1,297 @@
+#include "memorytracker.hpp"
+
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+
+// Share of a heap assumed to be available when the driver reports no budget
+static constexpr double ESTIMATED_BUDGET = 0.8;
+
+const char *memoryCategoryName(MemoryCategory category) {
+    switch(category) {
+    case MemoryCategory::Buffer: return "Buffer";
+    case MemoryCategory::Image: return "Image";
+    case MemoryCategory::Attachment: return "Attachment";
+    case MemoryCategory::RenderGraph: return "Render graph";
+    case MemoryCategory::Other: return "Other";
+    }
+
+    return "Unknown";
+}
+
+MemoryTracker::MemoryTracker(Device &device): device(device) {
+    const auto &memory_properties = properties();
+
+    heaps.resize(memory_properties.memoryHeapCount);
+    for(uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+        auto &heap = memory_properties.memoryHeaps[i];
+
+        heaps[i].size = heap.size;
+        heaps[i].budget = static_cast<vk::DeviceSize>(heap.size * ESTIMATED_BUDGET);
+        heaps[i].device_local = static_cast<bool>(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+    }
+
+    update();
+}
+
+// The ranking a set of required flags is looked up in
+static MemoryUsage usageForFlags(vk::MemoryPropertyFlags required) {
+    using Flag = vk::MemoryPropertyFlagBits;
+
+    if(!(required & Flag::eHostVisible)) return MemoryUsage::GpuOnly;
+    if(required & Flag::eHostCached) return MemoryUsage::Readback;
+    if(required & Flag::eDeviceLocal) return MemoryUsage::Dynamic;
+
+    return MemoryUsage::Upload;
+}
+
+std::optional<uint32_t> MemoryTracker::tryFindMemoryType(uint32_t type_bits, vk::MemoryPropertyFlags required) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const auto &memory_properties = properties();
+
+    std::optional<uint32_t> over_budget;
+
+    for(uint32_t type : device.memory_type_ranking[static_cast<size_t>(usageForFlags(required))]) {
+        if(!(type_bits & (1u << type))) continue;
+        if((memory_properties.memoryTypes[type].propertyFlags & required) != required) continue;
+
+        uint32_t heap = memory_properties.memoryTypes[type].heapIndex;
+        if(heapUsage(heap) < heaps[heap].budget) return type;
+
+        if(!over_budget.has_value()) over_budget = type;
+    }
+
+    if(over_budget.has_value()) return over_budget;
+
+    // Types the ranking leaves out, e.g. host visible memory that is not coherent
+    for(uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if((type_bits & (1u << i)) && (memory_properties.memoryTypes[i].propertyFlags & required) == required) {
+            return i;
+        }
+    }
+
+    return std::nullopt;
+}
+
+uint32_t MemoryTracker::findMemoryType(uint32_t type_bits, vk::MemoryPropertyFlags required) {
+    auto type = tryFindMemoryType(type_bits, required);
+
+    if(!type.has_value()) {
+        THROW(runtime_error, "Failed to find a memory type with {}.", vk::to_string(required));
+    }
+
+    return *type;
+}
+
+vk::DeviceMemory MemoryTracker::allocate(vk::MemoryAllocateInfo info, MemoryCategory category, float priority) {
+    auto priorityInfo = vk::MemoryPriorityAllocateInfoEXT()
+        .setPriority(std::clamp(priority, 0.0f, 1.0f));
+
+    if(device.capabilities.memoryPriority) {
+        priorityInfo.setPNext(info.pNext);
+        info.setPNext(&priorityInfo);
+    }
+
+    vk::DeviceMemory memory = device.v_device.allocateMemory(info, nullptr, device.v_dispatcher);
+    SVK_COUNT(Allocations, 1);
+
+    uint32_t heap = properties().memoryTypes[info.memoryTypeIndex].heapIndex;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    allocations.emplace(static_cast<VkDeviceMemory>(memory), Allocation {
+        .heap = heap,
+        .size = info.allocationSize,
+        .category = category,
+        .priority = priorityInfo.priority,
+    });
+
+    heaps[heap].tracked += info.allocationSize;
+    heaps[heap].allocations++;
+
+    category_bytes[static_cast<size_t>(category)] += info.allocationSize;
+    category_allocations[static_cast<size_t>(category)]++;
+
+    return memory;
+}
+
+void MemoryTracker::release(vk::DeviceMemory memory) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = allocations.find(static_cast<VkDeviceMemory>(memory));
+    if(it == allocations.end()) return;
+
+    auto &allocation = it->second;
+
+    heaps[allocation.heap].tracked -= allocation.size;
+    heaps[allocation.heap].allocations--;
+
+    category_bytes[static_cast<size_t>(allocation.category)] -= allocation.size;
+    category_allocations[static_cast<size_t>(allocation.category)]--;
+
+    auto pending = evicting.find(static_cast<VkDeviceMemory>(memory));
+    if(pending != evicting.end()) {
+        heaps[allocation.heap].evicting -= pending->second;
+        evicting.erase(pending);
+    }
+
+    allocations.erase(it);
+
+    for(auto evictable = evictables.begin(); evictable != evictables.end();) {
+        bool freed = evictable->second.memory == static_cast<VkDeviceMemory>(memory);
+        evictable = freed ? evictables.erase(evictable) : std::next(evictable);
+    }
+}
+
+ResidencyHandle MemoryTracker::registerEvictable(vk::DeviceMemory memory, float priority, std::function<void()> evict) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = allocations.find(static_cast<VkDeviceMemory>(memory));
+    if(it == allocations.end()) {
+        THROW(runtime_error, "Registering memory as evictable that was not allocated through the tracker.");
+    }
+
+    ResidencyHandle handle = next_handle++;
+
+    evictables.emplace(handle, Evictable {
+        .memory = static_cast<VkDeviceMemory>(memory),
+        .heap = it->second.heap,
+        .size = it->second.size,
+        .priority = priority,
+        .evict = std::move(evict),
+    });
+
+    return handle;
+}
+
+void MemoryTracker::unregisterEvictable(ResidencyHandle handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    evictables.erase(handle);
+}
+
+vk::DeviceSize MemoryTracker::heapUsage(uint32_t heap) const {
+    return device.capabilities.memoryBudget ? heaps[heap].usage : heaps[heap].tracked;
+}
+
+void MemoryTracker::update() {
+    SVK_ZONE("MemoryTracker::update");
+
+    std::vector<std::function<void()>> evict;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if(device.capabilities.memoryBudget) {
+            auto properties = device.v_physical_device.getMemoryProperties2<
+                vk::PhysicalDeviceMemoryProperties2,
+                vk::PhysicalDeviceMemoryBudgetPropertiesEXT
+            >(device.v_dispatcher);
+            auto &budget = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+
+            for(uint32_t i = 0; i < heaps.size(); i++) {
+                heaps[i].budget = budget.heapBudget[i];
+                heaps[i].usage = budget.heapUsage[i];
+            }
+        } else {
+            for(auto &heap : heaps) {
+                heap.usage = heap.tracked;
+            }
+        }
+
+        // Lowest priority first, ties broken by size so fewer evictions free more
+        std::vector<std::pair<ResidencyHandle, Evictable*>> candidates;
+        candidates.reserve(evictables.size());
+        for(auto &[handle, evictable] : evictables) {
+            candidates.emplace_back(handle, &evictable);
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+            if(a.second->priority != b.second->priority) return a.second->priority < b.second->priority;
+            return a.second->size > b.second->size;
+        });
+
+        for(uint32_t heap = 0; heap < heaps.size(); heap++) {
+            double budget = static_cast<double>(heaps[heap].budget);
+            double usage = static_cast<double>(heapUsage(heap));
+
+            // Evicted memory still counts until the deletion queue frees it, a few frames later
+            usage -= static_cast<double>(heaps[heap].evicting);
+
+            if(budget == 0.0) continue;
+
+            // Pressure is gone, hand downgraded memory its allocation priority back
+            if(usage <= budget * downgrade_threshold) {
+                for(auto &[handle, evictable] : candidates) {
+                    if(evictable->heap != heap || !evictable->downgraded) continue;
+
+                    auto allocation = allocations.find(evictable->memory);
+                    if(allocation == allocations.end()) continue;
+
+                    device.v_device.setMemoryPriorityEXT(
+                        vk::DeviceMemory(evictable->memory), allocation->second.priority, device.v_dispatcher
+                    );
+                    evictable->downgraded = false;
+                }
+                continue;
+            }
+
+            // Downgrading frees nothing by itself, it only decides what the OS pages out first
+            if(device.capabilities.pageableDeviceLocalMemory) {
+                double excess = usage - budget * downgrade_threshold;
+
+                for(auto &[handle, evictable] : candidates) {
+                    if(excess <= 0.0) break;
+                    if(evictable->heap != heap || evictable->downgraded || evictable->evicted) continue;
+
+                    device.v_device.setMemoryPriorityEXT(vk::DeviceMemory(evictable->memory), 0.0f, device.v_dispatcher);
+                    evictable->downgraded = true;
+                    excess -= static_cast<double>(evictable->size);
+                    downgrades++;
+                }
+            }
+
+            if(usage <= budget * evict_threshold) continue;
+
+            double excess = usage - budget * downgrade_threshold;
+
+            for(auto &[handle, evictable] : candidates) {
+                if(excess <= 0.0) break;
+                if(evictable->heap != heap || !evictable->evict || evictable->evicted) continue;
+
+                excess -= static_cast<double>(evictable->size);
+                evict.push_back(std::move(evictable->evict));
+                evictable->evicted = true;
+                evictions++;
+
+                evicting.emplace(evictable->memory, evictable->size);
+                heaps[heap].evicting += evictable->size;
+
+                LOG_DEBUG("Evicting {} bytes from heap {} ({} of {} budget bytes used).",
+                    evictable->size, heap, static_cast<vk::DeviceSize>(usage), heaps[heap].budget
+                );
+            }
+        }
+
+        for(auto it = evictables.begin(); it != evictables.end();) {
+            it = it->second.evicted ? evictables.erase(it) : std::next(it);
+        }
+    }
+
+    for(auto &callback : evict) {
+        callback();
+    }
+}
+
+MemoryStats MemoryTracker::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    MemoryStats result;
+    result.heaps = heaps;
+    result.category_bytes = category_bytes;
+    result.category_allocations = category_allocations;
+    result.downgrades = downgrades;
+    result.evictions = evictions;
+    result.driver_budget = device.capabilities.memoryBudget;
+
+    return result;
+}
@@ -0,0 +1,270 @@
+#include "meshpool.hpp"
+
+#include "instrument.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+MeshPool::MeshPool(
+    Device &device,
+    const VertexLayout &layout,
+    uint32_t vertices_per_page,
+    uint32_t indices_per_page,
+    vk::DispatchLoaderDynamic &dispatcher
+): device(device), layout(layout), vertices_per_page(vertices_per_page),
+   indices_per_page(indices_per_page), v_dispatcher(dispatcher) {
+    if(layout.stride() == 0) {
+        THROW(invalid_argument, "MeshPool needs a vertex layout with at least one attribute.");
+    }
+}
+
+MeshPool::~MeshPool() {
+    for(auto &page : pages) {
+        device.resource_states->forgetBuffer(page.vertices.v_buffer);
+        device.resource_states->forgetBuffer(page.indices.v_buffer);
+    }
+}
+
+uint32_t MeshPool::createPage(uint32_t vertex_capacity, uint32_t index_capacity) {
+    auto vertexInfo = vk::BufferCreateInfo()
+        .setSize(static_cast<vk::DeviceSize>(vertex_capacity) * layout.stride())
+        .setUsage(vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    auto indexInfo = vk::BufferCreateInfo()
+        .setSize(static_cast<vk::DeviceSize>(index_capacity) * sizeof(uint32_t))
+        .setUsage(vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    pages.push_back(Page {
+        .vertices = Buffer(device, vertexInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, v_dispatcher),
+        .indices = Buffer(device, indexInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, v_dispatcher),
+        .vertex_ranges = RangeAllocator(vertex_capacity),
+        .index_ranges = RangeAllocator(index_capacity),
+    });
+
+    Page &page = pages.back();
+    device.resource_states->trackBuffer(page.vertices.v_buffer);
+    device.resource_states->trackBuffer(page.indices.v_buffer);
+
+    LOG_DEBUG("Mesh pool page {} created, {} vertices and {} indices",
+        pages.size() - 1, vertex_capacity, index_capacity);
+
+    return static_cast<uint32_t>(pages.size() - 1);
+}
+
+void MeshPool::reclaim() {
+    uint64_t completed = device.deletion_queue->completedValue();
+
+    auto it = std::remove_if(retired.begin(), retired.end(), [&](const RetiredMesh &retired_mesh) {
+        if(retired_mesh.retire_value > completed) return false;
+
+        const MeshAllocation &mesh = retired_mesh.mesh;
+        Page &page = pages[mesh.page];
+
+        page.vertex_ranges.free(static_cast<uint64_t>(mesh.vertex_offset), mesh.vertex_count);
+        page.index_ranges.free(mesh.first_index, mesh.index_count);
+        return true;
+    });
+    retired.erase(it, retired.end());
+}
+
+MeshAllocation MeshPool::add(const void *vertices, uint32_t vertex_count, const uint32_t *indices, uint32_t index_count) {
+    SVK_ZONE("MeshPool::add");
+
+    if(vertex_count == 0 || index_count == 0) {
+        THROW(invalid_argument, "Meshes added to a MeshPool need vertices and indices.");
+    }
+
+    reclaim();
+
+    MeshAllocation mesh;
+    mesh.vertex_count = vertex_count;
+    mesh.index_count = index_count;
+
+    uint64_t vertex_offset = RangeAllocator::INVALID;
+    uint64_t first_index = RangeAllocator::INVALID;
+
+    for(uint32_t i = 0; i < pages.size(); i++) {
+        Page &page = pages[i];
+
+        vertex_offset = page.vertex_ranges.allocate(vertex_count);
+        if(vertex_offset == RangeAllocator::INVALID) continue;
+
+        first_index = page.index_ranges.allocate(index_count);
+        if(first_index == RangeAllocator::INVALID) {
+            page.vertex_ranges.free(vertex_offset, vertex_count);
+            continue;
+        }
+
+        mesh.page = i;
+        break;
+    }
+
+    if(first_index == RangeAllocator::INVALID) {
+        mesh.page = createPage(
+            std::max(vertex_count, vertices_per_page),
+            std::max(index_count, indices_per_page)
+        );
+
+        vertex_offset = pages[mesh.page].vertex_ranges.allocate(vertex_count);
+        first_index = pages[mesh.page].index_ranges.allocate(index_count);
+    }
+
+    mesh.vertex_offset = static_cast<int32_t>(vertex_offset);
+    mesh.first_index = static_cast<uint32_t>(first_index);
+    pages[mesh.page].meshes++;
+
+    auto vertex_bytes = static_cast<const uint8_t*>(vertices);
+    auto index_bytes = reinterpret_cast<const uint8_t*>(indices);
+
+    pending.push_back(PendingUpload {
+        .page = mesh.page,
+        .index = false,
+        .offset = vertex_offset * layout.stride(),
+        .data = std::vector<uint8_t>(vertex_bytes, vertex_bytes + static_cast<size_t>(vertex_count) * layout.stride()),
+    });
+
+    pending.push_back(PendingUpload {
+        .page = mesh.page,
+        .index = true,
+        .offset = first_index * sizeof(uint32_t),
+        .data = std::vector<uint8_t>(index_bytes, index_bytes + static_cast<size_t>(index_count) * sizeof(uint32_t)),
+    });
+
+    return mesh;
+}
+
+void MeshPool::remove(const MeshAllocation &mesh) {
+    if(mesh.page >= pages.size()) {
+        LOG_ERROR("Removed mesh refers to page {}, the pool has {}", mesh.page, pages.size());
+        return;
+    }
+
+    vk::DeviceSize vertex_begin = static_cast<vk::DeviceSize>(mesh.vertex_offset) * layout.stride();
+    vk::DeviceSize index_begin = static_cast<vk::DeviceSize>(mesh.first_index) * sizeof(uint32_t);
+
+    // Uploads that were never recorded are dropped
+    auto it = std::remove_if(pending.begin(), pending.end(), [&](const PendingUpload &upload) {
+        if(upload.page != mesh.page) return false;
+        return upload.offset == (upload.index ? index_begin : vertex_begin);
+    });
+    pending.erase(it, pending.end());
+
+    pages[mesh.page].meshes--;
+
+    retired.push_back(RetiredMesh {
+        .mesh = mesh,
+        .retire_value = device.deletion_queue->retireValue(),
+    });
+}
+
+void MeshPool::recordUploads(vk::CommandBuffer command_buffer) {
+    SVK_ZONE("MeshPool::recordUploads");
+
+    reclaim();
+
+    if(pending.empty()) return;
+
+    vk::DeviceSize total = 0;
+    for(auto &upload : pending) {
+        total += upload.data.size();
+    }
+
+    auto stagingInfo = vk::BufferCreateInfo()
+        .setSize(total)
+        .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    // Released into the deletion queue at the end of the scope, after the copies ran
+    Buffer staging(
+        device,
+        stagingInfo,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        v_dispatcher
+    );
+
+    BarrierBatcher batcher(device, *device.resource_states);
+    {
+        auto mapping = staging.mapMemory();
+        auto mapped = static_cast<uint8_t*>(*mapping);
+
+        vk::DeviceSize offset = 0;
+        for(auto &upload : pending) {
+            std::memcpy(mapped + offset, upload.data.data(), upload.data.size());
+            offset += upload.data.size();
+
+            Page &page = pages[upload.page];
+            batcher.access(upload.index ? page.indices.v_buffer : page.vertices.v_buffer, ResourceUsage::TransferDst);
+        }
+    }
+
+    batcher.flush(command_buffer);
+
+    vk::DeviceSize offset = 0;
+    for(auto &upload : pending) {
+        Page &page = pages[upload.page];
+        vk::Buffer destination = upload.index ? page.indices.v_buffer : page.vertices.v_buffer;
+
+        command_buffer.copyBuffer(
+            staging.v_buffer,
+            destination,
+            vk::BufferCopy(offset, upload.offset, upload.data.size()),
+            v_dispatcher
+        );
+
+        offset += upload.data.size();
+    }
+
+    SVK_COUNT(Uploads, pending.size());
+
+    bytes_uploaded += total;
+    pending.clear();
+}
+
+void MeshPool::prepare(BarrierBatcher &batcher) {
+    for(auto &page : pages) {
+        batcher.access(page.vertices.v_buffer, ResourceUsage::VertexBuffer);
+        batcher.access(page.indices.v_buffer, ResourceUsage::IndexBuffer);
+    }
+}
+
+void MeshPool::bind(vk::CommandBuffer command_buffer, uint32_t page) {
+    vk::DeviceSize offset = 0;
+
+    command_buffer.bindVertexBuffers(0, pages[page].vertices.v_buffer, offset, v_dispatcher);
+    command_buffer.bindIndexBuffer(pages[page].indices.v_buffer, 0, vk::IndexType::eUint32, v_dispatcher);
+}
+
+void MeshPool::draw(
+    vk::CommandBuffer command_buffer,
+    const MeshAllocation &mesh,
+    uint32_t instance_count,
+    uint32_t first_instance
+) {
+    command_buffer.drawIndexed(
+        mesh.index_count,
+        instance_count,
+        mesh.first_index,
+        mesh.vertex_offset,
+        first_instance,
+        v_dispatcher
+    );
+
+    SVK_COUNT(Draws, 1);
+}
+
+MeshPoolStats MeshPool::stats() const {
+    MeshPoolStats result;
+    result.pages = static_cast<uint32_t>(pages.size());
+    result.bytes_uploaded = bytes_uploaded;
+
+    for(auto &page : pages) {
+        result.meshes += page.meshes;
+        result.vertices_used += page.vertex_ranges.used();
+        result.indices_used += page.index_ranges.used();
+    }
+
+    return result;
+}
@@ -0,0 +1,411 @@
+#include "meshutil.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+// Tuning constants of Forsyth's vertex cache optimization
+static constexpr size_t CACHE_SIZE = 32;
+static constexpr float CACHE_DECAY_POWER = 1.5f;
+static constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+static constexpr float VALENCE_BOOST_SCALE = 2.0f;
+static constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+uint16_t utils::floatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t biased = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // Infinity and NaN
+    if(biased == 0xff) {
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+
+    int32_t exponent = static_cast<int32_t>(biased) - 127 + 15;
+
+    if(exponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+
+    // Subnormal halves, or zero when even those are too small
+    if(exponent <= 0) {
+        if(exponent < -10) return static_cast<uint16_t>(sign);
+
+        mantissa |= 0x800000;
+        uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        if((mantissa >> (shift - 1)) & 1) half++;
+
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    // Rounding may carry into the exponent, which is still the right result
+    if(mantissa & 0x1000) half++;
+
+    return static_cast<uint16_t>(half);
+}
+
+int16_t utils::quantizeSnorm16(float value) {
+    value = std::clamp(value, -1.0f, 1.0f);
+    return static_cast<int16_t>(std::lround(value * 32767.0f));
+}
+
+std::array<float, 2> utils::octEncode(float x, float y, float z) {
+    float length = std::abs(x) + std::abs(y) + std::abs(z);
+    if(length == 0.0f) return {0.0f, 0.0f};
+
+    x /= length;
+    y /= length;
+    z /= length;
+
+    // The lower hemisphere folds over the diagonals
+    if(z < 0.0f) {
+        float folded_x = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float folded_y = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    return {x, y};
+}
+
+utils::MeshBounds utils::computeBounds(const float *positions, size_t vertex_count, size_t stride) {
+    MeshBounds bounds;
+    if(vertex_count == 0) return bounds;
+
+    float min[3], max[3];
+    for(size_t axis = 0; axis < 3; axis++) {
+        min[axis] = std::numeric_limits<float>::max();
+        max[axis] = std::numeric_limits<float>::lowest();
+    }
+
+    for(size_t i = 0; i < vertex_count; i++) {
+        const float *position = positions + i * stride;
+
+        for(size_t axis = 0; axis < 3; axis++) {
+            min[axis] = std::min(min[axis], position[axis]);
+            max[axis] = std::max(max[axis], position[axis]);
+        }
+    }
+
+    // One extent for all axes keeps the quantization error uniform
+    float extent = 0.0f;
+    for(size_t axis = 0; axis < 3; axis++) {
+        bounds.center[axis] = (min[axis] + max[axis]) * 0.5f;
+        extent = std::max(extent, (max[axis] - min[axis]) * 0.5f);
+    }
+    bounds.extent = extent > 0.0f ? extent : 1.0f;
+
+    return bounds;
+}
+
+utils::QuantizedVertex utils::quantizeVertex(
+    const float position[3],
+    const float normal[3],
+    const float uv[2],
+    const MeshBounds &bounds
+) {
+    QuantizedVertex vertex;
+
+    for(size_t axis = 0; axis < 3; axis++) {
+        vertex.position[axis] = quantizeSnorm16((position[axis] - bounds.center[axis]) / bounds.extent);
+    }
+    vertex.position[3] = 32767;
+
+    auto octahedral = octEncode(normal[0], normal[1], normal[2]);
+    vertex.normal[0] = quantizeSnorm16(octahedral[0]);
+    vertex.normal[1] = quantizeSnorm16(octahedral[1]);
+
+    vertex.uv[0] = floatToHalf(uv[0]);
+    vertex.uv[1] = floatToHalf(uv[1]);
+
+    return vertex;
+}
+
+static float vertexScore(int32_t cache_position, uint32_t remaining) {
+    // Vertices without triangles left never matter again
+    if(remaining == 0) return -1.0f;
+
+    float score = 0.0f;
+
+    if(cache_position >= 0) {
+        if(cache_position < 3) {
+            // Used by the last triangle, slightly penalized to avoid strips
+            score = LAST_TRIANGLE_SCORE;
+        } else {
+            float scale = 1.0f / static_cast<float>(CACHE_SIZE - 3);
+            score = std::pow(1.0f - static_cast<float>(cache_position - 3) * scale, CACHE_DECAY_POWER);
+        }
+    }
+
+    // Finishing off vertices with few triangles left avoids lone triangles later
+    score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remaining), -VALENCE_BOOST_POWER);
+
+    return score;
+}
+
+void utils::optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertex_count) {
+    size_t triangle_count = indices.size() / 3;
+    if(triangle_count == 0) return;
+
+    // Triangles of every vertex, the first `remaining[v]` entries are the live ones
+    std::vector<uint32_t> remaining(vertex_count, 0);
+    for(uint32_t index : indices) {
+        remaining[index]++;
+    }
+
+    std::vector<uint32_t> offsets(vertex_count + 1, 0);
+    for(size_t v = 0; v < vertex_count; v++) {
+        offsets[v + 1] = offsets[v] + remaining[v];
+    }
+
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for(size_t i = 0; i < indices.size(); i++) {
+        adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    std::vector<int32_t> cache_position(vertex_count, -1);
+    std::vector<float> vertex_scores(vertex_count);
+    for(size_t v = 0; v < vertex_count; v++) {
+        vertex_scores[v] = vertexScore(-1, remaining[v]);
+    }
+
+    std::vector<float> triangle_scores(triangle_count);
+    for(size_t t = 0; t < triangle_count; t++) {
+        triangle_scores[t] = vertex_scores[indices[t * 3]] +
+            vertex_scores[indices[t * 3 + 1]] +
+            vertex_scores[indices[t * 3 + 2]];
+    }
+
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> next_cache;
+    cache.reserve(CACHE_SIZE + 3);
+    next_cache.reserve(CACHE_SIZE + 3);
+
+    size_t scan = 0;
+    int64_t best = -1;
+
+    while(output.size() < triangle_count * 3) {
+        // Nothing in the cache has triangles left, continue with the next unused one
+        if(best < 0) {
+            while(emitted[scan]) scan++;
+            best = static_cast<int64_t>(scan);
+        }
+
+        size_t triangle = static_cast<size_t>(best);
+        const uint32_t *corners = &indices[triangle * 3];
+
+        emitted[triangle] = true;
+        output.insert(output.end(), corners, corners + 3);
+
+        for(size_t k = 0; k < 3; k++) {
+            uint32_t v = corners[k];
+
+            uint32_t *begin = &adjacency[offsets[v]];
+            uint32_t *end = begin + remaining[v];
+            uint32_t *found = std::find(begin, end, static_cast<uint32_t>(triangle));
+
+            if(found != end) {
+                std::swap(*found, *(end - 1));
+                remaining[v]--;
+            }
+        }
+
+        // The triangle's vertices move to the front, everything else shifts back
+        next_cache.assign(corners, corners + 3);
+        for(uint32_t v : cache) {
+            if(v != corners[0] && v != corners[1] && v != corners[2]) {
+                next_cache.push_back(v);
+            }
+        }
+
+        for(uint32_t v : cache) {
+            cache_position[v] = -1;
+        }
+
+        for(size_t i = 0; i < next_cache.size(); i++) {
+            uint32_t v = next_cache[i];
+
+            cache_position[v] = i < CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+            vertex_scores[v] = vertexScore(cache_position[v], remaining[v]);
+        }
+
+        best = -1;
+        float best_score = -std::numeric_limits<float>::max();
+
+        // Evicted vertices are rescored too, their triangles only lose score
+        for(uint32_t v : next_cache) {
+            for(uint32_t i = 0; i < remaining[v]; i++) {
+                uint32_t t = adjacency[offsets[v] + i];
+
+                float score = vertex_scores[indices[t * 3]] +
+                    vertex_scores[indices[t * 3 + 1]] +
+                    vertex_scores[indices[t * 3 + 2]];
+                triangle_scores[t] = score;
+
+                if(score > best_score) {
+                    best_score = score;
+                    best = t;
+                }
+            }
+        }
+
+        if(next_cache.size() > CACHE_SIZE) {
+            next_cache.resize(CACHE_SIZE);
+        }
+        std::swap(cache, next_cache);
+    }
+
+    indices = std::move(output);
+}
+
+void utils::optimizeOverdraw(
+    std::vector<uint32_t> &indices,
+    const float *positions,
+    size_t vertex_count,
+    size_t stride,
+    size_t cluster_triangles
+) {
+    size_t triangle_count = indices.size() / 3;
+    if(triangle_count == 0 || vertex_count == 0) return;
+
+    cluster_triangles = std::max<size_t>(cluster_triangles, 1);
+    size_t cluster_count = (triangle_count + cluster_triangles - 1) / cluster_triangles;
+
+    struct Cluster {
+        size_t first;
+        size_t count;
+        float centroid[3];
+        float normal[3];
+        float sort_key;
+    };
+    std::vector<Cluster> clusters(cluster_count);
+
+    float mesh_centroid[3] = {0.0f, 0.0f, 0.0f};
+    float mesh_area = 0.0f;
+
+    for(size_t c = 0; c < cluster_count; c++) {
+        Cluster &cluster = clusters[c];
+        cluster.first = c * cluster_triangles;
+        cluster.count = std::min(cluster_triangles, triangle_count - cluster.first);
+
+        float area_sum = 0.0f;
+        for(size_t axis = 0; axis < 3; axis++) {
+            cluster.centroid[axis] = 0.0f;
+            cluster.normal[axis] = 0.0f;
+        }
+
+        for(size_t t = cluster.first; t < cluster.first + cluster.count; t++) {
+            const float *a = positions + indices[t * 3] * stride;
+            const float *b = positions + indices[t * 3 + 1] * stride;
+            const float *c = positions + indices[t * 3 + 2] * stride;
+
+            float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            float ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+            float cross[3] = {
+                ab[1] * ac[2] - ab[2] * ac[1],
+                ab[2] * ac[0] - ab[0] * ac[2],
+                ab[0] * ac[1] - ab[1] * ac[0],
+            };
+
+            // Twice the area, weighs both the normal and the centroid
+            float area = std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+
+            for(size_t axis = 0; axis < 3; axis++) {
+                float centroid = (a[axis] + b[axis] + c[axis]) / 3.0f;
+
+                cluster.centroid[axis] += centroid * area;
+                cluster.normal[axis] += cross[axis];
+                mesh_centroid[axis] += centroid * area;
+            }
+
+            area_sum += area;
+        }
+
+        mesh_area += area_sum;
+
+        if(area_sum > 0.0f) {
+            for(size_t axis = 0; axis < 3; axis++) {
+                cluster.centroid[axis] /= area_sum;
+            }
+        }
+    }
+
+    if(mesh_area > 0.0f) {
+        for(size_t axis = 0; axis < 3; axis++) {
+            mesh_centroid[axis] /= mesh_area;
+        }
+    }
+
+    for(auto &cluster : clusters) {
+        float length = std::sqrt(
+            cluster.normal[0] * cluster.normal[0] +
+            cluster.normal[1] * cluster.normal[1] +
+            cluster.normal[2] * cluster.normal[2]
+        );
+
+        cluster.sort_key = 0.0f;
+        if(length == 0.0f) continue;
+
+        // How far out the cluster sits along the direction it faces
+        for(size_t axis = 0; axis < 3; axis++) {
+            cluster.sort_key += (cluster.centroid[axis] - mesh_centroid[axis]) * cluster.normal[axis] / length;
+        }
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) {
+        return a.sort_key > b.sort_key;
+    });
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    for(auto &cluster : clusters) {
+        output.insert(
+            output.end(),
+            indices.begin() + cluster.first * 3,
+            indices.begin() + (cluster.first + cluster.count) * 3
+        );
+    }
+
+    indices = std::move(output);
+}
+
+size_t utils::optimizeVertexFetch(void *vertices, size_t vertex_count, size_t vertex_size, std::vector<uint32_t> &indices) {
+    constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+
+    std::vector<uint32_t> remap(vertex_count, UNUSED);
+    uint32_t next = 0;
+
+    for(uint32_t &index : indices) {
+        if(remap[index] == UNUSED) {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+
+    auto source = static_cast<uint8_t*>(vertices);
+    std::vector<uint8_t> reordered(static_cast<size_t>(next) * vertex_size);
+
+    // Vertices no index refers to are dropped
+    for(size_t v = 0; v < vertex_count; v++) {
+        if(remap[v] == UNUSED) continue;
+
+        std::memcpy(&reordered[remap[v] * vertex_size], source + v * vertex_size, vertex_size);
+    }
+
+    std::memcpy(source, reordered.data(), reordered.size());
+
+    return next;
+}
@@ -0,0 +1,117 @@
+#include "offscreen.hpp"
+#include "barriers.hpp"
+#include "formatutil.hpp"
+#include "log.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_to_string.hpp>
+
+static constexpr vk::ImageUsageFlags OFFSCREEN_USAGE =
+    vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+
+OffscreenTarget::OffscreenTarget(
+    Device &device,
+    vk::Extent2D extent,
+    vk::Format format,
+    vk::DispatchLoaderDynamic &dispatcher
+) : device(device),
+    extent(extent),
+    format(format),
+    texel_size(utils::formatSize(format)),
+    v_dispatcher(dispatcher),
+    readbacks(device, static_cast<vk::DeviceSize>(extent.width) * extent.height * texel_size, dispatcher)
+{
+    auto imageInfo = vk::ImageCreateInfo()
+        .setImageType(vk::ImageType::e2D)
+        .setFormat(format)
+        .setExtent(vk::Extent3D(extent.width, extent.height, 1))
+        .setMipLevels(1)
+        .setArrayLayers(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(OFFSCREEN_USAGE)
+        .setSharingMode(vk::SharingMode::eExclusive)
+        .setInitialLayout(vk::ImageLayout::eUndefined);
+
+    color = Image(
+        device,
+        imageInfo,
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        vk::ImageAspectFlagBits::eColor,
+        dispatcher
+    );
+
+    layout.colorAttachments.push_back(AttachmentInfo {
+        .format = format,
+        .finalLayout = vk::ImageLayout::eTransferSrcOptimal,
+    });
+
+    LOG_DEBUG("Created {}x{} offscreen target ({}).", extent.width, extent.height, vk::to_string(format));
+}
+
+RenderPass &OffscreenTarget::renderPass() {
+    return device.render_pass_cache->get(layout);
+}
+
+void OffscreenTarget::beginRenderPass(vk::CommandBuffer command_buffer, vk::ClearColorValue clear_color) {
+    // Orders the render pass after the previous frame's copy out of the image
+    BarrierBatcher batcher(device, *device.resource_states);
+    batcher.transition(color.v_image, ResourceUsage::ColorAttachment);
+    batcher.flush(command_buffer);
+
+    device.framebuffer_cache->beginRenderPass(
+        command_buffer,
+        renderPass(),
+        {{color.v_image_view, OFFSCREEN_USAGE}},
+        extent,
+        {vk::ClearValue(clear_color)}
+    );
+}
+
+void OffscreenTarget::endRenderPass(vk::CommandBuffer command_buffer) {
+    command_buffer.endRenderPass(v_dispatcher);
+
+    device.resource_states->setImageState(color.v_image, ResourceState {
+        vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+        vk::AccessFlagBits2::eColorAttachmentWrite,
+        vk::ImageLayout::eTransferSrcOptimal,
+    });
+}
+
+bool OffscreenTarget::requestReadback(vk::CommandBuffer command_buffer) {
+    BarrierBatcher batcher(device, *device.resource_states);
+    batcher.transition(color.v_image, ResourceUsage::TransferSrc);
+    batcher.flush(command_buffer);
+
+    uint64_t frame = device.frame_index;
+
+    return readbacks.readImage(
+        command_buffer,
+        color.v_image,
+        format,
+        vk::ImageLayout::eTransferSrcOptimal,
+        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+        vk::Offset3D(0, 0, 0),
+        vk::Extent3D(extent.width, extent.height, 1),
+        [this, frame](const void *data, vk::DeviceSize size) {
+            // Callbacks run oldest first, so this ends up holding the newest copy
+            auto bytes = static_cast<const uint8_t*>(data);
+
+            latest = OffscreenReadback {
+                .frame = frame,
+                .extent = extent,
+                .format = format,
+                .pixels = std::vector<uint8_t>(bytes, bytes + size),
+            };
+        }
+    );
+}
+
+std::optional<OffscreenReadback> OffscreenTarget::takeReadback(bool device_idle) {
+    readbacks.collect(device_idle);
+
+    return std::exchange(latest, std::nullopt);
+}
@@ -0,0 +1,83 @@
+#include "rangeallocator.hpp"
+
+#include "log.hpp"
+
+#include <algorithm>
+
+RangeAllocator::RangeAllocator(uint64_t capacity): range_capacity(capacity) {
+    if(capacity > 0) free_ranges.emplace(0, capacity);
+}
+
+uint64_t RangeAllocator::allocate(uint64_t size, uint64_t alignment) {
+    if(size == 0) return INVALID;
+    alignment = std::max<uint64_t>(alignment, 1);
+
+    for(auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        uint64_t begin = it->first;
+        uint64_t end = begin + it->second;
+        uint64_t offset = (begin + alignment - 1) / alignment * alignment;
+
+        if(offset + size > end) continue;
+
+        // Padding in front of the aligned offset stays free
+        free_ranges.erase(it);
+        if(offset > begin) free_ranges.emplace(begin, offset - begin);
+        if(offset + size < end) free_ranges.emplace(offset + size, end - offset - size);
+
+        range_used += size;
+        return offset;
+    }
+
+    return INVALID;
+}
+
+void RangeAllocator::free(uint64_t offset, uint64_t size) {
+    if(size == 0) return;
+
+    if(offset + size > range_capacity) {
+        LOG_ERROR("Freed range {}+{} is outside of the allocator's {} units", offset, size, range_capacity);
+        return;
+    }
+
+    uint64_t freed = size;
+    auto next = free_ranges.lower_bound(offset);
+
+    if(next != free_ranges.end() && next->first < offset + size) {
+        LOG_ERROR("Freed range {}+{} overlaps a free range, it was freed twice", offset, size);
+        return;
+    }
+
+    if(next != free_ranges.begin()) {
+        auto previous = std::prev(next);
+
+        if(previous->first + previous->second > offset) {
+            LOG_ERROR("Freed range {}+{} overlaps a free range, it was freed twice", offset, size);
+            return;
+        }
+
+        // Merges into the preceding range
+        if(previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            free_ranges.erase(previous);
+        }
+    }
+
+    if(next != free_ranges.end() && next->first == offset + size) {
+        size += next->second;
+        free_ranges.erase(next);
+    }
+
+    free_ranges.emplace(offset, size);
+    range_used -= freed;
+}
+
+uint64_t RangeAllocator::largestFree() const {
+    uint64_t largest = 0;
+
+    for(auto &[offset, size] : free_ranges) {
+        largest = std::max(largest, size);
+    }
+
+    return largest;
+}
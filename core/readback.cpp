@@ -0,0 +1,307 @@
+#include "readback.hpp"
+#include "barriers.hpp"
+#include "deletionqueue.hpp"
+#include "formatutil.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#include <vulkan/vulkan.hpp>
+
+// Buffer copies only need whole words, which also keeps the host reads aligned
+static constexpr vk::DeviceSize BUFFER_ALIGNMENT = 4;
+
+ReadbackManager::ReadbackManager(Device &device, vk::DeviceSize frame_capacity, vk::DispatchLoaderDynamic &dispatcher)
+    : device(device), frame_capacity(frame_capacity), v_dispatcher(dispatcher)
+{
+    vk::MemoryPropertyFlags cached = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCached;
+
+    // The readback ranking puts cached types first when the device has any
+    auto readbackType = device.memoryType(~0u, MemoryUsage::Readback);
+    host_cached = readbackType.has_value() &&
+        (device.properties.memory.memoryTypes[*readbackType].propertyFlags & cached) == cached;
+
+    vk::MemoryPropertyFlags properties = host_cached ?
+        cached :
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+    for(uint32_t i = 0; i < device.frames_in_flight + 1; i++) {
+        auto bufferInfo = vk::BufferCreateInfo()
+            .setSize(frame_capacity)
+            .setUsage(vk::BufferUsageFlagBits::eTransferDst)
+            .setSharingMode(vk::SharingMode::eExclusive);
+
+        Buffer buffer(device, bufferInfo, properties, dispatcher);
+        // Mapped once for the lifetime of the manager
+        MemoryMap mapping = buffer.mapMemory();
+
+        slots.push_back(Slot {
+            .buffer = std::move(buffer),
+            .mapping = std::move(mapping),
+        });
+    }
+
+    LOG_DEBUG("Created readback ring of {} x {} bytes ({}).",
+        slots.size(), frame_capacity, host_cached ? "host cached" : "host coherent"
+    );
+}
+
+ReadbackManager::~ReadbackManager() {
+    size_t abandoned = 0;
+    for(auto &slot : slots) {
+        abandoned += slot.requests.size();
+    }
+
+    if(abandoned > 0) {
+        LOG_WARN("Readback manager destroyed with {} copies that never completed.", abandoned);
+    }
+}
+
+vk::DeviceSize ReadbackManager::copyAlignment(vk::DeviceSize texel_size) const {
+    // Image copies need a multiple of 4 and of the texel size, e.g. 12 for RGB32.
+    // The lcm keeps both when the optimal alignment is larger.
+    vk::DeviceSize alignment = std::lcm(BUFFER_ALIGNMENT, texel_size);
+    vk::DeviceSize optimal = device.properties.limits().optimalBufferCopyOffsetAlignment;
+
+    return optimal > alignment ? std::lcm(alignment, optimal) : alignment;
+}
+
+ReadbackManager::Slot *ReadbackManager::allocate(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset) {
+    readback_stats.requested++;
+
+    Slot &slot = slots[device.frame_index % slots.size()];
+
+    if(slot.frame != device.frame_index) {
+        // Copies of the frame that used the slot last are normally done by now
+        if(!slot.requests.empty()) {
+            collect();
+        }
+
+        if(!slot.requests.empty()) {
+            readback_stats.dropped++;
+            return nullptr;
+        }
+
+        slot.frame = device.frame_index;
+        slot.used = 0;
+    }
+
+    // Not necessarily a power of two
+    offset = (slot.used + alignment - 1) / alignment * alignment;
+
+    if(offset + size > frame_capacity) {
+        readback_stats.dropped++;
+        LOG_DEBUG("Readback of {} bytes does not fit into frame {} ({} of {} bytes used).",
+            size, device.frame_index.load(), slot.used, frame_capacity
+        );
+        return nullptr;
+    }
+
+    slot.used = offset + size;
+
+    return &slot;
+}
+
+void ReadbackManager::recordHostBarrier(
+    vk::CommandBuffer command_buffer,
+    Slot &slot,
+    vk::DeviceSize offset,
+    vk::DeviceSize size
+) {
+    // Makes the copy visible to the host once the submission completed
+    auto hostBarrier = vk::BufferMemoryBarrier2()
+        .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+        .setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+        .setDstStageMask(vk::PipelineStageFlagBits2::eHost)
+        .setDstAccessMask(vk::AccessFlagBits2::eHostRead)
+        .setBuffer(slot.buffer.v_buffer)
+        .setOffset(offset)
+        .setSize(size);
+
+    recordBarriers(device, command_buffer, {}, {hostBarrier});
+}
+
+bool ReadbackManager::readBuffer(
+    vk::CommandBuffer command_buffer,
+    vk::Buffer buffer,
+    vk::DeviceSize offset,
+    vk::DeviceSize size,
+    ReadbackCallback callback
+) {
+    vk::DeviceSize destination;
+    Slot *slot = allocate(size, copyAlignment(BUFFER_ALIGNMENT), destination);
+
+    if(slot == nullptr) return false;
+
+    command_buffer.copyBuffer(
+        buffer,
+        slot->buffer.v_buffer,
+        vk::BufferCopy(offset, destination, size),
+        v_dispatcher
+    );
+
+    recordHostBarrier(command_buffer, *slot, destination, size);
+
+    slot->requests.push_back(Request {
+        .retire_value = device.deletion_queue->retireValue(),
+        .offset = destination,
+        .size = size,
+        .callback = std::move(callback),
+    });
+
+    return true;
+}
+
+bool ReadbackManager::readImage(
+    vk::CommandBuffer command_buffer,
+    vk::Image image,
+    vk::Format format,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceLayers subresource,
+    vk::Offset3D offset,
+    vk::Extent3D extent,
+    ReadbackCallback callback
+) {
+    vk::DeviceSize texel_size = utils::formatSize(format);
+
+    // Rows and layers are tightly packed in the readback buffer
+    vk::DeviceSize size = texel_size * extent.width * extent.height * extent.depth * subresource.layerCount;
+
+    vk::DeviceSize destination;
+    Slot *slot = allocate(size, copyAlignment(texel_size), destination);
+
+    if(slot == nullptr) return false;
+
+    auto region = vk::BufferImageCopy()
+        .setBufferOffset(destination)
+        .setBufferRowLength(0)
+        .setBufferImageHeight(0)
+        .setImageSubresource(subresource)
+        .setImageOffset(offset)
+        .setImageExtent(extent);
+
+    command_buffer.copyImageToBuffer(image, layout, slot->buffer.v_buffer, region, v_dispatcher);
+
+    recordHostBarrier(command_buffer, *slot, destination, size);
+
+    slot->requests.push_back(Request {
+        .retire_value = device.deletion_queue->retireValue(),
+        .offset = destination,
+        .size = size,
+        .callback = std::move(callback),
+    });
+
+    return true;
+}
+
+// Wraps a promise into a copyable callback, std::function cannot hold move-only state
+static std::pair<ReadbackCallback, std::future<std::vector<uint8_t>>> promiseCallback(
+    std::shared_ptr<std::promise<std::vector<uint8_t>>> &promise
+) {
+    promise = std::make_shared<std::promise<std::vector<uint8_t>>>();
+    auto future = promise->get_future();
+
+    ReadbackCallback callback = [promise](const void *data, vk::DeviceSize size) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        promise->set_value(std::vector<uint8_t>(bytes, bytes + size));
+    };
+
+    return {std::move(callback), std::move(future)};
+}
+
+static void rejectPromise(std::promise<std::vector<uint8_t>> &promise) {
+    promise.set_exception(std::make_exception_ptr(
+        std::runtime_error("Readback was dropped, the frame's readback buffer was full or still in flight.")
+    ));
+}
+
+std::future<std::vector<uint8_t>> ReadbackManager::readBuffer(
+    vk::CommandBuffer command_buffer,
+    vk::Buffer buffer,
+    vk::DeviceSize offset,
+    vk::DeviceSize size
+) {
+    std::shared_ptr<std::promise<std::vector<uint8_t>>> promise;
+    auto [callback, future] = promiseCallback(promise);
+
+    if(!readBuffer(command_buffer, buffer, offset, size, std::move(callback))) {
+        rejectPromise(*promise);
+    }
+
+    return std::move(future);
+}
+
+std::future<std::vector<uint8_t>> ReadbackManager::readImage(
+    vk::CommandBuffer command_buffer,
+    vk::Image image,
+    vk::Format format,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceLayers subresource,
+    vk::Offset3D offset,
+    vk::Extent3D extent
+) {
+    std::shared_ptr<std::promise<std::vector<uint8_t>>> promise;
+    auto [callback, future] = promiseCallback(promise);
+
+    if(!readImage(command_buffer, image, format, layout, subresource, offset, extent, std::move(callback))) {
+        rejectPromise(*promise);
+    }
+
+    return std::move(future);
+}
+
+void ReadbackManager::collect(bool device_idle) {
+    uint64_t completed = device.deletion_queue->completedValue();
+
+    // Oldest frame first, so callbacks see the copies in recording order
+    std::vector<Slot*> ordered;
+    for(auto &slot : slots) {
+        if(!slot.requests.empty()) ordered.push_back(&slot);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const Slot *a, const Slot *b) {
+        return a->frame < b->frame;
+    });
+
+    for(Slot *slot : ordered) {
+        size_t done = 0;
+        while(done < slot->requests.size() &&
+              (device_idle || slot->requests[done].retire_value <= completed)) {
+            done++;
+        }
+
+        if(done == 0) continue;
+
+        if(host_cached) {
+            // Cached memory may not be coherent, the whole range is invalidated to avoid atom alignment
+            auto range = vk::MappedMemoryRange()
+                .setMemory(slot->buffer.v_memory)
+                .setOffset(0)
+                .setSize(VK_WHOLE_SIZE);
+
+            device.v_device.invalidateMappedMemoryRanges(range, v_dispatcher);
+        }
+
+        // Taken out first so callbacks may record new readbacks
+        std::vector<Request> finished(
+            std::make_move_iterator(slot->requests.begin()),
+            std::make_move_iterator(slot->requests.begin() + done)
+        );
+        slot->requests.erase(slot->requests.begin(), slot->requests.begin() + done);
+
+        auto base = static_cast<const uint8_t*>(*slot->mapping);
+
+        for(auto &request : finished) {
+            if(request.callback) {
+                request.callback(base + request.offset, request.size);
+            }
+
+            readback_stats.completed++;
+            readback_stats.bytes += request.size;
+        }
+    }
+}
@@ -0,0 +1,217 @@
+#include "rendercache.hpp"
+#include "deletionqueue.hpp"
+#include "hashutil.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <vulkan/vulkan.hpp>
+#ifndef __MACH__
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+#endif
+
+RenderPassCache::RenderPassCache(Device &device, uint32_t max_unused_frames)
+    : device(device), max_unused_frames(max_unused_frames) {}
+
+RenderPassCache::~RenderPassCache() {
+    clear();
+}
+
+RenderPass &RenderPassCache::get(const RenderPassLayout &layout) {
+    auto found = render_passes.find(layout);
+
+    if(found != render_passes.end()) {
+        found->second.last_used = device.frame_index;
+        return found->second.render_pass;
+    }
+
+    auto [entry, inserted] = render_passes.emplace(layout, Entry {
+        .render_pass = RenderPass(device, layout, device.v_dispatcher),
+        .last_used = device.frame_index,
+    });
+
+    LOG_DEBUG("Cached render pass with {} attachments ({} cached).", layout.attachmentCount(), render_passes.size());
+
+    return entry->second.render_pass;
+}
+
+void RenderPassCache::evictUnused() {
+    for(auto it = render_passes.begin(); it != render_passes.end();) {
+        if(device.frame_index - it->second.last_used > max_unused_frames) {
+            it = render_passes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void RenderPassCache::clear() {
+    render_passes.clear();
+}
+
+size_t FramebufferKey::hash() const {
+    size_t seed = 0;
+    utils::hashCombine(seed, static_cast<VkRenderPass>(renderPass));
+    utils::hashCombine(seed, extent.width);
+    utils::hashCombine(seed, extent.height);
+    utils::hashCombine(seed, layers);
+    utils::hashCombine(seed, imageless);
+
+    for(auto &view : views) {
+        utils::hashCombine(seed, static_cast<VkImageView>(view));
+    }
+
+    for(auto &usage : usages) {
+        utils::hashCombine(seed, static_cast<VkImageUsageFlags>(usage));
+    }
+
+    return seed;
+}
+
+FramebufferCache::FramebufferCache(Device &device, uint32_t max_unused_frames)
+    : device(device), max_unused_frames(max_unused_frames) {}
+
+FramebufferCache::~FramebufferCache() {
+    clear();
+}
+
+vk::Framebuffer FramebufferCache::get(
+    RenderPass &render_pass,
+    const std::vector<FramebufferAttachment> &attachments,
+    vk::Extent2D extent,
+    uint32_t layers
+) {
+    FramebufferKey key;
+    key.renderPass = render_pass.v_render_pass;
+    key.extent = extent;
+    key.layers = layers;
+    key.imageless = device.capabilities.imagelessFramebuffer;
+
+    for(auto &attachment : attachments) {
+        if(key.imageless) {
+            key.usages.push_back(attachment.usage);
+        } else {
+            key.views.push_back(attachment.view);
+        }
+    }
+
+    auto found = framebuffers.find(key);
+
+    if(found != framebuffers.end()) {
+        found->second.last_used = device.frame_index;
+        return found->second.v_framebuffer;
+    }
+
+    auto framebufferInfo = vk::FramebufferCreateInfo()
+        .setRenderPass(render_pass.v_render_pass)
+        .setWidth(extent.width)
+        .setHeight(extent.height)
+        .setLayers(layers);
+
+    std::vector<vk::Format> formats = render_pass.layout.attachmentFormats();
+    std::vector<vk::FramebufferAttachmentImageInfo> imageInfos;
+    vk::FramebufferAttachmentsCreateInfo attachmentsInfo;
+
+    if(key.imageless) {
+        if(formats.size() != attachments.size()) {
+            THROW(runtime_error, "Render pass expects {} attachments, got {}.", formats.size(), attachments.size());
+        }
+
+        imageInfos.reserve(attachments.size());
+        for(size_t i = 0; i < attachments.size(); i++) {
+            imageInfos.push_back(vk::FramebufferAttachmentImageInfo()
+                .setUsage(attachments[i].usage)
+                .setWidth(extent.width)
+                .setHeight(extent.height)
+                .setLayerCount(layers)
+                .setViewFormatCount(1)
+                .setPViewFormats(&formats[i])
+            );
+        }
+
+        attachmentsInfo = attachmentsInfo.setAttachmentImageInfos(imageInfos);
+
+        framebufferInfo = framebufferInfo
+            .setFlags(vk::FramebufferCreateFlagBits::eImageless)
+            .setAttachmentCount(static_cast<uint32_t>(attachments.size()))
+            .setPNext(&attachmentsInfo);
+    } else {
+        framebufferInfo = framebufferInfo.setAttachments(key.views);
+    }
+
+    vk::Framebuffer framebuffer = device.v_device.createFramebuffer(framebufferInfo, nullptr, device.v_dispatcher);
+
+    framebuffers.emplace(std::move(key), Entry {
+        .v_framebuffer = framebuffer,
+        .last_used = device.frame_index,
+    });
+
+    LOG_DEBUG("Cached framebuffer {}x{} ({} cached).", extent.width, extent.height, framebuffers.size());
+
+    return framebuffer;
+}
+
+void FramebufferCache::beginRenderPass(
+    vk::CommandBuffer command_buffer,
+    RenderPass &render_pass,
+    const std::vector<FramebufferAttachment> &attachments,
+    vk::Extent2D extent,
+    const std::vector<vk::ClearValue> &clear_values,
+    vk::SubpassContents contents
+) {
+    vk::Framebuffer framebuffer = get(render_pass, attachments, extent);
+
+    auto renderPassBegin = vk::RenderPassBeginInfo()
+        .setRenderPass(render_pass.v_render_pass)
+        .setFramebuffer(framebuffer)
+        .setRenderArea(vk::Rect2D({0, 0}, extent))
+        .setClearValues(clear_values);
+
+    std::vector<vk::ImageView> views;
+    vk::RenderPassAttachmentBeginInfo attachmentBegin;
+
+    if(device.capabilities.imagelessFramebuffer) {
+        views.reserve(attachments.size());
+        for(auto &attachment : attachments) {
+            views.push_back(attachment.view);
+        }
+
+        attachmentBegin = attachmentBegin.setAttachments(views);
+        renderPassBegin = renderPassBegin.setPNext(&attachmentBegin);
+    }
+
+    command_buffer.beginRenderPass(renderPassBegin, contents, device.v_dispatcher);
+}
+
+void FramebufferCache::evictView(vk::ImageView view) {
+    for(auto it = framebuffers.begin(); it != framebuffers.end();) {
+        auto &views = it->first.views;
+
+        if(std::find(views.begin(), views.end(), view) != views.end()) {
+            device.deletion_queue->push(it->second.v_framebuffer);
+            it = framebuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FramebufferCache::evictUnused() {
+    for(auto it = framebuffers.begin(); it != framebuffers.end();) {
+        if(device.frame_index - it->second.last_used > max_unused_frames) {
+            device.deletion_queue->push(it->second.v_framebuffer);
+            it = framebuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FramebufferCache::clear() {
+    for(auto &[key, entry] : framebuffers) {
+        device.deletion_queue->push(entry.v_framebuffer);
+    }
+    framebuffers.clear();
+}
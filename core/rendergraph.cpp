@@ -0,0 +1,626 @@
+#include "rendergraph.hpp"
+#include "deletionqueue.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+#include "memorytracker.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include <vulkan/vulkan.hpp>
+#ifndef __MACH__
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+#endif
+
+void PassBuilder::read(GraphResource resource, ResourceUsage usage) {
+    if(resource.index >= graph.resources.size()) {
+        THROW(runtime_error, "Pass {} reads an unknown resource.", graph.passes[pass].name);
+    }
+
+    // Passes run in declaration order, so the contents of a transient have to come
+    // from this pass or one declared before it
+    if(!graph.resources[resource.index].imported) {
+        bool written = false;
+
+        for(uint32_t i = 0; i <= pass && !written; i++) {
+            for(auto &access : graph.passes[i].accesses) {
+                if(access.resource == resource.index && (access.write || isWriteUsage(access.usage))) {
+                    written = true;
+                    break;
+                }
+            }
+        }
+
+        if(!written) {
+            THROW(runtime_error, "Pass {} reads {} before any pass writes it.",
+                graph.passes[pass].name, graph.resources[resource.index].name
+            );
+        }
+    }
+
+    graph.passes[pass].accesses.push_back({resource.index, usage, false});
+}
+
+void PassBuilder::write(GraphResource resource, ResourceUsage usage) {
+    if(resource.index >= graph.resources.size()) {
+        THROW(runtime_error, "Pass {} writes an unknown resource.", graph.passes[pass].name);
+    }
+
+    graph.passes[pass].accesses.push_back({resource.index, usage, true});
+}
+
+void PassBuilder::sideEffect() {
+    graph.passes[pass].side_effect = true;
+}
+
+RenderGraph::RenderGraph(Device &device) : device(device) {}
+
+RenderGraph::~RenderGraph() {
+    destroyTransients();
+}
+
+GraphResource RenderGraph::createImage(const std::string &name, const GraphImageDesc &desc) {
+    Resource resource;
+    resource.name = name;
+    resource.is_image = true;
+    resource.imported = false;
+    resource.image_desc = desc;
+
+    resources.push_back(resource);
+    compiled = false;
+
+    return GraphResource { static_cast<uint32_t>(resources.size() - 1) };
+}
+
+GraphResource RenderGraph::createBuffer(const std::string &name, const GraphBufferDesc &desc) {
+    Resource resource;
+    resource.name = name;
+    resource.is_image = false;
+    resource.imported = false;
+    resource.buffer_desc = desc;
+
+    resources.push_back(resource);
+    compiled = false;
+
+    return GraphResource { static_cast<uint32_t>(resources.size() - 1) };
+}
+
+GraphResource RenderGraph::importImage(
+    const std::string &name,
+    vk::Image image,
+    vk::ImageView view,
+    const GraphImageDesc &desc,
+    ResourceState initial,
+    std::optional<ResourceUsage> final
+) {
+    Resource resource;
+    resource.name = name;
+    resource.is_image = true;
+    resource.imported = true;
+    resource.output = final.has_value();
+    resource.image_desc = desc;
+    resource.initial = initial;
+    resource.final_usage = final;
+    resource.v_image = image;
+    resource.v_image_view = view;
+
+    resources.push_back(resource);
+    compiled = false;
+
+    return GraphResource { static_cast<uint32_t>(resources.size() - 1) };
+}
+
+GraphResource RenderGraph::importBuffer(
+    const std::string &name,
+    vk::Buffer buffer,
+    vk::DeviceSize size,
+    ResourceState initial,
+    bool output
+) {
+    Resource resource;
+    resource.name = name;
+    resource.is_image = false;
+    resource.imported = true;
+    resource.output = output;
+    resource.buffer_desc.size = size;
+    resource.initial = initial;
+    resource.v_buffer = buffer;
+
+    resources.push_back(resource);
+    compiled = false;
+
+    return GraphResource { static_cast<uint32_t>(resources.size() - 1) };
+}
+
+void RenderGraph::setImportedImage(GraphResource resource, vk::Image image, vk::ImageView view) {
+    auto &imported = resources.at(resource.index);
+
+    if(!imported.imported || !imported.is_image) {
+        THROW(runtime_error, "Resource {} is not an imported image.", imported.name);
+    }
+
+    imported.v_image = image;
+    imported.v_image_view = view;
+}
+
+void RenderGraph::setImportedBuffer(GraphResource resource, vk::Buffer buffer) {
+    auto &imported = resources.at(resource.index);
+
+    if(!imported.imported || imported.is_image) {
+        THROW(runtime_error, "Resource {} is not an imported buffer.", imported.name);
+    }
+
+    imported.v_buffer = buffer;
+}
+
+void RenderGraph::addPass(
+    const std::string &name,
+    const std::function<void(PassBuilder&)> &setup,
+    PassExecute execute
+) {
+    passes.push_back(Pass {
+        .name = name,
+        .execute = std::move(execute),
+    });
+
+    PassBuilder builder(*this, static_cast<uint32_t>(passes.size() - 1));
+    setup(builder);
+
+    compiled = false;
+}
+
+void RenderGraph::compile() {
+    SVK_ZONE("RenderGraph::compile");
+
+    destroyTransients();
+
+    graph_stats = RenderGraphStats();
+    graph_stats.passes = static_cast<uint32_t>(passes.size());
+
+    cull();
+    computeLifetimes();
+    allocateTransients();
+    buildBarriers();
+
+    compiled = true;
+
+    LOG_DEBUG("Compiled render graph: {} passes ({} culled), {} barrier batches, {} transient bytes ({} without aliasing).",
+        graph_stats.passes, graph_stats.culledPasses, graph_stats.barrierBatches,
+        graph_stats.transientBytes, graph_stats.unaliasedBytes
+    );
+}
+
+void RenderGraph::execute(vk::CommandBuffer command_buffer) {
+    SVK_ZONE("RenderGraph::execute");
+
+    if(!compiled) {
+        compile();
+    }
+
+    for(size_t i = 0; i < passes.size(); i++) {
+        if(passes[i].culled) continue;
+
+        if(!pass_barriers[i].empty()) {
+            emitBarriers(command_buffer, pass_barriers[i]);
+        }
+
+        passes[i].execute(command_buffer, *this);
+    }
+
+    if(!final_barriers.empty()) {
+        emitBarriers(command_buffer, final_barriers);
+    }
+}
+
+void RenderGraph::reset() {
+    destroyTransients();
+
+    passes.clear();
+    resources.clear();
+    pass_barriers.clear();
+    final_barriers.clear();
+
+    compiled = false;
+}
+
+vk::Image RenderGraph::image(GraphResource resource) const {
+    return resources.at(resource.index).v_image;
+}
+
+vk::ImageView RenderGraph::imageView(GraphResource resource) const {
+    return resources.at(resource.index).v_image_view;
+}
+
+vk::Buffer RenderGraph::buffer(GraphResource resource) const {
+    return resources.at(resource.index).v_buffer;
+}
+
+// Walks passes backwards from the graph outputs. A pass survives if it has side
+// effects or writes something a surviving pass (or the outside world) consumes.
+// Declaration order is already a topological order, PassBuilder::read rejects
+// transients that no earlier pass writes.
+void RenderGraph::cull() {
+    std::vector<bool> needed(resources.size(), false);
+
+    for(size_t i = 0; i < resources.size(); i++) {
+        needed[i] = resources[i].output;
+    }
+
+    for(auto pass = passes.rbegin(); pass != passes.rend(); ++pass) {
+        bool alive = pass->side_effect;
+
+        for(auto &access : pass->accesses) {
+            if(access.write && needed[access.resource]) {
+                alive = true;
+            }
+        }
+
+        pass->culled = !alive;
+
+        if(!alive) {
+            graph_stats.culledPasses++;
+            LOG_DEBUG("Culled render graph pass {}.", pass->name);
+            continue;
+        }
+
+        // Writes keep earlier writers alive as well, since attachments may be loaded
+        for(auto &access : pass->accesses) {
+            needed[access.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::computeLifetimes() {
+    for(auto &resource : resources) {
+        resource.first_use = UINT32_MAX;
+        resource.last_use = 0;
+        resource.alias_of.reset();
+        resource.heap = UINT32_MAX;
+    }
+
+    for(uint32_t i = 0; i < passes.size(); i++) {
+        if(passes[i].culled) continue;
+
+        for(auto &access : passes[i].accesses) {
+            auto &resource = resources[access.resource];
+            resource.first_use = std::min(resource.first_use, i);
+            resource.last_use = std::max(resource.last_use, i);
+        }
+    }
+}
+
+void RenderGraph::allocateTransients() {
+    std::vector<uint32_t> transients;
+
+    for(uint32_t i = 0; i < resources.size(); i++) {
+        auto &resource = resources[i];
+        if(resource.imported || resource.first_use == UINT32_MAX) continue;
+
+        if(resource.is_image) {
+            auto &desc = resource.image_desc;
+            auto imageInfo = vk::ImageCreateInfo()
+                .setImageType(vk::ImageType::e2D)
+                .setFormat(desc.format)
+                .setExtent(vk::Extent3D(desc.extent.width, desc.extent.height, 1))
+                .setMipLevels(desc.mipLevels)
+                .setArrayLayers(desc.arrayLayers)
+                .setSamples(desc.samples)
+                .setTiling(vk::ImageTiling::eOptimal)
+                .setUsage(desc.usage)
+                .setSharingMode(vk::SharingMode::eExclusive)
+                .setInitialLayout(vk::ImageLayout::eUndefined);
+
+            resource.v_image = device.v_device.createImage(imageInfo, nullptr, device.v_dispatcher);
+            resource.requirements = device.v_device.getImageMemoryRequirements(resource.v_image, device.v_dispatcher);
+        } else {
+            auto bufferInfo = vk::BufferCreateInfo()
+                .setSize(resource.buffer_desc.size)
+                .setUsage(resource.buffer_desc.usage)
+                .setSharingMode(vk::SharingMode::eExclusive);
+
+            resource.v_buffer = device.v_device.createBuffer(bufferInfo, nullptr, device.v_dispatcher);
+            resource.requirements = device.v_device.getBufferMemoryRequirements(resource.v_buffer, device.v_dispatcher);
+        }
+
+        graph_stats.unaliasedBytes += resource.requirements.size;
+        transients.push_back(i);
+    }
+
+    // Largest first, so the first resource of each heap defines its size
+    std::sort(transients.begin(), transients.end(), [this](uint32_t a, uint32_t b) {
+        return resources[a].requirements.size > resources[b].requirements.size;
+    });
+
+    std::vector<std::vector<uint32_t>> heapMembers;
+
+    auto lifetimesOverlap = [](const Resource &a, const Resource &b) {
+        return a.first_use <= b.last_use && b.first_use <= a.last_use;
+    };
+
+    for(uint32_t index : transients) {
+        auto &resource = resources[index];
+        auto &reqs = resource.requirements;
+
+        for(uint32_t h = 0; h < heaps.size() && resource.heap == UINT32_MAX; h++) {
+            if(heaps[h].images != resource.is_image) continue;
+            if((heaps[h].memory_type_bits & reqs.memoryTypeBits) == 0) continue;
+
+            std::vector<uint32_t> live;
+            for(uint32_t member : heapMembers[h]) {
+                if(lifetimesOverlap(resources[member], resource)) {
+                    live.push_back(member);
+                }
+            }
+
+            std::sort(live.begin(), live.end(), [this](uint32_t a, uint32_t b) {
+                return resources[a].offset < resources[b].offset;
+            });
+
+            // First fit between resources that are alive at the same time
+            vk::DeviceSize offset = 0;
+            for(uint32_t member : live) {
+                offset = (offset + reqs.alignment - 1) / reqs.alignment * reqs.alignment;
+                if(offset + reqs.size <= resources[member].offset) break;
+                offset = std::max(offset, resources[member].offset + resources[member].requirements.size);
+            }
+            offset = (offset + reqs.alignment - 1) / reqs.alignment * reqs.alignment;
+
+            if(offset + reqs.size > heaps[h].size) continue;
+
+            resource.heap = h;
+            resource.offset = offset;
+        }
+
+        if(resource.heap == UINT32_MAX) {
+            heaps.push_back(Heap {
+                .size = reqs.size,
+                .memory_type_bits = reqs.memoryTypeBits,
+                .images = resource.is_image,
+            });
+            heapMembers.emplace_back();
+
+            resource.heap = static_cast<uint32_t>(heaps.size() - 1);
+            resource.offset = 0;
+        }
+
+        heaps[resource.heap].memory_type_bits &= reqs.memoryTypeBits;
+
+        // The latest earlier resource sharing memory needs to be synchronized against
+        std::optional<uint32_t> predecessor;
+        for(uint32_t member : heapMembers[resource.heap]) {
+            auto &other = resources[member];
+            bool memoryOverlaps = resource.offset < other.offset + other.requirements.size &&
+                other.offset < resource.offset + reqs.size;
+
+            if(memoryOverlaps && other.last_use < resource.first_use &&
+                (!predecessor.has_value() || resources[*predecessor].last_use < other.last_use))
+            {
+                predecessor = member;
+            }
+        }
+
+        resource.alias_of = predecessor;
+        heapMembers[resource.heap].push_back(index);
+    }
+
+    for(uint32_t h = 0; h < heaps.size(); h++) {
+        auto allocateInfo = vk::MemoryAllocateInfo()
+            .setAllocationSize(heaps[h].size)
+            .setMemoryTypeIndex(device.memory->findMemoryType(
+                heaps[h].memory_type_bits, vk::MemoryPropertyFlagBits::eDeviceLocal
+            ));
+
+        // Transient attachments are used every frame, keep them resident first
+        heaps[h].v_memory = device.memory->allocate(allocateInfo, MemoryCategory::RenderGraph, 1.0f);
+        graph_stats.transientBytes += heaps[h].size;
+    }
+
+    for(uint32_t index : transients) {
+        auto &resource = resources[index];
+        vk::DeviceMemory memory = heaps[resource.heap].v_memory;
+
+        if(resource.is_image) {
+            device.v_device.bindImageMemory(resource.v_image, memory, resource.offset, device.v_dispatcher);
+
+            auto &desc = resource.image_desc;
+            auto viewInfo = vk::ImageViewCreateInfo()
+                .setImage(resource.v_image)
+                .setViewType(desc.arrayLayers > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D)
+                .setFormat(desc.format)
+                .setSubresourceRange(vk::ImageSubresourceRange(desc.aspect, 0, desc.mipLevels, 0, desc.arrayLayers));
+
+            resource.v_image_view = device.v_device.createImageView(viewInfo, nullptr, device.v_dispatcher);
+        } else {
+            device.v_device.bindBufferMemory(resource.v_buffer, memory, resource.offset, device.v_dispatcher);
+        }
+    }
+}
+
+void RenderGraph::buildBarriers() {
+    // Transient memory is reused every frame, so the first use of a transient also
+    // waits for the previous frame's last accesses to the same memory, by itself or
+    // by any resource aliasing it. Those accesses are only known after one walk.
+    std::vector<SubresourceState> frame_end = placeBarriers({});
+
+    std::vector<SubresourceState> carried(resources.size());
+
+    for(uint32_t i = 0; i < resources.size(); i++) {
+        auto &resource = resources[i];
+        if(resource.heap == UINT32_MAX) continue;
+
+        for(uint32_t j = 0; j < resources.size(); j++) {
+            auto &other = resources[j];
+            if(other.heap != resource.heap) continue;
+
+            bool memoryOverlaps = resource.offset < other.offset + other.requirements.size &&
+                other.offset < resource.offset + resource.requirements.size;
+            if(!memoryOverlaps) continue;
+
+            carried[i].write_stages |= frame_end[j].write_stages | frame_end[j].read_stages;
+            carried[i].write_access |= frame_end[j].write_access;
+        }
+    }
+
+    placeBarriers(carried);
+
+    for(auto &batch : pass_barriers) {
+        if(batch.empty()) continue;
+        graph_stats.barrierBatches++;
+        for(auto &barrier : batch) {
+            if(resources[barrier.resource].is_image) graph_stats.imageBarriers++;
+            else graph_stats.bufferBarriers++;
+        }
+    }
+
+    if(!final_barriers.empty()) {
+        graph_stats.barrierBatches++;
+        graph_stats.imageBarriers += static_cast<uint32_t>(final_barriers.size());
+    }
+}
+
+std::vector<SubresourceState> RenderGraph::placeBarriers(const std::vector<SubresourceState> &carried) {
+    std::vector<SubresourceState> tracked(resources.size());
+    std::vector<bool> touched(resources.size(), false);
+
+    for(size_t i = 0; i < resources.size(); i++) {
+        if(resources[i].imported) {
+            tracked[i] = SubresourceState(resources[i].initial);
+            touched[i] = true;
+        }
+    }
+
+    pass_barriers.assign(passes.size(), {});
+    final_barriers.clear();
+
+    for(uint32_t i = 0; i < passes.size(); i++) {
+        if(passes[i].culled) continue;
+
+        // Merge every access of a resource within the pass into one state
+        std::vector<std::pair<uint32_t, ResourceState>> merged;
+        std::vector<bool> writes;
+
+        for(auto &access : passes[i].accesses) {
+            ResourceState state = stateForUsage(access.usage);
+            bool write = access.write || isWriteUsage(access.usage);
+
+            auto existing = std::find_if(merged.begin(), merged.end(), [&access](auto &entry) {
+                return entry.first == access.resource;
+            });
+
+            if(existing == merged.end()) {
+                merged.emplace_back(access.resource, state);
+                writes.push_back(write);
+                continue;
+            }
+
+            if(resources[access.resource].is_image && existing->second.layout != state.layout) {
+                THROW(runtime_error, "Pass {} uses image {} in two different layouts.",
+                    passes[i].name, resources[access.resource].name
+                );
+            }
+
+            existing->second.stages |= state.stages;
+            existing->second.access |= state.access;
+            writes[existing - merged.begin()] = writes[existing - merged.begin()] || write;
+        }
+
+        for(size_t m = 0; m < merged.size(); m++) {
+            uint32_t index = merged[m].first;
+            auto &resource = resources[index];
+
+            if(!touched[index]) {
+                // First use of a transient: contents are undefined, but memory may be
+                // shared with an earlier resource whose accesses have to finish first
+                touched[index] = true;
+                tracked[index] = carried.empty() ? SubresourceState() : carried[index];
+
+                if(resource.alias_of.has_value()) {
+                    auto &previous = tracked[*resource.alias_of];
+                    tracked[index].write_stages |= previous.write_stages | previous.read_stages;
+                    tracked[index].write_access |= previous.write_access;
+                }
+            }
+
+            auto transition = tracked[index].access(merged[m].second, writes[m], resource.is_image);
+
+            if(transition.has_value()) {
+                pass_barriers[i].push_back(Barrier { index, *transition });
+            }
+        }
+    }
+
+    for(uint32_t i = 0; i < resources.size(); i++) {
+        auto &resource = resources[i];
+        if(!resource.final_usage.has_value()) continue;
+
+        auto transition = tracked[i].access(stateForUsage(*resource.final_usage), false, resource.is_image);
+
+        if(transition.has_value()) {
+            final_barriers.push_back(Barrier { i, *transition });
+        }
+    }
+
+    return tracked;
+}
+
+void RenderGraph::emitBarriers(vk::CommandBuffer command_buffer, const std::vector<Barrier> &barriers) {
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+    std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+
+    for(auto &barrier : barriers) {
+        auto &resource = resources[barrier.resource];
+        auto &src = barrier.transition.src;
+        auto &dst = barrier.transition.dst;
+
+        if(resource.is_image) {
+            auto &desc = resource.image_desc;
+            imageBarriers.push_back(vk::ImageMemoryBarrier2()
+                .setSrcStageMask(src.stages)
+                .setSrcAccessMask(src.access)
+                .setDstStageMask(dst.stages)
+                .setDstAccessMask(dst.access)
+                .setOldLayout(src.layout)
+                .setNewLayout(dst.layout)
+                .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                .setImage(resource.v_image)
+                .setSubresourceRange(vk::ImageSubresourceRange(desc.aspect, 0, desc.mipLevels, 0, desc.arrayLayers))
+            );
+        } else {
+            bufferBarriers.push_back(vk::BufferMemoryBarrier2()
+                .setSrcStageMask(src.stages)
+                .setSrcAccessMask(src.access)
+                .setDstStageMask(dst.stages)
+                .setDstAccessMask(dst.access)
+                .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                .setBuffer(resource.v_buffer)
+                .setOffset(0)
+                .setSize(VK_WHOLE_SIZE)
+            );
+        }
+    }
+
+    recordBarriers(device, command_buffer, imageBarriers, bufferBarriers);
+}
+
+void RenderGraph::destroyTransients() {
+    for(auto &resource : resources) {
+        if(resource.imported) continue;
+
+        device.deletion_queue->push(resource.v_image_view);
+        device.deletion_queue->push(resource.v_image);
+        device.deletion_queue->push(resource.v_buffer);
+
+        resource.v_image_view = nullptr;
+        resource.v_image = nullptr;
+        resource.v_buffer = nullptr;
+    }
+
+    for(auto &heap : heaps) {
+        device.deletion_queue->push(heap.v_memory);
+    }
+    heaps.clear();
+}
@@ -0,0 +1,124 @@
+#include "syncpool.hpp"
+#include "deletionqueue.hpp"
+#include "log.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+FencePool::FencePool(Device &device, uint32_t grow_by) : device(device), grow_by(grow_by) {}
+
+FencePool::~FencePool() {
+    for(auto &fence : fences) {
+        device.deletion_queue->push(fence);
+    }
+}
+
+vk::Fence FencePool::acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(free.empty()) {
+        resetPending();
+    }
+
+    if(free.empty()) {
+        for(uint32_t i = 0; i < grow_by; i++) {
+            vk::Fence fence = device.v_device.createFence(vk::FenceCreateInfo(), nullptr, device.v_dispatcher);
+            fences.push_back(fence);
+            free.push_back(fence);
+        }
+
+        LOG_DEBUG("Fence pool grew to {} fences.", fences.size());
+    }
+
+    vk::Fence fence = free.back();
+    free.pop_back();
+
+    return fence;
+}
+
+void FencePool::release(vk::Fence fence) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_reset.push_back(fence);
+}
+
+void FencePool::collect() {
+    std::lock_guard<std::mutex> lock(mutex);
+    resetPending();
+}
+
+SyncPoolStats FencePool::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t pooled = static_cast<uint32_t>(free.size() + pending_reset.size());
+
+    return SyncPoolStats {
+        .live = static_cast<uint32_t>(fences.size()) - pooled,
+        .pooled = pooled,
+        .created = static_cast<uint32_t>(fences.size()),
+    };
+}
+
+void FencePool::resetPending() {
+    if(pending_reset.empty()) return;
+
+    device.v_device.resetFences(pending_reset, device.v_dispatcher);
+
+    free.insert(free.end(), pending_reset.begin(), pending_reset.end());
+    pending_reset.clear();
+}
+
+SemaphorePool::SemaphorePool(Device &device, uint32_t grow_by) : device(device), grow_by(grow_by) {}
+
+SemaphorePool::~SemaphorePool() {
+    for(auto &semaphore : semaphores) {
+        device.deletion_queue->push(semaphore);
+    }
+}
+
+vk::Semaphore SemaphorePool::acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(free.empty()) {
+        for(uint32_t i = 0; i < grow_by; i++) {
+            vk::Semaphore semaphore = device.v_device.createSemaphore(vk::SemaphoreCreateInfo(), nullptr, device.v_dispatcher);
+            semaphores.push_back(semaphore);
+            free.push_back(semaphore);
+        }
+
+        LOG_DEBUG("Semaphore pool grew to {} semaphores.", semaphores.size());
+    }
+
+    vk::Semaphore semaphore = free.back();
+    free.pop_back();
+
+    return semaphore;
+}
+
+void SemaphorePool::release(vk::Semaphore semaphore) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    pending.push_back(Pending {
+        .semaphore = semaphore,
+        .reusable_frame = device.frame_index + device.frames_in_flight,
+    });
+}
+
+void SemaphorePool::collect() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    while(!pending.empty() && pending.front().reusable_frame <= device.frame_index) {
+        free.push_back(pending.front().semaphore);
+        pending.pop_front();
+    }
+}
+
+SyncPoolStats SemaphorePool::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t pooled = static_cast<uint32_t>(free.size() + pending.size());
+
+    return SyncPoolStats {
+        .live = static_cast<uint32_t>(semaphores.size()) - pooled,
+        .pooled = pooled,
+        .created = static_cast<uint32_t>(semaphores.size()),
+    };
+}
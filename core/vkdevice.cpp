@@ -0,0 +1,434 @@
+#include "vkdevice.hpp"
+#include "barriers.hpp"
+#include "deletionqueue.hpp"
+#include "instrument.hpp"
+#include "jobsystem.hpp"
+#include "log.hpp"
+#include "memorytracker.hpp"
+#include "rendercache.hpp"
+#include "syncpool.hpp"
+#include "validation.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+#ifndef __MACH__
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+#endif
+
+// vk::PhysicalDeviceFeatures is a plain sequence of VkBool32 members
+static bool supportsFeatures(const vk::PhysicalDeviceFeatures &supported, const vk::PhysicalDeviceFeatures &requested) {
+    constexpr size_t count = sizeof(vk::PhysicalDeviceFeatures) / sizeof(vk::Bool32);
+
+    auto supportedFlags = reinterpret_cast<const vk::Bool32*>(&supported);
+    auto requestedFlags = reinterpret_cast<const vk::Bool32*>(&requested);
+
+    for(size_t i = 0; i < count; i++) {
+        if(requestedFlags[i] && !supportedFlags[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool hasExtension(const std::vector<const char*> &extensions, const char *name) {
+    return std::any_of(extensions.begin(), extensions.end(), [name](const char *extension) {
+        return std::strcmp(extension, name) == 0;
+    });
+}
+
+static bool supportsExtension(vk::PhysicalDevice device, const char *name, vk::DispatchLoaderDynamic &v_dispatcher) {
+    for(auto &extension : device.enumerateDeviceExtensionProperties(nullptr, v_dispatcher)) {
+        if(std::strcmp(extension.extensionName.data(), name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Queries everything svklib reads about a physical device in one go, with the
+// version specific structs only when the device implements that version
+static DeviceProperties queryProperties(vk::PhysicalDevice device, vk::DispatchLoaderDynamic &v_dispatcher) {
+    DeviceProperties properties;
+
+    properties.core = device.getProperties(v_dispatcher);
+    properties.features = device.getFeatures(v_dispatcher);
+    properties.memory = device.getMemoryProperties(v_dispatcher);
+    properties.queue_families = device.getQueueFamilyProperties(v_dispatcher);
+
+    if(properties.core.apiVersion >= VK_API_VERSION_1_2) {
+        auto chain = device.getProperties2<
+            vk::PhysicalDeviceProperties2,
+            vk::PhysicalDeviceVulkan11Properties,
+            vk::PhysicalDeviceVulkan12Properties
+        >(v_dispatcher);
+        auto features = device.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceVulkan12Features
+        >(v_dispatcher);
+
+        properties.vulkan11 = chain.get<vk::PhysicalDeviceVulkan11Properties>();
+        properties.vulkan12 = chain.get<vk::PhysicalDeviceVulkan12Properties>();
+        properties.features12 = features.get<vk::PhysicalDeviceVulkan12Features>();
+    }
+
+    if(properties.core.apiVersion >= VK_API_VERSION_1_3) {
+        auto chain = device.getProperties2<
+            vk::PhysicalDeviceProperties2,
+            vk::PhysicalDeviceVulkan13Properties
+        >(v_dispatcher);
+        auto features = device.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceVulkan13Features
+        >(v_dispatcher);
+
+        properties.vulkan13 = chain.get<vk::PhysicalDeviceVulkan13Properties>();
+        properties.features13 = features.get<vk::PhysicalDeviceVulkan13Features>();
+    }
+
+    // The copies point into chains that went out of scope
+    properties.vulkan11.pNext = nullptr;
+    properties.vulkan12.pNext = nullptr;
+    properties.vulkan13.pNext = nullptr;
+    properties.features12.pNext = nullptr;
+    properties.features13.pNext = nullptr;
+
+    return properties;
+}
+
+// Higher is better, negative when the memory type does not qualify for the usage
+static int scoreMemoryType(vk::MemoryPropertyFlags flags, MemoryUsage usage) {
+    using Flag = vk::MemoryPropertyFlagBits;
+
+    if(flags & (Flag::eProtected | Flag::eLazilyAllocated)) return -1;
+
+    bool deviceLocal = static_cast<bool>(flags & Flag::eDeviceLocal);
+    bool hostVisible = static_cast<bool>(flags & Flag::eHostVisible);
+    bool hostCoherent = static_cast<bool>(flags & Flag::eHostCoherent);
+    bool hostCached = static_cast<bool>(flags & Flag::eHostCached);
+
+    switch(usage) {
+    case MemoryUsage::GpuOnly:
+        return (deviceLocal ? 4 : 0) + (hostVisible ? 0 : 1);
+    case MemoryUsage::Upload:
+        // Write combined system memory, leaving mappable VRAM to Dynamic
+        if(!hostVisible || !hostCoherent) return -1;
+        return (deviceLocal ? 0 : 2) + (hostCached ? 0 : 1);
+    case MemoryUsage::Readback:
+        if(!hostVisible) return -1;
+        return (hostCached ? 4 : 0) + (hostCoherent ? 1 : 0);
+    case MemoryUsage::Dynamic:
+        if(!hostVisible || !hostCoherent) return -1;
+        return (deviceLocal ? 2 : 0) + (hostCached ? 0 : 1);
+    }
+
+    return -1;
+}
+
+Device::Device(
+    vk::Instance &instance,
+    vk::SurfaceKHR surface,
+    vk::PhysicalDeviceFeatures requestedFeatures,
+    const std::vector<const char*> &requestedExtensions,
+    vk::DispatchLoaderDynamic &v_dispatcher
+) : v_dispatcher(v_dispatcher) {
+    auto physical_devices = instance.enumeratePhysicalDevices(v_dispatcher);
+
+    vk::Optional<vk::PhysicalDevice> chosenDevice = nullptr;
+
+    for(auto &device : physical_devices) {
+        auto features = device.getFeatures(v_dispatcher);
+
+        if(!supportsFeatures(features, requestedFeatures)) {
+            continue;
+        }
+
+        std::set<std::string> requiredExtensions(requestedExtensions.begin(), requestedExtensions.end());
+
+        for(auto &availableExtension :
+            device.enumerateDeviceExtensionProperties(nullptr, v_dispatcher))
+        {
+            requiredExtensions.erase(availableExtension.extensionName);
+        }
+
+        if(requiredExtensions.empty()) {
+            chosenDevice = device;
+            break;
+        }
+    }
+
+    if(chosenDevice == nullptr) {
+        THROW(runtime_error, "Failed to find device with requested Vulkan features!");
+    }
+
+    v_physical_device = *chosenDevice;
+    properties = queryProperties(v_physical_device, v_dispatcher);
+
+    for(size_t usage = 0; usage < MEMORY_USAGE_COUNT; usage++) {
+        auto &ranking = memory_type_ranking[usage];
+
+        for(uint32_t i = 0; i < properties.memory.memoryTypeCount; i++) {
+            if(scoreMemoryType(properties.memory.memoryTypes[i].propertyFlags, MemoryUsage(usage)) >= 0) {
+                ranking.push_back(i);
+            }
+        }
+
+        std::stable_sort(ranking.begin(), ranking.end(), [&](uint32_t a, uint32_t b) {
+            return scoreMemoryType(properties.memory.memoryTypes[a].propertyFlags, MemoryUsage(usage)) >
+                scoreMemoryType(properties.memory.memoryTypes[b].propertyFlags, MemoryUsage(usage));
+        });
+    }
+
+    queue_family_indices = QueueFamilyIndices(v_physical_device, properties.queue_families, surface, v_dispatcher);
+
+    std::set<uint32_t> uniqueQueueFamilies = {
+        queue_family_indices.graphics,
+        queue_family_indices.present,
+    };
+    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+
+    for(auto queueFamily : uniqueQueueFamilies) {
+        const std::vector<float> queuePriorities = {1.0f};
+        auto queueInfo = vk::DeviceQueueCreateInfo()
+            .setQueueFamilyIndex(queueFamily)
+            .setQueuePriorities(queuePriorities)
+            .setQueueCount(1);
+        queueCreateInfos.push_back(queueInfo);
+    }
+
+    const auto &supportedFeatures = properties.features;
+
+    capabilities.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+    capabilities.occlusionQueryPrecise = supportedFeatures.occlusionQueryPrecise;
+    capabilities.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    capabilities.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+
+    requestedFeatures
+        .setPipelineStatisticsQuery(supportedFeatures.pipelineStatisticsQuery)
+        .setOcclusionQueryPrecise(supportedFeatures.occlusionQueryPrecise)
+        .setMultiDrawIndirect(supportedFeatures.multiDrawIndirect)
+        .setDrawIndirectFirstInstance(supportedFeatures.drawIndirectFirstInstance);
+
+    std::vector<const char*> enabledExtensions = requestedExtensions;
+
+    auto deviceInfo = vk::DeviceCreateInfo()
+        .setQueueCreateInfos(queueCreateInfos)
+        .setPEnabledFeatures(&requestedFeatures);
+
+    // Newer feature structs are only chained when the device actually implements that version
+    const uint32_t apiVersion = properties.core.apiVersion;
+
+    vk::PhysicalDeviceVulkan12Features enabledFeatures12;
+    vk::PhysicalDeviceVulkan13Features enabledFeatures13;
+
+    if(apiVersion >= VK_API_VERSION_1_2) {
+        const auto &supported12 = properties.features12;
+
+        capabilities.imagelessFramebuffer = supported12.imagelessFramebuffer;
+        capabilities.timelineSemaphore = supported12.timelineSemaphore;
+        capabilities.drawIndirectCount = supported12.drawIndirectCount;
+        capabilities.bufferDeviceAddress = supported12.bufferDeviceAddress;
+
+        enabledFeatures12
+            .setImagelessFramebuffer(supported12.imagelessFramebuffer)
+            .setTimelineSemaphore(supported12.timelineSemaphore)
+            .setDrawIndirectCount(supported12.drawIndirectCount)
+            .setBufferDeviceAddress(supported12.bufferDeviceAddress);
+
+        deviceInfo = deviceInfo.setPNext(&enabledFeatures12);
+    }
+
+    if(apiVersion >= VK_API_VERSION_1_3) {
+        const auto &supported13 = properties.features13;
+
+        capabilities.synchronization2 = supported13.synchronization2;
+
+        enabledFeatures13.setSynchronization2(supported13.synchronization2);
+
+        enabledFeatures12.setPNext(&enabledFeatures13);
+    }
+
+    vk::PhysicalDevicePresentIdFeaturesKHR enabledPresentId;
+    vk::PhysicalDevicePresentWaitFeaturesKHR enabledPresentWait;
+
+    // Lets frame pacing wait for frames to reach the display, only useful when presenting
+    if(apiVersion >= VK_API_VERSION_1_1 &&
+       hasExtension(enabledExtensions, vk::KHRSwapchainExtensionName) &&
+       supportsExtension(v_physical_device, vk::KHRPresentIdExtensionName, v_dispatcher) &&
+       supportsExtension(v_physical_device, vk::KHRPresentWaitExtensionName, v_dispatcher))
+    {
+        auto supported = v_physical_device.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDevicePresentIdFeaturesKHR,
+            vk::PhysicalDevicePresentWaitFeaturesKHR
+        >(v_dispatcher);
+
+        capabilities.presentWait = supported.get<vk::PhysicalDevicePresentIdFeaturesKHR>().presentId &&
+            supported.get<vk::PhysicalDevicePresentWaitFeaturesKHR>().presentWait;
+    }
+
+    if(capabilities.presentWait) {
+        for(const char *extension : {vk::KHRPresentIdExtensionName, vk::KHRPresentWaitExtensionName}) {
+            if(!hasExtension(enabledExtensions, extension)) {
+                enabledExtensions.push_back(extension);
+            }
+        }
+
+        enabledPresentId.setPresentId(vk::True);
+        enabledPresentWait
+            .setPresentWait(vk::True)
+            .setPNext(const_cast<void*>(deviceInfo.pNext));
+
+        enabledPresentId.setPNext(&enabledPresentWait);
+        deviceInfo = deviceInfo.setPNext(&enabledPresentId);
+    }
+
+    // Lets the memory tracker watch heap budgets and order what gets paged out first
+    capabilities.memoryBudget = apiVersion >= VK_API_VERSION_1_1 &&
+        supportsExtension(v_physical_device, vk::EXTMemoryBudgetExtensionName, v_dispatcher);
+
+    if(capabilities.memoryBudget && !hasExtension(enabledExtensions, vk::EXTMemoryBudgetExtensionName)) {
+        enabledExtensions.push_back(vk::EXTMemoryBudgetExtensionName);
+    }
+
+    vk::PhysicalDeviceMemoryPriorityFeaturesEXT enabledMemoryPriority;
+    vk::PhysicalDevicePageableDeviceLocalMemoryFeaturesEXT enabledPageable;
+
+    if(apiVersion >= VK_API_VERSION_1_1 &&
+       supportsExtension(v_physical_device, vk::EXTMemoryPriorityExtensionName, v_dispatcher))
+    {
+        auto supported = v_physical_device.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceMemoryPriorityFeaturesEXT
+        >(v_dispatcher);
+
+        capabilities.memoryPriority = supported.get<vk::PhysicalDeviceMemoryPriorityFeaturesEXT>().memoryPriority;
+    }
+
+    if(capabilities.memoryPriority &&
+       supportsExtension(v_physical_device, vk::EXTPageableDeviceLocalMemoryExtensionName, v_dispatcher))
+    {
+        auto supported = v_physical_device.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDevicePageableDeviceLocalMemoryFeaturesEXT
+        >(v_dispatcher);
+
+        capabilities.pageableDeviceLocalMemory =
+            supported.get<vk::PhysicalDevicePageableDeviceLocalMemoryFeaturesEXT>().pageableDeviceLocalMemory;
+    }
+
+    if(capabilities.memoryPriority) {
+        if(!hasExtension(enabledExtensions, vk::EXTMemoryPriorityExtensionName)) {
+            enabledExtensions.push_back(vk::EXTMemoryPriorityExtensionName);
+        }
+
+        enabledMemoryPriority
+            .setMemoryPriority(vk::True)
+            .setPNext(const_cast<void*>(deviceInfo.pNext));
+        deviceInfo = deviceInfo.setPNext(&enabledMemoryPriority);
+    }
+
+    if(capabilities.pageableDeviceLocalMemory) {
+        if(!hasExtension(enabledExtensions, vk::EXTPageableDeviceLocalMemoryExtensionName)) {
+            enabledExtensions.push_back(vk::EXTPageableDeviceLocalMemoryExtensionName);
+        }
+
+        enabledPageable
+            .setPageableDeviceLocalMemory(vk::True)
+            .setPNext(const_cast<void*>(deviceInfo.pNext));
+        deviceInfo = deviceInfo.setPNext(&enabledPageable);
+    }
+
+    deviceInfo = deviceInfo.setPEnabledExtensionNames(enabledExtensions);
+
+    if(Validation::enableValidationLayers) {
+        deviceInfo = deviceInfo.setPEnabledLayerNames(Validation::validationLayers);
+    }
+
+    v_device = v_physical_device.createDevice(deviceInfo, nullptr, v_dispatcher);
+    LOG_DEBUG("Created Vulkan device for {} (present wait: {}, memory budget: {}, pageable memory: {}).",
+        properties.name(), capabilities.presentWait,
+        capabilities.memoryBudget, capabilities.pageableDeviceLocalMemory
+    );
+
+    v_dispatcher.init(v_device);
+
+    v_queue = v_device.getQueue(queue_family_indices.graphics, 0, v_dispatcher);
+    LOG_DEBUG("Created graphics queue.");
+
+    if(queue_family_indices.presentable) {
+        v_present_queue = v_device.getQueue(queue_family_indices.present, 0, v_dispatcher);
+        LOG_DEBUG("Created present queue.");
+    } else {
+        v_present_queue = v_queue;
+        LOG_DEBUG("Created headless device without a present queue.");
+    }
+
+    memory = std::make_unique<MemoryTracker>(*this);
+    deletion_queue = std::make_unique<DeletionQueue>(*this);
+    resource_states = std::make_unique<ResourceStateTracker>();
+
+    render_pass_cache = std::make_unique<RenderPassCache>(*this);
+    framebuffer_cache = std::make_unique<FramebufferCache>(*this);
+    LOG_DEBUG("Created render pass and framebuffer caches (imageless framebuffers: {}).",
+        capabilities.imagelessFramebuffer
+    );
+
+    fence_pool = std::make_unique<FencePool>(*this);
+    semaphore_pool = std::make_unique<SemaphorePool>(*this);
+
+    jobs = std::make_unique<JobSystem>();
+}
+
+Device::~Device() {
+    v_device.waitIdle(v_dispatcher);
+
+    // Jobs may still release into the subsystems below
+    jobs.reset();
+
+    semaphore_pool.reset();
+    fence_pool.reset();
+    framebuffer_cache.reset();
+    render_pass_cache.reset();
+    resource_states.reset();
+
+    deletion_queue->flush();
+    deletion_queue.reset();
+    memory.reset();
+
+    LOG_DEBUG("Destroyed Vulkan device for {}.", properties.name());
+    v_device.destroy(nullptr, v_dispatcher);
+}
+
+void Device::nextFrame() {
+    SVK_FRAME_MARK();
+    SVK_ZONE("Device::nextFrame");
+
+    frame_index++;
+
+    framebuffer_cache->evictUnused();
+    render_pass_cache->evictUnused();
+
+    fence_pool->collect();
+    semaphore_pool->collect();
+
+    deletion_queue->collect();
+
+    memory->update();
+}
+
+std::optional<uint32_t> Device::memoryType(uint32_t type_bits, MemoryUsage usage) const {
+    for(uint32_t type : memory_type_ranking[static_cast<size_t>(usage)]) {
+        if(type_bits & (1u << type)) return type;
+    }
+
+    return std::nullopt;
+}
@@ -1,14 +1,19 @@
 #include "vkswapchain.hpp"
+#include "barriers.hpp"
+#include "instrument.hpp"
 #include "log.hpp"
+#include "rendercache.hpp"
 #include "vkdevice.hpp"
 
 #include <algorithm>
 #include <cstdint>
 #include <limits>
 #include <set>
+#include <utility>
 
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_to_string.hpp>
 #ifndef __MACH__
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_structs.hpp>
@@ -20,166 +25,180 @@ Swapchain::Swapchain(
     vk::SurfaceKHR surface,
     PreferredSwapchainSettings preferredSettings,
     vk::DispatchLoaderDynamic &dispatcher
-) : device(device), v_surface(surface), framebuffer_render_pass(nullptr), v_dispatcher(dispatcher) {
-    auto supportDetails = querySupportDetails(surface);
-
-    // std::set<vk::SurfaceFormatKHR> formatsUnique(supportDetails.formats.begin(), supportDetails.formats.end());
-    std::set<vk::PresentModeKHR> presentModesUnique(supportDetails.presentModes.begin(), supportDetails.presentModes.end());
+) : device(&device), settings(std::move(preferredSettings)), v_surface(surface), v_dispatcher(&dispatcher) {
+    if(!device.queue_family_indices.presentable) {
+        THROW(runtime_error, "Cannot create a swapchain on a device created without a surface.");
+    }
 
-    vk::SurfaceFormatKHR chosenFormat;
-    vk::PresentModeKHR chosenPresentMode;
+    auto supportDetails = querySupportDetails(surface);
 
     auto format = std::find_if(
         supportDetails.formats.begin(),
         supportDetails.formats.end(),
-        [preferredSettings](vk::SurfaceFormatKHR format) {
-            return format == preferredSettings.preferredFormat;
+        [this](vk::SurfaceFormatKHR format) {
+            return format == settings.preferredFormat;
         }
     );
 
     if(format == supportDetails.formats.end()) {
-        chosenFormat = supportDetails.formats[0];
+        v_format = supportDetails.formats[0];
     } else {
-        chosenFormat = *format;
+        v_format = *format;
     }
 
-    // if(formatsUnique.find(preferredSettings.preferredFormat) != formatsUnique.end()) {
-    //     chosenFormat = preferredSettings.preferredFormat;
-    // } else {
-    //     chosenFormat = supportDetails.formats[0];
-    // }
+    createSwapchain(windowWidth, windowHeight);
+}
 
-    if(presentModesUnique.find(preferredSettings.preferredPresentMode) != presentModesUnique.end()) {
-        chosenPresentMode = preferredSettings.preferredPresentMode;
-    } else {
-        chosenPresentMode = supportDetails.presentModes[0];
-    }
+Swapchain::~Swapchain() {
+    if(device) cleanupSwapchain();
+}
 
-    auto extent = chooseExtent(windowWidth, windowHeight, supportDetails.capabilities);
-    
-    uint32_t imageCount = supportDetails.capabilities.minImageCount + 1;
-    if(supportDetails.capabilities.maxImageCount > 0 && imageCount > supportDetails.capabilities.maxImageCount) {
-        imageCount = supportDetails.capabilities.maxImageCount;
+Swapchain::Swapchain(Swapchain &&other) noexcept
+: device(std::exchange(other.device, nullptr)),
+  images(std::move(other.images)),
+  imageViews(std::move(other.imageViews)),
+  v_format(other.v_format),
+  v_swapchain_extent(other.v_swapchain_extent),
+  v_present_mode(other.v_present_mode),
+  settings(std::move(other.settings)),
+  generation(other.generation),
+  v_surface(other.v_surface),
+  v_dispatcher(other.v_dispatcher),
+  v_swapchain(std::exchange(other.v_swapchain, nullptr)) {}
+
+Swapchain &Swapchain::operator=(Swapchain &&other) noexcept {
+    if(this != &other) {
+        if(device) cleanupSwapchain();
+
+        device = std::exchange(other.device, nullptr);
+        images = std::move(other.images);
+        imageViews = std::move(other.imageViews);
+        v_format = other.v_format;
+        v_swapchain_extent = other.v_swapchain_extent;
+        v_present_mode = other.v_present_mode;
+        settings = std::move(other.settings);
+        generation = other.generation;
+        v_surface = other.v_surface;
+        v_dispatcher = other.v_dispatcher;
+        v_swapchain = std::exchange(other.v_swapchain, nullptr);
     }
+    return *this;
+}
 
-    auto swapchainInfo = vk::SwapchainCreateInfoKHR()
-        .setSurface(surface)
-        .setMinImageCount(imageCount)
-        .setImageFormat(chosenFormat.format)
-        .setImageColorSpace(chosenFormat.colorSpace)
-        .setPresentMode(chosenPresentMode)
-        .setImageExtent(extent)
-        .setImageArrayLayers(1)
-        .setImageUsage(vk::ImageUsageFlagBits::eColorAttachment)
-        .setPreTransform(supportDetails.capabilities.currentTransform)
-        .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
-        .setClipped(vk::True);
-    
-    QueueFamilyIndices indices = device.queue_family_indices;
+void Swapchain::cleanupSwapchain() {
+    for(auto &imageView : imageViews) {
+        device->framebuffer_cache->evictView(imageView);
+        device->v_device.destroyImageView(imageView, nullptr, *v_dispatcher);
+    }
 
-    if(indices.graphics != indices.present) {
-        const std::vector<uint32_t> queueFamilyIndices = {indices.graphics, indices.present};
-        swapchainInfo = swapchainInfo.setImageSharingMode(vk::SharingMode::eConcurrent)
-            .setQueueFamilyIndices(queueFamilyIndices);
-    } else {
-        swapchainInfo = swapchainInfo.setImageSharingMode(vk::SharingMode::eExclusive);
+    for(auto &image : images) {
+        device->resource_states->forgetImage(image);
     }
 
-    v_swapchain = device.v_device.createSwapchainKHR(swapchainInfo, nullptr, v_dispatcher);
-    v_swapchain_extent = extent;
-    v_format = chosenFormat;
-    v_present_mode = chosenPresentMode;
+    device->v_device.destroySwapchainKHR(v_swapchain, nullptr, *v_dispatcher);
+    LOG_DEBUG("Destroyed swapchain.");
+}
 
-    LOG_DEBUG("Created swapchain with extent {}x{}", extent.width, extent.height);
 
-    images = device.v_device.getSwapchainImagesKHR(v_swapchain, v_dispatcher);
+void Swapchain::recreate(int windowWidth, int windowHeight) {
+    SVK_ZONE("Swapchain::recreate");
 
-    imageViews = createImageViews();
-    LOG_DEBUG("Created {} image views.", imageViews.size());
-}
+    device->v_device.waitIdle(*v_dispatcher);
 
-Swapchain::~Swapchain() {
     cleanupSwapchain();
+    createSwapchain(windowWidth, windowHeight);
 }
 
-void Swapchain::cleanupSwapchain() {
-    if(framebuffers.size() != 0) {
-        for(auto &framebuffer : framebuffers) {
-            device.v_device.destroyFramebuffer(framebuffer, nullptr, v_dispatcher);
-        }
-    }
-    
-    for(auto &imageView : imageViews) {
-        device.v_device.destroyImageView(imageView, nullptr, v_dispatcher);
+vk::PresentModeKHR Swapchain::setPresentModes(std::vector<vk::PresentModeKHR> priority) {
+    settings.presentModePriority = std::move(priority);
+
+    auto chosenPresentMode = choosePresentMode(querySupportDetails(v_surface).presentModes);
+
+    if(chosenPresentMode != v_present_mode) {
+        recreate(v_swapchain_extent.width, v_swapchain_extent.height);
     }
 
-    device.v_device.destroySwapchainKHR(v_swapchain, nullptr, v_dispatcher);
-    LOG_DEBUG("Destroyed swapchain.");
+    return v_present_mode;
 }
 
+void Swapchain::setImageCount(uint32_t imageCount) {
+    settings.imageCount = imageCount;
 
-void Swapchain::recreate(int windowWidth, int windowHeight) {
-    (*device).waitIdle(v_dispatcher);
+    recreate(v_swapchain_extent.width, v_swapchain_extent.height);
+}
 
+void Swapchain::createSwapchain(int windowWidth, int windowHeight) {
     auto supportDetails = querySupportDetails(v_surface);
-    bool recreateFramebuffers = framebuffers.size() != 0;
 
     auto extent = chooseExtent(windowWidth, windowHeight, supportDetails.capabilities);
-
-    cleanupSwapchain();
-
-    uint32_t imageCount = supportDetails.capabilities.minImageCount + 1;
-    if(supportDetails.capabilities.maxImageCount > 0 && imageCount > supportDetails.capabilities.maxImageCount) {
-        imageCount = supportDetails.capabilities.maxImageCount;
-    }
+    auto presentMode = choosePresentMode(supportDetails.presentModes);
+    uint32_t imageCount = chooseImageCount(supportDetails.capabilities);
 
     auto swapchainInfo = vk::SwapchainCreateInfoKHR()
         .setSurface(v_surface)
         .setMinImageCount(imageCount)
         .setImageFormat(v_format.format)
         .setImageColorSpace(v_format.colorSpace)
-        .setPresentMode(v_present_mode)
+        .setPresentMode(presentMode)
         .setImageExtent(extent)
         .setImageArrayLayers(1)
         .setImageUsage(vk::ImageUsageFlagBits::eColorAttachment)
         .setPreTransform(supportDetails.capabilities.currentTransform)
         .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
         .setClipped(vk::True);
-    
-    QueueFamilyIndices indices = device.queue_family_indices;
 
-    v_swapchain = device.v_device.createSwapchainKHR(swapchainInfo, nullptr, v_dispatcher);
+    QueueFamilyIndices indices = device->queue_family_indices;
+    const std::vector<uint32_t> queueFamilyIndices = {indices.graphics, indices.present};
+
+    if(indices.graphics != indices.present) {
+        swapchainInfo = swapchainInfo.setImageSharingMode(vk::SharingMode::eConcurrent)
+            .setQueueFamilyIndices(queueFamilyIndices);
+    } else {
+        swapchainInfo = swapchainInfo.setImageSharingMode(vk::SharingMode::eExclusive);
+    }
+
+    v_swapchain = device->v_device.createSwapchainKHR(swapchainInfo, nullptr, *v_dispatcher);
     v_swapchain_extent = extent;
+    v_present_mode = presentMode;
+    generation++;
 
-    LOG_DEBUG("Created swapchain with extent {}x{}", extent.width, extent.height);
+    LOG_DEBUG("Created swapchain with extent {}x{}, {} and {} images.",
+        extent.width, extent.height, vk::to_string(presentMode), imageCount
+    );
 
-    images = device.v_device.getSwapchainImagesKHR(v_swapchain, v_dispatcher);
+    images = device->v_device.getSwapchainImagesKHR(v_swapchain, *v_dispatcher);
+    trackImages();
 
     imageViews = createImageViews();
     LOG_DEBUG("Created {} image views.", imageViews.size());
+}
 
-    if(recreateFramebuffers) {
-        initFramebuffers(*framebuffer_render_pass);
+vk::PresentModeKHR Swapchain::choosePresentMode(const std::vector<vk::PresentModeKHR> &supported) {
+    std::set<vk::PresentModeKHR> presentModesUnique(supported.begin(), supported.end());
+
+    for(auto presentMode : settings.presentModePriority) {
+        if(presentModesUnique.find(presentMode) != presentModesUnique.end()) {
+            return presentMode;
+        }
     }
-}
 
-void Swapchain::initFramebuffers(RenderPass &render_pass) {
-    framebuffer_render_pass = render_pass;
+    if(presentModesUnique.find(settings.preferredPresentMode) != presentModesUnique.end()) {
+        return settings.preferredPresentMode;
+    }
 
-    framebuffers.resize(imageViews.size());
+    // The only mode the spec requires
+    return vk::PresentModeKHR::eFifo;
+}
 
-    for(size_t i = 0; i < imageViews.size(); i++) {
-        vk::ImageView &attachment = imageViews[i];
+uint32_t Swapchain::chooseImageCount(vk::SurfaceCapabilitiesKHR &caps) {
+    uint32_t imageCount = settings.imageCount != 0 ? settings.imageCount : caps.minImageCount + 1;
 
-        auto framebufferInfo = vk::FramebufferCreateInfo()
-            .setAttachments(attachment)
-            .setWidth(v_swapchain_extent.width)
-            .setHeight(v_swapchain_extent.height)
-            .setRenderPass(render_pass.v_render_pass)
-            .setLayers(1);
-        
-        framebuffers[i] = device.v_device.createFramebuffer(framebufferInfo, nullptr, v_dispatcher);
+    imageCount = std::max(imageCount, caps.minImageCount);
+    if(caps.maxImageCount > 0 && imageCount > caps.maxImageCount) {
+        imageCount = caps.maxImageCount;
     }
+
+    return imageCount;
 }
 
 std::vector<vk::ImageView> Swapchain::createImageViews() {
@@ -204,7 +223,7 @@ std::vector<vk::ImageView> Swapchain::createImageViews() {
                 .setLayerCount(1)
             );
         
-        result[i] = device.v_device.createImageView(imageViewInfo, nullptr, v_dispatcher);
+        result[i] = device->v_device.createImageView(imageViewInfo, nullptr, *v_dispatcher);
     }
     return result;
 }
@@ -218,14 +237,42 @@ vk::ResultValue<uint32_t> Swapchain::acquireImage(
         semaphore->v_semaphore;
     vk::Fence fenceChecked = fence == nullptr ? nullptr :
         fence->v_fence;
-    
-    return device.v_device.acquireNextImageKHR(
+
+    return acquireImage(semaphoreChecked, fenceChecked, timeout);
+}
+
+vk::ResultValue<uint32_t> Swapchain::acquireImage(
+    vk::Semaphore semaphore,
+    vk::Fence fence,
+    uint64_t timeout
+) {
+    SVK_ZONE("Swapchain::acquireImage");
+
+    auto result = device->v_device.acquireNextImageKHR(
         v_swapchain,
         timeout,
-        semaphoreChecked,
-        fenceChecked,
-        v_dispatcher
+        semaphore,
+        fence,
+        *v_dispatcher
     );
+
+    if(result.result == vk::Result::eSuccess || result.result == vk::Result::eSuboptimalKHR) {
+        // Contents are discarded on acquire. The first transition has to wait for
+        // the stage the acquire semaphore is waited on.
+        device->resource_states->setImageState(images[result.value], ResourceState {
+            vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+            vk::AccessFlags2(),
+            vk::ImageLayout::eUndefined,
+        });
+    }
+
+    return result;
+}
+
+void Swapchain::trackImages() {
+    for(auto &image : images) {
+        device->resource_states->trackImage(image, 1, 1, vk::ImageAspectFlagBits::eColor);
+    }
 }
 
 vk::Extent2D Swapchain::chooseExtent(int windowWidth, int windowHeight, vk::SurfaceCapabilitiesKHR &caps) {
@@ -247,9 +294,9 @@ vk::Extent2D Swapchain::chooseExtent(int windowWidth, int windowHeight, vk::Surf
 SwapChainSupportDetails Swapchain::querySupportDetails(vk::SurfaceKHR surface) {
     SwapChainSupportDetails details;
 
-    auto caps = device.v_physical_device.getSurfaceCapabilitiesKHR(surface, v_dispatcher);
-    auto formats = device.v_physical_device.getSurfaceFormatsKHR(surface, v_dispatcher);
-    auto presentModes = device.v_physical_device.getSurfacePresentModesKHR(surface, v_dispatcher);
+    auto caps = device->v_physical_device.getSurfaceCapabilitiesKHR(surface, *v_dispatcher);
+    auto formats = device->v_physical_device.getSurfaceFormatsKHR(surface, *v_dispatcher);
+    auto presentModes = device->v_physical_device.getSurfacePresentModesKHR(surface, *v_dispatcher);
 
     details.capabilities = caps;
     details.formats = formats;
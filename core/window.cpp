@@ -1,9 +1,13 @@
 #include "window.hpp"
 
 #include <GLFW/glfw3.h>
+#include <chrono>
 #include <cstdint>
+#include <exception>
+#include <memory>
 #include <fmt/format.h>
 #include <stdexcept>
+#include <thread>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan_enums.hpp>
@@ -11,8 +15,8 @@
 #include <vulkan/vulkan_structs.hpp>
 #include <vulkan/vulkan_to_string.hpp>
 
+#include "instrument.hpp"
 #include "log.hpp"
-#include "validation.hpp"
 #include "vkswapchain.hpp"
 
 Window::Window(std::string title, const std::vector<std::tuple<int, int>> &hints) : title(title)
@@ -40,62 +44,57 @@ Window::Window(std::string title, const std::vector<std::tuple<int, int>> &hints
 
     glfwSetWindowUserPointer(window, this);
     auto resize = [](GLFWwindow *window, int width, int height) {
-        static_cast<Window*>(glfwGetWindowUserPointer(window))->resize(width, height);
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->queueResize(width, height);
     };
     glfwSetWindowSizeCallback(window, resize);
     auto mouseWheel = [](GLFWwindow *window, double dx, double dy) {
-        static_cast<Window*>(glfwGetWindowUserPointer(window))->mouseScroll(dx, dy);
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->queueEvent(InputEvent {
+            .type = InputEvent::Type::MouseScroll,
+            .dx = dx,
+            .dy = dy,
+        });
     };
     glfwSetScrollCallback(window, mouseWheel);
     auto keyboardCall = [](GLFWwindow *window, int key, int scancode, int action, int mod) {
-        static_cast<Window*>(glfwGetWindowUserPointer(window))->keyboardCallback(key, action, scancode, mod);
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->queueEvent(InputEvent {
+            .type = InputEvent::Type::Key,
+            .key = key,
+            .action = action,
+            .scancode = scancode,
+            .mod = mod,
+        });
     };
     glfwSetKeyCallback(window, keyboardCall);
+    auto mouseButtonCall = [](GLFWwindow *window, int button, int action, int mod) {
+        static_cast<Window*>(glfwGetWindowUserPointer(window))->queueEvent(InputEvent {
+            .type = InputEvent::Type::MouseButton,
+            .key = button,
+            .action = action,
+            .mod = mod,
+        });
+    };
+    glfwSetMouseButtonCallback(window, mouseButtonCall);
 }
 
 Window::~Window()
 {
     LOG_DEBUG("Stopping GLFW.");
 
-    if(v_swapchain != nullptr)
-        delete v_swapchain;
+    // Swapchain releases into the device, so it goes first
+    v_swapchain.reset();
+    v_context.v_device.reset();
 
-    if(v_device != nullptr)
-        delete v_device;
+    if(v_context.vk_ready) {
+        v_context.v_instance.destroySurfaceKHR(v_surface, nullptr, v_dispatcher);
+    }
 
-    if(vk_ready) {
-        v_instance.destroySurfaceKHR(v_surface, nullptr, v_dispatcher);
+    v_context.destroy();
 
-        v_instance.destroyDebugUtilsMessengerEXT(v_messenger, nullptr, v_dispatcher);
-        LOG_DEBUG("Destroyed Vulkan debug messenger.");
-        v_instance.destroy(nullptr, v_dispatcher);
-        LOG_DEBUG("Destroyed Vulkan instance.");
-    }
-    
     glfwDestroyWindow(window);
     glfwTerminate();
 }
 
 void Window::initVulkan(std::vector<const char*> requestedExtensions, bool portability) {
-    auto appinfo = vk::ApplicationInfo()
-        .setPApplicationName(title.c_str())
-        .setApplicationVersion(vk::makeApiVersion(0, 0, 1, 0))
-        .setApiVersion(vk::ApiVersion13)
-        .setEngineVersion(vk::makeApiVersion(0, 0, 1, 0))
-        .setPEngineName("svk");
-
-    std::vector<const char*> enabledLayers = {
-        "VK_LAYER_KHRONOS_validation"
-    };
-
-    if(Validation::enableValidationLayers) {
-        requestedExtensions.push_back(vk::EXTDebugUtilsExtensionName);
-    }
-
-    if(portability) {
-        requestedExtensions.push_back(vk::KHRPortabilityEnumerationExtensionName);
-    }
-
     uint32_t glfwExtensionCount;
 
     const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
@@ -104,46 +103,10 @@ void Window::initVulkan(std::vector<const char*> requestedExtensions, bool porta
         requestedExtensions.push_back(glfwExtensions[i]);
     }
 
-    auto instanceInfo = vk::InstanceCreateInfo()
-        .setPApplicationInfo(&appinfo)
-        .setPEnabledExtensionNames(requestedExtensions);
-    
-    if(Validation::enableValidationLayers) {
-        instanceInfo = instanceInfo.setPEnabledLayerNames(enabledLayers);
-    } else {
-        instanceInfo = instanceInfo.setEnabledLayerCount(0);
-    }
-
-    if(portability) {
-        instanceInfo.setFlags(vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR);
-    }
-
-    v_dispatcher.init();
-
-    v_instance = vk::createInstance(instanceInfo, nullptr, v_dispatcher);
-    v_dispatcher.init(v_instance);
-
-    LOG_DEBUG("Initialized Vulkan instance.");
-
-    if(Validation::enableValidationLayers) {
-        auto messengerInfo = vk::DebugUtilsMessengerCreateInfoEXT()
-            .setMessageSeverity(
-                vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo |
-                vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose |
-                vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
-                vk::DebugUtilsMessageSeverityFlagBitsEXT::eError
-            ).setMessageType(
-                vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
-                vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance |
-                vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation
-            ).setPfnUserCallback(logging::debugCallback);
-        
-        v_messenger = v_instance.createDebugUtilsMessengerEXT(messengerInfo, nullptr, v_dispatcher);
-        LOG_DEBUG("Initialized Vulkan debug messenger.");
-    }
+    v_context.createInstance(title, requestedExtensions, portability);
 
     vk::Result surfaceCreateResult = (vk::Result)glfwCreateWindowSurface(
-        static_cast<VkInstance>(v_instance),
+        static_cast<VkInstance>(v_context.v_instance),
         window,
         nullptr,
         reinterpret_cast<VkSurfaceKHR*>(&v_surface)
@@ -156,32 +119,23 @@ void Window::initVulkan(std::vector<const char*> requestedExtensions, bool porta
     }
 
     LOG_DEBUG("Created VkSurfaceKHR.");
-
-    vk_ready = true;
 }
 
-Device *Window::requestDevice(
+Device &Window::requestDevice(
     const vk::PhysicalDeviceFeatures &requestedFeatures,
     const std::vector<const char*> &requestedExtensions
 ) {
-    v_device = new Device(
-    v_instance,
-        v_surface,
-        vk::PhysicalDeviceFeatures(),
-        requestedExtensions,
-        v_dispatcher
-    );
-    return v_device;
+    return v_context.requestDevice(requestedFeatures, requestedExtensions, v_surface);
 }
 
-Swapchain *Window::requestSwapchain(
+Swapchain &Window::requestSwapchain(
     PreferredSwapchainSettings preferredSettings
 ) {
     int width, height;
     glfwGetWindowSize(window, &width, &height);
 
-    v_swapchain = new Swapchain(
-        *v_device,
+    v_swapchain = std::make_unique<Swapchain>(
+        *v_context.v_device,
         width,
         height,
         v_surface, 
@@ -189,5 +143,144 @@ Swapchain *Window::requestSwapchain(
         v_dispatcher
     );
 
-    return v_swapchain;
+    return *v_swapchain;
+}
+
+void Window::runRenderThread() {
+    render_thread_running.store(true, std::memory_order_release);
+    stop_render_thread.store(false, std::memory_order_release);
+
+    std::exception_ptr renderError;
+
+    std::thread renderThread([this, &renderError] {
+        try {
+            renderLoop();
+        } catch(...) {
+            renderError = std::current_exception();
+        }
+
+        stop_render_thread.store(true, std::memory_order_release);
+        // Wakes the event loop so it notices the render thread is gone
+        glfwPostEmptyEvent();
+    });
+
+    LOG_DEBUG("Started render thread.");
+
+    while(!glfwWindowShouldClose(window) && !stop_render_thread.load(std::memory_order_acquire)) {
+        glfwWaitEvents();
+
+        if(pending_fullscreen_toggles.exchange(0, std::memory_order_acq_rel) % 2 == 1) {
+            applyFullscreenToggle();
+        }
+    }
+
+    stop_render_thread.store(true, std::memory_order_release);
+    renderThread.join();
+
+    render_thread_running.store(false, std::memory_order_release);
+
+    LOG_DEBUG("Stopped render thread ({} input events dropped).", dropped_events);
+
+    if(renderError) {
+        std::rethrow_exception(renderError);
+    }
+}
+
+void Window::toggleFullscreen() {
+    if(!render_thread_running.load(std::memory_order_acquire)) {
+        applyFullscreenToggle();
+        return;
+    }
+
+    pending_fullscreen_toggles.fetch_add(1, std::memory_order_acq_rel);
+    glfwPostEmptyEvent();
+}
+
+void Window::applyFullscreenToggle() {
+    if(!fullscreen) {
+        GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+        int width, height, xpos, ypos;
+        glfwGetMonitorWorkarea(monitor, &xpos, &ypos, &width, &height);
+
+        glfwSetWindowMonitor(window, monitor, xpos, ypos, width, height, GLFW_DONT_CARE);
+        fullscreen = true;
+    } else {
+        glfwSetWindowMonitor(window, nullptr, 0, 0, 1280, 720, GLFW_DONT_CARE);
+        fullscreen = false;
+    }
+}
+
+void Window::renderLoop() {
+    SVK_THREAD_NAME("Render");
+
+    auto last = std::chrono::steady_clock::now();
+    bool minimized = false;
+
+    while(!stop_render_thread.load(std::memory_order_acquire)) {
+        if(!minimized) beginFrame();
+
+        InputEvent event;
+        while(input_events.pop(event)) {
+            dispatchEvent(event);
+        }
+
+        // Only the newest size matters, every resize in between was never rendered
+        uint64_t size = pending_resize.exchange(NO_PENDING_RESIZE, std::memory_order_acq_rel);
+        if(size != NO_PENDING_RESIZE) {
+            int newWidth = static_cast<int>(size >> 32);
+            int newHeight = static_cast<int>(size & 0xffffffff);
+
+            minimized = newWidth == 0 || newHeight == 0;
+            if(!minimized) resize(newWidth, newHeight);
+        }
+
+        if(minimized) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double delta = std::chrono::duration<double>(now - last).count();
+        last = now;
+
+        render(delta);
+    }
+}
+
+void Window::queueResize(int width, int height) {
+    if(!render_thread_running.load(std::memory_order_acquire)) {
+        resize(width, height);
+        return;
+    }
+
+    pending_resize.store(
+        (static_cast<uint64_t>(width) << 32) | static_cast<uint32_t>(height),
+        std::memory_order_release
+    );
+}
+
+void Window::queueEvent(const InputEvent &event) {
+    if(!render_thread_running.load(std::memory_order_acquire)) {
+        dispatchEvent(event);
+        return;
+    }
+
+    // The event thread never blocks on the render thread
+    if(!input_events.push(event)) {
+        dropped_events++;
+    }
+}
+
+void Window::dispatchEvent(const InputEvent &event) {
+    switch(event.type) {
+    case InputEvent::Type::Key:
+        keyboardCallback(event.key, event.action, event.scancode, event.mod);
+        break;
+    case InputEvent::Type::MouseButton:
+        mouseButton(event.key, event.action, event.mod);
+        break;
+    case InputEvent::Type::MouseScroll:
+        mouseScroll(event.dx, event.dy);
+        break;
+    }
 }
@@ -0,0 +1,690 @@
+/*
+    Many-instance benchmark of the triangle example's render loop with svklib's
+    GPU culling stage. Draws a grid of cubes either with a single instanced draw of
+    everything, or frustum and HiZ occlusion culled through indirect draws, and
+    alternates between the two to report CPU and GPU times of both.
+
+    Usage: culling [instance count, default 131072]. C switches the mode manually.
+*/
+
+#include "barriers.hpp"
+#include "buffer.hpp"
+#include "commandpool.hpp"
+#include "gpuculling.hpp"
+#include "gpuprofiler.hpp"
+#include "image.hpp"
+#include "instrument.hpp"
+#include "meshpool.hpp"
+#include "rendercache.hpp"
+#include "shader.hpp"
+#include "syncpool.hpp"
+#include "vertexlayout.hpp"
+#include "vkpipeline.hpp"
+#include "vkrenderpass.hpp"
+#include "window.hpp"
+#include "log.hpp"
+#include "vkswapchain.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_to_string.hpp>
+
+// Frames spent in each mode before switching to the other one
+static constexpr int PHASE_FRAMES = 600;
+
+static constexpr vk::Format DEPTH_FORMAT = vk::Format::eD32Sfloat;
+
+using Vector3 = std::array<float, 3>;
+
+static Vector3 subtract(const Vector3 &a, const Vector3 &b) {
+    return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+static float dot(const Vector3 &a, const Vector3 &b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static Vector3 cross(const Vector3 &a, const Vector3 &b) {
+    return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+}
+
+static Vector3 normalize(const Vector3 &v) {
+    float length = std::sqrt(dot(v, v));
+    return {v[0] / length, v[1] / length, v[2] / length};
+}
+
+// Right handed, depth in [0, 1] and y pointing down as in Vulkan clip space
+static Matrix4 perspective(float fovy, float aspect, float near, float far) {
+    float f = 1.0f / std::tan(fovy * 0.5f);
+
+    Matrix4 m {};
+    m[0] = f / aspect;
+    m[5] = -f;
+    m[10] = far / (near - far);
+    m[11] = -1.0f;
+    m[14] = near * far / (near - far);
+    return m;
+}
+
+static Matrix4 lookAt(const Vector3 &eye, const Vector3 &center, const Vector3 &up) {
+    Vector3 f = normalize(subtract(center, eye));
+    Vector3 s = normalize(cross(f, up));
+    Vector3 u = cross(s, f);
+
+    Matrix4 m {};
+    m[0] = s[0];  m[4] = s[1];  m[8] = s[2];   m[12] = -dot(s, eye);
+    m[1] = u[0];  m[5] = u[1];  m[9] = u[2];   m[13] = -dot(u, eye);
+    m[2] = -f[0]; m[6] = -f[1]; m[10] = -f[2]; m[14] = dot(f, eye);
+    m[15] = 1.0f;
+    return m;
+}
+
+static Matrix4 multiply(const Matrix4 &a, const Matrix4 &b) {
+    Matrix4 m {};
+    for(int column = 0; column < 4; column++) {
+        for(int row = 0; row < 4; row++) {
+            for(int k = 0; k < 4; k++) {
+                m[column * 4 + row] += a[k * 4 + row] * b[column * 4 + k];
+            }
+        }
+    }
+    return m;
+}
+
+// Averages of one benchmark phase
+struct PhaseTimings {
+    int frames = 0;
+    double record_ms = 0.0;
+    double gpu_ms = 0.0;
+
+    void reset() {
+        *this = PhaseTimings();
+    }
+};
+
+class App : public Window {
+public:
+    App(uint32_t instance_count) : Window("Culling Example", {}), instance_count(instance_count) {
+        Validation::enableValidationLayers = true;
+
+        initVulkan({
+            vk::KHRSurfaceExtensionName,
+        },
+#ifdef __MACH__
+            true
+#else
+            false
+#endif
+        );
+        device = &requestDevice(
+            vk::PhysicalDeviceFeatures(),
+            {
+#ifdef __MACH__
+                "VK_KHR_portability_subset",
+#endif
+                vk::KHRSwapchainExtensionName,
+            }
+        );
+        LOG_INFO("Chosen physical device {} (multiDrawIndirect: {}, drawIndirectCount: {})",
+            device->properties.name(),
+            device->capabilities.multiDrawIndirect,
+            device->capabilities.drawIndirectCount
+        );
+
+        // Unthrottled present modes first, vsync would hide the difference
+        swapchain = &requestSwapchain(PreferredSwapchainSettings {
+            .requestedCapabilities = vk::SurfaceCapabilitiesKHR(),
+            .preferredFormat = vk::Format::eB8G8R8A8Srgb,
+            .preferredPresentMode = vk::PresentModeKHR::eFifo,
+            .presentModePriority = {vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox},
+        });
+
+        render_pass_layout.colorAttachments.push_back(AttachmentInfo {
+            .format = swapchain->v_format.format,
+            .finalLayout = vk::ImageLayout::ePresentSrcKHR,
+        });
+        // Stored, the culler builds its pyramid from it
+        render_pass_layout.depthAttachment = AttachmentInfo {
+            .format = DEPTH_FORMAT,
+        };
+
+        createDepth();
+        createScene();
+        createPipeline();
+
+        command_pool = CommandPool(
+            *device,
+            device->queue_family_indices.graphics,
+            vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+            v_dispatcher
+        );
+
+        graphicsCommandBuffer = command_pool.createCommandBuffer();
+
+        gpu_profiler = std::make_unique<GpuProfiler>(*device);
+        culler = std::make_unique<GpuCuller>(*device, instance_count, v_dispatcher);
+    }
+
+    ~App() {
+        device->v_device.waitIdle(v_dispatcher);
+        releaseFrameSync();
+
+        device->resource_states->forgetBuffer(instances.v_buffer);
+
+        device->deletion_queue->push(v_descriptor_pool);
+        device->deletion_queue->push(v_set_layout);
+
+#ifdef SVK_INSTRUMENTATION
+        instrument::writeChromeTrace("culling_cpu.json");
+#endif
+    }
+
+    void createDepth() {
+        if(depth.v_image) {
+            device->framebuffer_cache->evictView(depth.v_image_view);
+        }
+
+        auto depthInfo = vk::ImageCreateInfo()
+            .setImageType(vk::ImageType::e2D)
+            .setFormat(DEPTH_FORMAT)
+            .setExtent(vk::Extent3D(swapchain->v_swapchain_extent.width, swapchain->v_swapchain_extent.height, 1))
+            .setMipLevels(1)
+            .setArrayLayers(1)
+            .setSamples(vk::SampleCountFlagBits::e1)
+            .setTiling(vk::ImageTiling::eOptimal)
+            .setUsage(vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled)
+            .setSharingMode(vk::SharingMode::eExclusive)
+            .setInitialLayout(vk::ImageLayout::eUndefined);
+
+        depth = Image(*device, depthInfo, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::ImageAspectFlagBits::eDepth, v_dispatcher);
+    }
+
+    // One cube in a mesh pool and a grid of instances around the origin. Most cubes are
+    // hidden behind the outer ones or outside of the view, which is what culling is for.
+    void createScene() {
+        const std::array<float, 24> corners = {
+            -1, -1, -1,   1, -1, -1,   1,  1, -1,  -1,  1, -1,
+            -1, -1,  1,   1, -1,  1,   1,  1,  1,  -1,  1,  1,
+        };
+        const std::array<uint32_t, 36> indices = {
+            0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,
+            0, 1, 5, 0, 5, 4,   3, 6, 2, 3, 7, 6,
+            0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5,
+        };
+
+        mesh_pool = std::make_unique<MeshPool>(
+            *device,
+            VertexLayout().attribute(0, vk::Format::eR32G32B32Sfloat),
+            1024,
+            4096,
+            v_dispatcher
+        );
+        cube = mesh_pool->add(corners.data(), 8, indices.data(), static_cast<uint32_t>(indices.size()));
+
+        auto instancesInfo = vk::BufferCreateInfo()
+            .setSize(static_cast<vk::DeviceSize>(instance_count) * sizeof(CullInstance))
+            .setUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+            .setSharingMode(vk::SharingMode::eExclusive);
+
+        instances = Buffer(
+            *device,
+            instancesInfo,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            v_dispatcher
+        );
+        device->resource_states->trackBuffer(instances.v_buffer);
+
+        uint32_t side = static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(instance_count))));
+        grid_radius = side * SPACING * 0.5f;
+
+        std::vector<CullInstance> data(instance_count);
+        for(uint32_t i = 0; i < instance_count; i++) {
+            uint32_t x = i % side, y = (i / side) % side, z = i / (side * side);
+
+            data[i] = CullInstance {
+                .sphere = {
+                    (x + 0.5f) * SPACING - grid_radius,
+                    (y + 0.5f) * SPACING - grid_radius,
+                    (z + 0.5f) * SPACING - grid_radius,
+                    0.8f,
+                },
+                .index_count = cube.index_count,
+                .first_index = cube.first_index,
+                .vertex_offset = cube.vertex_offset,
+            };
+        }
+
+        auto mapping = instances.mapMemory();
+        std::memcpy(*mapping, data.data(), data.size() * sizeof(CullInstance));
+
+        LOG_INFO("Scene has {} cubes in a {}^3 grid.", instance_count, side);
+    }
+
+    void createPipeline() {
+        auto binding = vk::DescriptorSetLayoutBinding(
+            0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eVertex
+        );
+        v_set_layout = device->v_device.createDescriptorSetLayout(
+            vk::DescriptorSetLayoutCreateInfo().setBindings(binding), nullptr, v_dispatcher
+        );
+
+        auto poolSize = vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 1);
+        v_descriptor_pool = device->v_device.createDescriptorPool(
+            vk::DescriptorPoolCreateInfo().setMaxSets(1).setPoolSizes(poolSize), nullptr, v_dispatcher
+        );
+
+        v_set = device->v_device.allocateDescriptorSets(
+            vk::DescriptorSetAllocateInfo().setDescriptorPool(v_descriptor_pool).setSetLayouts(v_set_layout),
+            v_dispatcher
+        )[0];
+
+        auto instancesInfo = vk::DescriptorBufferInfo(instances.v_buffer, 0, VK_WHOLE_SIZE);
+        device->v_device.updateDescriptorSets(
+            vk::WriteDescriptorSet(v_set, 0, 0, vk::DescriptorType::eStorageBuffer, nullptr, instancesInfo),
+            nullptr,
+            v_dispatcher
+        );
+
+        Shader vertShader = Shader(
+            *device,
+            "shaders/instanced.vert.spv",
+            vk::ShaderStageFlagBits::eVertex,
+            v_dispatcher
+        );
+        Shader fragShader = Shader(
+            *device,
+            "shaders/instanced.frag.spv",
+            vk::ShaderStageFlagBits::eFragment,
+            v_dispatcher
+        );
+        std::vector<vk::PipelineShaderStageCreateInfo> shader_stages = {
+            vertShader.v_stage_info, fragShader.v_stage_info
+        };
+
+        auto colorBlendInfo = vk::PipelineColorBlendStateCreateInfo()
+            .setAttachments(vk::PipelineColorBlendAttachmentState()
+                .setBlendEnable(vk::False)
+                .setColorWriteMask(vk::ColorComponentFlagBits::eR |
+                    vk::ColorComponentFlagBits::eG |
+                    vk::ColorComponentFlagBits::eB |
+                    vk::ColorComponentFlagBits::eA
+                )
+            );
+
+        auto inputAssembly = vk::PipelineInputAssemblyStateCreateInfo()
+            .setPrimitiveRestartEnable(vk::False)
+            .setTopology(vk::PrimitiveTopology::eTriangleList);
+
+        VertexInputState vertexInputState;
+        vertexInputState.binding(mesh_pool->vertexLayout());
+
+        auto multisampleState = vk::PipelineMultisampleStateCreateInfo()
+            .setRasterizationSamples(vk::SampleCountFlagBits::e1)
+            .setSampleShadingEnable(vk::False);
+
+        auto rasterizationState = vk::PipelineRasterizationStateCreateInfo()
+            .setCullMode(vk::CullModeFlagBits::eBack)
+            .setPolygonMode(vk::PolygonMode::eFill)
+            .setRasterizerDiscardEnable(vk::False)
+            .setDepthClampEnable(vk::False)
+            .setLineWidth(1.0)
+            .setFrontFace(vk::FrontFace::eCounterClockwise)
+            .setDepthBiasEnable(vk::False);
+
+        auto depthStencilState = vk::PipelineDepthStencilStateCreateInfo()
+            .setDepthTestEnable(vk::True)
+            .setDepthWriteEnable(vk::True)
+            .setDepthCompareOp(vk::CompareOp::eLess);
+
+        auto pipelineInfo = vk::GraphicsPipelineCreateInfo()
+            .setPColorBlendState(&colorBlendInfo)
+            .setPInputAssemblyState(&inputAssembly)
+            .setPVertexInputState(&vertexInputState.info())
+            .setPMultisampleState(&multisampleState)
+            .setPRasterizationState(&rasterizationState)
+            .setPDepthStencilState(&depthStencilState);
+
+        auto pushRange = vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(Matrix4));
+
+        pipeline = Pipeline(
+            *device,
+            device->render_pass_cache->get(render_pass_layout),
+            shader_stages,
+            vk::PipelineLayoutCreateInfo()
+                .setSetLayouts(v_set_layout)
+                .setPushConstantRanges(pushRange),
+            pipelineInfo,
+            v_dispatcher
+        );
+    }
+
+    // Hands the sync objects of the last submission back to the device pools
+    void releaseFrameSync() {
+        if(!in_flight_fence) return;
+
+        device->fence_pool->release(in_flight_fence);
+        device->semaphore_pool->release(image_ready);
+        device->semaphore_pool->release(render_finished);
+
+        in_flight_fence = nullptr;
+        image_ready = nullptr;
+        render_finished = nullptr;
+    }
+
+    Matrix4 viewProjection() {
+        // Orbits just outside of the grid, looking at its center
+        float angle = frame * 0.002f;
+        float distance = grid_radius * 1.6f;
+        Vector3 eye = {std::cos(angle) * distance, grid_radius * 0.4f, std::sin(angle) * distance};
+
+        auto &extent = swapchain->v_swapchain_extent;
+        float aspect = static_cast<float>(extent.width) / static_cast<float>(std::max(extent.height, 1u));
+
+        return multiply(
+            perspective(1.0f, aspect, 0.1f, distance * 3.0f),
+            lookAt(eye, {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f})
+        );
+    }
+
+    void recordCmdBuffer(uint32_t imageIndex) {
+        SVK_ZONE("Record commands");
+
+        graphicsCommandBuffer.begin(vk::CommandBufferBeginInfo());
+
+        gpu_profiler->beginFrame(graphicsCommandBuffer);
+        mesh_pool->recordUploads(graphicsCommandBuffer);
+
+        Matrix4 view_projection = viewProjection();
+
+        if(culling) {
+            ProfileScope scope(*gpu_profiler, graphicsCommandBuffer, "Cull");
+            culler->cull(graphicsCommandBuffer, instances, instance_count, view_projection);
+        }
+
+        BarrierBatcher batcher(*device, *device->resource_states);
+        mesh_pool->prepare(batcher);
+        if(culling) culler->prepareDraw(batcher);
+        // Last used by the pyramid build, the render pass clears it
+        batcher.transition(depth.v_image, ResourceUsage::DepthStencilAttachment);
+        batcher.flush(graphicsCommandBuffer);
+
+        {
+            ProfileScope scope(*gpu_profiler, graphicsCommandBuffer, "Draw");
+
+            std::vector<vk::ClearValue> clearValues = {
+                vk::ClearValue(vk::ClearColorValue(0.1f, 0.2f, 0.3f, 1.0f)),
+                vk::ClearValue(vk::ClearDepthStencilValue(1.0f, 0)),
+            };
+
+            device->framebuffer_cache->beginRenderPass(
+                graphicsCommandBuffer,
+                device->render_pass_cache->get(render_pass_layout),
+                {
+                    {swapchain->imageViews[imageIndex], vk::ImageUsageFlagBits::eColorAttachment},
+                    {depth.v_image_view, vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled},
+                },
+                swapchain->v_swapchain_extent,
+                clearValues
+            );
+
+            pipeline.bind(graphicsCommandBuffer);
+
+            auto viewport = vk::Viewport()
+                .setWidth(static_cast<float>(swapchain->v_swapchain_extent.width))
+                .setHeight(static_cast<float>(swapchain->v_swapchain_extent.height))
+                .setMinDepth(0.0)
+                .setMaxDepth(1.0)
+                .setX(0.0)
+                .setY(0.0);
+            graphicsCommandBuffer.setViewport(0, viewport, v_dispatcher);
+
+            auto scissor = vk::Rect2D()
+                .setOffset({0, 0})
+                .setExtent(swapchain->v_swapchain_extent);
+            graphicsCommandBuffer.setScissor(0, scissor, v_dispatcher);
+
+            graphicsCommandBuffer.bindDescriptorSets(
+                vk::PipelineBindPoint::eGraphics, pipeline.v_layout, 0, v_set, nullptr, v_dispatcher
+            );
+            graphicsCommandBuffer.pushConstants(
+                pipeline.v_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(Matrix4), view_projection.data(), v_dispatcher
+            );
+
+            mesh_pool->bind(graphicsCommandBuffer, cube.page);
+
+            if(culling) {
+                culler->draw(graphicsCommandBuffer);
+            } else {
+                mesh_pool->draw(graphicsCommandBuffer, cube, instance_count);
+            }
+
+            graphicsCommandBuffer.endRenderPass(v_dispatcher);
+        }
+
+        device->resource_states->setImageState(depth.v_image, ResourceState {
+            vk::PipelineStageFlagBits2::eLateFragmentTests,
+            vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+            vk::ImageLayout::eDepthStencilAttachmentOptimal,
+        });
+
+        if(culling) {
+            ProfileScope scope(*gpu_profiler, graphicsCommandBuffer, "HiZ");
+            culler->buildHiZ(graphicsCommandBuffer, depth, view_projection);
+        }
+    }
+
+    void render(double delta) override {
+        (void)delta;
+
+        if(in_flight_fence) {
+            SVK_ZONE("Wait for frame");
+
+            vk::Result waitResult = device->v_device.waitForFences(
+                in_flight_fence,
+                vk::True,
+                std::numeric_limits<uint64_t>::max(),
+                v_dispatcher
+            );
+            if(waitResult != vk::Result::eSuccess) {
+                THROW(runtime_error, "Failed to wait on fences: {}.", vk::to_string(waitResult));
+            }
+
+            releaseFrameSync();
+        }
+
+        // Timings of the frame that just finished belong to the mode it was rendered in
+        if(gpu_profiler->lastFrame() != nullptr && phase.frames > 0) {
+            phase.gpu_ms += gpu_profiler->duration("Cull") + gpu_profiler->duration("Draw") + gpu_profiler->duration("HiZ");
+        }
+
+        if(frame > 0 && frame % PHASE_FRAMES == 0) {
+            reportPhase();
+            culling = !culling;
+        }
+
+        in_flight_fence = device->fence_pool->acquire();
+        image_ready = device->semaphore_pool->acquire();
+        render_finished = device->semaphore_pool->acquire();
+
+        auto acquireResult = swapchain->acquireImage(image_ready, nullptr);
+        switch((uint32_t)acquireResult.result) {
+            case (uint32_t)vk::Result::eSuboptimalKHR:
+            case (uint32_t)vk::Result::eSuccess:
+            break;
+            case (uint32_t)vk::Result::eErrorOutOfDateKHR:
+            recreate();
+            releaseFrameSync();
+            return;
+            default:
+            THROW(runtime_error, "Failed to acquire image: {}.", vk::to_string(acquireResult.result));
+        }
+
+        uint32_t imageIndex = acquireResult.value;
+
+        auto recordStart = std::chrono::steady_clock::now();
+
+        graphicsCommandBuffer.reset();
+        recordCmdBuffer(imageIndex);
+        graphicsCommandBuffer.end(v_dispatcher);
+
+        phase.record_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+        phase.frames++;
+
+        std::vector<vk::PipelineStageFlags> waitStages = {
+            vk::PipelineStageFlagBits::eColorAttachmentOutput
+        };
+
+        auto renderSubmit = vk::SubmitInfo()
+            .setWaitSemaphores(image_ready)
+            .setWaitDstStageMask(waitStages)
+            .setCommandBuffers(graphicsCommandBuffer)
+            .setSignalSemaphores(render_finished);
+
+        {
+            SVK_ZONE("Submit");
+            device->v_queue.submit({renderSubmit}, in_flight_fence, v_dispatcher);
+            SVK_COUNT(Submits, 1);
+        }
+
+        auto presentInfo = vk::PresentInfoKHR()
+            .setImageIndices(imageIndex)
+            .setSwapchains(swapchain->v_swapchain)
+            .setWaitSemaphores(render_finished);
+
+        vk::Result presentResult;
+        {
+            SVK_ZONE("Present");
+            try {
+                presentResult = device->v_present_queue.presentKHR(presentInfo, v_dispatcher);
+            } catch(vk::OutOfDateKHRError&) {
+                presentResult = vk::Result::eErrorOutOfDateKHR;
+            }
+        }
+
+        switch((uint64_t)presentResult) {
+            case (uint64_t)vk::Result::eSuccess:
+            break;
+            case (uint64_t)vk::Result::eSuboptimalKHR:
+            case (uint64_t)vk::Result::eErrorOutOfDateKHR:
+            recreate();
+            break;
+            default:
+            THROW(runtime_error, fmt::format("Failed to present: {}", vk::to_string(presentResult)));
+        }
+
+        frame++;
+        device->nextFrame();
+    }
+
+    void reportPhase() {
+        if(phase.frames == 0) return;
+
+        LOG_INFO("{:<8} {} instances: CPU record {:.3f} ms, GPU {:.3f} ms per frame over {} frames",
+            culling ? "culled" : "unculled",
+            instance_count,
+            phase.record_ms / phase.frames,
+            phase.gpu_ms / phase.frames,
+            phase.frames
+        );
+
+        if(culling) {
+            LOG_INFO("         GPU cull {:.3f} ms, draw {:.3f} ms, HiZ {:.3f} ms in the last frame",
+                gpu_profiler->duration("Cull"), gpu_profiler->duration("Draw"), gpu_profiler->duration("HiZ")
+            );
+        }
+
+        phase.reset();
+    }
+
+    void recreate() {
+        swapchain->recreate(width, height);
+        createDepth();
+    }
+
+protected:
+    // C switches between culled and unculled rendering
+    void keyboardCallback(int key, int action, int scancode, int mod) override {
+        (void)scancode;
+        (void)mod;
+
+        if(key != GLFW_KEY_C || action != GLFW_PRESS) return;
+
+        reportPhase();
+        culling = !culling;
+    }
+
+    void resize(int width, int height) override {
+        Window::resize(width, height);
+
+        recreate();
+    }
+
+private:
+    static constexpr float SPACING = 3.0f;
+
+    uint32_t instance_count;
+
+    Device *device;
+    Swapchain *swapchain;
+    RenderPassLayout render_pass_layout;
+    Pipeline pipeline;
+    CommandPool command_pool;
+
+    Image depth;
+
+    std::unique_ptr<MeshPool> mesh_pool;
+    MeshAllocation cube;
+    Buffer instances;
+    float grid_radius = 0.0f;
+
+    vk::DescriptorSetLayout v_set_layout;
+    vk::DescriptorPool v_descriptor_pool;
+    vk::DescriptorSet v_set;
+
+    // Borrowed from the device sync pools for the submission in flight
+    vk::Semaphore image_ready;
+    vk::Semaphore render_finished;
+    vk::Fence in_flight_fence;
+
+    vk::CommandBuffer graphicsCommandBuffer;
+
+    std::unique_ptr<GpuProfiler> gpu_profiler;
+    std::unique_ptr<GpuCuller> culler;
+
+private:
+    int frame = 0;
+    bool culling = true;
+    PhaseTimings phase;
+};
+
+int main(int argc, char **argv) {
+    logging::set_environmental_log_level(LOGLEVEL_DEBUG);
+
+    uint32_t instance_count = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 131072;
+
+    App *app;
+    try {
+        app = new App(std::max(instance_count, 1u));
+    } catch(std::runtime_error &error) {
+        LOG_ERROR("Error occured while initializing application: {}", error.what());
+        return 1;
+    }
+
+    try {
+        app->runRenderThread();
+    } catch(std::runtime_error &error) {
+        LOG_ERROR("Error occured while rendering: {}", error.what());
+    }
+
+    delete app;
+}
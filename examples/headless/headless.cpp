@@ -0,0 +1,334 @@
+/*
+    Example for rendering a triangle without a window in Vulkan with svklib,
+    e.g. on a headless server with lavapipe. The last frame is written to headless.ppm.
+    The frame is recorded through a RenderGraph, which places the barriers around the pass.
+*/
+
+#include "commandpool.hpp"
+#include "context.hpp"
+#include "offscreen.hpp"
+#include "rendercache.hpp"
+#include "rendergraph.hpp"
+#include "shader.hpp"
+#include "syncpool.hpp"
+#include "vkpipeline.hpp"
+#include "log.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+#include <vulkan/vulkan_to_string.hpp>
+
+class App {
+public:
+    App(uint32_t width, uint32_t height) {
+        Validation::enableValidationLayers = true;
+
+        context.createInstance("Headless Example", {},
+#ifdef __MACH__
+            true
+#else
+            false
+#endif
+        );
+        device = &context.requestDevice(
+            vk::PhysicalDeviceFeatures(),
+            {
+#ifdef __MACH__
+                "VK_KHR_portability_subset",
+#endif
+            }
+        );
+        LOG_INFO("Chosen physical device {}", device->properties.name());
+
+        target = std::make_unique<OffscreenTarget>(
+            *device,
+            vk::Extent2D(width, height),
+            vk::Format::eR8G8B8A8Unorm,
+            context.v_dispatcher
+        );
+
+        // The graph moves the image into the attachment layout before the pass,
+        // and the readback moves it out of it afterwards
+        pass_layout.colorAttachments.push_back(AttachmentInfo {
+            .format = target->format,
+            .initialLayout = vk::ImageLayout::eColorAttachmentOptimal,
+        });
+
+        Shader vertShader = Shader(
+            *device,
+            "shaders/triangle.vert.spv",
+            vk::ShaderStageFlagBits::eVertex,
+            context.v_dispatcher
+        );
+        Shader fragShader = Shader(
+            *device,
+            "shaders/triangle.frag.spv",
+            vk::ShaderStageFlagBits::eFragment,
+            context.v_dispatcher
+        );
+        std::vector<vk::PipelineShaderStageCreateInfo> shader_stages = {
+            vertShader.v_stage_info, fragShader.v_stage_info
+        };
+
+        auto colorBlendInfo = vk::PipelineColorBlendStateCreateInfo()
+            .setAttachments(vk::PipelineColorBlendAttachmentState()
+                .setBlendEnable(vk::False)
+                .setColorWriteMask(vk::ColorComponentFlagBits::eR |
+                    vk::ColorComponentFlagBits::eG |
+                    vk::ColorComponentFlagBits::eB |
+                    vk::ColorComponentFlagBits::eA
+                )
+            );
+
+        auto inputAssembly = vk::PipelineInputAssemblyStateCreateInfo()
+            .setPrimitiveRestartEnable(vk::False)
+            .setTopology(vk::PrimitiveTopology::eTriangleList);
+
+        auto vertexInputState = vk::PipelineVertexInputStateCreateInfo()
+            .setVertexAttributeDescriptions({})
+            .setVertexBindingDescriptions({});
+
+        auto multisampleState = vk::PipelineMultisampleStateCreateInfo()
+            .setRasterizationSamples(vk::SampleCountFlagBits::e1)
+            .setSampleShadingEnable(vk::False);
+
+        auto rasterizationState = vk::PipelineRasterizationStateCreateInfo()
+            .setCullMode(vk::CullModeFlagBits::eNone)
+            .setPolygonMode(vk::PolygonMode::eFill)
+            .setRasterizerDiscardEnable(vk::False)
+            .setDepthClampEnable(vk::False)
+            .setLineWidth(1.0)
+            .setFrontFace(vk::FrontFace::eCounterClockwise)
+            .setDepthBiasEnable(vk::False);
+
+        auto pipelineInfo = vk::GraphicsPipelineCreateInfo()
+            .setPColorBlendState(&colorBlendInfo)
+            .setPInputAssemblyState(&inputAssembly)
+            .setPVertexInputState(&vertexInputState)
+            .setPMultisampleState(&multisampleState)
+            .setPRasterizationState(&rasterizationState);
+
+        pipeline = Pipeline(
+            *device,
+            device->render_pass_cache->get(pass_layout),
+            shader_stages,
+            vk::PipelineLayoutCreateInfo(),
+            pipelineInfo,
+            context.v_dispatcher
+        );
+
+        command_pool = CommandPool(
+            *device,
+            device->queue_family_indices.graphics,
+            vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+            context.v_dispatcher
+        );
+
+        command_buffers = command_pool.createCommandBuffers(device->frames_in_flight);
+        in_flight_fences.resize(device->frames_in_flight);
+
+        buildGraph();
+    }
+
+    ~App() {
+        device->v_device.waitIdle(context.v_dispatcher);
+
+        for(auto fence : in_flight_fences) {
+            if(fence) device->fence_pool->release(fence);
+        }
+    }
+
+    void renderFrame() {
+        uint32_t slot = frame % device->frames_in_flight;
+        vk::CommandBuffer commandBuffer = command_buffers[slot];
+
+        // Frame that used this slot before has to finish before its command buffer is reused
+        if(in_flight_fences[slot]) {
+            vk::Result waitResult = device->v_device.waitForFences(
+                in_flight_fences[slot],
+                vk::True,
+                std::numeric_limits<uint64_t>::max(),
+                context.v_dispatcher
+            );
+            if(waitResult != vk::Result::eSuccess) {
+                THROW(runtime_error, "Failed to wait on fences: {}.", vk::to_string(waitResult));
+            }
+
+            device->fence_pool->release(in_flight_fences[slot]);
+        }
+        in_flight_fences[slot] = device->fence_pool->acquire();
+
+        if(auto readback = target->takeReadback()) {
+            last_readback = std::move(readback);
+        }
+
+        commandBuffer.reset();
+        commandBuffer.begin(vk::CommandBufferBeginInfo());
+
+        graph->execute(commandBuffer);
+
+        // The graph does not update the device's tracker, tell it where the pass left the image
+        device->resource_states->setImageState(target->color.v_image, stateForUsage(ResourceUsage::ColorAttachment));
+        target->requestReadback(commandBuffer);
+
+        commandBuffer.end(context.v_dispatcher);
+
+        auto submit = vk::SubmitInfo()
+            .setCommandBuffers(commandBuffer);
+
+        device->v_queue.submit({submit}, in_flight_fences[slot], context.v_dispatcher);
+
+        frame++;
+        device->nextFrame();
+    }
+
+    // Waits for the remaining frames and writes the newest readback as a binary PPM
+    void writeLastFrame(const std::string &path) {
+        device->v_device.waitIdle(context.v_dispatcher);
+
+        if(auto readback = target->takeReadback(true)) {
+            last_readback = std::move(readback);
+        }
+
+        if(!last_readback.has_value()) {
+            THROW(runtime_error, "No frame was read back.");
+        }
+
+        std::ofstream file(path, std::ios::binary);
+
+        if(!file.is_open()) {
+            THROW(runtime_error, "Failed to open {} for writing.", path);
+        }
+
+        auto &extent = last_readback->extent;
+        file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+
+        auto &pixels = last_readback->pixels;
+        for(size_t i = 0; i < pixels.size(); i += 4) {
+            file.write(reinterpret_cast<const char*>(&pixels[i]), 3);
+        }
+
+        LOG_INFO("Wrote frame {} to {} ({} readbacks dropped).",
+            last_readback->frame, path, target->readbacks.stats().dropped
+        );
+    }
+
+private:
+    void buildGraph() {
+        graph = std::make_unique<RenderGraph>(*device);
+
+        GraphImageDesc colorDesc;
+        colorDesc.format = target->format;
+        colorDesc.extent = target->extent;
+        colorDesc.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+
+        // The previous frame last copied the image, or only drew into it when its readback
+        // buffer was busy. The contents are cleared anyway, so the layout is discarded.
+        ResourceState previousFrame {
+            vk::PipelineStageFlagBits2::eTransfer | vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+            vk::AccessFlags2(),
+            vk::ImageLayout::eUndefined,
+        };
+
+        GraphResource color = graph->importImage(
+            "color",
+            target->color.v_image,
+            target->color.v_image_view,
+            colorDesc,
+            previousFrame
+        );
+
+        graph->addPass(
+            "triangle",
+            [color](PassBuilder &builder) {
+                builder.write(color, ResourceUsage::ColorAttachment);
+                // Consumed by the readback recorded after the graph
+                builder.sideEffect();
+            },
+            [this, color](vk::CommandBuffer commandBuffer, RenderGraph &graph) {
+                drawTriangle(commandBuffer, graph.imageView(color));
+            }
+        );
+
+        graph->compile();
+    }
+
+    void drawTriangle(vk::CommandBuffer commandBuffer, vk::ImageView view) {
+        device->framebuffer_cache->beginRenderPass(
+            commandBuffer,
+            device->render_pass_cache->get(pass_layout),
+            {{view, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc}},
+            target->extent,
+            {vk::ClearValue(vk::ClearColorValue(0.1f, 0.2f, 0.3f, 1.0f))}
+        );
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.v_pipeline, context.v_dispatcher);
+
+        auto viewport = vk::Viewport()
+            .setWidth(static_cast<float>(target->extent.width))
+            .setHeight(static_cast<float>(target->extent.height))
+            .setMinDepth(0.0)
+            .setMaxDepth(1.0)
+            .setX(0.0)
+            .setY(0.0);
+        commandBuffer.setViewport(0, viewport, context.v_dispatcher);
+
+        auto scissor = vk::Rect2D()
+            .setOffset({0, 0})
+            .setExtent(target->extent);
+        commandBuffer.setScissor(0, scissor, context.v_dispatcher);
+
+        commandBuffer.draw(3, 1, 0, 0, context.v_dispatcher);
+
+        commandBuffer.endRenderPass(context.v_dispatcher);
+    }
+
+    // Declared first so it is destroyed after every object that releases into the device
+    Context context;
+    Device *device;
+
+    std::unique_ptr<OffscreenTarget> target;
+    RenderPassLayout pass_layout;
+    std::unique_ptr<RenderGraph> graph;
+    Pipeline pipeline;
+    CommandPool command_pool;
+
+    std::vector<vk::CommandBuffer> command_buffers;
+    std::vector<vk::Fence> in_flight_fences;
+
+    std::optional<OffscreenReadback> last_readback;
+
+    uint32_t frame = 0;
+};
+
+int main(int argc, char **argv) {
+    logging::set_environmental_log_level(LOGLEVEL_DEBUG);
+
+    uint32_t frames = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 120;
+
+    App *app;
+    try {
+        app = new App(640, 480);
+    } catch(std::runtime_error &error) {
+        LOG_ERROR("Error occured while initializing application: {}", error.what());
+        return 1;
+    }
+
+    for(uint32_t i = 0; i < frames; i++) {
+        app->renderFrame();
+    }
+
+    app->writeLastFrame("headless.ppm");
+
+    delete app;
+}
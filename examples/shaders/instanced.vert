@@ -0,0 +1,33 @@
+#version 450
+
+// Cubes placed by the CullInstance they were culled with, found through gl_InstanceIndex
+
+layout(location = 0) in vec3 position;
+
+layout(location = 0) out vec3 fragColor;
+
+struct CullInstance {
+    vec4 sphere;
+    uint index_count;
+    uint first_index;
+    int vertex_offset;
+    uint padding;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+    CullInstance instances[];
+};
+
+layout(push_constant) uniform Params {
+    mat4 view_projection;
+} params;
+
+void main() {
+    vec4 sphere = instances[gl_InstanceIndex].sphere;
+
+    // Unit cube corners touch the bounding sphere
+    vec3 world = sphere.xyz + position * (sphere.w / sqrt(3.0));
+    gl_Position = params.view_projection * vec4(world, 1.0);
+
+    fragColor = fract(sphere.xyz * 0.0173) * 0.7 + 0.3 * (position * 0.5 + 0.5);
+}
@@ -3,15 +3,19 @@
 */
 
 #include "commandpool.hpp"
+#include "framepacer.hpp"
+#include "gpuprofiler.hpp"
+#include "instrument.hpp"
+#include "rendercache.hpp"
 #include "shader.hpp"
-#include "vkfence.hpp"
+#include "syncpool.hpp"
 #include "vkpipeline.hpp"
 #include "vkrenderpass.hpp"
-#include "vksemaphore.hpp"
 #include "window.hpp"
 #include "log.hpp"
 #include "vkswapchain.hpp"
 
+#include <algorithm>
 #include <limits>
 #include <memory>
 #include <stdexcept>
@@ -36,7 +40,7 @@ public:
             false
 #endif
         );
-        device = requestDevice(
+        device = &requestDevice(
             vk::PhysicalDeviceFeatures(),
             {
 #ifdef __MACH__
@@ -45,9 +49,9 @@ public:
                 vk::KHRSwapchainExtensionName,
             }
         );
-        LOG_INFO("Chosen physical device {}", device->v_physical_device.getProperties(v_dispatcher).deviceName.data());
+        LOG_INFO("Chosen physical device {}", device->properties.name());
 
-        swapchain = requestSwapchain(PreferredSwapchainSettings {
+        swapchain = &requestSwapchain(PreferredSwapchainSettings {
             .requestedCapabilities = vk::SurfaceCapabilitiesKHR(),
             .preferredFormat = vk::Format::eB8G8R8A8Srgb,
             .preferredPresentMode = vk::PresentModeKHR::eFifo
@@ -56,12 +60,10 @@ public:
             swapchain->v_swapchain_extent.width, swapchain->v_swapchain_extent.height
         );
 
-        render_pass = std::make_unique<RenderPass>(
-            *device,
-            swapchain->v_format.format,
-            vk::RenderPassCreateInfo(),
-            v_dispatcher
-        );
+        render_pass_layout.colorAttachments.push_back(AttachmentInfo {
+            .format = swapchain->v_format.format,
+            .finalLayout = vk::ImageLayout::ePresentSrcKHR,
+        });
 
         Shader vertShader = Shader(
             *device,
@@ -117,57 +119,82 @@ public:
             .setPMultisampleState(&multisampleState)
             .setPRasterizationState(&rasterizationState);
 
-        pipeline = std::make_unique<Pipeline>(
+        pipeline = Pipeline(
             *device,
-            *render_pass,
+            device->render_pass_cache->get(render_pass_layout),
             shader_stages,
             vk::PipelineLayoutCreateInfo(),
             pipelineInfo,
             v_dispatcher
         );
 
-        swapchain->initFramebuffers(*render_pass);
-        command_pool = std::make_unique<CommandPool>(
+        command_pool = CommandPool(
             *device,
             device->queue_family_indices.graphics,
             vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
             v_dispatcher
         );
 
-        graphicsCommandBuffer = command_pool->createCommandBuffer();
+        graphicsCommandBuffer = command_pool.createCommandBuffer();
 
-        image_ready = std::make_unique<Semaphore>(*device, v_dispatcher);
-        render_finished = std::make_unique<Semaphore>(*device, v_dispatcher);
-        in_flight_fence = std::make_unique<Fence>(*device, true, v_dispatcher);
+        gpu_profiler = std::make_unique<GpuProfiler>(*device);
+
+        frame_pacer = std::make_unique<FramePacer>(*device, *swapchain, FramePacerSettings {
+            .max_frames_queued = 2,
+        }, v_dispatcher);
     }
 
     ~App() {
         device->v_device.waitIdle(v_dispatcher);
+        releaseFrameSync();
+
+        auto fences = device->fence_pool->stats();
+        auto semaphores = device->semaphore_pool->stats();
+        LOG_DEBUG("Sync pools created {} fences and {} semaphores over {} frames.",
+            fences.created, semaphores.created, frame
+        );
+
+#ifdef SVK_INSTRUMENTATION
+        instrument::writeChromeTrace("triangle_cpu.json");
+#endif
+    }
+
+    // Hands the sync objects of the last submission back to the device pools
+    void releaseFrameSync() {
+        if(!in_flight_fence) return;
+
+        device->fence_pool->release(in_flight_fence);
+        device->semaphore_pool->release(image_ready);
+        device->semaphore_pool->release(render_finished);
+
+        in_flight_fence = nullptr;
+        image_ready = nullptr;
+        render_finished = nullptr;
     }
 
     void recordCmdBuffer(uint32_t imageIndex) {
+        SVK_ZONE("Record commands");
+
         graphicsCommandBuffer.begin(vk::CommandBufferBeginInfo());
 
+        gpu_profiler->beginFrame(graphicsCommandBuffer);
+        ProfileScope frameScope(*gpu_profiler, graphicsCommandBuffer, "Triangle pass");
+
         auto clearColor = vk::ClearValue(
             vk::ClearColorValue(0.1f, 0.2f, 0.3f, 1.0f)
         );
-        
-        vk::Rect2D renderArea = {
-            {0, 0},
-            swapchain->v_swapchain_extent,
-        };
 
-        auto renderPassBegin = vk::RenderPassBeginInfo()
-            .setRenderPass(render_pass->v_render_pass)
-            .setRenderArea(renderArea)
-            .setClearValues(clearColor)
-            .setFramebuffer(swapchain->framebuffers[imageIndex]);
-        
-        graphicsCommandBuffer.beginRenderPass(renderPassBegin, vk::SubpassContents::eInline, v_dispatcher);
+        device->framebuffer_cache->beginRenderPass(
+            graphicsCommandBuffer,
+            device->render_pass_cache->get(render_pass_layout),
+            {{swapchain->imageViews[imageIndex], vk::ImageUsageFlagBits::eColorAttachment}},
+            swapchain->v_swapchain_extent,
+            {clearColor}
+        );
 
         graphicsCommandBuffer.bindPipeline(
             vk::PipelineBindPoint::eGraphics,
-            pipeline->v_pipeline,
+            pipeline.v_pipeline,
             v_dispatcher
         );
 
@@ -186,35 +213,41 @@ public:
         graphicsCommandBuffer.setScissor(0, scissor, v_dispatcher);
 
         graphicsCommandBuffer.draw(3, 1, 0, 0, v_dispatcher);
+        SVK_COUNT(Draws, 1);
 
         graphicsCommandBuffer.endRenderPass(v_dispatcher);
-
-        graphicsCommandBuffer.end(v_dispatcher);
     }
 
-    void loop(double delta) {
-        vk::Result waitResult = device->v_device.waitForFences(
-            in_flight_fence->v_fence,
-            vk::True,
-            std::numeric_limits<uint64_t>::max(),
-            v_dispatcher
-        );
-        if(waitResult != vk::Result::eSuccess) {
-            THROW(runtime_error, "Failed to wait on fences: {}.", vk::to_string(waitResult));
+    void render(double delta) override {
+        if(in_flight_fence) {
+            SVK_ZONE("Wait for frame");
+
+            vk::Result waitResult = device->v_device.waitForFences(
+                in_flight_fence,
+                vk::True,
+                std::numeric_limits<uint64_t>::max(),
+                v_dispatcher
+            );
+            if(waitResult != vk::Result::eSuccess) {
+                THROW(runtime_error, "Failed to wait on fences: {}.", vk::to_string(waitResult));
+            }
+
+            releaseFrameSync();
         }
 
-        auto acquireResult = swapchain->acquireImage(*image_ready, nullptr);
+        // Pooled fences come unsignaled, no reset needed
+        in_flight_fence = device->fence_pool->acquire();
+        image_ready = device->semaphore_pool->acquire();
+        render_finished = device->semaphore_pool->acquire();
+
+        auto acquireResult = swapchain->acquireImage(image_ready, nullptr);
         switch((uint32_t)acquireResult.result) {
             case (uint32_t)vk::Result::eSuboptimalKHR:
             case (uint32_t)vk::Result::eSuccess:
-            device->v_device.resetFences(in_flight_fence->v_fence, v_dispatcher);
             break;
             case (uint32_t)vk::Result::eErrorOutOfDateKHR:
-            if(width == 0 || height == 0) {
-                glfwGetFramebufferSize(getWindow(), &width, &height);
-                glfwWaitEvents();
-            }
             swapchain->recreate(width, height);
+            releaseFrameSync();
             return;
             default:
             THROW(runtime_error, "Failed to acquire image: {}.", vk::to_string(acquireResult.result));
@@ -224,27 +257,42 @@ public:
 
         graphicsCommandBuffer.reset();
         recordCmdBuffer(imageIndex);
+        graphicsCommandBuffer.end(v_dispatcher);
+
+        if(frame % 600 == 0 && gpu_profiler->lastFrame() != nullptr) {
+            LOG_DEBUG("Triangle pass took {:.3f} ms on the GPU.", gpu_profiler->duration("Triangle pass"));
+        }
+
+        if(frame % 600 == 0 && frame_pacer->stats().frames > 0) {
+            auto &latency = frame_pacer->stats();
+            LOG_DEBUG("Input to photon latency {:.2f} ms (average {:.2f} ms, max {:.2f} ms).",
+                latency.last_ms, latency.average_ms, latency.max_ms
+            );
+        }
 
         std::vector<vk::PipelineStageFlags> waitStages = {
             vk::PipelineStageFlagBits::eColorAttachmentOutput
         };
         
         auto renderSubmit = vk::SubmitInfo()
-            .setWaitSemaphores(image_ready->v_semaphore)
+            .setWaitSemaphores(image_ready)
             .setWaitDstStageMask(waitStages)
             .setCommandBuffers(graphicsCommandBuffer)
-            .setSignalSemaphores(render_finished->v_semaphore);
+            .setSignalSemaphores(render_finished);
 
         // LOG_DEBUG("Submitting rendering frame {}", frame);
-        device->v_queue.submit({renderSubmit}, in_flight_fence->v_fence, v_dispatcher);
+        {
+            SVK_ZONE("Submit");
+            device->v_queue.submit({renderSubmit}, in_flight_fence, v_dispatcher);
+            SVK_COUNT(Submits, 1);
+        }
 
-        auto presentInfo = vk::PresentInfoKHR()
-            .setImageIndices(imageIndex)
-            .setSwapchains(swapchain->v_swapchain)
-            .setWaitSemaphores(render_finished->v_semaphore);
-        
         // LOG_DEBUG("Presenting frame {}", frame);
-        auto presentResult = device->v_present_queue.presentKHR(presentInfo, v_dispatcher);
+        vk::Result presentResult;
+        {
+            SVK_ZONE("Present");
+            presentResult = frame_pacer->present(imageIndex, render_finished);
+        }
 
         switch((uint64_t)presentResult) {
             case (uint64_t)vk::Result::eSuccess:
@@ -258,40 +306,63 @@ public:
         }
 
         frame++;
+        device->nextFrame();
     }
 
 protected:
+    void beginFrame() override {
+        frame_pacer->beginFrame();
+    }
+
+    // P cycles through the present modes, switching recreates the swapchain
+    void keyboardCallback(int key, int action, int scancode, int mod) override {
+        (void)scancode;
+        (void)mod;
+
+        if(key != GLFW_KEY_P || action != GLFW_PRESS) return;
+
+        static const std::vector<vk::PresentModeKHR> modes = {
+            vk::PresentModeKHR::eMailbox,
+            vk::PresentModeKHR::eImmediate,
+            vk::PresentModeKHR::eFifoRelaxed,
+            vk::PresentModeKHR::eFifo,
+        };
+
+        auto current = std::find(modes.begin(), modes.end(), swapchain->v_present_mode);
+        size_t next = current == modes.end() ? 0 : (current - modes.begin() + 1) % modes.size();
+
+        // Unsupported modes fall through to the next one in the list
+        std::vector<vk::PresentModeKHR> priority(modes.begin() + next, modes.end());
+        auto chosen = swapchain->setPresentModes(priority);
+
+        LOG_INFO("Switched to present mode {}.", vk::to_string(chosen));
+    }
+
+    // Runs on the render thread with the newest size only, so a drag resize
+    // recreates the swapchain at most once per frame instead of once per event
     void resize(int width, int height) override {
-        if(width == 0 || height == 0) {
-            glfwGetFramebufferSize(getWindow(), &width, &height);
-            glfwWaitEvents();
-        }
+        Window::resize(width, height);
 
-        // NOTE: This is a small hack to mitigate issue that I'm experiencing
-        // Basically, when resizing window too much, it causes it to lag (at least on Wayland)
-        // By skipping 10 frames between resizing, it helps mitigate the lag of
-        // continuous swapchain recreation, and it should still be fine
-        // since I check outdated/suboptimal image in loop.
-        // This should not be a thing though.
-        if(frame % 10 == 0) {
-            swapchain->recreate(width, height);
-            frame++;
-        }
+        swapchain->recreate(width, height);
     }
 
 private:
     Device *device;
     Swapchain *swapchain;
-    std::unique_ptr<RenderPass> render_pass;
-    std::unique_ptr<Pipeline> pipeline;
-    std::unique_ptr<CommandPool> command_pool;
+    RenderPassLayout render_pass_layout;
+    Pipeline pipeline;
+    CommandPool command_pool;
 
-    std::unique_ptr<Semaphore> image_ready;
-    std::unique_ptr<Semaphore> render_finished;
-    std::unique_ptr<Fence> in_flight_fence;
+    // Borrowed from the device sync pools for the submission in flight
+    vk::Semaphore image_ready;
+    vk::Semaphore render_finished;
+    vk::Fence in_flight_fence;
 
     vk::CommandBuffer graphicsCommandBuffer;
 
+    std::unique_ptr<GpuProfiler> gpu_profiler;
+    std::unique_ptr<FramePacer> frame_pacer;
+
 private:
     int frame = 0;
 };
@@ -307,10 +378,10 @@ int main(void) {
         return 1;
     }
 
-    while(!app->shouldClose()) {
-        app->pollEvents();
-
-        app->loop(0.0);
+    try {
+        app->runRenderThread();
+    } catch(std::runtime_error &error) {
+        LOG_ERROR("Error occured while rendering: {}", error.what());
     }
 
     delete app;
@@ -26,7 +26,7 @@ public:
             false
 #endif
         );
-        device = requestDevice(
+        device = &requestDevice(
             vk::PhysicalDeviceFeatures(),
             {
 #ifdef __MACH__
@@ -35,9 +35,9 @@ public:
                 vk::KHRSwapchainExtensionName,
             }
         );
-        LOG_INFO("Chosen physical device {}", device->v_physical_device.getProperties(v_dispatcher).deviceName.data());
+        LOG_INFO("Chosen physical device {}", device->properties.name());
 
-        swapchain = requestSwapchain(PreferredSwapchainSettings {
+        swapchain = &requestSwapchain(PreferredSwapchainSettings {
             .requestedCapabilities = vk::SurfaceCapabilitiesKHR(),
             .preferredFormat = vk::Format::eB8G8R8A8Srgb,
             .preferredPresentMode = vk::PresentModeKHR::eFifo
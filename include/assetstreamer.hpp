@@ -0,0 +1,192 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "jobsystem.hpp"
+#include "memorytracker.hpp"
+#include "vkdevice.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+enum class AssetPriority {
+    High,
+    Normal,
+    Low,
+};
+
+enum class AssetState {
+    Queued,
+    Reading,
+    Decoding,
+    // Decoded and waiting for, or in the middle of, its transfer
+    Uploading,
+    // Transfer completed, the buffer can be used
+    Ready,
+    Failed,
+    Cancelled,
+    // Dropped by the MemoryTracker under memory pressure, request the asset again
+    Evicted,
+};
+
+// Turns the file contents into the bytes uploaded to the GPU. Runs on a job worker.
+using AssetDecoder = std::function<std::vector<uint8_t>(std::vector<uint8_t> &&file)>;
+
+using AssetHandle = uint64_t;
+
+struct AssetRequest {
+    std::string path;
+    AssetPriority priority = AssetPriority::Normal;
+    // Empty uploads the file as is
+    AssetDecoder decode;
+    vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer;
+};
+
+struct AssetStreamerStats {
+    uint64_t requested = 0;
+    uint64_t ready = 0;
+    uint64_t failed = 0;
+    uint64_t cancelled = 0;
+    uint64_t evicted = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_uploaded = 0;
+};
+
+class IoUring;
+
+// Loads files into device local buffers without blocking the render loop.
+//
+// Reads go through io_uring on a dedicated I/O thread, or through blocking pread
+// calls (std::ifstream on Windows) on the device's job workers when io_uring is
+// unavailable. Decoders run on the job workers, and the decoded bytes are copied
+// through a per-frame staging ring in recordUploads(). Higher priorities are read, decoded and uploaded first.
+// An asset becomes Ready once its copies completed on the GPU, tracked like handles
+// in the DeletionQueue.
+//
+// Uploaded buffers are registered with the resource state tracker, so use them
+// through a BarrierBatcher, e.g. `batcher.access(*buffer, ResourceUsage::VertexBuffer)`.
+// Ready buffers are registered as evictable with the device's MemoryTracker, lower
+// request priorities first in line, and move to Evicted when it drops them.
+// Everything except reading and decoding happens on the thread calling the methods,
+// which has to be the render thread.
+class AssetStreamer {
+public:
+    AssetStreamer(Device &device, vk::DeviceSize staging_capacity, vk::DispatchLoaderDynamic &dispatcher);
+    ~AssetStreamer();
+
+    AssetStreamer(const AssetStreamer&) = delete;
+    AssetStreamer &operator=(const AssetStreamer&) = delete;
+
+    AssetHandle request(AssetRequest request);
+    // Stops the asset at the next stage boundary and frees anything it uploaded
+    void cancel(AssetHandle handle);
+    // Destroys the asset's buffer once the GPU is done with it
+    void release(AssetHandle handle);
+
+    AssetState state(AssetHandle handle);
+    // The uploaded buffer, nullptr until the asset is Ready
+    Buffer *get(AssetHandle handle);
+
+    // Marks completed transfers Ready and records copies for decoded assets into
+    // the frame's staging buffer, at most `staging_capacity` bytes per frame
+    void recordUploads(vk::CommandBuffer command_buffer);
+
+    bool usesIoUring() const {
+        return io_uring != nullptr;
+    }
+
+    AssetStreamerStats stats();
+
+public:
+    Device &device;
+
+    vk::DeviceSize staging_capacity;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+private:
+    struct Asset {
+        AssetHandle handle;
+        AssetRequest request;
+
+        std::atomic<AssetState> state {AssetState::Queued};
+
+        // File contents, then the decoded bytes
+        std::vector<uint8_t> data;
+        int fd = -1;
+        vk::DeviceSize read_offset = 0;
+
+        Buffer buffer;
+        vk::DeviceSize uploaded = 0;
+        uint64_t retire_value = 0;
+
+        // Registration with the MemoryTracker while Ready, 0 otherwise
+        ResidencyHandle residency = 0;
+    };
+
+    struct StagingSlot {
+        Buffer buffer;
+        MemoryMap mapping;
+    };
+
+    using AssetQueue = std::deque<std::shared_ptr<Asset>>;
+
+    // Highest priority first, nullptr when all queues are empty
+    static std::shared_ptr<Asset> popHighest(AssetQueue (&queues)[3]);
+
+    std::shared_ptr<Asset> find(AssetHandle handle);
+
+    // Opens the file and sizes the buffer, false when the asset failed
+    bool openAsset(Asset &asset);
+    void closeAsset(Asset &asset);
+    void fail(Asset &asset, const std::string &reason);
+
+    // pread fallback, runs on a job worker and reads the highest priority request
+    void readNextBlocking();
+    void ioLoop();
+    bool submitRead(Asset &asset);
+
+    // Queues the decoder on a job worker
+    void decode(std::shared_ptr<Asset> asset);
+    void decodeNow(Asset &asset);
+
+    // Moves the asset on unless it was cancelled meanwhile
+    static bool advance(Asset &asset, AssetState from, AssetState to);
+    // Hands the buffer to the deletion queue
+    void dropBuffer(Asset &asset);
+    // Lets the MemoryTracker drop the buffer of a Ready asset
+    void registerEvictable(const std::shared_ptr<Asset> &asset);
+
+    std::unique_ptr<IoUring> io_uring;
+    std::thread io_thread;
+
+    std::mutex mutex;
+    std::condition_variable io_wake;
+    bool stopping = false;
+
+    AssetHandle next_handle = 1;
+    std::unordered_map<AssetHandle, std::shared_ptr<Asset>> assets;
+
+    AssetQueue read_queues[3];
+    AssetQueue upload_queues[3];
+
+    // Copied and waiting for their transfer to complete
+    std::vector<std::shared_ptr<Asset>> in_transfer;
+
+    std::vector<StagingSlot> staging;
+
+    // Reads and decodes still running on the job workers
+    JobCounter job_counter;
+
+    AssetStreamerStats streamer_stats;
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// How a resource is used. Determines the pipeline stages, access mask
+// and (for images) the layout the resource has to be in.
+enum class ResourceUsage {
+    ColorAttachment,
+    DepthStencilAttachment,
+    DepthStencilRead,
+    SampledFragment,
+    SampledCompute,
+    StorageRead,
+    StorageWrite,
+    TransferSrc,
+    TransferDst,
+    VertexBuffer,
+    IndexBuffer,
+    IndirectBuffer,
+    UniformBuffer,
+    Present,
+};
+
+struct ResourceState {
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+
+    bool operator==(const ResourceState &other) const {
+        return stages == other.stages && access == other.access && layout == other.layout;
+    }
+
+    bool operator!=(const ResourceState &other) const {
+        return !(*this == other);
+    }
+};
+
+struct StateTransition {
+    ResourceState src;
+    ResourceState dst;
+};
+
+ResourceState stateForUsage(ResourceUsage usage);
+bool isWriteUsage(ResourceUsage usage);
+// Write bits of an access mask; only these need to be made available by a barrier
+vk::AccessFlags2 writeAccess(vk::AccessFlags2 access);
+
+// Records the barriers with vkCmdPipelineBarrier2, or lowers them to a single
+// vkCmdPipelineBarrier when synchronization2 is not enabled on the device.
+void recordBarriers(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    const std::vector<vk::ImageMemoryBarrier2> &image_barriers,
+    const std::vector<vk::BufferMemoryBarrier2> &buffer_barriers
+);
+
+// Synchronization state of one image subresource or a whole buffer
+struct SubresourceState {
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+
+    // Last write (or layout transition) that later accesses have to wait for
+    vk::PipelineStageFlags2 write_stages;
+    vk::AccessFlags2 write_access;
+
+    // Accesses since that write that are already synchronized against it
+    vk::PipelineStageFlags2 read_stages;
+    vk::AccessFlags2 read_access;
+
+    SubresourceState() = default;
+    SubresourceState(ResourceState initial)
+        : layout(initial.layout), write_stages(initial.stages), write_access(writeAccess(initial.access)) {}
+
+    // Records an access and returns the barrier it needs, if any.
+    // Read after read, and reads already made visible after the last write, need none.
+    std::optional<StateTransition> access(const ResourceState &dst, bool write, bool is_image);
+};
+
+// Last known layout, access and stage of every image subresource and buffer
+// registered with it. State follows command recording order, so command
+// buffers have to be submitted in the order they were recorded.
+class ResourceStateTracker {
+public:
+    struct TrackedImage {
+        uint32_t mip_levels;
+        uint32_t array_layers;
+        vk::ImageAspectFlags aspect;
+        // Indexed by mip * array_layers + layer
+        std::vector<SubresourceState> subresources;
+    };
+
+    void trackImage(
+        vk::Image image,
+        uint32_t mip_levels,
+        uint32_t array_layers,
+        vk::ImageAspectFlags aspect,
+        ResourceState initial=ResourceState()
+    );
+    void trackBuffer(vk::Buffer buffer, ResourceState initial=ResourceState());
+
+    void forgetImage(vk::Image image);
+    void forgetBuffer(vk::Buffer buffer);
+
+    TrackedImage *image(vk::Image image);
+    SubresourceState *buffer(vk::Buffer buffer);
+
+    // Overrides the state of every subresource without recording a barrier
+    void setImageState(vk::Image image, ResourceState state);
+
+private:
+    std::unordered_map<VkImage, TrackedImage> images;
+    std::unordered_map<VkBuffer, SubresourceState> buffers;
+};
+
+struct BarrierStats {
+    // Transitions requested through the batcher
+    uint32_t requested = 0;
+    // Requests that did not need any barrier
+    uint32_t redundant = 0;
+    // Requests that were folded into a pending barrier of the same subresource
+    uint32_t merged = 0;
+    uint32_t imageBarriers = 0;
+    uint32_t bufferBarriers = 0;
+    uint32_t batches = 0;
+};
+
+// Collects the transitions needed before the next piece of work and emits
+// them as one barrier with the tightest stage and access masks known from the tracker.
+class BarrierBatcher {
+public:
+    BarrierBatcher(Device &device, ResourceStateTracker &tracker, bool debug=false);
+
+    void transition(
+        vk::Image image,
+        ResourceUsage usage,
+        std::optional<vk::ImageSubresourceRange> range=std::nullopt
+    );
+    void transition(
+        vk::Image image,
+        ResourceState state,
+        bool write,
+        std::optional<vk::ImageSubresourceRange> range=std::nullopt
+    );
+
+    void access(vk::Buffer buffer, ResourceUsage usage);
+    void access(vk::Buffer buffer, ResourceState state, bool write);
+
+    void flush(vk::CommandBuffer command_buffer);
+
+    bool empty() const {
+        return pending_images.empty() && pending_buffers.empty();
+    }
+
+    // Returns the counters of the frame that just ended and resets them.
+    // In debug mode they are also logged.
+    BarrierStats nextFrame();
+
+    const BarrierStats &stats() const {
+        return frame_stats;
+    }
+
+public:
+    Device &device;
+    ResourceStateTracker &tracker;
+
+    bool debug;
+
+private:
+    struct PendingImage {
+        vk::Image image;
+        vk::ImageAspectFlags aspect;
+        uint32_t mip;
+        uint32_t layer;
+        ResourceState src;
+        ResourceState dst;
+    };
+
+    struct PendingBuffer {
+        vk::Buffer buffer;
+        ResourceState src;
+        ResourceState dst;
+    };
+
+    std::vector<PendingImage> pending_images;
+    std::vector<PendingBuffer> pending_buffers;
+
+    BarrierStats frame_stats;
+};
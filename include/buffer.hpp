@@ -1,8 +1,12 @@
 #pragma once
 
+#include "deletionqueue.hpp"
+#include "instrument.hpp"
 #include "log.hpp"
+#include "memorytracker.hpp"
 #include "vkdevice.hpp"
 #include <stdexcept>
+#include <utility>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
@@ -18,94 +22,163 @@ public:
         vk::DeviceAddress memory_size,
         vk::DispatchLoaderDynamic &dispatcher,
         vk::MemoryMapFlags flags=vk::MemoryMapFlags()
-    ): device(device), v_device_memory(device_memory), v_dispatcher(dispatcher) {
+    ): device(&device), v_device_memory(device_memory), v_dispatcher(&dispatcher) {
         mappedMemory = device->mapMemory(
             v_device_memory,
             0,
             memory_size,
             flags,
-            v_dispatcher
+            *v_dispatcher
         );
     }
 
+    MemoryMap(const MemoryMap&) = delete;
+    MemoryMap &operator=(const MemoryMap&) = delete;
+
+    MemoryMap(MemoryMap &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_device_memory(std::exchange(other.v_device_memory, nullptr)),
+      mappedMemory(std::exchange(other.mappedMemory, nullptr)),
+      v_dispatcher(other.v_dispatcher) {}
+
+    MemoryMap &operator=(MemoryMap &&other) noexcept {
+        if(this != &other) {
+            unmap();
+            device = std::exchange(other.device, nullptr);
+            v_device_memory = std::exchange(other.v_device_memory, nullptr);
+            mappedMemory = std::exchange(other.mappedMemory, nullptr);
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
+    }
+
     ~MemoryMap() {
-        device->unmapMemory(v_device_memory, v_dispatcher);
+        unmap();
     }
 
     void *operator*() {
         return mappedMemory;
     }
 
+private:
+    void unmap() {
+        if(device) device->v_device.unmapMemory(v_device_memory, *v_dispatcher);
+    }
+
 public:
-    Device &device;
+    Device *device = nullptr;
 
     vk::DeviceMemory v_device_memory;
 
-    void *mappedMemory;
+    void *mappedMemory = nullptr;
 
-    vk::DispatchLoaderDynamic &v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
 };
 
 class Buffer {
 public:
+    Buffer() = default;
+
     Buffer(
         Device &device,
         vk::BufferCreateInfo &buffer_info,
         vk::MemoryPropertyFlags memory_properties,
         vk::DispatchLoaderDynamic &dispatcher
-    ): device(device), v_buffer_size(buffer_info.size), v_dispatcher(dispatcher) {
-        v_buffer = device->createBuffer(buffer_info, nullptr, v_dispatcher);
+    ): device(&device), v_buffer_size(buffer_info.size), v_dispatcher(&dispatcher) {
+        v_buffer = device->createBuffer(buffer_info, nullptr, *v_dispatcher);
+
+        bool addressable = static_cast<bool>(buffer_info.usage & vk::BufferUsageFlagBits::eShaderDeviceAddress);
+
+        if(addressable && !device.capabilities.bufferDeviceAddress) {
+            device->destroyBuffer(v_buffer, nullptr, *v_dispatcher);
+            THROW(runtime_error, "Buffer requests a device address but bufferDeviceAddress is not enabled.");
+        }
 
-        auto memoryReqs = device->getBufferMemoryRequirements(v_buffer, v_dispatcher);
+        auto memoryReqs = device->getBufferMemoryRequirements(v_buffer, *v_dispatcher);
+
+        auto allocateFlags = vk::MemoryAllocateFlagsInfo()
+            .setFlags(vk::MemoryAllocateFlagBits::eDeviceAddress);
 
         auto allocateInfo = vk::MemoryAllocateInfo()
             .setAllocationSize(memoryReqs.size)
-            .setMemoryTypeIndex(findMemoryType(memoryReqs.memoryTypeBits, memory_properties));
+            .setMemoryTypeIndex(device.memory->findMemoryType(memoryReqs.memoryTypeBits, memory_properties))
+            .setPNext(addressable ? &allocateFlags : nullptr);
+
+        v_memory = device.memory->allocate(allocateInfo, MemoryCategory::Buffer);
+        device->bindBufferMemory(v_buffer, v_memory, 0, *v_dispatcher);
+
+        if(addressable) {
+            v_device_address = device->getBufferAddress(vk::BufferDeviceAddressInfo(v_buffer), *v_dispatcher);
+        }
+    }
 
-        v_memory = device->allocateMemory(allocateInfo, nullptr, v_dispatcher);
-        device->bindBufferMemory(v_buffer, v_memory, 0);
+    Buffer(const Buffer&) = delete;
+    Buffer &operator=(const Buffer&) = delete;
+
+    Buffer(Buffer &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_buffer(std::exchange(other.v_buffer, nullptr)),
+      v_memory(std::exchange(other.v_memory, nullptr)),
+      v_buffer_size(std::exchange(other.v_buffer_size, 0)),
+      v_device_address(std::exchange(other.v_device_address, 0)),
+      v_dispatcher(other.v_dispatcher) {}
+
+    Buffer &operator=(Buffer &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            v_buffer = std::exchange(other.v_buffer, nullptr);
+            v_memory = std::exchange(other.v_memory, nullptr);
+            v_buffer_size = std::exchange(other.v_buffer_size, 0);
+            v_device_address = std::exchange(other.v_device_address, 0);
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
     }
 
     ~Buffer() {
-        device->destroyBuffer(v_buffer, nullptr, v_dispatcher);
-        device->freeMemory(v_memory, nullptr, v_dispatcher);
+        release();
     }
 
     MemoryMap mapMemory() {
-        return MemoryMap(device, v_memory, v_buffer_size, v_dispatcher);
+        return MemoryMap(*device, v_memory, v_buffer_size, *v_dispatcher);
     }
 
     vk::Buffer operator*() {
         return v_buffer;
     }
 
+    // GPU pointer to the start of the buffer, e.g. for push constants read through
+    // GL_EXT_buffer_reference. Needs eShaderDeviceAddress in the buffer usage.
+    vk::DeviceAddress deviceAddress() const {
+        if(!v_device_address) {
+            THROW(runtime_error, "Buffer was not created with eShaderDeviceAddress usage.");
+        }
+        return v_device_address;
+    }
+
     vk::Buffer *operator->() {
         return &v_buffer;
     }
 
 private:
-    uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) {
-        auto memProperties = device.v_physical_device.getMemoryProperties(v_dispatcher);
-
-        for(uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            if((typeFilter & (1 << i)) && 
-               (memProperties.memoryTypes[i].propertyFlags & properties) == properties) 
-            {
-                return i;
-            }
-        }
+    void release() {
+        if(!device) return;
 
-        THROW(runtime_error, "Failed to find suitable memory type for a buffer.");
+        device->deletion_queue->push(v_buffer);
+        device->deletion_queue->push(v_memory);
     }
 
 public:
-    Device &device;
+    Device *device = nullptr;
 
     vk::Buffer v_buffer;
 
     // TODO: Separate device memory and buffer (buffer can have multiple memories attached)
     vk::DeviceMemory v_memory;
-    vk::DeviceAddress v_buffer_size;
+    vk::DeviceAddress v_buffer_size = 0;
+    // Zero unless the buffer was created with eShaderDeviceAddress usage
+    vk::DeviceAddress v_device_address = 0;
 
-    vk::DispatchLoaderDynamic &v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
 };
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "barriers.hpp"
+#include "buffer.hpp"
+#include "rangeallocator.hpp"
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Handles stay valid when the defragmenter moves their range, 0 is never handed out
+using BufferHandle = uint64_t;
+
+// Where an allocation currently lives. Only valid until the next defragment() or free().
+struct BufferRange {
+    vk::Buffer buffer;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+
+    vk::DescriptorBufferInfo descriptor() const {
+        return vk::DescriptorBufferInfo(buffer, offset, size);
+    }
+};
+
+struct DefragmentStats {
+    uint32_t moves = 0;
+    vk::DeviceSize bytes_moved = 0;
+    // Capacity of the blocks released
+    vk::DeviceSize bytes_reclaimed = 0;
+    uint32_t blocks_freed = 0;
+    // CPU time spent in defragment()
+    double milliseconds = 0.0;
+};
+
+struct BufferHeapStats {
+    uint32_t blocks = 0;
+    uint32_t allocations = 0;
+    vk::DeviceSize capacity = 0;
+    vk::DeviceSize used = 0;
+    // Totals since the heap was created
+    uint64_t moves = 0;
+    uint64_t bytes_moved = 0;
+    uint64_t bytes_reclaimed = 0;
+};
+
+// Sub-allocates device local ranges of large buffer blocks, so long lived buffers
+// share a few vkAllocateMemory calls instead of one each. Allocations are referred
+// to by handle and resolved to their current block and offset when used.
+//
+// Churn leaves blocks sparsely used. defragment() incrementally drains the sparsest
+// block: every call copies at most `max_bytes` of its live allocations into the
+// densest blocks with room on the GPU, repoints their handles, and releases the
+// block once nothing in flight reads from it any more. Call it at the start of the
+// frame's command buffer, before handles are resolved for that frame:
+//
+//     auto moved = heap.defragment(cmd, 4 << 20);
+//     heap.prepare(batcher, ResourceUsage::StorageRead);
+//     batcher.flush(cmd);
+//     auto range = heap.resolve(handle);
+//
+// Contents are written through transfers or shaders, the blocks are never mapped.
+class BufferHeap {
+public:
+    BufferHeap(
+        Device &device,
+        vk::BufferUsageFlags usage,
+        vk::DeviceSize block_size,
+        vk::DispatchLoaderDynamic &dispatcher
+    );
+    ~BufferHeap();
+
+    BufferHeap(const BufferHeap&) = delete;
+    BufferHeap &operator=(const BufferHeap&) = delete;
+
+    // Creates a new block when no existing one has room. Allocations larger than
+    // the block size get a block of their own.
+    BufferHandle allocate(vk::DeviceSize size, vk::DeviceSize alignment=1);
+    // The range is reused once the GPU finished the frames that may still use it
+    void free(BufferHandle handle);
+
+    BufferRange resolve(BufferHandle handle) const;
+
+    // Moves every block to the given usage
+    void prepare(BarrierBatcher &batcher, ResourceUsage usage);
+
+    // Moves at most `max_bytes` out of the sparsest block and releases drained blocks
+    DefragmentStats defragment(vk::CommandBuffer command_buffer, vk::DeviceSize max_bytes);
+
+    BufferHeapStats stats() const;
+
+public:
+    Device &device;
+
+    // TransferSrc and TransferDst are always added for uploads and moves
+    vk::BufferUsageFlags usage;
+    vk::DeviceSize block_size;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+    // Blocks used below this fraction of their capacity are drained
+    float sparse_threshold = 0.5f;
+
+private:
+    struct Block {
+        Buffer buffer;
+        RangeAllocator ranges;
+
+        uint32_t allocations = 0;
+        // Being drained, skipped by allocate()
+        bool draining = false;
+    };
+
+    struct Allocation {
+        uint32_t block;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        vk::DeviceSize alignment;
+    };
+
+    struct RetiredRange {
+        uint32_t block;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        uint64_t retire_value;
+    };
+
+    uint32_t createBlock(vk::DeviceSize capacity);
+    // Frees retired ranges the GPU is done with, and returns the bytes of the empty blocks released
+    vk::DeviceSize reclaim(uint32_t &blocks_freed);
+    // Picks the next block to drain, if any is sparse enough and fits into the others
+    std::optional<uint32_t> pickSource() const;
+
+    void retire(uint32_t block, vk::DeviceSize offset, vk::DeviceSize size);
+
+    // Null entries are released blocks whose index is reused
+    std::vector<std::unique_ptr<Block>> blocks;
+
+    BufferHandle next_handle = 1;
+    std::unordered_map<BufferHandle, Allocation> allocations;
+
+    std::vector<RetiredRange> retired;
+
+    std::optional<uint32_t> source;
+
+    uint64_t total_moves = 0;
+    uint64_t total_bytes_moved = 0;
+    uint64_t total_bytes_reclaimed = 0;
+};
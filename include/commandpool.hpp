@@ -1,26 +1,49 @@
 #pragma once
 
+#include <utility>
+
 #include <vulkan/vulkan.hpp>
 
+#include "deletionqueue.hpp"
 #include "vkdevice.hpp"
 
 class CommandPool {
 public:
+    CommandPool() = default;
+
     CommandPool(
         Device &device,
         uint32_t queue_family_index,
         vk::CommandPoolCreateFlags flags,
-        vk::DispatchLoaderDynamic dispatcher
-    ) : device(device), v_dispatcher(dispatcher) {
+        vk::DispatchLoaderDynamic &dispatcher
+    ) : device(&device), v_dispatcher(&dispatcher) {
         auto commandPoolInfo = vk::CommandPoolCreateInfo()
             .setFlags(flags)
             .setQueueFamilyIndex(queue_family_index);
             
-        v_command_pool = device.v_device.createCommandPool(commandPoolInfo, nullptr, v_dispatcher);
+        v_command_pool = device.v_device.createCommandPool(commandPoolInfo, nullptr, *v_dispatcher);
+    }
+
+    CommandPool(const CommandPool&) = delete;
+    CommandPool &operator=(const CommandPool&) = delete;
+
+    CommandPool(CommandPool &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_command_pool(std::exchange(other.v_command_pool, nullptr)),
+      v_dispatcher(other.v_dispatcher) {}
+
+    CommandPool &operator=(CommandPool &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            v_command_pool = std::exchange(other.v_command_pool, nullptr);
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
     }
 
     ~CommandPool() {
-        device.v_device.destroyCommandPool(v_command_pool, nullptr, v_dispatcher);
+        release();
     }
 
     vk::CommandPool operator*() {
@@ -36,9 +59,9 @@ public:
             .setCommandPool(v_command_pool)
             .setLevel(level);
         
-        std::vector<vk::CommandBuffer> vkCmdBuffers = device.v_device.allocateCommandBuffers(
+        std::vector<vk::CommandBuffer> vkCmdBuffers = device->v_device.allocateCommandBuffers(
             allocateInfo,
-            v_dispatcher
+            *v_dispatcher
         );
 
         // command_buffers.insert(command_buffers.end(), cmdBuffer.begin(), cmdBuffer.end());
@@ -50,12 +73,17 @@ public:
         return createCommandBuffers(1, level)[0];
     }
 
+private:
+    void release() {
+        if(device) device->deletion_queue->push(v_command_pool);
+    }
+
 public:
-    Device &device;
+    Device *device = nullptr;
 
     // Might not be necessary
     // std::vector<vk::CommandBuffer> command_buffers;
 
     vk::CommandPool v_command_pool;
-    vk::DispatchLoaderDynamic v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
 };
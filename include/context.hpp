@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vkdevice.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+#ifndef __MACH__
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+#endif
+
+// Vulkan instance, debug messenger, dispatcher and device, with no window system
+// involved. Window builds on it for on-screen rendering, headless and offscreen
+// applications use it directly.
+//
+// Devices keep a reference to the dispatcher, so a context cannot be moved.
+class Context {
+public:
+    Context() = default;
+    Context(
+        const std::string &application_name,
+        std::vector<const char*> requestedExtensions,
+        bool portability=false
+    );
+    ~Context();
+
+    Context(const Context&) = delete;
+    Context &operator=(const Context&) = delete;
+
+    void createInstance(
+        const std::string &application_name,
+        std::vector<const char*> requestedExtensions,
+        bool portability=false
+    );
+
+    // Without a surface the device only needs a graphics queue and cannot present
+    Device &requestDevice(
+        const vk::PhysicalDeviceFeatures &requestedFeatures,
+        const std::vector<const char*> &requestedExtensions,
+        vk::SurfaceKHR surface=nullptr
+    );
+
+    // Destroys the device, messenger and instance. Surfaces have to be destroyed before.
+    void destroy();
+
+public:
+    vk::Instance v_instance;
+    vk::DebugUtilsMessengerEXT v_messenger;
+    vk::DispatchLoaderDynamic v_dispatcher;
+
+    std::unique_ptr<Device> v_device;
+
+    bool vk_ready = false;
+};
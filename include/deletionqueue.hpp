@@ -0,0 +1,74 @@
+#pragma once
+
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include <vulkan/vulkan.hpp>
+
+// Defers destruction of Vulkan handles until the GPU is done with them.
+//
+// Every handle is tagged with the frame it was released in and destroyed once
+// Device::nextFrame has been called `frames_in_flight + 1` more times. Since
+// nextFrame follows the submit, that is after the application waited for the
+// fence of the frame that released the handle. Alternatively, with a timeline
+// semaphore set, handles are tagged with the value the next submission signals
+// and destroyed as soon as the semaphore reaches it.
+class DeletionQueue {
+public:
+    DeletionQueue(Device &device);
+    ~DeletionQueue();
+
+    template<typename Handle>
+    void push(Handle handle) {
+        if(!handle) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back(Entry {
+            .type = Handle::objectType,
+            .handle = (uint64_t)static_cast<typename Handle::CType>(handle),
+            .retire_value = retireValueLocked(),
+        });
+    }
+
+    // Switches to timeline tagging. `pending_value` is what the next submission signals.
+    void setTimeline(vk::Semaphore timeline, uint64_t pending_value);
+    void setPendingTimelineValue(uint64_t pending_value);
+
+    // Value work recorded now completes at, and the value completed so far.
+    // Other deferred work (e.g. readbacks) uses the same tagging as the handles.
+    uint64_t retireValue();
+    uint64_t completedValue() const;
+
+    // Destroys every handle whose frame or timeline value completed
+    void collect();
+
+    // Destroys everything. The device must be idle.
+    void flush();
+
+    size_t size();
+
+public:
+    Device &device;
+
+private:
+    struct Entry {
+        vk::ObjectType type;
+        uint64_t handle;
+        uint64_t retire_value;
+    };
+
+    // retireValue with `mutex` held
+    uint64_t retireValueLocked() const;
+
+    void destroy(const Entry &entry);
+
+    std::mutex mutex;
+    // Ordered by retire value, since values only grow
+    std::deque<Entry> entries;
+
+    vk::Semaphore v_timeline;
+    uint64_t pending_timeline_value = 0;
+};
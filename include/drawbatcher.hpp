@@ -0,0 +1,151 @@
+#pragma once
+
+#include "instancebuffer.hpp"
+#include "meshpool.hpp"
+#include "vkpipeline.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct DrawBatchStats {
+    // Draws added through add()
+    uint32_t items = 0;
+    // Instanced draw calls they were merged into
+    uint32_t draws = 0;
+    uint32_t pipeline_binds = 0;
+    uint32_t material_binds = 0;
+    uint32_t page_binds = 0;
+};
+
+// Collects single draws of MeshPool meshes over a frame, sorts them by pipeline,
+// material and mesh, and records every run of the same mesh as one instanced draw
+// whose per-instance data of type T is streamed through an InstanceBuffer<T>.
+//
+//     batcher.add(pipeline, material_id, mesh, instance);
+//     ...
+//     instances.begin();
+//     batcher.record(cmd, pool, instances, 1, bindMaterial);
+//
+// Materials are opaque ids, `bind_material` is called whenever the id changes
+// (e.g. to bind descriptor sets) and may be empty.
+template<typename T>
+class DrawBatcher {
+public:
+    using BindMaterial = std::function<void(vk::CommandBuffer command_buffer, Pipeline &pipeline, uint64_t material)>;
+
+    void add(Pipeline &pipeline, uint64_t material, const MeshAllocation &mesh, const T &instance) {
+        items.push_back(Item {
+            .pipeline = &pipeline,
+            .material = material,
+            .mesh = mesh,
+            .instance = static_cast<uint32_t>(instance_data.size()),
+        });
+        instance_data.push_back(instance);
+    }
+
+    void clear() {
+        items.clear();
+        instance_data.clear();
+    }
+
+    size_t size() const {
+        return items.size();
+    }
+
+    // Records and clears the collected draws inside a render pass. The instance buffer
+    // is bound as a vertex buffer at `instance_binding`; pass std::nullopt when the
+    // shaders read it as a storage buffer through InstanceBuffer::descriptor() instead.
+    DrawBatchStats record(
+        vk::CommandBuffer command_buffer,
+        MeshPool &pool,
+        InstanceBuffer<T> &instances,
+        std::optional<uint32_t> instance_binding,
+        const BindMaterial &bind_material=BindMaterial()
+    ) {
+        DrawBatchStats stats;
+        stats.items = static_cast<uint32_t>(items.size());
+
+        if(items.empty()) return stats;
+
+        // Stable, instances of one draw keep the order they were added in
+        std::stable_sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+            if(a.pipeline != b.pipeline) return std::less<Pipeline*>()(a.pipeline, b.pipeline);
+            return a.key() < b.key();
+        });
+
+        if(instance_binding.has_value()) {
+            instances.bind(command_buffer, *instance_binding);
+        }
+
+        Pipeline *bound_pipeline = nullptr;
+        std::optional<uint64_t> bound_material;
+        std::optional<uint32_t> bound_page;
+
+        for(size_t begin = 0; begin < items.size();) {
+            const Item &item = items[begin];
+
+            size_t end = begin + 1;
+            while(end < items.size() && items[end].pipeline == item.pipeline && items[end].key() == item.key()) {
+                end++;
+            }
+
+            uint32_t count = static_cast<uint32_t>(end - begin);
+            uint32_t first_instance;
+            T *data = instances.allocate(count, first_instance);
+
+            for(size_t i = begin; i < end; i++) {
+                data[i - begin] = instance_data[items[i].instance];
+            }
+
+            if(item.pipeline != bound_pipeline) {
+                item.pipeline->bind(command_buffer);
+                bound_pipeline = item.pipeline;
+                bound_material.reset();
+                stats.pipeline_binds++;
+            }
+
+            if(bound_material != item.material) {
+                if(bind_material) bind_material(command_buffer, *item.pipeline, item.material);
+                bound_material = item.material;
+                stats.material_binds++;
+            }
+
+            if(bound_page != item.mesh.page) {
+                pool.bind(command_buffer, item.mesh.page);
+                bound_page = item.mesh.page;
+                stats.page_binds++;
+            }
+
+            pool.draw(command_buffer, item.mesh, count, first_instance);
+            stats.draws++;
+
+            begin = end;
+        }
+
+        clear();
+
+        return stats;
+    }
+
+private:
+    struct Item {
+        Pipeline *pipeline;
+        uint64_t material;
+        MeshAllocation mesh;
+        // Into instance_data
+        uint32_t instance;
+
+        auto key() const {
+            return std::make_tuple(material, mesh.page, mesh.first_index, mesh.vertex_offset, mesh.index_count);
+        }
+    };
+
+    std::vector<Item> items;
+    std::vector<T> instance_data;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_to_string.hpp>
+
+namespace utils {
+    // Bytes per texel of the uncompressed color and depth formats svklib copies around,
+    // or per element of the vertex attribute formats, quantized ones included
+    [[nodiscard]] uint32_t formatSize(vk::Format format);
+}
+
+inline uint32_t utils::formatSize(vk::Format format)
+{
+    switch(format) {
+    case vk::Format::eR8Unorm:
+    case vk::Format::eS8Uint:
+        return 1;
+    case vk::Format::eR8G8Unorm:
+    case vk::Format::eR8G8Snorm:
+    case vk::Format::eR16Sfloat:
+    case vk::Format::eD16Unorm:
+        return 2;
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR8G8B8A8Srgb:
+    case vk::Format::eB8G8R8A8Unorm:
+    case vk::Format::eB8G8R8A8Srgb:
+    case vk::Format::eA2B10G10R10UnormPack32:
+    case vk::Format::eR8G8B8A8Snorm:
+    case vk::Format::eR16G16Sfloat:
+    case vk::Format::eR16G16Snorm:
+    case vk::Format::eR16G16Unorm:
+    case vk::Format::eR32Sfloat:
+    case vk::Format::eR32Uint:
+    case vk::Format::eD32Sfloat:
+    case vk::Format::eX8D24UnormPack32:
+        return 4;
+    case vk::Format::eR16G16B16A16Sfloat:
+    case vk::Format::eR16G16B16A16Snorm:
+    case vk::Format::eR32G32Sfloat:
+        return 8;
+    case vk::Format::eR32G32B32Sfloat:
+        return 12;
+    case vk::Format::eR32G32B32A32Sfloat:
+        return 16;
+    default:
+        throw std::runtime_error(fmt::format("Texel size of format {} is unknown.", vk::to_string(format)));
+    }
+}
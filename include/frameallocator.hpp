@@ -0,0 +1,117 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <vulkan/vulkan.hpp>
+
+// A range of the current frame's scratch memory, valid until the allocator reuses the region
+struct FrameAllocation {
+    vk::Buffer buffer;
+    // From the start of the buffer, also the dynamic offset when bound through dynamicDescriptor()
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    void *data = nullptr;
+    // GPU pointer to the data, 0 when bufferDeviceAddress is not enabled
+    vk::DeviceAddress address = 0;
+
+    vk::DescriptorBufferInfo descriptor() const {
+        return vk::DescriptorBufferInfo(buffer, offset, size);
+    }
+
+    uint32_t dynamicOffset() const {
+        return static_cast<uint32_t>(offset);
+    }
+};
+
+// Linear allocator for data that lives exactly one frame: uniforms, dynamic
+// vertices, compute scratch. One persistently mapped buffer holds a region per frame
+// in flight, allocations bump an offset in the current region and begin() drops them
+// all at once when the region comes around again. InstanceBuffer builds on it for
+// typed per-instance data.
+//
+// Uniform and storage allocations honor the device's minimum offset alignments, so
+// they can be bound with dynamic offsets into a single descriptor:
+//
+//     allocator.begin(frame_fence);
+//     auto params = allocator.uniform(sizeof(Params));
+//     std::memcpy(params.data, &params_data, sizeof(Params));
+//     cmd.bindDescriptorSets(..., set, params.dynamicOffset(), ...);
+class FrameAllocator {
+public:
+    FrameAllocator(Device &device, vk::DeviceSize frame_capacity, vk::DispatchLoaderDynamic &dispatcher);
+
+    FrameAllocator(const FrameAllocator&) = delete;
+    FrameAllocator &operator=(const FrameAllocator&) = delete;
+
+    // Switches to the current frame's region and empties it. The region was last used
+    // `frames_in_flight` frames ago; pass that frame's fence unless it was already
+    // waited on, begin() waits for it before the region is reused.
+    void begin(vk::Fence frame_fence=nullptr);
+
+    FrameAllocation allocate(vk::DeviceSize size, vk::DeviceSize alignment=1);
+
+    FrameAllocation uniform(vk::DeviceSize size) {
+        return allocate(size, uniform_alignment);
+    }
+
+    FrameAllocation storage(vk::DeviceSize size) {
+        return allocate(size, storage_alignment);
+    }
+
+    // Copies `data` into a new uniform allocation
+    template<typename T>
+    FrameAllocation uniform(const T &data) {
+        static_assert(std::is_trivially_copyable_v<T>, "Uniform data is copied into mapped memory");
+
+        FrameAllocation allocation = uniform(sizeof(T));
+        std::memcpy(allocation.data, &data, sizeof(T));
+        return allocation;
+    }
+
+    // For a eUniformBufferDynamic or eStorageBufferDynamic binding, the allocation's
+    // dynamicOffset() selects the data. `range` is the size the shader reads.
+    vk::DescriptorBufferInfo dynamicDescriptor(vk::DeviceSize range) const {
+        return vk::DescriptorBufferInfo(buffer.v_buffer, 0, range);
+    }
+
+    vk::DeviceSize frameOffset() const {
+        return region * region_size;
+    }
+
+    vk::DeviceSize used() const {
+        return region_used;
+    }
+
+    // Largest amount used by one frame, to size the allocator
+    vk::DeviceSize peak() const {
+        return peak_used;
+    }
+
+public:
+    Device &device;
+
+    vk::DeviceSize frame_capacity;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+    vk::DeviceSize uniform_alignment;
+    vk::DeviceSize storage_alignment;
+
+private:
+    Buffer createBuffer();
+
+    vk::DeviceSize region_size;
+
+    // Declared before the mapping, which unmaps first
+    Buffer buffer;
+    MemoryMap mapping;
+
+    uint32_t region = 0;
+    vk::DeviceSize region_used = 0;
+    vk::DeviceSize peak_used = 0;
+};
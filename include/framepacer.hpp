@@ -0,0 +1,95 @@
+#pragma once
+
+#include "vkdevice.hpp"
+#include "vkswapchain.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+#include <vulkan/vulkan.hpp>
+
+struct FramePacerSettings {
+    // Frames presented but not on screen yet before beginFrame() blocks,
+    // 1 trades throughput for the lowest input latency
+    uint32_t max_frames_queued = 2;
+    // Give up on a frame that takes longer than this to reach the display,
+    // e.g. when the window is covered and the compositor stops presenting
+    uint64_t wait_timeout_ns = 100'000'000;
+};
+
+struct FrameLatencyStats {
+    // Frames whose latency was measured
+    uint64_t frames = 0;
+    // Frames given up on after the wait timeout
+    uint64_t timeouts = 0;
+    // Times beginFrame() had to block
+    uint64_t stalls = 0;
+    double last_ms = 0.0;
+    double average_ms = 0.0;
+    double max_ms = 0.0;
+};
+
+// Bounds and measures input-to-photon latency of a swapchain.
+//
+// Every present gets an id through VK_KHR_present_id. beginFrame(), called right
+// before input is sampled, waits with VK_KHR_present_wait until no more than
+// `max_frames_queued - 1` earlier frames are still waiting for the display. The time
+// from beginFrame() until its frame is on screen is the measured latency, exact
+// for frames the pacer blocked on and rounded up to the next beginFrame() otherwise.
+//
+// Without present wait support only the frames_in_flight fences limit queueing and
+// no latency is measured. Swapchain recreation is detected and restarts the ids.
+class FramePacer {
+public:
+    FramePacer(Device &device, Swapchain &swapchain, FramePacerSettings settings, vk::DispatchLoaderDynamic &dispatcher);
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer &operator=(const FramePacer&) = delete;
+
+    void beginFrame();
+
+    // Presents with the frame's present id chained. Out of date swapchains are
+    // returned as eErrorOutOfDateKHR instead of thrown.
+    vk::Result present(uint32_t image_index, vk::Semaphore wait_semaphore);
+
+    void setMaxFramesQueued(uint32_t max_frames_queued);
+
+    bool enabled() const {
+        return present_wait;
+    }
+
+    const FrameLatencyStats &stats() const {
+        return latency_stats;
+    }
+
+public:
+    Device &device;
+    Swapchain &swapchain;
+
+    FramePacerSettings settings;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct QueuedFrame {
+        uint64_t present_id;
+        Clock::time_point start;
+    };
+
+    // Waits for the oldest queued frame, returns false on timeout
+    bool waitForOldest(uint64_t timeout);
+    void restart();
+
+    bool present_wait;
+
+    uint64_t swapchain_generation = 0;
+    uint64_t next_present_id = 1;
+    Clock::time_point frame_start;
+
+    std::deque<QueuedFrame> queued;
+
+    FrameLatencyStats latency_stats;
+};
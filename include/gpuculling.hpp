@@ -0,0 +1,147 @@
+#pragma once
+
+#include "barriers.hpp"
+#include "buffer.hpp"
+#include "image.hpp"
+#include "shader.hpp"
+#include "vkdevice.hpp"
+#include "vkpipeline.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// One entry of the instance buffer the culler reads, std430 layout. The draw
+// arguments are those of MeshPool::indirectCommand for the instance's mesh.
+struct CullInstance {
+    // World space bounding sphere, xyz center and w radius
+    std::array<float, 4> sphere;
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t padding = 0;
+};
+static_assert(sizeof(CullInstance) == 32);
+
+struct CullSettings {
+    bool frustum = true;
+    // Needs a pyramid from buildHiZ, skipped until the first one is built
+    bool occlusion = true;
+};
+
+// Column major, clip space depth in [0, 1] as Vulkan expects
+using Matrix4 = std::array<float, 16>;
+
+// GPU driven culling stage. A compute shader tests the bounding sphere of every
+// instance against the view frustum and a hierarchical depth (HiZ) pyramid of an
+// earlier depth buffer, and writes one indexed indirect command per survivor with
+// firstInstance set to the instance index, so shaders can look up per-instance data.
+//
+// With DeviceCapabilities::drawIndirectCount the survivors are compacted and drawn
+// with drawIndexedIndirectCount. Otherwise every instance keeps its slot with an
+// instance count of 0 or 1 and all slots go through drawIndexedIndirect.
+//
+// Per frame, outside of a render pass:
+//
+//     culler.cull(cmd, instances, instance_count, view_projection);
+//     culler.prepareDraw(batcher);
+//     batcher.flush(cmd);
+//     ... begin the render pass, bind the mesh pool page ...
+//     culler.draw(cmd);
+//     ... end the render pass ...
+//     culler.buildHiZ(cmd, depth, view_projection);
+//
+// The pyramid is one frame old when culling, which suits mostly static scenes.
+// Objects appearing from behind an occluder may pop in one frame late.
+class GpuCuller {
+public:
+    GpuCuller(Device &device, uint32_t max_instances, vk::DispatchLoaderDynamic &dispatcher);
+    ~GpuCuller();
+
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller &operator=(const GpuCuller&) = delete;
+
+    // Reduces a depth image (sampled usage, depth aspect only) into the pyramid and
+    // leaves it in the SampledCompute state. Record after the pass that wrote the depth.
+    void buildHiZ(vk::CommandBuffer command_buffer, Image &depth, const Matrix4 &view_projection);
+
+    // `instances` holds CullInstances, needs storage buffer usage and has to be
+    // registered with the resource state tracker
+    void cull(
+        vk::CommandBuffer command_buffer,
+        Buffer &instances,
+        uint32_t instance_count,
+        const Matrix4 &view_projection,
+        CullSettings settings=CullSettings()
+    );
+
+    // Makes the commands written by cull() available to indirect draws
+    void prepareDraw(BarrierBatcher &batcher);
+
+    // Draws the survivors of the last cull, inside the render pass with the geometry bound
+    void draw(vk::CommandBuffer command_buffer);
+
+    bool compacts() const {
+        return device.capabilities.drawIndirectCount;
+    }
+
+public:
+    Device &device;
+
+    uint32_t max_instances;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+    // vk::DrawIndexedIndirectCommand per instance, and the survivor count
+    Buffer commands;
+    Buffer count;
+
+private:
+    struct CullParams {
+        Matrix4 hiz_view_projection;
+        std::array<float, 4> planes[6];
+        std::array<float, 2> hiz_size;
+        uint32_t instance_count;
+        uint32_t flags;
+    };
+
+    struct ParamSlot {
+        Buffer buffer;
+        MemoryMap mapping;
+        vk::DescriptorSet v_set;
+    };
+
+    // Recreates the pyramid and its descriptor sets for a new depth extent. Only the
+    // extent matters, switching between depth images only rewrites a level 0 set.
+    void resizeHiZ(vk::Extent2D extent);
+
+    Shader cull_shader;
+    Shader hiz_shader;
+
+    vk::DescriptorSetLayout v_cull_set_layout;
+    vk::DescriptorSetLayout v_hiz_set_layout;
+
+    Pipeline cull_pipeline;
+    Pipeline hiz_pipeline;
+
+    vk::Sampler v_sampler;
+
+    vk::DescriptorPool v_pool;
+    std::vector<ParamSlot> params;
+
+    Image hiz;
+    std::vector<vk::ImageView> v_hiz_levels;
+    vk::DescriptorPool v_hiz_pool;
+    // Sets per level reading the previous one, null for level 0
+    std::vector<vk::DescriptorSet> v_hiz_sets;
+    // Level 0 sets per frame in flight, and the depth view each one reads
+    std::vector<vk::DescriptorSet> v_depth_sets;
+    std::vector<vk::ImageView> v_depth_views;
+
+    bool hiz_valid = false;
+    Matrix4 hiz_view_projection {};
+
+    uint32_t last_instance_count = 0;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct GpuScopeTiming {
+    std::string name;
+    // Nesting level, 0 for top level scopes
+    uint32_t depth = 0;
+    // Start relative to the first timestamp the profiler resolved
+    double start_us = 0.0;
+    double duration_ms = 0.0;
+};
+
+struct GpuFrameTimings {
+    uint64_t frame = 0;
+    std::vector<GpuScopeTiming> scopes;
+};
+
+// GPU timestamp profiler with one query pool per frame in flight.
+// Scopes recorded in a frame are read back without waiting when the frame's
+// pool comes around again, which is `frames_in_flight + 1` frames later.
+// A no-op on queues without timestamp support.
+class GpuProfiler {
+public:
+    GpuProfiler(Device &device, uint32_t max_scopes_per_frame=256, uint32_t history_size=240);
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler &operator=(const GpuProfiler&) = delete;
+
+    // Resolves the oldest frame and resets its pool. Record before any scope,
+    // outside of a render pass.
+    void beginFrame(vk::CommandBuffer command_buffer);
+
+    // Returns a scope index for endScope, UINT32_MAX if the frame is out of queries
+    uint32_t beginScope(vk::CommandBuffer command_buffer, const std::string &name);
+    void endScope(vk::CommandBuffer command_buffer, uint32_t scope);
+
+    bool supported() const {
+        return valid_bits != 0;
+    }
+
+    // Most recently resolved frame, nullptr until the first one is resolved
+    const GpuFrameTimings *lastFrame() const;
+
+    const std::deque<GpuFrameTimings> &history() const {
+        return resolved;
+    }
+
+    // Sum of the durations of every scope with this name in the last resolved frame
+    double duration(const std::string &name) const;
+
+    // Writes the resolved history in the Chrome trace event format (chrome://tracing, Perfetto)
+    void writeChromeTrace(const std::string &path) const;
+
+public:
+    Device &device;
+
+private:
+    struct Scope {
+        std::string name;
+        uint32_t depth;
+        uint32_t query;
+    };
+
+    struct FrameSlot {
+        vk::QueryPool v_pool;
+        std::vector<Scope> scopes;
+        uint32_t used_queries = 0;
+        uint64_t frame = 0;
+        bool recorded = false;
+    };
+
+    void resolve(FrameSlot &slot);
+
+    uint32_t max_scopes;
+    uint32_t history_size;
+
+    // Nanoseconds per tick
+    double timestamp_period;
+    uint32_t valid_bits;
+    uint64_t timestamp_mask;
+
+    std::vector<FrameSlot> slots;
+    uint32_t current_slot = 0;
+    uint64_t frame = 0;
+    uint32_t current_depth = 0;
+    uint32_t dropped_frames = 0;
+
+    bool has_base_timestamp = false;
+    uint64_t base_timestamp = 0;
+
+    std::deque<GpuFrameTimings> resolved;
+};
+
+// Writes begin and end timestamps around its lifetime
+class ProfileScope {
+public:
+    ProfileScope(GpuProfiler &profiler, vk::CommandBuffer command_buffer, const std::string &name)
+    : profiler(profiler), command_buffer(command_buffer) {
+        scope = profiler.beginScope(command_buffer, name);
+    }
+
+    ~ProfileScope() {
+        profiler.endScope(command_buffer, scope);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope &operator=(const ProfileScope&) = delete;
+
+private:
+    GpuProfiler &profiler;
+    vk::CommandBuffer command_buffer;
+    uint32_t scope;
+};
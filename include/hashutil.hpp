@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace utils {
+    template<typename T>
+    inline void hashCombine(size_t &seed, const T &value) {
+        seed ^= std::hash<T>()(value) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+    }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "barriers.hpp"
+#include "deletionqueue.hpp"
+#include "instrument.hpp"
+#include "log.hpp"
+#include "memorytracker.hpp"
+#include "vkdevice.hpp"
+#include <stdexcept>
+#include <utility>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_handles.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+class Image {
+public:
+    Image() = default;
+
+    Image(
+        Device &device,
+        vk::ImageCreateInfo &image_info,
+        vk::MemoryPropertyFlags memory_properties,
+        vk::ImageAspectFlags aspect,
+        vk::DispatchLoaderDynamic &dispatcher
+    ): device(&device),
+       v_format(image_info.format),
+       v_extent(image_info.extent),
+       mip_levels(image_info.mipLevels),
+       array_layers(image_info.arrayLayers),
+       aspect(aspect),
+       v_dispatcher(&dispatcher)
+    {
+        v_image = device->createImage(image_info, nullptr, *v_dispatcher);
+
+        auto memoryReqs = device->getImageMemoryRequirements(v_image, *v_dispatcher);
+
+        auto allocateInfo = vk::MemoryAllocateInfo()
+            .setAllocationSize(memoryReqs.size)
+            .setMemoryTypeIndex(device.memory->findMemoryType(memoryReqs.memoryTypeBits, memory_properties));
+
+        // Attachments are rewritten every frame, paging them out would stall rendering
+        const auto attachmentUsage = vk::ImageUsageFlagBits::eColorAttachment |
+            vk::ImageUsageFlagBits::eDepthStencilAttachment;
+        bool attachment = static_cast<bool>(image_info.usage & attachmentUsage);
+
+        v_memory = device.memory->allocate(
+            allocateInfo,
+            attachment ? MemoryCategory::Attachment : MemoryCategory::Image,
+            attachment ? 1.0f : 0.5f
+        );
+        device->bindImageMemory(v_image, v_memory, 0, *v_dispatcher);
+
+        auto viewInfo = vk::ImageViewCreateInfo()
+            .setImage(v_image)
+            .setViewType(array_layers > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D)
+            .setFormat(v_format)
+            .setSubresourceRange(fullRange());
+
+        v_image_view = device->createImageView(viewInfo, nullptr, *v_dispatcher);
+
+        device.resource_states->trackImage(v_image, mip_levels, array_layers, aspect,
+            ResourceState { vk::PipelineStageFlags2(), vk::AccessFlags2(), image_info.initialLayout }
+        );
+    }
+
+    Image(const Image&) = delete;
+    Image &operator=(const Image&) = delete;
+
+    Image(Image &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_image(std::exchange(other.v_image, nullptr)),
+      v_image_view(std::exchange(other.v_image_view, nullptr)),
+      v_memory(std::exchange(other.v_memory, nullptr)),
+      v_format(other.v_format),
+      v_extent(other.v_extent),
+      mip_levels(other.mip_levels),
+      array_layers(other.array_layers),
+      aspect(other.aspect),
+      v_dispatcher(other.v_dispatcher) {}
+
+    Image &operator=(Image &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            v_image = std::exchange(other.v_image, nullptr);
+            v_image_view = std::exchange(other.v_image_view, nullptr);
+            v_memory = std::exchange(other.v_memory, nullptr);
+            v_format = other.v_format;
+            v_extent = other.v_extent;
+            mip_levels = other.mip_levels;
+            array_layers = other.array_layers;
+            aspect = other.aspect;
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
+    }
+
+    ~Image() {
+        release();
+    }
+
+    vk::Image operator*() {
+        return v_image;
+    }
+
+    vk::ImageSubresourceRange fullRange() const {
+        return vk::ImageSubresourceRange(aspect, 0, mip_levels, 0, array_layers);
+    }
+
+private:
+    void release() {
+        if(!device) return;
+
+        device->resource_states->forgetImage(v_image);
+
+        device->deletion_queue->push(v_image_view);
+        device->deletion_queue->push(v_image);
+        device->deletion_queue->push(v_memory);
+    }
+
+public:
+    Device *device = nullptr;
+
+    vk::Image v_image;
+    vk::ImageView v_image_view;
+    vk::DeviceMemory v_memory;
+
+    vk::Format v_format = vk::Format::eUndefined;
+    vk::Extent3D v_extent;
+    uint32_t mip_levels = 0;
+    uint32_t array_layers = 0;
+    vk::ImageAspectFlags aspect;
+
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
+};
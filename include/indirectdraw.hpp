@@ -0,0 +1,43 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "vkdevice.hpp"
+
+#include <cstdint>
+
+#include <vulkan/vulkan.hpp>
+
+// Draws recorded from buffers of vk::DrawIndirectCommand or vk::DrawIndexedIndirectCommand,
+// tightly packed starting at `offset`. The buffers need eIndirectBuffer usage and
+// ResourceUsage::IndirectBuffer access, e.g. through a BarrierBatcher, before the render pass.
+//
+// With multiDrawIndirect all commands go out in one call, otherwise one call is
+// recorded per command. Commands with a non-zero firstInstance need drawIndirectFirstInstance.
+
+void drawIndirect(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    Buffer &commands,
+    uint32_t draw_count,
+    vk::DeviceSize offset=0
+);
+
+void drawIndexedIndirect(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    Buffer &commands,
+    uint32_t draw_count,
+    vk::DeviceSize offset=0
+);
+
+// The draw count is read on the GPU from a uint32_t in `count`, clamped to `max_draw_count`,
+// so a compute pass can decide what is drawn. Requires DeviceCapabilities::drawIndirectCount.
+void drawIndexedIndirectCount(
+    Device &device,
+    vk::CommandBuffer command_buffer,
+    Buffer &commands,
+    vk::DeviceSize offset,
+    Buffer &count,
+    vk::DeviceSize count_offset,
+    uint32_t max_draw_count
+);
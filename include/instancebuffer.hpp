@@ -0,0 +1,98 @@
+#pragma once
+
+#include "frameallocator.hpp"
+#include "log.hpp"
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <type_traits>
+
+#include <vulkan/vulkan.hpp>
+
+// Per-frame instance data of type T, a FrameAllocator whose regions each hold
+// `capacity` instances. Bind it as a vertex buffer with vk::VertexInputRate::eInstance
+// (see VertexInputState::binding) or as a storage buffer through descriptor().
+//
+// Instance indices are relative to the current frame's region, which is what bind()
+// and descriptor() point at, so they go straight into firstInstance. Writing to a
+// region is safe once the frame that used it `frames_in_flight` frames ago finished.
+template<typename T>
+class InstanceBuffer {
+    static_assert(std::is_trivially_copyable_v<T>, "Instance data is copied into mapped memory");
+
+public:
+    InstanceBuffer(Device &device, uint32_t capacity, vk::DispatchLoaderDynamic &dispatcher)
+    : device(device), capacity(capacity), v_dispatcher(dispatcher),
+      allocator(device, static_cast<vk::DeviceSize>(capacity) * sizeof(T), dispatcher) {
+        begin();
+    }
+
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer &operator=(const InstanceBuffer&) = delete;
+
+    // Switches to the current frame's region and empties it. Call once per frame.
+    void begin() {
+        allocator.begin();
+        // The whole region at once, regions start at the allocator's region alignment
+        frame = allocator.allocate(static_cast<vk::DeviceSize>(capacity) * sizeof(T));
+        used = 0;
+    }
+
+    // Reserves `count` consecutive instances, `first` receives the index of the first one
+    T *allocate(uint32_t count, uint32_t &first) {
+        if(used + count > capacity) {
+            THROW(runtime_error, "Instance buffer is full, {} of {} instances used and {} requested.",
+                used, capacity, count
+            );
+        }
+
+        first = used;
+        used += count;
+
+        return static_cast<T*>(frame.data) + first;
+    }
+
+    uint32_t push(const T &instance) {
+        uint32_t index;
+        *allocate(1, index) = instance;
+        return index;
+    }
+
+    void bind(vk::CommandBuffer command_buffer, uint32_t binding) {
+        command_buffer.bindVertexBuffers(binding, frame.buffer, frame.offset, v_dispatcher);
+    }
+
+    vk::DescriptorBufferInfo descriptor() const {
+        return frame.descriptor();
+    }
+
+    // The current frame's region as a GPU pointer, for shaders that take the
+    // instances through push constants instead of a descriptor
+    vk::DeviceAddress deviceAddress() const {
+        if(!frame.address) {
+            THROW(runtime_error, "Instance buffer needs bufferDeviceAddress for a device address.");
+        }
+        return frame.address;
+    }
+
+    vk::DeviceSize frameOffset() const {
+        return frame.offset;
+    }
+
+    uint32_t size() const {
+        return used;
+    }
+
+public:
+    Device &device;
+
+    uint32_t capacity;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+private:
+    FrameAllocator allocator;
+    FrameAllocation frame;
+
+    uint32_t used = 0;
+};
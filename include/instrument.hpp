@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// CPU zones and per-frame counters, compiled in with the SVK_INSTRUMENTATION
+// CMake option. Without it the macros expand to nothing.
+//
+//     SVK_ZONE("Swapchain::recreate");
+//     SVK_COUNT(Draws, 1);
+//     SVK_FRAME_MARK();
+#ifdef SVK_INSTRUMENTATION
+#define SVK_CONCAT_INNER(a, b) a##b
+#define SVK_CONCAT(a, b) SVK_CONCAT_INNER(a, b)
+#define SVK_ZONE(name) instrument::Zone SVK_CONCAT(svk_zone_, __LINE__)(name)
+#define SVK_COUNT(counter, amount) instrument::count(instrument::Counter::counter, amount)
+#define SVK_FRAME_MARK() instrument::frameMark()
+#define SVK_THREAD_NAME(name) instrument::setThreadName(name)
+#else
+#define SVK_ZONE(name) do {} while(0)
+#define SVK_COUNT(counter, amount) do {} while(0)
+#define SVK_FRAME_MARK() do {} while(0)
+#define SVK_THREAD_NAME(name) do {} while(0)
+#endif
+
+namespace instrument {
+    enum class Counter : uint32_t {
+        Submits,
+        Draws,
+        Barriers,
+        Allocations,
+        DescriptorUpdates,
+        Uploads,
+        Count,
+    };
+
+    constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::Count);
+
+    struct FrameCounters {
+        uint64_t frame = 0;
+        uint64_t end_ns = 0;
+        std::array<uint64_t, COUNTER_COUNT> values {};
+    };
+
+    const char *counterName(Counter counter);
+
+    uint64_t now();
+
+    // Zone names must outlive the trace dump; string literals are expected
+    void recordZone(const char *name, uint64_t begin_ns, uint64_t end_ns);
+    void count(Counter counter, uint64_t amount=1);
+
+    // Closes the frame's counters
+    void frameMark();
+    FrameCounters lastFrame();
+
+    void setThreadName(const std::string &name);
+
+    // Writes zones still held in the per-thread rings and the counter history
+    void writeChromeTrace(const std::string &path);
+
+    class Zone {
+    public:
+        explicit Zone(const char *name) : name(name), begin(now()) {}
+
+        ~Zone() {
+            recordZone(name, begin, now());
+        }
+
+        Zone(const Zone&) = delete;
+        Zone &operator=(const Zone&) = delete;
+
+    private:
+        const char *name;
+        uint64_t begin;
+    };
+}
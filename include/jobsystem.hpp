@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+// Counts unfinished jobs. Jobs started with a counter increment it and decrement it
+// when done; jobs scheduled with runAfter() start once it drops to zero.
+// A counter can be reused or destroyed once wait() returned on it.
+class JobCounter {
+public:
+    JobCounter() = default;
+
+    JobCounter(const JobCounter&) = delete;
+    JobCounter &operator=(const JobCounter&) = delete;
+
+    bool done() const {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    struct Continuation {
+        std::function<void()> function;
+        JobCounter *counter;
+    };
+
+    std::atomic<uint32_t> pending {0};
+
+    std::mutex mutex;
+    std::vector<Continuation> continuations;
+};
+
+struct JobSystemStats {
+    uint64_t executed = 0;
+    // Jobs a worker took from another worker's deque or the external queue
+    uint64_t stolen = 0;
+};
+
+// Work-stealing scheduler shared by the engine subsystems.
+//
+// Every worker owns a deque it pushes to and pops from at the back, idle workers
+// steal from the front of the others. Threads that are not workers, like the render
+// thread, submit into an extra queue every worker steals from. wait() runs other
+// jobs on the waiting thread instead of blocking, so jobs may wait on jobs.
+class JobSystem {
+public:
+    // 0 workers uses one per hardware thread minus the caller's, at least one
+    explicit JobSystem(uint32_t worker_count=0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem &operator=(const JobSystem&) = delete;
+
+    void run(std::function<void()> job, JobCounter *counter=nullptr);
+    // Starts `job` once every job counted by `dependency` finished
+    void runAfter(JobCounter &dependency, std::function<void()> job, JobCounter *counter=nullptr);
+
+    // Executes jobs until the counter drops to zero
+    void wait(JobCounter &counter);
+
+    // Splits [0, count) into ranges of `batch` items and waits for all of them.
+    // The calling thread works on ranges as well.
+    void parallelFor(uint32_t count, uint32_t batch, const std::function<void(uint32_t begin, uint32_t end)> &function);
+
+    uint32_t workerCount() const {
+        return static_cast<uint32_t>(threads.size());
+    }
+
+    JobSystemStats stats() const;
+
+private:
+    struct Job {
+        std::function<void()> function;
+        JobCounter *counter = nullptr;
+    };
+
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+
+        std::atomic<uint64_t> executed {0};
+        std::atomic<uint64_t> stolen {0};
+    };
+
+    void submit(Job job);
+    // Runs one job if any is available, false when every queue was empty
+    bool executeOne(uint32_t worker);
+    void execute(Job &job, uint32_t worker);
+    void finish(JobCounter &counter);
+
+    bool popOwn(uint32_t worker, Job &job);
+    bool steal(uint32_t worker, Job &job);
+
+    void workerLoop(uint32_t worker);
+
+    // Index of the calling thread's worker in this system, or the external queue
+    uint32_t currentWorker() const;
+
+    std::vector<std::thread> threads;
+    // One per thread, plus the external queue at the end
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::atomic<uint32_t> queued {0};
+    std::atomic<bool> stopping {false};
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    uint32_t sleeping = 0;
+};
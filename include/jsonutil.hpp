@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+#include <fmt/format.h>
+
+namespace utils {
+    [[nodiscard]] std::string escapeJson(const std::string &text);
+}
+
+inline std::string utils::escapeJson(const std::string &text)
+{
+    std::string result;
+    result.reserve(text.size());
+
+    for(char c : text) {
+        switch(c) {
+        case '"': result += "\\\""; break;
+        case '\\': result += "\\\\"; break;
+        case '\n': result += "\\n"; break;
+        case '\t': result += "\\t"; break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20) {
+                result += fmt::format("\\u{:04x}", static_cast<int>(c));
+            } else {
+                result += c;
+            }
+        }
+    }
+
+    return result;
+}
@@ -1,5 +1,15 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 #include <fmt/format.h>
 #include <vulkan/vulkan.hpp>
 
@@ -9,18 +19,42 @@
 #define LOGLEVEL_ERROR 1
 #define LOGLEVEL_NONE 0
 
+// Levels above this are compiled out entirely, set with the SVK_LOG_COMPILED_LEVEL CMake variable
+#ifndef SVK_LOG_COMPILED_LEVEL
+#define SVK_LOG_COMPILED_LEVEL LOGLEVEL_DEBUG
+#endif
+
+#if SVK_LOG_COMPILED_LEVEL >= LOGLEVEL_DEBUG
 #define LOG_DEBUG(...) if(logging::Logging::LOG_LEVEL >= LOGLEVEL_DEBUG) {\
-    fmt::println("\x1b[38;5;229m>\tDEBUG:\t\x1b[0m{}", fmt::format(__VA_ARGS__)); \
+    logging::write(LOGLEVEL_DEBUG, __VA_ARGS__); \
 }
+#else
+#define LOG_DEBUG(...) do {} while(0)
+#endif
+
+#if SVK_LOG_COMPILED_LEVEL >= LOGLEVEL_INFO
 #define LOG_INFO(...) if(logging::Logging::LOG_LEVEL >= LOGLEVEL_INFO) { \
-    fmt::println("\x1b[38;5;111m>>\tINFO:\t\x1b[0m{}", fmt::format(__VA_ARGS__)); \
+    logging::write(LOGLEVEL_INFO, __VA_ARGS__); \
 }
+#else
+#define LOG_INFO(...) do {} while(0)
+#endif
+
+#if SVK_LOG_COMPILED_LEVEL >= LOGLEVEL_WARN
 #define LOG_WARN(...) if(logging::Logging::LOG_LEVEL >= LOGLEVEL_WARN) { \
-    fmt::println("\x1b[38;5;208m>>>\tWARN:\t\x1b[0m{}", fmt::format(__VA_ARGS__)); \
+    logging::write(LOGLEVEL_WARN, __VA_ARGS__); \
 }
+#else
+#define LOG_WARN(...) do {} while(0)
+#endif
+
+#if SVK_LOG_COMPILED_LEVEL >= LOGLEVEL_ERROR
 #define LOG_ERROR(...) if(logging::Logging::LOG_LEVEL >= LOGLEVEL_ERROR) { \
-    fmt::println("\x1b[38;5;196m>>>>\tERROR:\t\x1b[0m{}", fmt::format(__VA_ARGS__)); \
+    logging::write(LOGLEVEL_ERROR, __VA_ARGS__); \
 }
+#else
+#define LOG_ERROR(...) do {} while(0)
+#endif
 
 #define THROW(ERROR, ...) throw std:: ERROR (fmt::format(__VA_ARGS__))
 
@@ -35,21 +69,99 @@ namespace logging {
     void set_environmental_log_level(int _default=LOGLEVEL_NONE) noexcept;
     void set_log_level(int log_level) noexcept;
 
-    static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+    // Blocks until every message logged so far has been written
+    void flush();
+
+    // Same validation message id is printed at most this many times per second,
+    // the rest are counted and reported once the next second starts
+    constexpr uint32_t VALIDATION_REPEAT_LIMIT = 5;
+
+    VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
         VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
         VkDebugUtilsMessageTypeFlagsEXT messageType,
         const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
         void* pUserData
-    ) {
-        if(messageSeverity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT ||
-            messageSeverity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
-            LOG_DEBUG("Validation layer: {}", pCallbackData->pMessage);
-        } else if(messageSeverity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-            LOG_WARN("Validation layer: {}", pCallbackData->pMessage);
-        } else if(messageSeverity == VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
-            LOG_ERROR("Validation layer: {}", pCallbackData->pMessage);
+    );
+
+    namespace detail {
+        // Slot of a per-thread ring. Arguments are copied into `storage` and
+        // only formatted on the logging thread.
+        struct Record {
+            static constexpr size_t INLINE_SIZE = 192;
+
+            int level;
+            uint64_t timestamp_ns;
+            std::string_view format;
+
+            void (*format_to)(const Record &record, fmt::memory_buffer &out);
+            void (*destroy)(Record &record);
+
+            alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+        };
+
+        // Strings are copied since their pointers rarely outlive the call,
+        // e.g. pMessage of the validation callback
+        template<typename T, typename Decayed = std::decay_t<T>>
+        using stored_t = std::conditional_t<
+            std::is_same_v<Decayed, const char*> ||
+            std::is_same_v<Decayed, char*> ||
+            std::is_same_v<Decayed, std::string_view> ||
+            std::is_same_v<Decayed, fmt::string_view>,
+            std::string,
+            Decayed
+        >;
+
+        // Slot in the calling thread's ring, nullptr once the logging thread has shut down
+        Record *acquire();
+        void publish(Record *record);
+
+        void writeNow(int level, const std::string &message);
+
+        template<typename Stored>
+        void formatStored(const Record &record, fmt::memory_buffer &out) {
+            auto &stored = *std::launder(reinterpret_cast<const Stored*>(record.storage));
+
+            std::apply([&](const auto&... args) {
+                fmt::format_to(std::back_inserter(out), fmt::runtime(record.format), args...);
+            }, stored);
+        }
+
+        template<typename Stored>
+        void destroyStored(Record &record) {
+            std::launder(reinterpret_cast<Stored*>(record.storage))->~Stored();
+        }
+    }
+
+    // Queues the message for the logging thread; the format string must be a literal
+    template<typename... Args>
+    void write(int level, fmt::format_string<Args...> format, Args&&... args) {
+        detail::Record *record = detail::acquire();
+
+        if(record == nullptr) {
+            detail::writeNow(level, fmt::format(format, std::forward<Args>(args)...));
+            return;
+        }
+
+        using Stored = std::tuple<detail::stored_t<Args>...>;
+
+        record->level = level;
+
+        if constexpr(sizeof(Stored) <= detail::Record::INLINE_SIZE) {
+            fmt::string_view view = format;
+            record->format = std::string_view(view.data(), view.size());
+            new (record->storage) Stored(std::forward<Args>(args)...);
+            record->format_to = &detail::formatStored<Stored>;
+            record->destroy = &detail::destroyStored<Stored>;
+        } else {
+            // Too large to defer, formatted on the calling thread instead
+            using Formatted = std::tuple<std::string>;
+
+            record->format = "{}";
+            new (record->storage) Formatted(fmt::format(format, std::forward<Args>(args)...));
+            record->format_to = &detail::formatStored<Formatted>;
+            record->destroy = &detail::destroyStored<Formatted>;
         }
 
-        return vk::False;
+        detail::publish(record);
     }
 }
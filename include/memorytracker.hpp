@@ -0,0 +1,148 @@
+#pragma once
+
+#include "vkdevice.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+enum class MemoryCategory {
+    Buffer,
+    Image,
+    // Color and depth attachments, kept resident with the highest priority
+    Attachment,
+    // Aliased heaps of the render graph
+    RenderGraph,
+    Other,
+};
+
+constexpr size_t MEMORY_CATEGORY_COUNT = static_cast<size_t>(MemoryCategory::Other) + 1;
+
+const char *memoryCategoryName(MemoryCategory category);
+
+struct MemoryHeapStats {
+    vk::DeviceSize size = 0;
+    // From VK_EXT_memory_budget when available, otherwise estimated from the heap size
+    vk::DeviceSize budget = 0;
+    // Usage of the whole process as reported by the driver, the tracked bytes without the extension
+    vk::DeviceSize usage = 0;
+    // Bytes allocated through the tracker
+    vk::DeviceSize tracked = 0;
+    // Tracked bytes whose eviction callback ran but that were not freed yet
+    vk::DeviceSize evicting = 0;
+    uint32_t allocations = 0;
+    bool device_local = false;
+};
+
+struct MemoryStats {
+    std::vector<MemoryHeapStats> heaps;
+
+    std::array<vk::DeviceSize, MEMORY_CATEGORY_COUNT> category_bytes {};
+    std::array<uint32_t, MEMORY_CATEGORY_COUNT> category_allocations {};
+
+    // Evictable allocations moved to the lowest priority, and the ones evicted
+    uint64_t downgrades = 0;
+    uint64_t evictions = 0;
+
+    bool driver_budget = false;
+};
+
+using ResidencyHandle = uint64_t;
+
+// Accounts every device memory allocation by heap and category, and watches the
+// heap budgets (VK_EXT_memory_budget) once per frame from Device::nextFrame.
+//
+// Resources that can be dropped and reloaded register themselves as evictable with
+// a priority. When a heap gets close to its budget the lowest priorities are first
+// downgraded, so the OS pages them out before anything else when
+// VK_EXT_pageable_device_local_memory is enabled, and then evicted through their
+// callback until the heap is back under the threshold. Downgraded memory gets its
+// allocation priority back once the heap drops below the downgrade threshold.
+class MemoryTracker {
+public:
+    MemoryTracker(Device &device);
+
+    MemoryTracker(const MemoryTracker&) = delete;
+    MemoryTracker &operator=(const MemoryTracker&) = delete;
+
+    const vk::PhysicalDeviceMemoryProperties &properties() const {
+        return device.properties.memory;
+    }
+
+    // The best type in `type_bits` with every `required` flag, walking the device's
+    // precomputed ranking for the MemoryUsage those flags describe. Types whose heap
+    // is over its budget are only picked when nothing else qualifies.
+    std::optional<uint32_t> tryFindMemoryType(uint32_t type_bits, vk::MemoryPropertyFlags required);
+    uint32_t findMemoryType(uint32_t type_bits, vk::MemoryPropertyFlags required);
+
+    // Allocates and accounts the memory. The priority in [0, 1] is passed on with
+    // VK_EXT_memory_priority. Free the memory through the deletion queue as usual.
+    vk::DeviceMemory allocate(vk::MemoryAllocateInfo info, MemoryCategory category, float priority=0.5f);
+
+    // Called by the deletion queue right before freeing the memory
+    void release(vk::DeviceMemory memory);
+
+    // `evict` has to release the memory, it is called at most once and without
+    // any tracker lock held. Lower priorities are evicted first.
+    ResidencyHandle registerEvictable(vk::DeviceMemory memory, float priority, std::function<void()> evict);
+    void unregisterEvictable(ResidencyHandle handle);
+
+    // Polls the budgets and downgrades or evicts under pressure
+    void update();
+
+    MemoryStats stats();
+
+public:
+    Device &device;
+
+    // Fraction of a heap's budget above which evictable memory is downgraded
+    float downgrade_threshold = 0.85f;
+    // Fraction above which it is evicted
+    float evict_threshold = 0.95f;
+
+private:
+    struct Allocation {
+        uint32_t heap;
+        vk::DeviceSize size;
+        MemoryCategory category;
+        // Passed on allocation, restored once a downgrade is lifted
+        float priority;
+    };
+
+    struct Evictable {
+        VkDeviceMemory memory;
+        uint32_t heap;
+        vk::DeviceSize size;
+        float priority;
+        bool downgraded = false;
+        // Set once the callback was taken, the entry is dropped at the end of update()
+        bool evicted = false;
+        // Null for memory that may only be downgraded
+        std::function<void()> evict;
+    };
+
+    // Driver usage when known, the tracked bytes otherwise. Expects the mutex held.
+    vk::DeviceSize heapUsage(uint32_t heap) const;
+
+    std::mutex mutex;
+
+    std::vector<MemoryHeapStats> heaps;
+    std::unordered_map<VkDeviceMemory, Allocation> allocations;
+
+    std::array<vk::DeviceSize, MEMORY_CATEGORY_COUNT> category_bytes {};
+    std::array<uint32_t, MEMORY_CATEGORY_COUNT> category_allocations {};
+
+    ResidencyHandle next_handle = 1;
+    std::unordered_map<ResidencyHandle, Evictable> evictables;
+    // Evicted memory waiting in the deletion queue, with its size
+    std::unordered_map<VkDeviceMemory, vk::DeviceSize> evicting;
+
+    uint64_t downgrades = 0;
+    uint64_t evictions = 0;
+};
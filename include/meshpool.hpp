@@ -0,0 +1,147 @@
+#pragma once
+
+#include "barriers.hpp"
+#include "buffer.hpp"
+#include "rangeallocator.hpp"
+#include "vertexlayout.hpp"
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Where a mesh lives inside a MeshPool, the arguments of its indexed draw
+struct MeshAllocation {
+    uint32_t page = 0;
+    int32_t vertex_offset = 0;
+    uint32_t vertex_count = 0;
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+};
+
+struct MeshPoolStats {
+    uint32_t pages = 0;
+    uint32_t meshes = 0;
+    uint64_t vertices_used = 0;
+    uint64_t indices_used = 0;
+    uint64_t bytes_uploaded = 0;
+};
+
+// Packs many meshes of one vertex layout into a few large vertex and index buffers,
+// so a scene binds once per page instead of once per mesh and consecutive draws
+// differ only in their offsets. Pages are added when the existing ones are full;
+// a mesh larger than a page gets a page of its own.
+//
+// Mesh data is copied through a staging buffer in recordUploads(). Removed ranges are
+// reused once the GPU finished the frames that may still draw them.
+// Call prepare() on the frame's BarrierBatcher before drawing, e.g.
+//
+//     pool.recordUploads(cmd);
+//     pool.prepare(batcher);
+//     batcher.flush(cmd);
+//     pool.bind(cmd, mesh.page);
+//     pool.draw(cmd, mesh);
+class MeshPool {
+public:
+    MeshPool(
+        Device &device,
+        const VertexLayout &layout,
+        uint32_t vertices_per_page,
+        uint32_t indices_per_page,
+        vk::DispatchLoaderDynamic &dispatcher
+    );
+    ~MeshPool();
+
+    MeshPool(const MeshPool&) = delete;
+    MeshPool &operator=(const MeshPool&) = delete;
+
+    // `vertices` holds `vertex_count` vertices of the pool's layout. Indices are
+    // relative to the mesh, the draw adds the vertex offset.
+    MeshAllocation add(const void *vertices, uint32_t vertex_count, const uint32_t *indices, uint32_t index_count);
+    void remove(const MeshAllocation &mesh);
+
+    // Copies the meshes added since the last call
+    void recordUploads(vk::CommandBuffer command_buffer);
+
+    // Moves every page to vertex and index buffer reads
+    void prepare(BarrierBatcher &batcher);
+
+    void bind(vk::CommandBuffer command_buffer, uint32_t page);
+    // Expects the mesh's page to be bound
+    void draw(
+        vk::CommandBuffer command_buffer,
+        const MeshAllocation &mesh,
+        uint32_t instance_count=1,
+        uint32_t first_instance=0
+    );
+
+    // The same draw as a command for drawIndexedIndirect(), with the mesh's page bound
+    static vk::DrawIndexedIndirectCommand indirectCommand(
+        const MeshAllocation &mesh,
+        uint32_t instance_count=1,
+        uint32_t first_instance=0
+    ) {
+        return vk::DrawIndexedIndirectCommand(
+            mesh.index_count,
+            instance_count,
+            mesh.first_index,
+            mesh.vertex_offset,
+            first_instance
+        );
+    }
+
+    uint32_t pageCount() const {
+        return static_cast<uint32_t>(pages.size());
+    }
+
+    const VertexLayout &vertexLayout() const {
+        return layout;
+    }
+
+    MeshPoolStats stats() const;
+
+public:
+    Device &device;
+
+    VertexLayout layout;
+    uint32_t vertices_per_page;
+    uint32_t indices_per_page;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+private:
+    struct Page {
+        Buffer vertices;
+        Buffer indices;
+
+        RangeAllocator vertex_ranges;
+        RangeAllocator index_ranges;
+
+        uint32_t meshes = 0;
+    };
+
+    struct PendingUpload {
+        uint32_t page;
+        bool index;
+        // In bytes
+        vk::DeviceSize offset;
+        std::vector<uint8_t> data;
+    };
+
+    struct RetiredMesh {
+        MeshAllocation mesh;
+        uint64_t retire_value;
+    };
+
+    uint32_t createPage(uint32_t vertex_capacity, uint32_t index_capacity);
+    // Returns the ranges of removed meshes the GPU is done with
+    void reclaim();
+
+    std::vector<Page> pages;
+
+    std::vector<PendingUpload> pending;
+    std::vector<RetiredMesh> retired;
+
+    uint64_t bytes_uploaded = 0;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+    // Axis aligned bounds the quantized positions are relative to. The vertex
+    // shader reconstructs `center + position.xyz * extent`.
+    struct MeshBounds {
+        std::array<float, 3> center {0.0f, 0.0f, 0.0f};
+        float extent = 1.0f;
+    };
+
+    // Matches VertexLayout::quantized()
+    struct QuantizedVertex {
+        int16_t position[4];
+        int16_t normal[2];
+        uint16_t uv[2];
+    };
+    static_assert(sizeof(QuantizedVertex) == 16);
+
+    [[nodiscard]] uint16_t floatToHalf(float value);
+    [[nodiscard]] int16_t quantizeSnorm16(float value);
+
+    // Maps a unit vector onto the octahedron, two components in [-1, 1]
+    [[nodiscard]] std::array<float, 2> octEncode(float x, float y, float z);
+
+    // `positions` holds xyz triples with `stride` floats between vertices
+    [[nodiscard]] MeshBounds computeBounds(const float *positions, size_t vertex_count, size_t stride);
+
+    [[nodiscard]] QuantizedVertex quantizeVertex(
+        const float position[3],
+        const float normal[3],
+        const float uv[2],
+        const MeshBounds &bounds
+    );
+
+    // Reorders triangles for the post-transform vertex cache (Forsyth's linear speed
+    // algorithm), which cuts vertex shader invocations on indexed draws
+    void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertex_count);
+
+    // Reorders clusters of the cache optimized triangles so the ones facing outwards
+    // come first, which lets early depth testing reject more of the hidden ones.
+    // Run after optimizeVertexCache; clusters keep their internal order.
+    void optimizeOverdraw(
+        std::vector<uint32_t> &indices,
+        const float *positions,
+        size_t vertex_count,
+        size_t stride,
+        size_t cluster_triangles=64
+    );
+
+    // Reorders vertices by first use in the index buffer, rewriting the indices,
+    // so vertex fetches walk through memory mostly linearly. Returns the new vertex count.
+    size_t optimizeVertexFetch(void *vertices, size_t vertex_count, size_t vertex_size, std::vector<uint32_t> &indices);
+}
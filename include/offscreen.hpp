@@ -0,0 +1,72 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "image.hpp"
+#include "readback.hpp"
+#include "rendercache.hpp"
+#include "vkdevice.hpp"
+#include "vkrenderpass.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Pixels of one finished readback, rows tightly packed
+struct OffscreenReadback {
+    // Device::frame_index the copy was recorded in
+    uint64_t frame;
+    vk::Extent2D extent;
+    vk::Format format;
+    std::vector<uint8_t> pixels;
+};
+
+// Color image to render into without a swapchain, for headless and batch rendering.
+//
+// requestReadback records a copy through the target's ReadbackManager; takeReadback
+// hands out the newest copy whose frame completed and never waits on the GPU.
+class OffscreenTarget {
+public:
+    OffscreenTarget(
+        Device &device,
+        vk::Extent2D extent,
+        vk::Format format,
+        vk::DispatchLoaderDynamic &dispatcher
+    );
+
+    OffscreenTarget(const OffscreenTarget&) = delete;
+    OffscreenTarget &operator=(const OffscreenTarget&) = delete;
+
+    // Render pass the color attachment is rendered with, it ends in eTransferSrcOptimal
+    RenderPass &renderPass();
+
+    // Both keep the resource state tracker in sync with the layout the render pass leaves behind
+    void beginRenderPass(vk::CommandBuffer command_buffer, vk::ClearColorValue clear_color);
+    void endRenderPass(vk::CommandBuffer command_buffer);
+
+    // Records the copy into this frame's readback buffer. Call after endRenderPass.
+    // Returns false without recording anything when the buffer is still in flight.
+    bool requestReadback(vk::CommandBuffer command_buffer);
+
+    // Pass `device_idle` after waiting for the device to also take copies of frames still counted as in flight
+    std::optional<OffscreenReadback> takeReadback(bool device_idle=false);
+
+public:
+    Device &device;
+
+    vk::Extent2D extent;
+    vk::Format format;
+    uint32_t texel_size;
+
+    RenderPassLayout layout;
+    Image color;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+    // Sized for one copy of the image per frame
+    ReadbackManager readbacks;
+
+private:
+    std::optional<OffscreenReadback> latest;
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "deletionqueue.hpp"
+#include "log.hpp"
+#include "vkdevice.hpp"
+
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Counters of the statistics svklib decodes by name, zero when not queried
+struct PipelineStatistics {
+    uint64_t inputAssemblyVertices = 0;
+    uint64_t inputAssemblyPrimitives = 0;
+    uint64_t vertexShaderInvocations = 0;
+    uint64_t clippingInvocations = 0;
+    uint64_t clippingPrimitives = 0;
+    uint64_t fragmentShaderInvocations = 0;
+    uint64_t computeShaderInvocations = 0;
+};
+
+// Occlusion or pipeline statistics queries.
+// Pipeline statistics pools are left empty when the device lacks
+// pipelineStatisticsQuery; every call is then a no-op and results are never available.
+class QueryPool {
+public:
+    QueryPool() = default;
+
+    QueryPool(
+        Device &device,
+        vk::QueryType type,
+        uint32_t query_count,
+        vk::DispatchLoaderDynamic &dispatcher,
+        vk::QueryPipelineStatisticFlags statistics=vk::QueryPipelineStatisticFlags()
+    ) : device(&device), type(type), query_count(query_count), statistics(statistics), v_dispatcher(&dispatcher) {
+        if(type == vk::QueryType::ePipelineStatistics && !device.capabilities.pipelineStatisticsQuery) {
+            LOG_WARN("Pipeline statistics queries are not supported by this device.");
+            return;
+        }
+
+        auto poolInfo = vk::QueryPoolCreateInfo()
+            .setQueryType(type)
+            .setQueryCount(query_count)
+            .setPipelineStatistics(statistics);
+
+        v_query_pool = device.v_device.createQueryPool(poolInfo, nullptr, *v_dispatcher);
+    }
+
+    QueryPool(const QueryPool&) = delete;
+    QueryPool &operator=(const QueryPool&) = delete;
+
+    QueryPool(QueryPool &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_query_pool(std::exchange(other.v_query_pool, nullptr)),
+      type(other.type),
+      query_count(other.query_count),
+      statistics(other.statistics),
+      v_dispatcher(other.v_dispatcher) {}
+
+    QueryPool &operator=(QueryPool &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            v_query_pool = std::exchange(other.v_query_pool, nullptr);
+            type = other.type;
+            query_count = other.query_count;
+            statistics = other.statistics;
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
+    }
+
+    ~QueryPool() {
+        release();
+    }
+
+    vk::QueryPool operator*() {
+        return v_query_pool;
+    }
+
+    bool supported() const {
+        return static_cast<bool>(v_query_pool);
+    }
+
+    // 64-bit values each query produces
+    uint32_t valuesPerQuery() const {
+        if(type != vk::QueryType::ePipelineStatistics) return 1;
+
+        return static_cast<uint32_t>(
+            std::bitset<32>(static_cast<VkQueryPipelineStatisticFlags>(statistics)).count()
+        );
+    }
+
+    void reset(vk::CommandBuffer command_buffer) {
+        if(!supported()) return;
+
+        command_buffer.resetQueryPool(v_query_pool, 0, query_count, *v_dispatcher);
+    }
+
+    // `precise` asks for exact sample counts and falls back to boolean occlusion when unsupported
+    void begin(vk::CommandBuffer command_buffer, uint32_t query, bool precise=false) {
+        if(!supported()) return;
+
+        vk::QueryControlFlags flags;
+        if(precise && device->capabilities.occlusionQueryPrecise) {
+            flags = vk::QueryControlFlagBits::ePrecise;
+        }
+
+        command_buffer.beginQuery(v_query_pool, query, flags, *v_dispatcher);
+    }
+
+    void end(vk::CommandBuffer command_buffer, uint32_t query) {
+        if(!supported()) return;
+
+        command_buffer.endQuery(v_query_pool, query, *v_dispatcher);
+    }
+
+    // Reads results without waiting; std::nullopt until every query in the range is available.
+    // Values are laid out as valuesPerQuery() counters per query.
+    std::optional<std::vector<uint64_t>> results(uint32_t first, uint32_t count) {
+        if(!supported()) return std::nullopt;
+
+        uint32_t values = valuesPerQuery();
+        // Availability word follows each query's values
+        uint32_t stride = values + 1;
+
+        auto result = device->v_device.getQueryPoolResults<uint64_t>(
+            v_query_pool,
+            first,
+            count,
+            count * stride * sizeof(uint64_t),
+            stride * sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability,
+            *v_dispatcher
+        );
+
+        if(result.result == vk::Result::eNotReady) {
+            return std::nullopt;
+        }
+
+        std::vector<uint64_t> output;
+        output.reserve(count * values);
+
+        for(uint32_t i = 0; i < count; i++) {
+            const uint64_t *query = result.value.data() + i * stride;
+
+            if(query[values] == 0) return std::nullopt;
+
+            output.insert(output.end(), query, query + values);
+        }
+
+        return output;
+    }
+
+    // Samples that passed for an occlusion query, nonzero meaning visible without `precise`
+    std::optional<uint64_t> occlusion(uint32_t query) {
+        auto values = results(query, 1);
+        if(!values.has_value()) return std::nullopt;
+
+        return (*values)[0];
+    }
+
+    std::optional<PipelineStatistics> pipelineStatistics(uint32_t query) {
+        auto values = results(query, 1);
+        if(!values.has_value()) return std::nullopt;
+
+        PipelineStatistics stats;
+        size_t index = 0;
+
+        // Counters are written in the order of the flag bits
+        auto take = [&](vk::QueryPipelineStatisticFlagBits bit, uint64_t *target) {
+            if(statistics & bit) {
+                uint64_t value = (*values)[index++];
+                if(target != nullptr) *target = value;
+            }
+        };
+
+        using Bit = vk::QueryPipelineStatisticFlagBits;
+        take(Bit::eInputAssemblyVertices, &stats.inputAssemblyVertices);
+        take(Bit::eInputAssemblyPrimitives, &stats.inputAssemblyPrimitives);
+        take(Bit::eVertexShaderInvocations, &stats.vertexShaderInvocations);
+        take(Bit::eGeometryShaderInvocations, nullptr);
+        take(Bit::eGeometryShaderPrimitives, nullptr);
+        take(Bit::eClippingInvocations, &stats.clippingInvocations);
+        take(Bit::eClippingPrimitives, &stats.clippingPrimitives);
+        take(Bit::eFragmentShaderInvocations, &stats.fragmentShaderInvocations);
+        take(Bit::eTessellationControlShaderPatches, nullptr);
+        take(Bit::eTessellationEvaluationShaderInvocations, nullptr);
+        take(Bit::eComputeShaderInvocations, &stats.computeShaderInvocations);
+
+        return stats;
+    }
+
+    // Copies results into a buffer on the GPU, e.g. as the predicate for conditional rendering
+    void copyResults(
+        vk::CommandBuffer command_buffer,
+        uint32_t first,
+        uint32_t count,
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        vk::QueryResultFlags flags=vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait
+    ) {
+        if(!supported()) return;
+
+        vk::DeviceSize valueSize = (flags & vk::QueryResultFlagBits::e64) ? sizeof(uint64_t) : sizeof(uint32_t);
+        vk::DeviceSize stride = valueSize * (valuesPerQuery() + ((flags & vk::QueryResultFlagBits::eWithAvailability) ? 1 : 0));
+
+        command_buffer.copyQueryPoolResults(v_query_pool, first, count, buffer, offset, stride, flags, *v_dispatcher);
+    }
+
+private:
+    void release() {
+        if(device) device->deletion_queue->push(v_query_pool);
+    }
+
+public:
+    Device *device = nullptr;
+
+    vk::QueryPool v_query_pool;
+    vk::QueryType type = vk::QueryType::eOcclusion;
+    uint32_t query_count = 0;
+    vk::QueryPipelineStatisticFlags statistics;
+
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
+};
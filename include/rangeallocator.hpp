@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <map>
+
+// First fit allocator of offsets into a fixed size range, e.g. a sub-range of a
+// buffer. Neighbouring free ranges are merged when freed. Does not own any memory.
+class RangeAllocator {
+public:
+    static constexpr uint64_t INVALID = std::numeric_limits<uint64_t>::max();
+
+    explicit RangeAllocator(uint64_t capacity);
+
+    // Offset of the reserved range, INVALID when no free range fits
+    uint64_t allocate(uint64_t size, uint64_t alignment=1);
+    // Returns a range exactly as it was allocated
+    void free(uint64_t offset, uint64_t size);
+
+    uint64_t capacity() const {
+        return range_capacity;
+    }
+
+    uint64_t used() const {
+        return range_used;
+    }
+
+    uint64_t largestFree() const;
+
+private:
+    uint64_t range_capacity;
+    uint64_t range_used = 0;
+
+    // Offset to size of every free range
+    std::map<uint64_t, uint64_t> free_ranges;
+};
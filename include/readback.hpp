@@ -0,0 +1,121 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Called with the copied bytes, which are only valid during the call
+using ReadbackCallback = std::function<void(const void *data, vk::DeviceSize size)>;
+
+struct ReadbackStats {
+    uint64_t requested = 0;
+    uint64_t completed = 0;
+    // Copies refused because the frame's buffer was full or still in flight
+    uint64_t dropped = 0;
+    uint64_t bytes = 0;
+};
+
+// Copies GPU data back to the host without stalling the pipeline.
+//
+// Every frame gets its own persistently mapped buffer out of a ring of
+// `frames_in_flight + 1`, preferring HOST_CACHED memory for fast CPU reads.
+// Copies are recorded into the caller's command buffer and tagged like handles
+// in the DeletionQueue, so results arrive `frames_in_flight + 1` frames later (or as
+// soon as the timeline value signals) when collect() runs their callbacks.
+//
+// Sources have to be synchronized for transfer reads by the caller, e.g. with a
+// BarrierBatcher. Recording and collect() must happen on the same thread.
+class ReadbackManager {
+public:
+    ReadbackManager(Device &device, vk::DeviceSize frame_capacity, vk::DispatchLoaderDynamic &dispatcher);
+    ~ReadbackManager();
+
+    ReadbackManager(const ReadbackManager&) = delete;
+    ReadbackManager &operator=(const ReadbackManager&) = delete;
+
+    // Returns false without recording anything when the copy does not fit into this frame
+    bool readBuffer(
+        vk::CommandBuffer command_buffer,
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        vk::DeviceSize size,
+        ReadbackCallback callback
+    );
+    bool readImage(
+        vk::CommandBuffer command_buffer,
+        vk::Image image,
+        vk::Format format,
+        vk::ImageLayout layout,
+        vk::ImageSubresourceLayers subresource,
+        vk::Offset3D offset,
+        vk::Extent3D extent,
+        ReadbackCallback callback
+    );
+
+    // Future variants, a dropped copy surfaces as an exception from get()
+    std::future<std::vector<uint8_t>> readBuffer(
+        vk::CommandBuffer command_buffer,
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        vk::DeviceSize size
+    );
+    std::future<std::vector<uint8_t>> readImage(
+        vk::CommandBuffer command_buffer,
+        vk::Image image,
+        vk::Format format,
+        vk::ImageLayout layout,
+        vk::ImageSubresourceLayers subresource,
+        vk::Offset3D offset,
+        vk::Extent3D extent
+    );
+
+    // Runs the callbacks of completed copies, oldest first. Pass `device_idle`
+    // after waiting for the device to also finish copies still counted as in flight.
+    void collect(bool device_idle=false);
+
+    const ReadbackStats &stats() const {
+        return readback_stats;
+    }
+
+public:
+    Device &device;
+
+    vk::DeviceSize frame_capacity;
+    // False when no HOST_CACHED memory type exists and coherent memory is used instead
+    bool host_cached;
+
+    vk::DispatchLoaderDynamic &v_dispatcher;
+
+private:
+    struct Request {
+        uint64_t retire_value;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        ReadbackCallback callback;
+    };
+
+    struct Slot {
+        Buffer buffer;
+        MemoryMap mapping;
+        // Frame the slot is filled for
+        uint64_t frame = UINT64_MAX;
+        vk::DeviceSize used = 0;
+        std::vector<Request> requests;
+    };
+
+    // Destination offset alignment for copies of `texel_size` byte texels
+    vk::DeviceSize copyAlignment(vk::DeviceSize texel_size) const;
+    // Claims `size` bytes in the current frame's slot, nullptr when it does not fit
+    Slot *allocate(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset);
+    void recordHostBarrier(vk::CommandBuffer command_buffer, Slot &slot, vk::DeviceSize offset, vk::DeviceSize size);
+
+    std::vector<Slot> slots;
+
+    ReadbackStats readback_stats;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "vkdevice.hpp"
+#include "vkrenderpass.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct RenderPassLayoutHash {
+    size_t operator()(const RenderPassLayout &layout) const {
+        return layout.hash();
+    }
+};
+
+// Render passes keyed by their attachment configuration.
+// Entries not requested for `max_unused_frames` frames are destroyed by Device::nextFrame.
+class RenderPassCache {
+public:
+    RenderPassCache(Device &device, uint32_t max_unused_frames=8);
+    ~RenderPassCache();
+
+    RenderPass &get(const RenderPassLayout &layout);
+
+    void evictUnused();
+    void clear();
+
+    size_t size() const {
+        return render_passes.size();
+    }
+
+public:
+    Device &device;
+
+    uint32_t max_unused_frames;
+
+private:
+    struct Entry {
+        // Map nodes are stable, so references handed out by get() stay valid until eviction
+        RenderPass render_pass;
+        uint64_t last_used;
+    };
+
+    std::unordered_map<RenderPassLayout, Entry, RenderPassLayoutHash> render_passes;
+};
+
+struct FramebufferAttachment {
+    vk::ImageView view;
+    // Must match the usage the image was created with (required by imageless framebuffers)
+    vk::ImageUsageFlags usage;
+};
+
+struct FramebufferKey {
+    vk::RenderPass renderPass;
+    vk::Extent2D extent;
+    uint32_t layers = 1;
+    bool imageless = false;
+
+    // Image views are only part of the key when imageless framebuffers are unavailable
+    std::vector<vk::ImageView> views;
+    std::vector<vk::ImageUsageFlags> usages;
+
+    bool operator==(const FramebufferKey &other) const {
+        return renderPass == other.renderPass &&
+            extent == other.extent &&
+            layers == other.layers &&
+            imageless == other.imageless &&
+            views == other.views &&
+            usages == other.usages;
+    }
+
+    size_t hash() const;
+};
+
+struct FramebufferKeyHash {
+    size_t operator()(const FramebufferKey &key) const {
+        return key.hash();
+    }
+};
+
+// Framebuffers keyed by render pass, extent and attachments.
+// When the device supports imageless framebuffers, image views are bound at
+// vkCmdBeginRenderPass time instead, so swapchain recreation at the same extent
+// reuses cached framebuffers.
+class FramebufferCache {
+public:
+    FramebufferCache(Device &device, uint32_t max_unused_frames=8);
+    ~FramebufferCache();
+
+    vk::Framebuffer get(
+        RenderPass &render_pass,
+        const std::vector<FramebufferAttachment> &attachments,
+        vk::Extent2D extent,
+        uint32_t layers=1
+    );
+
+    // Looks up the framebuffer and begins the render pass over the whole extent,
+    // chaining the attachment views when the framebuffer is imageless.
+    void beginRenderPass(
+        vk::CommandBuffer command_buffer,
+        RenderPass &render_pass,
+        const std::vector<FramebufferAttachment> &attachments,
+        vk::Extent2D extent,
+        const std::vector<vk::ClearValue> &clear_values,
+        vk::SubpassContents contents=vk::SubpassContents::eInline
+    );
+
+    // Destroys framebuffers referencing the view. Call before destroying the view.
+    void evictView(vk::ImageView view);
+
+    void evictUnused();
+    void clear();
+
+    size_t size() const {
+        return framebuffers.size();
+    }
+
+public:
+    Device &device;
+
+    uint32_t max_unused_frames;
+
+private:
+    struct Entry {
+        vk::Framebuffer v_framebuffer;
+        uint64_t last_used;
+    };
+
+    std::unordered_map<FramebufferKey, Entry, FramebufferKeyHash> framebuffers;
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "barriers.hpp"
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct GraphImageDesc {
+    vk::Format format = vk::Format::eUndefined;
+    vk::Extent2D extent;
+    vk::ImageUsageFlags usage;
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+    uint32_t mipLevels = 1;
+    uint32_t arrayLayers = 1;
+    vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor;
+};
+
+struct GraphBufferDesc {
+    vk::DeviceSize size = 0;
+    vk::BufferUsageFlags usage;
+};
+
+struct GraphResource {
+    uint32_t index = UINT32_MAX;
+
+    bool valid() const {
+        return index != UINT32_MAX;
+    }
+};
+
+class RenderGraph;
+
+class PassBuilder {
+public:
+    PassBuilder(RenderGraph &graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+    // Throws for a transient no pass declared so far writes, declaration order is the schedule
+    void read(GraphResource resource, ResourceUsage usage);
+    void write(GraphResource resource, ResourceUsage usage);
+
+    // Keeps the pass alive even if nothing reads its outputs
+    void sideEffect();
+
+private:
+    RenderGraph &graph;
+    uint32_t pass;
+};
+
+using PassExecute = std::function<void(vk::CommandBuffer, RenderGraph&)>;
+
+struct RenderGraphStats {
+    uint32_t passes = 0;
+    uint32_t culledPasses = 0;
+    uint32_t barrierBatches = 0;
+    uint32_t imageBarriers = 0;
+    uint32_t bufferBarriers = 0;
+    vk::DeviceSize transientBytes = 0;
+    // Bytes transient resources would have used without aliasing
+    vk::DeviceSize unaliasedBytes = 0;
+};
+
+// Frame graph over a single queue.
+// Passes declare the resources they read and write. compile() culls passes
+// whose results are never consumed, places the minimal set of barriers between
+// the remaining ones (one vkCmdPipelineBarrier2 per pass at most) and aliases
+// transient resources with disjoint lifetimes into shared memory.
+//
+// Transient memory is allocated once and reused by every frame. The first use of
+// a transient therefore waits for the previous frame's last accesses to the memory
+// it occupies, whether they came from the resource itself or from one aliasing it.
+// Imported resources are synchronized against their `initial` state instead.
+//
+// Passes run in the order they are declared, a pass may only read transients
+// written by itself or an earlier pass.
+//
+// Passes are declared once and compiled once. Imported resources (such as
+// swapchain images) can be rebound every frame with setImportedImage.
+// Transient resources released by recompiling go through the device's deletion
+// queue, so frames still in flight keep using them safely.
+class RenderGraph {
+public:
+    RenderGraph(Device &device);
+    ~RenderGraph();
+
+    GraphResource createImage(const std::string &name, const GraphImageDesc &desc);
+    GraphResource createBuffer(const std::string &name, const GraphBufferDesc &desc);
+
+    // `initial` is the state the image is in before the graph runs. For a freshly
+    // acquired swapchain image use the stage the acquire semaphore waits on.
+    // `final` is transitioned to after the last pass and marks the image as a graph output.
+    GraphResource importImage(
+        const std::string &name,
+        vk::Image image,
+        vk::ImageView view,
+        const GraphImageDesc &desc,
+        ResourceState initial=ResourceState(),
+        std::optional<ResourceUsage> final=std::nullopt
+    );
+    GraphResource importBuffer(
+        const std::string &name,
+        vk::Buffer buffer,
+        vk::DeviceSize size,
+        ResourceState initial=ResourceState(),
+        bool output=false
+    );
+
+    void setImportedImage(GraphResource resource, vk::Image image, vk::ImageView view);
+    void setImportedBuffer(GraphResource resource, vk::Buffer buffer);
+
+    void addPass(
+        const std::string &name,
+        const std::function<void(PassBuilder&)> &setup,
+        PassExecute execute
+    );
+
+    void compile();
+    void execute(vk::CommandBuffer command_buffer);
+
+    // Removes all passes and resources, destroying transient memory
+    void reset();
+
+    vk::Image image(GraphResource resource) const;
+    vk::ImageView imageView(GraphResource resource) const;
+    vk::Buffer buffer(GraphResource resource) const;
+
+    const RenderGraphStats &stats() const {
+        return graph_stats;
+    }
+
+private:
+    friend class PassBuilder;
+
+    struct Access {
+        uint32_t resource;
+        ResourceUsage usage;
+        bool write;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<Access> accesses;
+        PassExecute execute;
+        bool side_effect = false;
+        bool culled = false;
+    };
+
+    struct Resource {
+        std::string name;
+        bool is_image;
+        bool imported;
+        bool output = false;
+
+        GraphImageDesc image_desc;
+        GraphBufferDesc buffer_desc;
+
+        ResourceState initial;
+        std::optional<ResourceUsage> final_usage;
+
+        vk::Image v_image;
+        vk::ImageView v_image_view;
+        vk::Buffer v_buffer;
+
+        // Lifetime within the compiled schedule
+        uint32_t first_use = UINT32_MAX;
+        uint32_t last_use = 0;
+
+        // Transient memory placement
+        uint32_t heap = UINT32_MAX;
+        vk::DeviceSize offset = 0;
+        vk::MemoryRequirements requirements;
+        // Resource that previously occupied overlapping memory
+        std::optional<uint32_t> alias_of;
+    };
+
+    struct Barrier {
+        uint32_t resource;
+        StateTransition transition;
+    };
+
+    struct Heap {
+        vk::DeviceMemory v_memory;
+        vk::DeviceSize size = 0;
+        uint32_t memory_type_bits = ~0u;
+        // Buffers and optimal images never share a heap, so bufferImageGranularity
+        // cannot put them on the same page
+        bool images = false;
+    };
+
+    void cull();
+    void computeLifetimes();
+    void allocateTransients();
+    void buildBarriers();
+    // Walks the schedule once, seeding the first use of each transient with
+    // `carried` (or nothing when empty). Returns the states after the last pass.
+    std::vector<SubresourceState> placeBarriers(const std::vector<SubresourceState> &carried);
+    void destroyTransients();
+
+    void emitBarriers(vk::CommandBuffer command_buffer, const std::vector<Barrier> &barriers);
+
+public:
+    Device &device;
+
+private:
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    std::vector<Heap> heaps;
+
+    // Barriers emitted before each pass, indexed by pass; plus the trailing batch
+    std::vector<std::vector<Barrier>> pass_barriers;
+    std::vector<Barrier> final_barriers;
+
+    bool compiled = false;
+
+    RenderGraphStats graph_stats;
+};
@@ -2,48 +2,85 @@
 
 #include <cstdint>
 #include <string>
+#include <utility>
 
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
+#include "deletionqueue.hpp"
 #include "fileutil.hpp"
 #include "vkdevice.hpp"
 
 class Shader {
 public:
+    Shader() = default;
+
     Shader(
         Device &device,
         const std::string &path,
         vk::ShaderStageFlagBits stage,
-        vk::DispatchLoaderDynamic dispatcher,
+        vk::DispatchLoaderDynamic &dispatcher,
         const std::string &entrypoint = "main"
-    ) : device(device), v_dispatcher(dispatcher) {
+    ) : device(&device), entrypoint(entrypoint), v_dispatcher(&dispatcher) {
         std::vector<uint8_t> code = utils::readFileBinary(path);
 
         auto shaderInfo = vk::ShaderModuleCreateInfo()
             .setPCode(reinterpret_cast<const uint32_t*>(code.data()))
             .setCodeSize(code.size());
-        
-        v_shader = device.v_device.createShaderModule(shaderInfo, nullptr, v_dispatcher);
+
+        v_shader = device.v_device.createShaderModule(shaderInfo, nullptr, *v_dispatcher);
 
         v_stage_info = vk::PipelineShaderStageCreateInfo()
             .setStage(stage)
             .setModule(v_shader)
-            .setPName(entrypoint.c_str());
+            .setPName(this->entrypoint.c_str());
+    }
+
+    Shader(const Shader&) = delete;
+    Shader &operator=(const Shader&) = delete;
+
+    Shader(Shader &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_shader(std::exchange(other.v_shader, nullptr)),
+      entrypoint(std::move(other.entrypoint)),
+      v_stage_info(std::exchange(other.v_stage_info, vk::PipelineShaderStageCreateInfo())),
+      v_dispatcher(other.v_dispatcher)
+    {
+        v_stage_info.setPName(entrypoint.c_str());
+    }
+
+    Shader &operator=(Shader &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            v_shader = std::exchange(other.v_shader, nullptr);
+            entrypoint = std::move(other.entrypoint);
+            v_stage_info = std::exchange(other.v_stage_info, vk::PipelineShaderStageCreateInfo());
+            v_stage_info.setPName(entrypoint.c_str());
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
     }
 
     ~Shader() {
-        device.v_device.destroyShaderModule(v_shader, nullptr, v_dispatcher);
+        release();
     }
 
     vk::PipelineShaderStageCreateInfo operator*() {
         return v_stage_info;
     }
 
+private:
+    void release() {
+        if(device) device->deletion_queue->push(v_shader);
+    }
+
 public:
-    Device &device;
+    Device *device = nullptr;
 
     vk::ShaderModule v_shader;
+    // Owned here so v_stage_info.pName outlives the caller's string
+    std::string entrypoint;
     vk::PipelineShaderStageCreateInfo v_stage_info;
-    vk::DispatchLoaderDynamic v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
 };
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Head and tail live on separate cache lines so both sides do not contend.
+template<typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two.");
+
+public:
+    // Producer side, false when the queue is full
+    bool push(T value) {
+        size_t head = write_position.load(std::memory_order_relaxed);
+
+        if(head - read_position.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+
+        items[head & (Capacity - 1)] = std::move(value);
+        write_position.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Consumer side, false when the queue is empty
+    bool pop(T &value) {
+        size_t tail = read_position.load(std::memory_order_relaxed);
+
+        if(tail == write_position.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        value = std::move(items[tail & (Capacity - 1)]);
+        read_position.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Only a snapshot when called while the other side is active
+    bool empty() const {
+        return read_position.load(std::memory_order_acquire) == write_position.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> write_position {0};
+    alignas(64) std::atomic<size_t> read_position {0};
+
+    std::array<T, Capacity> items {};
+};
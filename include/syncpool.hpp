@@ -0,0 +1,92 @@
+#pragma once
+
+#include "vkdevice.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct SyncPoolStats {
+    // Handed out and not yet released
+    uint32_t live = 0;
+    // Released and waiting for reuse
+    uint32_t pooled = 0;
+    uint32_t created = 0;
+};
+
+// Recycles fences instead of creating one per submission.
+// Released fences are reset together with a single vkResetFences call, either
+// when the pool runs dry or on Device::nextFrame. Only release a fence once it
+// signaled or if it was never submitted.
+class FencePool {
+public:
+    FencePool(Device &device, uint32_t grow_by=4);
+    ~FencePool();
+
+    FencePool(const FencePool&) = delete;
+    FencePool &operator=(const FencePool&) = delete;
+
+    // Returns an unsignaled fence
+    vk::Fence acquire();
+    void release(vk::Fence fence);
+
+    // Resets every released fence in one call
+    void collect();
+
+    SyncPoolStats stats();
+
+public:
+    Device &device;
+
+    uint32_t grow_by;
+
+private:
+    void resetPending();
+
+    std::mutex mutex;
+
+    std::vector<vk::Fence> fences;
+    std::vector<vk::Fence> free;
+    std::vector<vk::Fence> pending_reset;
+};
+
+// Recycles binary semaphores.
+// A binary semaphore cannot be reset, so a released semaphore is only reused
+// once Device::nextFrame has been called `frames_in_flight` times, by which
+// point the wait that consumed its signal has completed.
+class SemaphorePool {
+public:
+    SemaphorePool(Device &device, uint32_t grow_by=4);
+    ~SemaphorePool();
+
+    SemaphorePool(const SemaphorePool&) = delete;
+    SemaphorePool &operator=(const SemaphorePool&) = delete;
+
+    vk::Semaphore acquire();
+    void release(vk::Semaphore semaphore);
+
+    // Returns semaphores released `frames_in_flight` frames ago to the free list
+    void collect();
+
+    SyncPoolStats stats();
+
+public:
+    Device &device;
+
+    uint32_t grow_by;
+
+private:
+    struct Pending {
+        vk::Semaphore semaphore;
+        uint64_t reusable_frame;
+    };
+
+    std::mutex mutex;
+
+    std::vector<vk::Semaphore> semaphores;
+    std::vector<vk::Semaphore> free;
+    std::deque<Pending> pending;
+};
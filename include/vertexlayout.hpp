@@ -0,0 +1,107 @@
+#pragma once
+
+#include "formatutil.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Attributes of one vertex buffer binding, packed in the order they are added
+class VertexLayout {
+public:
+    struct Attribute {
+        uint32_t location;
+        vk::Format format;
+        uint32_t offset;
+    };
+
+    VertexLayout &attribute(uint32_t location, vk::Format format) {
+        attributes.push_back(Attribute {
+            .location = location,
+            .format = format,
+            .offset = vertex_stride,
+        });
+        vertex_stride += utils::formatSize(format);
+
+        return *this;
+    }
+
+    uint32_t stride() const {
+        return vertex_stride;
+    }
+
+    // 32 byte position, normal and uv at locations 0, 1 and 2
+    static VertexLayout standard() {
+        return VertexLayout()
+            .attribute(0, vk::Format::eR32G32B32Sfloat)
+            .attribute(1, vk::Format::eR32G32B32Sfloat)
+            .attribute(2, vk::Format::eR32G32Sfloat);
+    }
+
+    // 16 byte utils::QuantizedVertex: snorm16 position relative to the mesh bounds,
+    // octahedral snorm16 normal and half float uv
+    static VertexLayout quantized() {
+        return VertexLayout()
+            .attribute(0, vk::Format::eR16G16B16A16Snorm)
+            .attribute(1, vk::Format::eR16G16Snorm)
+            .attribute(2, vk::Format::eR16G16Sfloat);
+    }
+
+public:
+    std::vector<Attribute> attributes;
+
+private:
+    uint32_t vertex_stride = 0;
+};
+
+// Pipeline vertex input built from one layout per binding, e.g.
+//
+//     VertexInputState input;
+//     input.binding(VertexLayout::quantized())
+//          .binding(instanceLayout, vk::VertexInputRate::eInstance);
+//     pipelineInfo.setPVertexInputState(&input.info());
+//
+// The create info points into this object, keep it alive until the pipeline exists.
+class VertexInputState {
+public:
+    VertexInputState() = default;
+
+    VertexInputState(const VertexInputState&) = delete;
+    VertexInputState &operator=(const VertexInputState&) = delete;
+
+    VertexInputState &binding(const VertexLayout &layout, vk::VertexInputRate rate=vk::VertexInputRate::eVertex) {
+        uint32_t binding = static_cast<uint32_t>(bindings.size());
+
+        bindings.push_back(vk::VertexInputBindingDescription()
+            .setBinding(binding)
+            .setStride(layout.stride())
+            .setInputRate(rate)
+        );
+
+        for(auto &attribute : layout.attributes) {
+            attributes.push_back(vk::VertexInputAttributeDescription()
+                .setLocation(attribute.location)
+                .setBinding(binding)
+                .setFormat(attribute.format)
+                .setOffset(attribute.offset)
+            );
+        }
+
+        create_info = vk::PipelineVertexInputStateCreateInfo()
+            .setVertexBindingDescriptions(bindings)
+            .setVertexAttributeDescriptions(attributes);
+
+        return *this;
+    }
+
+    const vk::PipelineVertexInputStateCreateInfo &info() const {
+        return create_info;
+    }
+
+private:
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+
+    vk::PipelineVertexInputStateCreateInfo create_info;
+};
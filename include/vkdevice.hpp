@@ -2,9 +2,14 @@
 
 #include "log.hpp"
 #include "validation.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <set>
 #include <stdexcept>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 #ifndef __MACH__
 #include <vulkan/vulkan_enums.hpp>
@@ -14,18 +19,25 @@
 
 struct QueueFamilyIndices {
     uint32_t graphics;
+    // Same as graphics when the device was created without a surface
     uint32_t present;
 
     bool ready = false;
+    bool presentable = false;
 
     QueueFamilyIndices() {}
 
-    QueueFamilyIndices(vk::PhysicalDevice &device, vk::SurfaceKHR &surface, vk::DispatchLoaderDynamic &v_dispatcher) {
+    // A null surface skips the present family lookup, for headless devices.
+    // `properties` are the device's queue family properties.
+    QueueFamilyIndices(
+        vk::PhysicalDevice &device,
+        const std::vector<vk::QueueFamilyProperties> &properties,
+        vk::SurfaceKHR surface,
+        vk::DispatchLoaderDynamic &v_dispatcher
+    ) {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
 
-        auto properties = device.getQueueFamilyProperties(v_dispatcher);
-
         vk::Bool32 presentSupport = vk::False;
 
         for(uint32_t i = 0; i < properties.size(); i++) {
@@ -34,12 +46,14 @@ struct QueueFamilyIndices {
                 graphicsFamily = i;
             }
 
-            presentSupport = device.getSurfaceSupportKHR(i, surface, v_dispatcher);
-            if(!presentFamily.has_value() && presentSupport) {
-                presentFamily = i;
+            if(surface) {
+                presentSupport = device.getSurfaceSupportKHR(i, surface, v_dispatcher);
+                if(!presentFamily.has_value() && presentSupport) {
+                    presentFamily = i;
+                }
             }
 
-            if(graphicsFamily.has_value() && presentFamily.has_value())
+            if(graphicsFamily.has_value() && (presentFamily.has_value() || !surface))
                 break;
         }
 
@@ -47,97 +61,99 @@ struct QueueFamilyIndices {
             THROW(runtime_error, "Failed to find graphics queue family!");
         }
 
-        if(!presentFamily.has_value()) {
+        if(surface && !presentFamily.has_value()) {
             THROW(runtime_error, "Failed to find present queue family!");
         }
 
         graphics = *graphicsFamily;
-        present = *presentFamily;
+        present = presentFamily.value_or(graphics);
 
+        presentable = presentFamily.has_value();
         ready = true;
     }
 };
 
-class Device {
-public:
-    Device(
-        vk::Instance &instance,
-        vk::SurfaceKHR &surface,
-        vk::PhysicalDeviceFeatures requestedFeatures,
-        const std::vector<const char*> &requestedExtensions,
-        vk::DispatchLoaderDynamic &v_dispatcher
-    ) : v_dispatcher(v_dispatcher) {
-        auto physical_devices = instance.enumeratePhysicalDevices(v_dispatcher);
-
-        vk::Optional<vk::PhysicalDevice> chosenDevice = nullptr;
-
-        for(auto &device : physical_devices) {
-            auto features = device.getFeatures(v_dispatcher);
-
-            // TODO: Implement feature check
-
-            std::set<std::string> requiredExtensions(requestedExtensions.begin(), requestedExtensions.end());
-
-            for(auto &availableExtension : 
-                device.enumerateDeviceExtensionProperties(nullptr, v_dispatcher))
-            {
-                requiredExtensions.erase(availableExtension.extensionName);
-            }
-
-            if(requiredExtensions.empty()) {
-                chosenDevice = device;
-                break;
-            }
-        }
-
-        if(chosenDevice == nullptr) {
-            THROW(runtime_error, "Failed to find device with requested Vulkan features!");
-        }
-
-        v_physical_device = *chosenDevice;
-
-        queue_family_indices = QueueFamilyIndices(v_physical_device, surface, v_dispatcher);
-
-        std::set<uint32_t> uniqueQueueFamilies = {
-            queue_family_indices.graphics,
-            queue_family_indices.present,
-        };
-        std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+// Optional device features svklib enables when the physical device supports them
+struct DeviceCapabilities {
+    bool imagelessFramebuffer = false;
+    bool synchronization2 = false;
+    bool timelineSemaphore = false;
+    bool pipelineStatisticsQuery = false;
+    bool occlusionQueryPrecise = false;
+    // Several commands per indirect draw call, and non-zero firstInstance in those commands
+    bool multiDrawIndirect = false;
+    bool drawIndirectFirstInstance = false;
+    // Draw counts read from a buffer, Vulkan 1.2
+    bool drawIndirectCount = false;
+    // Buffer::deviceAddress for buffers created with eShaderDeviceAddress usage, Vulkan 1.2
+    bool bufferDeviceAddress = false;
+    // VK_KHR_present_id and VK_KHR_present_wait, only enabled along with VK_KHR_swapchain
+    bool presentWait = false;
+    // VK_EXT_memory_budget, heap budgets and usage reported by the driver
+    bool memoryBudget = false;
+    // VK_EXT_memory_priority, and VK_EXT_pageable_device_local_memory to change priorities later
+    bool memoryPriority = false;
+    bool pageableDeviceLocalMemory = false;
+};
 
-        for(auto queueFamily : uniqueQueueFamilies) {
-            const std::vector<float> queuePriorities = {1.0f};
-            auto queueInfo = vk::DeviceQueueCreateInfo()
-                .setQueueFamilyIndex(queueFamily)
-                .setQueuePriorities(queuePriorities)
-                .setQueueCount(1);
-            queueCreateInfos.push_back(queueInfo);
-        }
+// How the CPU and the GPU access an allocation, see Device::memoryType
+enum class MemoryUsage {
+    // Only touched by the GPU
+    GpuOnly,
+    // Written once by the CPU and read by the GPU, e.g. staging buffers
+    Upload,
+    // Written by the GPU and read by the CPU
+    Readback,
+    // Rewritten by the CPU every frame, device local when such memory is mappable
+    Dynamic,
+};
 
-        auto deviceInfo = vk::DeviceCreateInfo()
-            .setQueueCreateInfos(queueCreateInfos)
-            .setPEnabledExtensionNames(requestedExtensions)
-            .setPEnabledFeatures(&requestedFeatures);
-        
-        if(Validation::enableValidationLayers) {
-            deviceInfo = deviceInfo.setPEnabledLayerNames(Validation::validationLayers);
-        }
+constexpr size_t MEMORY_USAGE_COUNT = static_cast<size_t>(MemoryUsage::Dynamic) + 1;
 
-        v_device = v_physical_device.createDevice(deviceInfo, nullptr, v_dispatcher);
-        LOG_DEBUG("Created Vulkan device for {}.", v_physical_device.getProperties(v_dispatcher).deviceName.data());
+// Physical device properties and supported features, queried once when the device is created
+struct DeviceProperties {
+    vk::PhysicalDeviceProperties core;
+    // Left zeroed when the device implements an older Vulkan version
+    vk::PhysicalDeviceVulkan11Properties vulkan11;
+    vk::PhysicalDeviceVulkan12Properties vulkan12;
+    vk::PhysicalDeviceVulkan13Properties vulkan13;
 
-        v_dispatcher.init(v_device);
+    vk::PhysicalDeviceFeatures features;
+    vk::PhysicalDeviceVulkan12Features features12;
+    vk::PhysicalDeviceVulkan13Features features13;
 
-        v_queue = v_device.getQueue(queue_family_indices.graphics, 0, v_dispatcher);
-        LOG_DEBUG("Created graphics queue.");
+    vk::PhysicalDeviceMemoryProperties memory;
+    std::vector<vk::QueueFamilyProperties> queue_families;
 
-        v_present_queue = v_device.getQueue(queue_family_indices.present, 0, v_dispatcher);
-        LOG_DEBUG("Created present queue.");
+    const vk::PhysicalDeviceLimits &limits() const {
+        return core.limits;
     }
 
-    ~Device() {
-        LOG_DEBUG("Destroyed Vulkan device for {}.", v_physical_device.getProperties(v_dispatcher).deviceName.data());
-        v_device.destroy(nullptr, v_dispatcher);
+    const char *name() const {
+        return core.deviceName.data();
     }
+};
+
+class RenderPassCache;
+class FramebufferCache;
+class ResourceStateTracker;
+class DeletionQueue;
+class MemoryTracker;
+class FencePool;
+class SemaphorePool;
+class JobSystem;
+
+class Device {
+public:
+    // Pass a null surface for a headless device without a present queue
+    Device(
+        vk::Instance &instance,
+        vk::SurfaceKHR surface,
+        vk::PhysicalDeviceFeatures requestedFeatures,
+        const std::vector<const char*> &requestedExtensions,
+        vk::DispatchLoaderDynamic &v_dispatcher
+    );
+    ~Device();
 
     vk::Device operator*() {
         return v_device;
@@ -147,14 +163,52 @@ public:
         return &v_device;
     }
 
+    // Call right after submitting a frame. Evicts cached objects that went unused,
+    // recycles pooled sync objects and destroys handles released `frames_in_flight + 1`
+    // frames ago, whose fence the application has waited on by now
+    void nextFrame();
+
+    // Best memory type among `type_bits` for the usage, nullopt when none qualifies
+    std::optional<uint32_t> memoryType(uint32_t type_bits, MemoryUsage usage) const;
+
 public:
     vk::Device v_device;
     vk::PhysicalDevice v_physical_device;
 
     QueueFamilyIndices queue_family_indices;
+    DeviceCapabilities capabilities;
+    DeviceProperties properties;
+
+    // Qualifying memory types per MemoryUsage, best first
+    std::array<std::vector<uint32_t>, MEMORY_USAGE_COUNT> memory_type_ranking;
 
     vk::Queue v_queue;
+    // Aliases v_queue on headless devices
     vk::Queue v_present_queue;
 
     vk::DispatchLoaderDynamic &v_dispatcher;
+
+    // Advanced by nextFrame on the render thread, read by other threads (e.g. DeletionQueue::push)
+    std::atomic<uint64_t> frame_index {0};
+    // Frames the application lets the GPU work on before waiting on a fence
+    uint32_t frames_in_flight = 2;
+
+    // Allocates and accounts device memory. Declared before the deletion queue so it
+    // outlives it, the queue frees device memory through the tracker.
+    std::unique_ptr<MemoryTracker> memory;
+
+    // Destroyed after every other subsystem, which may still release handles into it
+    std::unique_ptr<DeletionQueue> deletion_queue;
+
+    std::unique_ptr<RenderPassCache> render_pass_cache;
+    std::unique_ptr<FramebufferCache> framebuffer_cache;
+
+    // Layout and access state of images and buffers registered by their wrappers
+    std::unique_ptr<ResourceStateTracker> resource_states;
+
+    std::unique_ptr<FencePool> fence_pool;
+    std::unique_ptr<SemaphorePool> semaphore_pool;
+
+    // Worker threads shared by every subsystem instead of each spawning its own
+    std::unique_ptr<JobSystem> jobs;
 };
@@ -1,34 +1,61 @@
 #pragma once
 
+#include "deletionqueue.hpp"
 #include "vkdevice.hpp"
+#include <utility>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
 
 class Fence {
 public:
-    Fence(Device &device, bool signaled, vk::DispatchLoaderDynamic dispatcher) 
-    : device(device), v_dispatcher(dispatcher) {
+    Fence() = default;
+
+    Fence(Device &device, bool signaled, vk::DispatchLoaderDynamic &dispatcher)
+    : device(&device), v_dispatcher(&dispatcher) {
         v_fence = device.v_device.createFence(
             vk::FenceCreateInfo().setFlags(
                 signaled ? vk::FenceCreateFlagBits::eSignaled :
                 vk::FenceCreateFlagBits()
             ),
             nullptr,
-            v_dispatcher
+            *v_dispatcher
         );
     }
 
+    Fence(const Fence&) = delete;
+    Fence &operator=(const Fence&) = delete;
+
+    Fence(Fence &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_fence(std::exchange(other.v_fence, nullptr)),
+      v_dispatcher(other.v_dispatcher) {}
+
+    Fence &operator=(Fence &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            v_fence = std::exchange(other.v_fence, nullptr);
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
+    }
+
     ~Fence() {
-        device.v_device.destroyFence(v_fence, nullptr, v_dispatcher);
+        release();
     }
 
     vk::Fence operator*() {
         return v_fence;
     }
 
+private:
+    void release() {
+        if(device) device->deletion_queue->push(v_fence);
+    }
+
 public:
-    Device &device;
+    Device *device = nullptr;
 
     vk::Fence v_fence;
-    vk::DispatchLoaderDynamic v_dispatcher;
-};
\ No newline at end of file
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
+};
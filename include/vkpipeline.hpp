@@ -1,5 +1,6 @@
 #pragma once
 
+#include "deletionqueue.hpp"
 #include "log.hpp"
 #include "shader.hpp"
 #include "vkdevice.hpp"
@@ -7,6 +8,7 @@
 #include <array>
 #include <cassert>
 #include <stdexcept>
+#include <utility>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_structs.hpp>
 #include <vulkan/vulkan_to_string.hpp>
@@ -16,6 +18,8 @@
 
 class Pipeline {
 public:
+    Pipeline() = default;
+
     // TODO: Separate pipeline layout
     Pipeline(
         Device &device,
@@ -24,7 +28,7 @@ public:
         vk::PipelineLayoutCreateInfo layout_info,
         vk::GraphicsPipelineCreateInfo pipeline_info,
         vk::DispatchLoaderDynamic &dispatcher
-    ): device(device), render_pass(render_pass), v_dispatcher(dispatcher) {
+    ): device(&device), v_dispatcher(&dispatcher) {
         std::array<vk::DynamicState, 2> dynamicStates = {
             vk::DynamicState::eScissor,
             vk::DynamicState::eViewport
@@ -33,7 +37,7 @@ public:
         auto dynamicStateInfo = vk::PipelineDynamicStateCreateInfo()
             .setDynamicStates(dynamicStates);
 
-        v_layout = device.v_device.createPipelineLayout(layout_info);
+        v_layout = device.v_device.createPipelineLayout(layout_info, nullptr, *v_dispatcher);
 
         // Mandatory pipeline info:
         // - blend
@@ -54,7 +58,7 @@ public:
             ).setStages(shader_stages)
             .setPDynamicState(&dynamicStateInfo);
 
-        auto result = device.v_device.createGraphicsPipeline(nullptr, pipeline_info, nullptr, v_dispatcher);
+        auto result = device.v_device.createGraphicsPipeline(nullptr, pipeline_info, nullptr, *v_dispatcher);
 
         if(result.result != vk::Result::eSuccess && result.result != vk::Result::ePipelineCompileRequiredEXT) {
             THROW(runtime_error, "Failed to create graphics pipeline: {}",
@@ -66,33 +70,80 @@ public:
         LOG_DEBUG("Created GraphicsPipeline.");
     }
 
+    // Compute pipeline, the stage of `info` is taken from the shader
     Pipeline(
         Device &device,
-        RenderPass &render_pass,
-        const std::vector<Shader> &shader_stages,
+        Shader &shader,
         vk::PipelineLayoutCreateInfo layout_info,
         vk::ComputePipelineCreateInfo info,
         vk::DispatchLoaderDynamic &dispatcher
-    ): device(device), render_pass(render_pass), v_dispatcher(dispatcher) {
-        assert(0 && "Not yet implemented.");
+    ): device(&device), bind_point(vk::PipelineBindPoint::eCompute), v_dispatcher(&dispatcher) {
+        v_layout = device.v_device.createPipelineLayout(layout_info, nullptr, *v_dispatcher);
+
+        info = info.setLayout(v_layout)
+            .setStage(shader.v_stage_info);
+
+        auto result = device.v_device.createComputePipeline(nullptr, info, nullptr, *v_dispatcher);
+
+        if(result.result != vk::Result::eSuccess && result.result != vk::Result::ePipelineCompileRequiredEXT) {
+            THROW(runtime_error, "Failed to create compute pipeline: {}",
+                vk::to_string(result.result)
+            );
+        }
+
+        v_pipeline = result.value;
+        LOG_DEBUG("Created ComputePipeline.");
     }
 
-    ~Pipeline() {
-        device.v_device.destroyPipelineLayout(v_layout, nullptr, v_dispatcher);
-        device.v_device.destroyPipeline(v_pipeline, nullptr, v_dispatcher);
+    Pipeline(const Pipeline&) = delete;
+    Pipeline &operator=(const Pipeline&) = delete;
 
-        LOG_DEBUG("Destroy Pipeline");
+    Pipeline(Pipeline &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      bind_point(other.bind_point),
+      v_layout(std::exchange(other.v_layout, nullptr)),
+      v_pipeline(std::exchange(other.v_pipeline, nullptr)),
+      v_dispatcher(other.v_dispatcher) {}
+
+    Pipeline &operator=(Pipeline &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            bind_point = other.bind_point;
+            v_layout = std::exchange(other.v_layout, nullptr);
+            v_pipeline = std::exchange(other.v_pipeline, nullptr);
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
+    }
+
+    ~Pipeline() {
+        release();
     }
 
     vk::Pipeline operator*() {
         return v_pipeline;
     }
 
+    void bind(vk::CommandBuffer command_buffer) {
+        command_buffer.bindPipeline(bind_point, v_pipeline, *v_dispatcher);
+    }
+
+private:
+    void release() {
+        if(!device) return;
+
+        device->deletion_queue->push(v_layout);
+        device->deletion_queue->push(v_pipeline);
+
+        LOG_DEBUG("Destroy Pipeline");
+    }
+
 public:
-    Device &device;
-    RenderPass &render_pass;
+    Device *device = nullptr;
+    vk::PipelineBindPoint bind_point = vk::PipelineBindPoint::eGraphics;
 
     vk::PipelineLayout v_layout;
     vk::Pipeline v_pipeline;
-    vk::DispatchLoaderDynamic &v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
 };
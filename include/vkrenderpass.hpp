@@ -1,16 +1,107 @@
 #pragma once
 
+#include "deletionqueue.hpp"
+#include "hashutil.hpp"
+#include "log.hpp"
 #include "vkdevice.hpp"
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
+struct AttachmentInfo {
+    vk::Format format = vk::Format::eUndefined;
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+    vk::AttachmentLoadOp loadOp = vk::AttachmentLoadOp::eClear;
+    vk::AttachmentStoreOp storeOp = vk::AttachmentStoreOp::eStore;
+    vk::AttachmentLoadOp stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    vk::AttachmentStoreOp stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined;
+    // eUndefined picks the attachment optimal layout for the attachment kind
+    vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined;
+
+    vk::AttachmentDescription describe(vk::ImageLayout attachmentLayout) const {
+        return vk::AttachmentDescription()
+            .setFormat(format)
+            .setSamples(samples)
+            .setLoadOp(loadOp)
+            .setStoreOp(storeOp)
+            .setStencilLoadOp(stencilLoadOp)
+            .setStencilStoreOp(stencilStoreOp)
+            .setInitialLayout(initialLayout)
+            .setFinalLayout(finalLayout == vk::ImageLayout::eUndefined ? attachmentLayout : finalLayout);
+    }
+
+    bool operator==(const AttachmentInfo &other) const {
+        return std::tie(format, samples, loadOp, storeOp, stencilLoadOp, stencilStoreOp, initialLayout, finalLayout) ==
+            std::tie(other.format, other.samples, other.loadOp, other.storeOp,
+                other.stencilLoadOp, other.stencilStoreOp, other.initialLayout, other.finalLayout);
+    }
+
+    size_t hash() const {
+        size_t seed = 0;
+        utils::hashCombine(seed, format);
+        utils::hashCombine(seed, samples);
+        utils::hashCombine(seed, loadOp);
+        utils::hashCombine(seed, storeOp);
+        utils::hashCombine(seed, stencilLoadOp);
+        utils::hashCombine(seed, stencilStoreOp);
+        utils::hashCombine(seed, initialLayout);
+        utils::hashCombine(seed, finalLayout);
+        return seed;
+    }
+};
+
+// Attachments of a single subpass render pass. Attachment indices are laid out
+// as color attachments, then resolve attachments, then the depth attachment.
+struct RenderPassLayout {
+    std::vector<AttachmentInfo> colorAttachments;
+    // Either empty or one resolve target per color attachment
+    std::vector<AttachmentInfo> resolveAttachments;
+    std::optional<AttachmentInfo> depthAttachment;
+
+    size_t attachmentCount() const {
+        return colorAttachments.size() + resolveAttachments.size() + (depthAttachment.has_value() ? 1 : 0);
+    }
+
+    std::vector<vk::Format> attachmentFormats() const {
+        std::vector<vk::Format> formats;
+        formats.reserve(attachmentCount());
+
+        for(auto &attachment : colorAttachments) formats.push_back(attachment.format);
+        for(auto &attachment : resolveAttachments) formats.push_back(attachment.format);
+        if(depthAttachment.has_value()) formats.push_back(depthAttachment->format);
+
+        return formats;
+    }
+
+    bool operator==(const RenderPassLayout &other) const {
+        return colorAttachments == other.colorAttachments &&
+            resolveAttachments == other.resolveAttachments &&
+            depthAttachment == other.depthAttachment;
+    }
+
+    size_t hash() const {
+        size_t seed = attachmentCount();
+        for(auto &attachment : colorAttachments) utils::hashCombine(seed, attachment.hash());
+        for(auto &attachment : resolveAttachments) utils::hashCombine(seed, attachment.hash());
+        if(depthAttachment.has_value()) utils::hashCombine(seed, depthAttachment->hash());
+        return seed;
+    }
+};
+
 class RenderPass {
 public:
+    RenderPass() = default;
+
     RenderPass(
         Device &device,
         vk::Format format,
         vk::RenderPassCreateInfo renderPassInfo,
-        vk::DispatchLoaderDynamic dispatcher
-    ) : device(device), v_dispatcher(dispatcher) {
+        vk::DispatchLoaderDynamic &dispatcher
+    ) : device(&device), v_dispatcher(&dispatcher) {
         // Default color attachment at 0
         auto color_attachment = vk::AttachmentDescription()
             .setFinalLayout(vk::ImageLayout::ePresentSrcKHR)
@@ -48,20 +139,129 @@ public:
             .setAttachments(color_attachment)
             .setDependencies(dep);
 
-        v_render_pass = device.v_device.createRenderPass(renderPassInfo);
+        v_render_pass = device.v_device.createRenderPass(renderPassInfo, nullptr, *v_dispatcher);
+
+        layout.colorAttachments.push_back(AttachmentInfo {
+            .format = format,
+            .finalLayout = vk::ImageLayout::ePresentSrcKHR,
+        });
+    }
+
+    RenderPass(
+        Device &device,
+        const RenderPassLayout &layout,
+        vk::DispatchLoaderDynamic &dispatcher
+    ) : device(&device), layout(layout), v_dispatcher(&dispatcher) {
+        if(!layout.resolveAttachments.empty() &&
+            layout.resolveAttachments.size() != layout.colorAttachments.size())
+        {
+            THROW(runtime_error, "Render pass has {} resolve attachments for {} color attachments.",
+                layout.resolveAttachments.size(), layout.colorAttachments.size()
+            );
+        }
+
+        std::vector<vk::AttachmentDescription> attachments;
+        std::vector<vk::AttachmentReference> colorRefs;
+        std::vector<vk::AttachmentReference> resolveRefs;
+        vk::AttachmentReference depthRef;
+
+        attachments.reserve(layout.attachmentCount());
+
+        for(auto &color : layout.colorAttachments) {
+            colorRefs.push_back(vk::AttachmentReference()
+                .setAttachment(static_cast<uint32_t>(attachments.size()))
+                .setLayout(vk::ImageLayout::eColorAttachmentOptimal)
+            );
+            attachments.push_back(color.describe(vk::ImageLayout::eColorAttachmentOptimal));
+        }
+
+        for(auto &resolve : layout.resolveAttachments) {
+            resolveRefs.push_back(vk::AttachmentReference()
+                .setAttachment(static_cast<uint32_t>(attachments.size()))
+                .setLayout(vk::ImageLayout::eColorAttachmentOptimal)
+            );
+            attachments.push_back(resolve.describe(vk::ImageLayout::eColorAttachmentOptimal));
+        }
+
+        auto subpass = vk::SubpassDescription()
+            .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+            .setColorAttachments(colorRefs)
+            .setResolveAttachments(resolveRefs);
+
+        vk::PipelineStageFlags srcStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        vk::PipelineStageFlags dstStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        vk::AccessFlags srcAccess = vk::AccessFlags();
+        vk::AccessFlags dstAccess = vk::AccessFlagBits::eColorAttachmentWrite;
+
+        if(layout.depthAttachment.has_value()) {
+            depthRef = vk::AttachmentReference()
+                .setAttachment(static_cast<uint32_t>(attachments.size()))
+                .setLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+            attachments.push_back(layout.depthAttachment->describe(vk::ImageLayout::eDepthStencilAttachmentOptimal));
+
+            subpass.setPDepthStencilAttachment(&depthRef);
+
+            srcStages |= vk::PipelineStageFlagBits::eLateFragmentTests;
+            dstStages |= vk::PipelineStageFlagBits::eEarlyFragmentTests;
+            srcAccess |= vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+            dstAccess |= vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+        }
+
+        auto dep = vk::SubpassDependency()
+            .setSrcSubpass(vk::SubpassExternal)
+            .setDstSubpass(0)
+            .setSrcStageMask(srcStages)
+            .setSrcAccessMask(srcAccess)
+            .setDstStageMask(dstStages)
+            .setDstAccessMask(dstAccess);
+
+        auto renderPassInfo = vk::RenderPassCreateInfo()
+            .setAttachments(attachments)
+            .setSubpasses(subpass)
+            .setDependencies(dep);
+
+        v_render_pass = device.v_device.createRenderPass(renderPassInfo, nullptr, *v_dispatcher);
+    }
+
+    RenderPass(const RenderPass&) = delete;
+    RenderPass &operator=(const RenderPass&) = delete;
+
+    RenderPass(RenderPass &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      layout(std::move(other.layout)),
+      v_render_pass(std::exchange(other.v_render_pass, nullptr)),
+      v_dispatcher(other.v_dispatcher) {}
+
+    RenderPass &operator=(RenderPass &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            layout = std::move(other.layout);
+            v_render_pass = std::exchange(other.v_render_pass, nullptr);
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
     }
 
     ~RenderPass() {
-        device.v_device.destroyRenderPass(v_render_pass, nullptr, v_dispatcher);
+        release();
     }
 
     vk::RenderPass operator*() {
         return v_render_pass;
     }
 
+private:
+    void release() {
+        if(device) device->deletion_queue->push(v_render_pass);
+    }
+
 public:
-    Device &device;
+    Device *device = nullptr;
+
+    // Attachment configuration the render pass was created with
+    RenderPassLayout layout;
 
     vk::RenderPass v_render_pass;
-    vk::DispatchLoaderDynamic v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
 };
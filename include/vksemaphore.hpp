@@ -1,26 +1,53 @@
 #pragma once
 
+#include "deletionqueue.hpp"
 #include "vkdevice.hpp"
+#include <utility>
 #include <vulkan/vulkan.hpp>
 
 class Semaphore {
 public:
-    Semaphore(Device &device, vk::DispatchLoaderDynamic dispatcher) 
-    : device(device), v_dispatcher(dispatcher) {
-        v_semaphore = device.v_device.createSemaphore(vk::SemaphoreCreateInfo(), nullptr, v_dispatcher);
+    Semaphore() = default;
+
+    Semaphore(Device &device, vk::DispatchLoaderDynamic &dispatcher)
+    : device(&device), v_dispatcher(&dispatcher) {
+        v_semaphore = device.v_device.createSemaphore(vk::SemaphoreCreateInfo(), nullptr, *v_dispatcher);
+    }
+
+    Semaphore(const Semaphore&) = delete;
+    Semaphore &operator=(const Semaphore&) = delete;
+
+    Semaphore(Semaphore &&other) noexcept
+    : device(std::exchange(other.device, nullptr)),
+      v_semaphore(std::exchange(other.v_semaphore, nullptr)),
+      v_dispatcher(other.v_dispatcher) {}
+
+    Semaphore &operator=(Semaphore &&other) noexcept {
+        if(this != &other) {
+            release();
+            device = std::exchange(other.device, nullptr);
+            v_semaphore = std::exchange(other.v_semaphore, nullptr);
+            v_dispatcher = other.v_dispatcher;
+        }
+        return *this;
     }
 
     ~Semaphore() {
-        device.v_device.destroySemaphore(v_semaphore, nullptr, v_dispatcher);
+        release();
     }
 
     vk::Semaphore operator*() {
         return v_semaphore;
     }
 
+private:
+    void release() {
+        if(device) device->deletion_queue->push(v_semaphore);
+    }
+
 public:
-    Device &device;
+    Device *device = nullptr;
 
     vk::Semaphore v_semaphore;
-    vk::DispatchLoaderDynamic v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
 };
@@ -22,10 +22,16 @@ struct PreferredSwapchainSettings {
     vk::SurfaceCapabilitiesKHR requestedCapabilities;
     vk::Format preferredFormat;
     vk::PresentModeKHR preferredPresentMode;
+    // Tried in order before preferredPresentMode, FIFO is the fallback every surface supports
+    std::vector<vk::PresentModeKHR> presentModePriority;
+    // Clamped to the surface limits, 0 requests minImageCount + 1
+    uint32_t imageCount = 0;
 };
 
 class Swapchain {
 public:
+    Swapchain() = default;
+
     Swapchain(
         Device &device,
         int windowWidth, int windowHeight,
@@ -35,13 +41,23 @@ public:
     );
     ~Swapchain();
 
+    Swapchain(const Swapchain&) = delete;
+    Swapchain &operator=(const Swapchain&) = delete;
+
+    Swapchain(Swapchain &&other) noexcept;
+    Swapchain &operator=(Swapchain &&other) noexcept;
+
     vk::SwapchainKHR operator*() {
         return v_swapchain;
     }
 
     void recreate(int windowWidth, int windowHeight);
 
-    void initFramebuffers(RenderPass &render_pass);
+    // Switches present modes at runtime. The swapchain is only recreated when the
+    // first supported mode of the new list differs from the current one.
+    vk::PresentModeKHR setPresentModes(std::vector<vk::PresentModeKHR> priority);
+    // Recreates the swapchain with a different image count, 0 requests minImageCount + 1
+    void setImageCount(uint32_t imageCount);
 
     std::vector<vk::ImageView> createImageViews();
 
@@ -52,26 +68,40 @@ public:
         vk::Optional<Fence> fence,
         uint64_t timeout=std::numeric_limits<uint64_t>::max()
     );
+    vk::ResultValue<uint32_t> acquireImage(
+        vk::Semaphore semaphore,
+        vk::Fence fence,
+        uint64_t timeout=std::numeric_limits<uint64_t>::max()
+    );
 
 private:
+    void createSwapchain(int windowWidth, int windowHeight);
     void cleanupSwapchain();
 
+    vk::PresentModeKHR choosePresentMode(const std::vector<vk::PresentModeKHR> &supported);
+    uint32_t chooseImageCount(vk::SurfaceCapabilitiesKHR &caps);
+
+    // Registers the swapchain images with the device resource state tracker
+    void trackImages();
+
     vk::Extent2D chooseExtent(int windowWidth, int windowHeight, vk::SurfaceCapabilitiesKHR &caps);
 
 public:
-    Device &device;
+    Device *device = nullptr;
 
     std::vector<vk::Image> images;
+    // Framebuffers over these come from the device's FramebufferCache
     std::vector<vk::ImageView> imageViews;
-    std::vector<vk::Framebuffer> framebuffers;
-
-    vk::Optional<RenderPass> framebuffer_render_pass;
 
     vk::SurfaceFormatKHR v_format;
     vk::Extent2D v_swapchain_extent;
     vk::PresentModeKHR v_present_mode;
 
+    PreferredSwapchainSettings settings;
+    // Incremented whenever the swapchain handle is replaced, present ids restart with it
+    uint64_t generation = 0;
+
     vk::SurfaceKHR v_surface;
-    vk::DispatchLoaderDynamic &v_dispatcher;
+    vk::DispatchLoaderDynamic *v_dispatcher = nullptr;
     vk::SwapchainKHR v_swapchain;
 };
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "context.hpp"
+#include "spscqueue.hpp"
 #include "vkdevice.hpp"
 #include "vkswapchain.hpp"
 
@@ -12,6 +14,9 @@
 #endif
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include <tuple>
@@ -22,35 +27,43 @@ public:
     virtual ~Window();
 
     void initVulkan(std::vector<const char*> requestedExtensions, bool portability=false);
-    Device *requestDevice(
+    Device &requestDevice(
         const vk::PhysicalDeviceFeatures &requestedFeatures,
         const std::vector<const char*> &requestedExtensions
     );
-    Swapchain *requestSwapchain(
+    Swapchain &requestSwapchain(
         PreferredSwapchainSettings preferredSettings
     );
 
     bool shouldClose(void) { return glfwWindowShouldClose(window); }
-    void close(void) { glfwSetWindowShouldClose(window, true); }
+    // Safe to call from the render thread
+    void close(void) {
+        glfwSetWindowShouldClose(window, true);
+        glfwPostEmptyEvent();
+    }
     void pollEvents(void) { glfwPollEvents(); }
 
-    void toggleFullscreen() {
-        if(!fullscreen) {
-            GLFWmonitor *monitor = glfwGetPrimaryMonitor();
-            int width, height, xpos, ypos;
-            glfwGetMonitorWorkarea(monitor, &xpos, &ypos, &width, &height);
-
-            glfwSetWindowMonitor(window, monitor, xpos, ypos, width, height, GLFW_DONT_CARE);
-            fullscreen = true;
-        } else {
-            glfwSetWindowMonitor(window, nullptr, 0, 0, 1280, 720, GLFW_DONT_CARE);
-            fullscreen = false;
-        }
-    }
+    // Runs until the window closes. The calling thread, which has to be the main
+    // thread, only pumps events; render() and the input virtuals run on a dedicated
+    // render thread, fed through a lock-free queue. Resizes are coalesced to the
+    // newest size and rendering pauses while the window is minimized.
+    // Exceptions thrown on the render thread are rethrown here.
+    void runRenderThread();
+
+    // Safe to call from the render thread, the switch then happens on the event
+    // thread once it wakes up
+    void toggleFullscreen();
 
     int width, height;
 
 protected: // Virtuals
+    // Called on the render thread before the frame's input is dispatched, the
+    // place to block for frame pacing so input is sampled as late as possible
+    virtual void beginFrame() {}
+    // Called every frame on the render thread by runRenderThread
+    virtual void render(double delta) {
+        (void)delta;
+    }
     virtual void mouseScroll(double dx, double dy) {
         (void)dx, (void)dy;
     }
@@ -72,17 +85,52 @@ protected: // Virtuals
     GLFWwindow *getWindow(void) { return window; }
 
 public: // vulkan properties
-    vk::Instance v_instance;
-    vk::DebugUtilsMessengerEXT v_messenger;
-    vk::SurfaceKHR v_surface;
-    vk::DispatchLoaderDynamic v_dispatcher;
+    // Instance and device, the window only adds the surface and swapchain on top
+    Context v_context;
+    vk::DispatchLoaderDynamic &v_dispatcher = v_context.v_dispatcher;
 
-    Device *v_device = nullptr;
-    Swapchain *v_swapchain = nullptr;
+    vk::SurfaceKHR v_surface;
 
-    bool vk_ready = false;
+    std::unique_ptr<Swapchain> v_swapchain;
 
 private:
+    struct InputEvent {
+        enum class Type {
+            Key,
+            MouseButton,
+            MouseScroll,
+        };
+
+        Type type = Type::Key;
+        int key = 0;
+        int action = 0;
+        int scancode = 0;
+        int mod = 0;
+        double dx = 0.0;
+        double dy = 0.0;
+    };
+
+    // Forwards GLFW callbacks directly, or to the render thread while it runs
+    void queueResize(int width, int height);
+    void queueEvent(const InputEvent &event);
+    void dispatchEvent(const InputEvent &event);
+
+    void renderLoop();
+
+    // Monitor changes are main thread only in GLFW
+    void applyFullscreenToggle();
+
+    static constexpr uint64_t NO_PENDING_RESIZE = UINT64_MAX;
+
+    SpscQueue<InputEvent, 1024> input_events;
+    // Width in the high and height in the low 32 bits
+    std::atomic<uint64_t> pending_resize {NO_PENDING_RESIZE};
+    std::atomic<bool> render_thread_running {false};
+    std::atomic<bool> stop_render_thread {false};
+    uint64_t dropped_events = 0;
+    // Toggles requested from the render thread, only an odd count switches
+    std::atomic<uint32_t> pending_fullscreen_toggles {0};
+
     bool fullscreen = false;
 
     GLFWwindow *window;